@@ -1,6 +1,10 @@
 #pragma once
 
 #include <iostream>
+#include <atomic>
+#include <list>
+#include <map>
+#include <unordered_map>
 #include <memory>
 #include <string>
 #include <mutex>
@@ -14,6 +18,7 @@
 #include "tinyxml2_parser.h"
 #include "executor.h"
 #include "put_block_list_request_base.h"
+#include "get_block_list_request_base.h"
 #include "get_blob_property_request_base.h"
 #include "get_blob_request_base.h"
 #include "get_container_property_request_base.h"
@@ -71,6 +76,17 @@ namespace microsoft_azure { namespace storage {
         /// <returns>A <see cref="std::future" /> object that represents the current operation.</returns>
         AZURE_STORAGE_API storage_outcome<chunk_property> get_chunk_to_stream_sync(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os);
 
+        /// <summary>
+        /// Synchronously download the contents of a blob to a stream, and return the properties of the blob from the response.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="offset">The offset at which to begin downloading the blob, in bytes.</param>
+        /// <param name="size">The size of the data to download from the blob, in bytes.</param>
+        /// <param name="os">The target stream.</param>
+        /// <param name="returned_props">Set to the properties of the blob, if the download succeeds.</param>
+        AZURE_STORAGE_API storage_outcome<chunk_property> get_chunk_to_stream_sync(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os, blob_property &returned_props);
+
         /// <summary>
         /// Intitiates an asynchronous operation  to download the contents of a blob to a stream.
         /// </summary>
@@ -92,6 +108,16 @@ namespace microsoft_azure { namespace storage {
         /// <returns>A <see cref="std::future" /> object that represents the current operation.</returns>
         AZURE_STORAGE_API std::future<storage_outcome<void>> upload_block_blob_from_stream(const std::string &container, const std::string &blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata);
 
+        /// <summary>
+        /// Synchronously upload the contents of a blob from a stream, and return the properties of the new blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="is">The source stream.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        AZURE_STORAGE_API storage_outcome<void> upload_block_blob_from_stream_sync(const std::string &container, const std::string &blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props);
+
         /// <summary>
         /// Intitiates an asynchronous operation  to delete a blob.
         /// </summary>
@@ -184,6 +210,16 @@ namespace microsoft_azure { namespace storage {
         /// <returns>A <see cref="std::future" /> object that represents the current operation.</returns>
         AZURE_STORAGE_API std::future<storage_outcome<void>> put_block_list(const std::string &container, const std::string &blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata);
 
+        /// <summary>
+        /// Synchronously create a block blob with existing blocks, and return the properties of the new blob other than its size.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">A <see cref="std::vector"> that contains all blocks in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the block list is committed.  The size is not set.</param>
+        AZURE_STORAGE_API storage_outcome<void> put_block_list_sync(const std::string &container, const std::string &blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props);
+
         /// <summary>
         /// Intitiates an asynchronous operation  to create an append blob.
         /// </summary>
@@ -251,6 +287,17 @@ namespace microsoft_azure { namespace storage {
         /// <returns>A <see cref="std::future" /> object that represents the current operation.</returns>
         AZURE_STORAGE_API std::future<storage_outcome<void>> start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob);
 
+        /// <summary>
+        /// Synchronously start copying a blob to another, and return the copy status, ETag and Last-Modified of the destination from the response.
+        /// Copies within an account often finish before the service responds, in which case the copy status is "success".
+        /// </summary>
+        /// <param name="sourceContainer">The source container name.</param>
+        /// <param name="sourceBlob">The source blob name.</param>
+        /// <param name="destContainer">The destination container name.</param>
+        /// <param name="destBlob">The destination blob name.</param>
+        /// <param name="returned_props">Set to the copy status and properties of the destination blob, if the copy starts.  The size is not set.</param>
+        AZURE_STORAGE_API storage_outcome<void> start_copy_sync(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props);
+
     private:
         std::shared_ptr<CurlEasyClient> m_client;
         std::shared_ptr<storage_account> m_account;
@@ -289,6 +336,16 @@ namespace microsoft_azure { namespace storage {
         /// <param name="blob">The blob name.</param>
         /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
         virtual void put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>()) = 0;
+
+        /// <summary>
+        /// Uploads the contents of a blob from a local file, file size need to be equal or smaller than 64MB, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="sourcePath">The source file path.</param>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        virtual void put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props) = 0;
  
         /// <summary>
         /// Uploads the contents of a blob from a stream.
@@ -299,6 +356,16 @@ namespace microsoft_azure { namespace storage {
         /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
         virtual void upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>()) = 0;
 
+        /// <summary>
+        /// Uploads the contents of a blob from a stream, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="is">The source stream.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        virtual void upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props) = 0;
+
         /// <summary>
         /// Uploads the contents of a blob from a local file.
         /// </summary>
@@ -309,6 +376,17 @@ namespace microsoft_azure { namespace storage {
         /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
         virtual void upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>(), size_t parallel = 8) = 0;
 
+        /// <summary>
+        /// Uploads the contents of a blob from a local file, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="sourcePath">The source file path.</param>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        virtual void upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel, blob_property &returned_props) = 0;
+
         /// <summary>
         /// Downloads the contents of a blob to a stream.
         /// </summary>
@@ -319,6 +397,17 @@ namespace microsoft_azure { namespace storage {
         /// <param name="os">The target stream.</param>
         virtual void download_blob_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os) = 0;
 
+        /// <summary>
+        /// Downloads a range of a blob to a stream.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="offset">The offset at which to begin downloading the blob, in bytes.</param>
+        /// <param name="size">The size of the data to download from the blob, in bytes.</param>
+        /// <param name="os">The target stream.</param>
+        /// <returns>A <see cref="chunk_property" /> object that represents the properties (etag, last modified time and total size) of the blob the range was read from.</returns>
+        virtual chunk_property download_chunk_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os) = 0;
+
         /// <summary>
         /// Downloads the contents of a blob to a local file.
         /// </summary>
@@ -330,6 +419,26 @@ namespace microsoft_azure { namespace storage {
         /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
         virtual void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, size_t parallel = 9) = 0;
 
+        /// <summary>
+        /// Downloads the contents of a blob to a local file, and returns the ETag of the version that was downloaded.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="destPath">The target file path.</param>
+        /// <param name="returned_etag">Set to the ETag of the blob that was downloaded.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        virtual void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, std::string &returned_etag, size_t parallel = 9) = 0;
+
+        /// <summary>
+        /// Downloads the contents of a blob to a local file, and returns the properties of the version that was downloaded.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="destPath">The target file path.</param>
+        /// <param name="returned_props">Set to the properties of the blob that was downloaded.  Not valid if the blob is empty, as no data is returned for it.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        virtual void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, blob_property &returned_props, size_t parallel = 9) = 0;
+
         /// <summary>
         /// Gets the property of a blob.
         /// </summary>
@@ -337,6 +446,14 @@ namespace microsoft_azure { namespace storage {
         /// <param name="blob">The blob name.</param>
         virtual blob_property get_blob_property(const std::string &container, const std::string &blob) = 0;
 
+        /// <summary>
+        /// Gets the property of a blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="assume_cache_invalid">True if the blob's properties must be fetched from the service, even if a cached copy is available.</param>
+        virtual blob_property get_blob_property(const std::string &container, const std::string &blob, bool assume_cache_invalid) = 0;
+
         /// <summary>
         /// Examines the existance of a blob.
         /// </summary>
@@ -360,6 +477,53 @@ namespace microsoft_azure { namespace storage {
         /// <param name="destContainer">The destination container name.</param>
         /// <param name="destBlob">The destination blob name.</param>
         virtual void start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob) = 0;
+
+        /// <summary>
+        /// Copy a blob to another, and return the copy status from the response.
+        /// </summary>
+        /// <param name="sourceContainer">The source container name.</param>
+        /// <param name="sourceBlob">The source blob name.</param>
+        /// <param name="destContainer">The destination container name.</param>
+        /// <param name="destBlob">The destination blob name.</param>
+        /// <param name="returned_props">Set to the copy status and properties of the destination blob, if the copy starts.  The size is not set.</param>
+        virtual void start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props) = 0;
+
+        /// <summary>
+        /// Gets the list of blocks that make up a block blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <returns>A <see cref="get_block_list_response" /> object that contains the committed and uncommitted blocks of the blob.</returns>
+        virtual get_block_list_response get_block_list(const std::string &container, const std::string &blob) = 0;
+
+        /// <summary>
+        /// Uploads a block of a blob from a stream.  The block is not part of the blob until it is committed with put_block_list.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="blockid">A Base64-encoded block ID that identifies the block.</param>
+        /// <param name="is">The source stream.</param>
+        virtual void upload_block_from_stream(const std::string &container, const std::string blob, const std::string &blockid, std::istream &is) = 0;
+
+        /// <summary>
+        /// Commits a block blob from a list of committed and uncommitted blocks.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">A <see cref="std::vector"> that contains all blocks in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        virtual void put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>()) = 0;
+
+        /// <summary>
+        /// Commits a block blob from a list of committed and uncommitted blocks, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">All blocks of the blob, in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="size">The size of the committed blob, which the service does not return.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the block list is committed.</param>
+        virtual void put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, unsigned long long size, blob_property &returned_props) = 0;
     };
 
     /// <summary>
@@ -488,6 +652,16 @@ namespace microsoft_azure { namespace storage {
         /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
         void put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>());
 
+        /// <summary>
+        /// Uploads the contents of a blob from a local file, file size need to be equal or smaller than 64MB, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="sourcePath">The source file path.</param>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props);
+
         /// <summary>
         /// Uploads the contents of a blob from a stream.
         /// </summary>
@@ -497,6 +671,16 @@ namespace microsoft_azure { namespace storage {
         /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
         void upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>());
 
+        /// <summary>
+        /// Uploads the contents of a blob from a stream, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="is">The source stream.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props);
+
         /// <summary>
         /// Uploads the contents of a blob from a local file.
         /// </summary>
@@ -507,6 +691,17 @@ namespace microsoft_azure { namespace storage {
         /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
         void upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>(), size_t parallel = 8);
 
+        /// <summary>
+        /// Uploads the contents of a blob from a local file, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="sourcePath">The source file path.</param>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel, blob_property &returned_props);
+
         /// <summary>
         /// Downloads the contents of a blob to a stream.
         /// </summary>
@@ -517,6 +712,17 @@ namespace microsoft_azure { namespace storage {
         /// <param name="os">The target stream.</param>
         void download_blob_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os);
 
+        /// <summary>
+        /// Downloads a range of a blob to a stream.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="offset">The offset at which to begin downloading the blob, in bytes.</param>
+        /// <param name="size">The size of the data to download from the blob, in bytes.</param>
+        /// <param name="os">The target stream.</param>
+        /// <returns>A <see cref="chunk_property" /> object that represents the properties (etag, last modified time and total size) of the blob the range was read from.</returns>
+        chunk_property download_chunk_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os);
+
         /// <summary>
         /// Downloads the contents of a blob to a local file.
         /// </summary>
@@ -529,6 +735,26 @@ namespace microsoft_azure { namespace storage {
         /// <returns>A <see cref="storage_outcome" /> object that represents the properties (etag, last modified time and size) from the first chunk retrieved.</returns>
         void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, size_t parallel = 9);
 
+        /// <summary>
+        /// Downloads the contents of a blob to a local file, and returns the ETag of the version that was downloaded.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="destPath">The target file path.</param>
+        /// <param name="returned_etag">Set to the ETag of the blob that was downloaded.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, std::string &returned_etag, size_t parallel = 9);
+
+        /// <summary>
+        /// Downloads the contents of a blob to a local file, and returns the properties of the version that was downloaded.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="destPath">The target file path.</param>
+        /// <param name="returned_props">Set to the properties of the blob that was downloaded.  Not valid if the blob is empty, as no data is returned for it.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, blob_property &returned_props, size_t parallel = 9);
+
         /// <summary>
         /// Gets the property of a blob.
         /// </summary>
@@ -537,6 +763,14 @@ namespace microsoft_azure { namespace storage {
         /// <returns> A <see cref="blob_property"/> object that represents the proerty of a particular blob
         blob_property get_blob_property(const std::string &container, const std::string &blob);
 
+        /// <summary>
+        /// Gets the property of a blob.  There is no cache at this level, so the properties always come from the service.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <returns> A <see cref="blob_property"/> object that represents the proerty of a particular blob
+        blob_property get_blob_property(const std::string &container, const std::string &blob, bool assume_cache_invalid);
+
         /// <summary>
         /// Examines the existance of a blob.
         /// </summary>
@@ -560,6 +794,53 @@ namespace microsoft_azure { namespace storage {
         /// <param name="destContainer">The destination container name.</param>
         /// <param name="destBlob">The destination blob name.</param>
         void start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob);
+
+        /// <summary>
+        /// Copy a blob to another, and return the copy status from the response.
+        /// </summary>
+        /// <param name="sourceContainer">The source container name.</param>
+        /// <param name="sourceBlob">The source blob name.</param>
+        /// <param name="destContainer">The destination container name.</param>
+        /// <param name="destBlob">The destination blob name.</param>
+        /// <param name="returned_props">Set to the copy status and properties of the destination blob, if the copy starts.  The size is not set.</param>
+        void start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props);
+
+        /// <summary>
+        /// Gets the list of blocks that make up a block blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <returns>A <see cref="get_block_list_response" /> object that contains the committed and uncommitted blocks of the blob.</returns>
+        get_block_list_response get_block_list(const std::string &container, const std::string &blob);
+
+        /// <summary>
+        /// Uploads a block of a blob from a stream.  The block is not part of the blob until it is committed with put_block_list.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="blockid">A Base64-encoded block ID that identifies the block.</param>
+        /// <param name="is">The source stream.</param>
+        void upload_block_from_stream(const std::string &container, const std::string blob, const std::string &blockid, std::istream &is);
+
+        /// <summary>
+        /// Commits a block blob from a list of committed and uncommitted blocks.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">A <see cref="std::vector"> that contains all blocks in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        void put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>());
+
+        /// <summary>
+        /// Commits a block blob from a list of committed and uncommitted blocks, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">All blocks of the blob, in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="size">The size of the committed blob, which the service does not return.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the block list is committed.</param>
+        void put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, unsigned long long size, blob_property &returned_props);
     private:
         blob_client_wrapper() {}
 
@@ -602,11 +883,22 @@ namespace microsoft_azure { namespace storage {
             return m_blob_client_wrapper != NULL;
         }
 
+        /// <summary>
+        /// Bounds the attribute cache.
+        /// </summary>
+        /// <param name="timeout">How long cached properties are trusted, in seconds.  Negative for no limit.</param>
+        /// <param name="max_entries">Maximum number of blobs in the cache.  Zero for no limit.</param>
+        /// <param name="max_bytes">Maximum estimated memory used by the cache.  Zero for no limit.</param>
+        void set_cache_limits(int timeout, size_t max_entries, unsigned long long max_bytes)
+        {
+            attr_cache.set_limits(timeout, max_entries, max_bytes);
+        }
+
         // Represents a blob on the service
         class blob_cache_item
         {
         public:
-            blob_cache_item(std::string name, blob_property props) : m_confirmed(false), m_mutex(), m_name(name), m_props(props)
+            blob_cache_item(std::string name, blob_property props) : m_confirmed(false), m_confirmed_time(0), m_size(0), m_last_used(0), m_write_count(0), m_mutex(), m_name(name), m_props(props)
             {
 
             }
@@ -616,6 +908,18 @@ namespace microsoft_azure { namespace storage {
             // False if not (or unknown).  Marking an item as not confirmed is invalidating the cache.
             bool m_confirmed;
 
+            // When the properties were last fetched from the service; they are trusted for the attribute cache timeout after that.
+            time_t m_confirmed_time;
+
+            // Estimated memory used by the item, as counted against the cache's memory limit, and when it was last looked up, as a tick of the cache's
+            // clock.  Guarded by the mutex of the cache stripe holding the item, not m_mutex.
+            size_t m_size;
+            unsigned long long m_last_used;
+
+            // Bumped by every call through the cache that changes the blob.  A download, which does not hold m_mutex while it runs, only stores the
+            // properties it read if this is unchanged when it finishes.
+            unsigned long long m_write_count;
+
             // A mutex that can be locked in shared or unique mode (reader/writer lock)
             // TODO: Consider switching this to be a regular mutex
             std::shared_timed_mutex m_mutex;
@@ -640,24 +944,75 @@ namespace microsoft_azure { namespace storage {
         // For a 'list blobs' request, first grab the mutex for the directory in unique mode.  Then, make the request and parse the response.  For each blob in the response, grab the blob mutex for that item in unique mode 
         // before updating it.  Don't release the directory mutex until all blobs have been updated.
         // 
-        // TODO: Currently, the maps holding the cached information grow without bound; this should be fixed.
-        // TODO: Implement a cache timeout
+        // The cache can be bounded by the number of blobs and their estimated memory use, beyond which the least recently used blobs are evicted, and by a
+        // timeout after which cached properties are fetched again.  An item is only evicted when no thread holds a reference to it, so two threads never
+        // lock different items for the same blob.  Directory mutexes are only kept while in use.
+        //
+        // Both maps are split into stripes by the hash of the path, each with its own lock, so lookups of different paths rarely contend, and a cache hit
+        // takes no process-wide lock.  Each blob stripe keeps its items in LRU order; eviction picks the least recently used of the stripes' oldest items.
         // TODO: When we no longer use an internal copy of cpplite, the attrib cache code should stay with blobfuse - it's not really applicable in the general cpplite use case.
         class attribute_cache
         {
         public:
-            attribute_cache() : blob_cache(), blobs_mutex(), dir_cache(), dirs_mutex()
+            attribute_cache() : clock(0), entry_count(0), total_bytes(0), timeout_in_seconds(-1), max_entries(0), max_bytes(0)
             {
             }
 
             std::shared_ptr<std::shared_timed_mutex> get_dir_item(const std::string& path);
             std::shared_ptr<blob_cache_item> get_blob_item(const std::string& path);
 
+            // Sets the limits of the cache.  A negative timeout means cached properties never expire; zero limits mean no limit.
+            void set_limits(int timeout, size_t entries, unsigned long long bytes);
+
+            // True if the item holds properties that can be returned without asking the service.  The item's mutex must be held.
+            bool is_fresh(const blob_cache_item& item);
+
+            // Stores properties fetched from the service in the item.  The item's mutex must be held in unique mode.
+            void confirm(blob_cache_item& item, const blob_property& props);
+
         private:
-            std::map<std::string, std::shared_ptr<blob_cache_item>> blob_cache;
-            std::mutex blobs_mutex; // Used to protect the blob_cache map itself, not items in the map.
-            std::map<std::string, std::shared_ptr<std::shared_timed_mutex>> dir_cache;
-            std::mutex dirs_mutex;// Used to protect the dir_cache map itself, not items in the map.
+            static const size_t stripe_count = 64;
+
+            struct blob_cache_entry
+            {
+                std::shared_ptr<blob_cache_item> item;
+                std::list<std::string>::iterator lru_position;
+            };
+
+            struct blob_stripe
+            {
+                std::mutex mutex; // Used to protect the stripe itself, not items in it.
+                std::unordered_map<std::string, blob_cache_entry> items;
+                std::list<std::string> lru; // Most recently used first.
+            };
+
+            struct dir_stripe
+            {
+                dir_stripe() : sweep_size(64)
+                {
+                }
+
+                std::mutex mutex;
+                std::unordered_map<std::string, std::weak_ptr<std::shared_timed_mutex>> dirs;
+                size_t sweep_size; // Size of dirs at which expired entries are next swept out.
+            };
+
+            static size_t stripe_of(const std::string& path)
+            {
+                return std::hash<std::string>()(path) % stripe_count;
+            }
+
+            bool over_limits() const;
+            void evict_over_limits();
+
+            blob_stripe blob_stripes[stripe_count];
+            dir_stripe dir_stripes[stripe_count];
+            std::atomic<unsigned long long> clock; // Ticks on every lookup, to order items across stripes by last use.
+            std::atomic<size_t> entry_count;
+            std::atomic<unsigned long long> total_bytes; // Total m_size of the cached items.
+            std::atomic<int> timeout_in_seconds;
+            std::atomic<size_t> max_entries;
+            std::atomic<unsigned long long> max_bytes;
         };
 
         /// <summary>
@@ -703,6 +1058,16 @@ namespace microsoft_azure { namespace storage {
         /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
         void put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>());
 
+        /// <summary>
+        /// Uploads the contents of a blob from a local file, file size need to be equal or smaller than 64MB, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="sourcePath">The source file path.</param>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props);
+
         /// <summary>
         /// Uploads the contents of a blob from a stream.
         /// </summary>
@@ -712,6 +1077,16 @@ namespace microsoft_azure { namespace storage {
         /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
         void upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>());
 
+        /// <summary>
+        /// Uploads the contents of a blob from a stream, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="is">The source stream.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props);
+
         /// <summary>
         /// Uploads the contents of a blob from a local file.
         /// </summary>
@@ -722,6 +1097,17 @@ namespace microsoft_azure { namespace storage {
         /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
         void upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>(), size_t parallel = 8);
 
+        /// <summary>
+        /// Uploads the contents of a blob from a local file, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="sourcePath">The source file path.</param>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel, blob_property &returned_props);
+
         /// <summary>
         /// Downloads the contents of a blob to a stream.
         /// </summary>
@@ -732,6 +1118,17 @@ namespace microsoft_azure { namespace storage {
         /// <param name="os">The target stream.</param>
         void download_blob_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os);
 
+        /// <summary>
+        /// Downloads a range of a blob to a stream.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="offset">The offset at which to begin downloading the blob, in bytes.</param>
+        /// <param name="size">The size of the data to download from the blob, in bytes.</param>
+        /// <param name="os">The target stream.</param>
+        /// <returns>A <see cref="chunk_property" /> object that represents the properties (etag, last modified time and total size) of the blob the range was read from.</returns>
+        chunk_property download_chunk_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os);
+
         /// <summary>
         /// Downloads the contents of a blob to a local file.
         /// </summary>
@@ -744,6 +1141,26 @@ namespace microsoft_azure { namespace storage {
         /// <returns>A <see cref="storage_outcome" /> object that represents the properties (etag, last modified time and size) from the first chunk retrieved.</returns>
         void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, size_t parallel = 8);
 
+        /// <summary>
+        /// Downloads the contents of a blob to a local file, and returns the ETag of the version that was downloaded.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="destPath">The target file path.</param>
+        /// <param name="returned_etag">Set to the ETag of the blob that was downloaded.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, std::string &returned_etag, size_t parallel = 8);
+
+        /// <summary>
+        /// Downloads the contents of a blob to a local file, and returns the properties of the version that was downloaded.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="destPath">The target file path.</param>
+        /// <param name="returned_props">Set to the properties of the blob that was downloaded.  Not valid if the blob is empty, as no data is returned for it.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, blob_property &returned_props, size_t parallel = 8);
+
         /// <summary>
         /// Gets the property of a blob.
         /// </summary>
@@ -783,9 +1200,58 @@ namespace microsoft_azure { namespace storage {
         /// <param name="destContainer">The destination container name.</param>
         /// <param name="destBlob">The destination blob name.</param>
         void start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob);
+
+        /// <summary>
+        /// Copy a blob to another, and return the copy status from the response.
+        /// </summary>
+        /// <param name="sourceContainer">The source container name.</param>
+        /// <param name="sourceBlob">The source blob name.</param>
+        /// <param name="destContainer">The destination container name.</param>
+        /// <param name="destBlob">The destination blob name.</param>
+        /// <param name="returned_props">Set to the copy status and properties of the destination blob, if the copy starts.  The size is not set.</param>
+        void start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props);
+
+        /// <summary>
+        /// Gets the list of blocks that make up a block blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <returns>A <see cref="get_block_list_response" /> object that contains the committed and uncommitted blocks of the blob.</returns>
+        get_block_list_response get_block_list(const std::string &container, const std::string &blob);
+
+        /// <summary>
+        /// Uploads a block of a blob from a stream.  The block is not part of the blob until it is committed with put_block_list.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="blockid">A Base64-encoded block ID that identifies the block.</param>
+        /// <param name="is">The source stream.</param>
+        void upload_block_from_stream(const std::string &container, const std::string blob, const std::string &blockid, std::istream &is);
+
+        /// <summary>
+        /// Commits a block blob from a list of committed and uncommitted blocks.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">A <see cref="std::vector"> that contains all blocks in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        void put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata = std::vector<std::pair<std::string, std::string>>());
+
+        /// <summary>
+        /// Commits a block blob from a list of committed and uncommitted blocks, and returns the properties of the new blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">All blocks of the blob, in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="size">The size of the committed blob, which the service does not return.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the block list is committed.</param>
+        void put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, unsigned long long size, blob_property &returned_props);
         
         private:
         std::shared_ptr<sync_blob_client> m_blob_client_wrapper;
         attribute_cache attr_cache;
+
+        void store_written_props(blob_cache_item& item, blob_property& props);
     };
 } } // microsoft_azure::storage
@@ -43,9 +43,39 @@ ssize_t get_length_from_content_range(const std::string &header) {
    return result;
 }
 
+// Reads the properties of a blob from the headers of a response to a request on it.  The size is left to the caller, as Content-Length is only the size
+// of the blob for HEAD requests.
+void read_blob_property(const http_base &http, blob_property &props) {
+    props.cache_control = http.get_header(constants::header_cache_control);
+    props.content_disposition = http.get_header(constants::header_content_disposition);
+    props.content_encoding = http.get_header(constants::header_content_encoding);
+    props.content_language = http.get_header(constants::header_content_language);
+    props.content_md5 = http.get_header(constants::header_content_md5);
+    props.content_type = http.get_header(constants::header_content_type);
+    props.etag = http.get_header(constants::header_etag);
+    props.copy_status = http.get_header(constants::header_ms_copy_status);
+    props.last_modified = curl_getdate(http.get_header(constants::header_last_modified).c_str(), NULL);
+
+    auto& headers = http.get_headers();
+    props.metadata.clear();
+    for (auto iter = headers.begin(); iter != headers.end(); ++iter)
+    {
+        if (iter->first.find("x-ms-meta-") == 0)
+        {
+            // We need to strip ten characters from the front of the key to account for "x-ms-meta-", and two characters from the end of the value, to account for the "\r\n".
+            props.metadata.push_back(std::make_pair(iter->first.substr(10), iter->second.substr(0, iter->second.size() - 2)));
+        }
+    }
+}
+
 } // noname namespace
 
 storage_outcome<chunk_property> blob_client::get_chunk_to_stream_sync(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os) {
+    blob_property props(false);
+    return get_chunk_to_stream_sync(container, blob, offset, size, os, props);
+}
+
+storage_outcome<chunk_property> blob_client::get_chunk_to_stream_sync(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os, blob_property &returned_props) {
     auto http = m_client->get_handle();
     auto request = std::make_shared<download_blob_request>(container, blob);
     if (size > 0) {
@@ -66,6 +96,18 @@ storage_outcome<chunk_property> blob_client::get_chunk_to_stream_sync(const std:
         property.totalSize = get_length_from_content_range(http->get_header(constants::header_content_range));
         std::istringstream(http->get_header(constants::header_content_length)) >> property.size;
         property.last_modified = curl_getdate(http->get_header(constants::header_last_modified).c_str(), NULL);
+        // For a range, Content-Length and Content-MD5 describe the range rather than the blob.
+        read_blob_property(*http, returned_props);
+        if (property.totalSize >= 0)
+        {
+            returned_props.size = property.totalSize;
+            returned_props.content_md5 = http->get_header(constants::header_ms_blob_content_md5);
+        }
+        else
+        {
+            returned_props.size = property.size;
+        }
+        returned_props.set_valid(true);
         return storage_outcome<chunk_property>(property);
     }
     return storage_outcome<chunk_property>(storage_error(response.error()));
@@ -110,6 +152,36 @@ std::future<storage_outcome<void>> blob_client::upload_block_blob_from_stream(co
     return async_executor<void>::submit(m_account, request, http, m_context);
 }
 
+storage_outcome<void> blob_client::upload_block_blob_from_stream_sync(const std::string &container, const std::string &blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props) {
+    auto http = m_client->get_handle();
+
+    auto request = std::make_shared<create_block_blob_request>(container, blob);
+
+    auto cur = is.tellg();
+    is.seekg(0, std::ios_base::end);
+    auto end = is.tellg();
+    is.seekg(cur);
+    //check < 2^32
+    request->set_content_length(static_cast<unsigned int>(end - cur));
+    if (metadata.size() > 0)
+    {
+        request->set_metadata(metadata);
+    }
+
+    http->set_input_stream(storage_istream(is));
+
+    auto response = async_executor<void>::submit(m_account, request, http, m_context).get();
+    if (response.success())
+    {
+        // The response only carries the ETag, Last-Modified and Content-MD5; the rest is what was sent.
+        read_blob_property(*http, returned_props);
+        returned_props.metadata = metadata;
+        returned_props.size = static_cast<unsigned long long>(end - cur);
+        returned_props.set_valid(true);
+    }
+    return response;
+}
+
 std::future<storage_outcome<void>> blob_client::delete_blob(const std::string &container, const std::string &blob, bool delete_snapshots) {
     auto http = m_client->get_handle();
 
@@ -227,31 +299,13 @@ storage_outcome<blob_property> blob_client::get_blob_property(const std::string
     blob_property blobProperty(true);
     if (response.success())
     {
-        blobProperty.cache_control = http->get_header(constants::header_cache_control);
-        blobProperty.content_disposition = http->get_header(constants::header_content_disposition);
-        blobProperty.content_encoding = http->get_header(constants::header_content_encoding);
-        blobProperty.content_language = http->get_header(constants::header_content_language);
-        blobProperty.content_md5 = http->get_header(constants::header_content_md5);
-        blobProperty.content_type = http->get_header(constants::header_content_type);
-        blobProperty.etag = http->get_header(constants::header_etag);
-        blobProperty.copy_status = http->get_header(constants::header_ms_copy_status);
-        blobProperty.last_modified = curl_getdate(http->get_header(constants::header_last_modified).c_str(), NULL);
+        read_blob_property(*http, blobProperty);
         std::string::size_type sz = 0;
         std::string contentLength = http->get_header(constants::header_content_length);
         if(contentLength.length() > 0)
         {
             blobProperty.size = std::stoull(contentLength, &sz, 0);
         }
-
-        auto& headers = http->get_headers();
-        for (auto iter = headers.begin(); iter != headers.end(); ++iter)
-        {
-            if (iter->first.find("x-ms-meta-") == 0)
-            {
-                // We need to strip ten characters from the front of the key to account for "x-ms-meta-", and two characters from the end of the value, to account for the "\r\n".
-                blobProperty.metadata.push_back(std::make_pair(iter->first.substr(10), iter->second.substr(0, iter->second.size() - 2)));
-            }
-        }
     }
     else
     {
@@ -291,6 +345,29 @@ std::future<storage_outcome<void>> blob_client::put_block_list(const std::string
     return async_executor<void>::submit(m_account, request, http, m_context);
 }
 
+storage_outcome<void> blob_client::put_block_list_sync(const std::string &container, const std::string &blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props) {
+    auto http = m_client->get_handle();
+
+    auto request = std::make_shared<put_block_list_request>(container, blob);
+    request->set_block_list(block_list);
+    if (metadata.size() > 0)
+    {
+        request->set_metadata(metadata);
+    }
+
+    auto response = async_executor<void>::submit(m_account, request, http, m_context).get();
+    if (response.success())
+    {
+        // The response only carries the ETag and Last-Modified; the size of the blob is left to the caller.  Its Content-MD5 is the MD5 of the block
+        // list sent in the request, not of the blob.
+        read_blob_property(*http, returned_props);
+        returned_props.content_md5.clear();
+        returned_props.metadata = metadata;
+        returned_props.set_valid(true);
+    }
+    return response;
+}
+
 std::future<storage_outcome<void>> blob_client::create_append_blob(const std::string &container, const std::string &blob) {
     auto http = m_client->get_handle();
 
@@ -389,5 +466,21 @@ std::future<storage_outcome<void>> blob_client::start_copy(const std::string &so
     return async_executor<void>::submit(m_account, request, http, m_context);
 }
 
+storage_outcome<void> blob_client::start_copy_sync(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props)
+{
+    auto http = m_client->get_handle();
+
+    auto request = std::make_shared<copy_blob_request>(sourceContainer, sourceBlob, destContainer, destBlob);
+
+    auto response = async_executor<void>::submit(m_account, request, http, m_context).get();
+    if (response.success())
+    {
+        // The response carries the copy status, and the ETag and Last-Modified of the destination; the rest are not known until the copy finishes.
+        read_blob_property(*http, returned_props);
+        returned_props.set_valid(true);
+    }
+    return response;
+}
+
 }
 }
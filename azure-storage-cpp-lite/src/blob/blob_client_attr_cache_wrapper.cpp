@@ -14,39 +14,183 @@ namespace microsoft_azure {
             return std::string();
         }
 
+        // Estimates the memory used by a cache item for the given blob, including the properties and the copies of the name in the map and the LRU list.
+        size_t estimate_item_size(const std::string& path, const blob_property& props)
+        {
+            size_t size = sizeof(blob_client_attr_cache_wrapper::blob_cache_item) + 2 * (sizeof(std::string) + path.capacity()) + 64 /* map and list nodes */;
+            size += props.cache_control.capacity() + props.content_disposition.capacity() + props.content_encoding.capacity() + props.content_language.capacity();
+            size += props.content_md5.capacity() + props.content_type.capacity() + props.etag.capacity() + props.copy_status.capacity();
+            size += props.metadata.capacity() * sizeof(std::pair<std::string, std::string>);
+            for (size_t i = 0; i < props.metadata.size(); i++)
+            {
+                size += props.metadata[i].first.capacity() + props.metadata[i].second.capacity();
+            }
+            return size;
+        }
+
         // Performs a thread-safe map lookup of the input key in the directory map.
         // Will create new entries if necessary before returning.
         std::shared_ptr<std::shared_timed_mutex> blob_client_attr_cache_wrapper::attribute_cache::get_dir_item(const std::string& path)
         {
-            std::lock_guard<std::mutex> lock(dirs_mutex);
-            auto iter = dir_cache.find(path);
-            if(iter == dir_cache.end())
+            dir_stripe& stripe = dir_stripes[stripe_of(path)];
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            auto iter = stripe.dirs.find(path);
+            if(iter != stripe.dirs.end())
             {
-                auto dir_item = std::make_shared<std::shared_timed_mutex>();
-                dir_cache[path] = dir_item;
-                return dir_item;
+                std::shared_ptr<std::shared_timed_mutex> dir_item = iter->second.lock();
+                if (dir_item)
+                {
+                    return dir_item;
+                }
             }
-            else
+
+            // Only the threads using a directory's mutex keep it alive.  The stripe is swept of the expired entries whenever it doubles in size.
+            auto dir_item = std::make_shared<std::shared_timed_mutex>();
+            stripe.dirs[path] = dir_item;
+            if (stripe.dirs.size() >= stripe.sweep_size)
             {
-                return iter->second;
+                for (auto sweep_iter = stripe.dirs.begin(); sweep_iter != stripe.dirs.end();)
+                {
+                    sweep_iter = sweep_iter->second.expired() ? stripe.dirs.erase(sweep_iter) : std::next(sweep_iter);
+                }
+                stripe.sweep_size = std::max(stripe.sweep_size, stripe.dirs.size() * 2);
             }
+            return dir_item;
         }
 
         // Performs a thread-safe map lookup of the input key in the blob map.
         // Will create new entries if necessary before returning.
         std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> blob_client_attr_cache_wrapper::attribute_cache::get_blob_item(const std::string& path)
         {
-            std::lock_guard<std::mutex> lock(blobs_mutex);
-            auto iter = blob_cache.find(path);
-            if(iter == blob_cache.end())
+            std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> blob_item;
             {
-                auto blob_item = std::make_shared<blob_client_attr_cache_wrapper::blob_cache_item>("", blob_property(false));
-                blob_cache[path] = blob_item;
-                return blob_item;
+                blob_stripe& stripe = blob_stripes[stripe_of(path)];
+                std::lock_guard<std::mutex> lock(stripe.mutex);
+                auto iter = stripe.items.find(path);
+                if(iter != stripe.items.end())
+                {
+                    stripe.lru.splice(stripe.lru.begin(), stripe.lru, iter->second.lru_position);
+                    iter->second.item->m_last_used = ++clock;
+                    return iter->second.item;
+                }
+
+                blob_item = std::make_shared<blob_client_attr_cache_wrapper::blob_cache_item>(path, blob_property(false));
+                blob_item->m_size = estimate_item_size(path, blob_item->m_props);
+                blob_item->m_last_used = ++clock;
+                stripe.lru.push_front(path);
+                blob_cache_entry entry;
+                entry.item = blob_item;
+                entry.lru_position = stripe.lru.begin();
+                stripe.items[path] = entry;
+                entry_count++;
+                total_bytes += blob_item->m_size;
+            }
+
+            // The new item is held here, so it is not evicted itself.
+            evict_over_limits();
+            return blob_item;
+        }
+
+        void blob_client_attr_cache_wrapper::attribute_cache::set_limits(int timeout, size_t entries, unsigned long long bytes)
+        {
+            timeout_in_seconds = timeout;
+            max_entries = entries;
+            max_bytes = bytes;
+            evict_over_limits();
+        }
+
+        bool blob_client_attr_cache_wrapper::attribute_cache::is_fresh(const blob_cache_item& item)
+        {
+            int timeout = timeout_in_seconds;
+            return item.m_confirmed && ((timeout < 0) || (time(NULL) - item.m_confirmed_time < timeout));
+        }
+
+        void blob_client_attr_cache_wrapper::attribute_cache::confirm(blob_cache_item& item, const blob_property& props)
+        {
+            item.m_props = props;
+            item.m_confirmed = true;
+            item.m_confirmed_time = time(NULL);
+
+            // The caller holds a reference to the item, so it is still in the map.
+            size_t size = estimate_item_size(item.m_name, props);
+            {
+                std::lock_guard<std::mutex> lock(blob_stripes[stripe_of(item.m_name)].mutex);
+                total_bytes += size;
+                total_bytes -= item.m_size;
+                item.m_size = size;
+            }
+            evict_over_limits();
+        }
+
+        // Stores the properties returned by a call that wrote the blob, or invalidates the item if the call failed.  The item's mutex must be held in
+        // unique mode.  Leaves errno unchanged.
+        void blob_client_attr_cache_wrapper::store_written_props(blob_cache_item& item, blob_property& props)
+        {
+            int write_errno = errno;
+            if ((write_errno == 0) && props.valid())
+            {
+                attr_cache.confirm(item, props);
             }
             else
             {
-                return iter->second;
+                item.m_confirmed = false;
+            }
+            errno = write_errno;
+        }
+
+        bool blob_client_attr_cache_wrapper::attribute_cache::over_limits() const
+        {
+            size_t entries = max_entries;
+            unsigned long long bytes = max_bytes;
+            return ((entries != 0) && (entry_count > entries)) || ((bytes != 0) && (total_bytes > bytes));
+        }
+
+        // Evicts the least recently used items until the cache is within its limits, skipping items that are in use.  Each stripe's oldest item not in
+        // use is a candidate, and the least recently used of the candidates is evicted.  Only one stripe is locked at a time.
+        void blob_client_attr_cache_wrapper::attribute_cache::evict_over_limits()
+        {
+            while (over_limits())
+            {
+                size_t victim_stripe = stripe_count;
+                std::string victim;
+                unsigned long long victim_last_used = 0;
+                for (size_t i = 0; i < stripe_count; i++)
+                {
+                    blob_stripe& stripe = blob_stripes[i];
+                    std::lock_guard<std::mutex> lock(stripe.mutex);
+                    for (auto lru_iter = stripe.lru.rbegin(); lru_iter != stripe.lru.rend(); ++lru_iter)
+                    {
+                        const blob_cache_entry& entry = stripe.items.find(*lru_iter)->second;
+                        if (entry.item.use_count() > 1)
+                        {
+                            continue;
+                        }
+                        if ((victim_stripe == stripe_count) || (entry.item->m_last_used < victim_last_used))
+                        {
+                            victim_stripe = i;
+                            victim = *lru_iter;
+                            victim_last_used = entry.item->m_last_used;
+                        }
+                        break;
+                    }
+                }
+                if (victim_stripe == stripe_count)
+                {
+                    return;
+                }
+
+                // The candidate may have been looked up since the scan; if so, scan again.
+                blob_stripe& stripe = blob_stripes[victim_stripe];
+                std::lock_guard<std::mutex> lock(stripe.mutex);
+                auto iter = stripe.items.find(victim);
+                if ((iter == stripe.items.end()) || (iter->second.item.use_count() > 1) || (iter->second.item->m_last_used != victim_last_used))
+                {
+                    continue;
+                }
+                entry_count--;
+                total_bytes -= iter->second.item->m_size;
+                stripe.lru.erase(iter->second.lru_position);
+                stripe.items.erase(iter);
             }
         }
 
@@ -92,8 +236,7 @@ namespace microsoft_azure {
                         // It should be fine, there should be no chance of deadlock, as the internal mutex is released before get_blob_item returns, but we should take care when modifying.
                         std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(response.blobs[i].name);
                         std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
-                        cache_item->m_props = properties;
-                        cache_item->m_confirmed = true;
+                        attr_cache.confirm(*cache_item, properties);
                     }
                 }
             }
@@ -122,16 +265,35 @@ namespace microsoft_azure {
         /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
         void blob_client_attr_cache_wrapper::put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata)
         {
-            // Invalidate the cache.
-            // TODO: consider updating the cache with the new values.  Will require modifying cpplite to return info from put_blob.
+            // Invalidate the cache.  The overload that returns the properties of the new blob stores them in the cache instead.
             std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
             std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
             std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
             std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
             m_blob_client_wrapper->put_blob(sourcePath, container, blob, metadata);
+            cache_item->m_write_count++;
             cache_item->m_confirmed = false;
         }
 
+        /// <summary>
+        /// Uploads the contents of a blob from a local file, and stores the properties of the new blob in the cache.
+        /// </summary>
+        /// <param name="sourcePath">The source file path.</param>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void blob_client_attr_cache_wrapper::put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props)
+        {
+            std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
+            std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
+            std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
+            std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
+            m_blob_client_wrapper->put_blob(sourcePath, container, blob, metadata, returned_props);
+            cache_item->m_write_count++;
+            store_written_props(*cache_item, returned_props);
+        }
+
         /// <summary>
         /// Uploads the contents of a blob from a stream.
         /// </summary>
@@ -141,16 +303,35 @@ namespace microsoft_azure {
         /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
         void blob_client_attr_cache_wrapper::upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata)
         {
-            // Invalidate the cache.
-            // TODO: consider updating the cache with the new values.  Will require modifying cpplite to return info from put_blob.
+            // Invalidate the cache.  The overload that returns the properties of the new blob stores them in the cache instead.
             std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
             std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
             std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
             std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
             m_blob_client_wrapper->upload_block_blob_from_stream(container, blob, is, metadata);
+            cache_item->m_write_count++;
             cache_item->m_confirmed = false;
         }
 
+        /// <summary>
+        /// Uploads the contents of a blob from a stream, and stores the properties of the new blob in the cache.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="is">The source stream.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void blob_client_attr_cache_wrapper::upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props)
+        {
+            std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
+            std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
+            std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
+            std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
+            m_blob_client_wrapper->upload_block_blob_from_stream(container, blob, is, metadata, returned_props);
+            cache_item->m_write_count++;
+            store_written_props(*cache_item, returned_props);
+        }
+
         /// <summary>
         /// Uploads the contents of a blob from a local file.
         /// </summary>
@@ -161,16 +342,36 @@ namespace microsoft_azure {
         /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
         void blob_client_attr_cache_wrapper::upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel)
         {
-            // Invalidate the cache.
-            // TODO: consider updating the cache with the new values.  Will require modifying cpplite to return info from put_blob.
+            // Invalidate the cache.  The overload that returns the properties of the new blob stores them in the cache instead.
             std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
             std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
             std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
             std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
             m_blob_client_wrapper->upload_file_to_blob(sourcePath, container, blob, metadata, parallel);
+            cache_item->m_write_count++;
             cache_item->m_confirmed = false;
         }
 
+        /// <summary>
+        /// Uploads the contents of a blob from a local file, and stores the properties of the new blob in the cache.
+        /// </summary>
+        /// <param name="sourcePath">The source file path.</param>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the upload succeeds.</param>
+        void blob_client_attr_cache_wrapper::upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel, blob_property &returned_props)
+        {
+            std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
+            std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
+            std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
+            std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
+            m_blob_client_wrapper->upload_file_to_blob(sourcePath, container, blob, metadata, parallel, returned_props);
+            cache_item->m_write_count++;
+            store_written_props(*cache_item, returned_props);
+        }
+
         /// <summary>
         /// Downloads the contents of a blob to a stream.
         /// </summary>
@@ -185,6 +386,21 @@ namespace microsoft_azure {
             m_blob_client_wrapper->download_blob_to_stream(container, blob, offset, size, os);
         }
 
+        /// <summary>
+        /// Downloads a range of a blob to a stream.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="offset">The offset at which to begin downloading the blob, in bytes.</param>
+        /// <param name="size">The size of the data to download from the blob, in bytes.</param>
+        /// <param name="os">The target stream.</param>
+        /// <returns>A <see cref="chunk_property" /> object that represents the properties (etag, last modified time and total size) of the blob the range was read from.</returns>
+        chunk_property blob_client_attr_cache_wrapper::download_chunk_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os)
+        {
+            // TODO: lock & update the attribute cache with the headers from the get call(s).
+            return m_blob_client_wrapper->download_chunk_to_stream(container, blob, offset, size, os);
+        }
+
         /// <summary>
         /// Downloads the contents of a blob to a local file.
         /// </summary>
@@ -197,10 +413,56 @@ namespace microsoft_azure {
         /// <returns>A <see cref="storage_outcome" /> object that represents the properties (etag, last modified time and size) from the first chunk retrieved.</returns>
         void blob_client_attr_cache_wrapper::download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, size_t parallel)
         {
-            // TODO: lock & update the attribute cache with the headers from the get call(s), once download_blob_to_* is modified to return them.
+            // The overload that returns the properties of the blob stores them in the cache.
             m_blob_client_wrapper->download_blob_to_file(container, blob, destPath, returned_last_modified, parallel);
         }
 
+        /// <summary>
+        /// Downloads the contents of a blob to a local file, and returns the ETag of the version that was downloaded.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="destPath">The target file path.</param>
+        /// <param name="returned_etag">Set to the ETag of the blob that was downloaded.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        void blob_client_attr_cache_wrapper::download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, std::string &returned_etag, size_t parallel)
+        {
+            m_blob_client_wrapper->download_blob_to_file(container, blob, destPath, returned_last_modified, returned_etag, parallel);
+        }
+
+        /// <summary>
+        /// Downloads the contents of a blob to a local file, and stores the properties of the version that was downloaded in the cache.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="destPath">The target file path.</param>
+        /// <param name="returned_props">Set to the properties of the blob that was downloaded.  Not valid if the blob is empty, as no data is returned for it.</param>
+        /// <param name="parallel">A size_t value indicates the maximum parallelism can be used in this request.</param>
+        void blob_client_attr_cache_wrapper::download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, blob_property &returned_props, size_t parallel)
+        {
+            // The item is not locked during the download, so that the blob's properties can still be read meanwhile.  If the blob is changed through the
+            // cache before the download finishes, what the download read may already be out of date, so it is not stored.
+            std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
+            std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
+            unsigned long long write_count;
+            {
+                std::shared_lock<std::shared_timed_mutex> sharedlock(cache_item->m_mutex);
+                write_count = cache_item->m_write_count;
+            }
+
+            errno = 0;
+            m_blob_client_wrapper->download_blob_to_file(container, blob, destPath, returned_props, parallel);
+            if ((errno == 0) && returned_props.valid())
+            {
+                std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
+                std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
+                if (cache_item->m_write_count == write_count)
+                {
+                    attr_cache.confirm(*cache_item, returned_props);
+                }
+            }
+        }
+
         /// <summary>
         /// Gets the property of a blob.
         /// </summary>
@@ -227,7 +489,7 @@ namespace microsoft_azure {
             if (!assume_cache_invalid)
             {
                 std::shared_lock<std::shared_timed_mutex> sharedlock(cache_item->m_mutex);
-                if (cache_item->m_confirmed)
+                if (attr_cache.is_fresh(*cache_item))
                 {
                     return cache_item->m_props;
                 }
@@ -236,12 +498,13 @@ namespace microsoft_azure {
             {
                 std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
                 errno = 0;
-                cache_item->m_props = m_blob_client_wrapper->get_blob_property(container, blob);
+                blob_property props = m_blob_client_wrapper->get_blob_property(container, blob);
                 if (errno != 0)
                 {
+                    cache_item->m_confirmed = false;
                     return blob_property(false); // keep errno unchanged
                 }
-                cache_item->m_confirmed = true;
+                attr_cache.confirm(*cache_item, props);
                 return cache_item->m_props;
             }
         }
@@ -276,6 +539,7 @@ namespace microsoft_azure {
             std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
             std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
             m_blob_client_wrapper->delete_blob(container, blob);
+            cache_item->m_write_count++;
             cache_item->m_confirmed = false;
         }
 
@@ -296,6 +560,91 @@ namespace microsoft_azure {
             std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
             errno = 0;
             m_blob_client_wrapper->start_copy(sourceContainer, sourceBlob, destContainer, destBlob);
+            cache_item->m_write_count++;
             cache_item->m_confirmed = false;
         }
-}}
\ No newline at end of file
+
+        /// <summary>
+        /// Copy a blob to another, and return the copy status from the response.
+        /// </summary>
+        /// <param name="sourceContainer">The source container name.</param>
+        /// <param name="sourceBlob">The source blob name.</param>
+        /// <param name="destContainer">The destination container name.</param>
+        /// <param name="destBlob">The destination blob name.</param>
+        /// <param name="returned_props">Set to the copy status and properties of the destination blob, if the copy starts.  The size is not set.</param>
+        void blob_client_attr_cache_wrapper::start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props)
+        {
+            // The size of the destination isn't in the response, so the cache is invalidated rather than filled.
+            std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(destBlob));
+            std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(destBlob);
+            std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
+            std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
+            errno = 0;
+            m_blob_client_wrapper->start_copy(sourceContainer, sourceBlob, destContainer, destBlob, returned_props);
+            cache_item->m_write_count++;
+            cache_item->m_confirmed = false;
+        }
+
+        /// <summary>
+        /// Gets the list of blocks that make up a block blob.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        get_block_list_response blob_client_attr_cache_wrapper::get_block_list(const std::string &container, const std::string &blob)
+        {
+            return m_blob_client_wrapper->get_block_list(container, blob);
+        }
+
+        /// <summary>
+        /// Uploads a block of a blob from a stream.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="blockid">A Base64-encoded block ID that identifies the block.</param>
+        /// <param name="is">The source stream.</param>
+        void blob_client_attr_cache_wrapper::upload_block_from_stream(const std::string &container, const std::string blob, const std::string &blockid, std::istream &is)
+        {
+            // Uncommitted blocks are not visible in the blob's properties, so there's nothing to invalidate.
+            m_blob_client_wrapper->upload_block_from_stream(container, blob, blockid, is);
+        }
+
+        /// <summary>
+        /// Commits a block blob from a list of committed and uncommitted blocks.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">All blocks of the blob, in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        void blob_client_attr_cache_wrapper::put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata)
+        {
+            std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
+            std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
+            std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
+            std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
+            errno = 0;
+            m_blob_client_wrapper->put_block_list(container, blob, block_list, metadata);
+            cache_item->m_write_count++;
+            cache_item->m_confirmed = false;
+        }
+
+        /// <summary>
+        /// Commits a block blob from a list of committed and uncommitted blocks, and stores the properties of the new blob in the cache.
+        /// </summary>
+        /// <param name="container">The container name.</param>
+        /// <param name="blob">The blob name.</param>
+        /// <param name="block_list">All blocks of the blob, in order.</param>
+        /// <param name="metadata">A <see cref="std::vector"> that respresents metadatas.</param>
+        /// <param name="size">The size of the committed blob, which the service does not return.</param>
+        /// <param name="returned_props">Set to the properties of the new blob, if the block list is committed.</param>
+        void blob_client_attr_cache_wrapper::put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, unsigned long long size, blob_property &returned_props)
+        {
+            std::shared_ptr<std::shared_timed_mutex> dir_mutex = attr_cache.get_dir_item(get_parent_str(blob));
+            std::shared_ptr<blob_client_attr_cache_wrapper::blob_cache_item> cache_item = attr_cache.get_blob_item(blob);
+            std::shared_lock<std::shared_timed_mutex> dirlock(*dir_mutex);
+            std::unique_lock<std::shared_timed_mutex> uniquelock(cache_item->m_mutex);
+            errno = 0;
+            m_blob_client_wrapper->put_block_list(container, blob, block_list, metadata, size, returned_props);
+            cache_item->m_write_count++;
+            store_written_props(*cache_item, returned_props);
+        }
+}}
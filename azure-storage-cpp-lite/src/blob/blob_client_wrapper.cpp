@@ -344,6 +344,12 @@ namespace microsoft_azure {
         }
 
         void blob_client_wrapper::put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata)
+        {
+            blob_property props(false);
+            put_blob(sourcePath, container, blob, metadata, props);
+        }
+
+        void blob_client_wrapper::put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props)
         {
             if(!is_valid())
             {
@@ -371,9 +377,7 @@ namespace microsoft_azure {
 
             try
             {
-                auto task = m_blobClient->upload_block_blob_from_stream(container, blob, ifs, metadata);
-                task.wait();
-                auto result = task.get();
+                auto result = m_blobClient->upload_block_blob_from_stream_sync(container, blob, ifs, metadata, returned_props);
                 if(!result.success())
                 {
                     errno = std::stoi(result.error().code);
@@ -402,6 +406,12 @@ namespace microsoft_azure {
         }
 
         void blob_client_wrapper::upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata)
+        {
+            blob_property props(false);
+            upload_block_blob_from_stream(container, blob, is, metadata, props);
+        }
+
+        void blob_client_wrapper::upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props)
         {
             if(!is_valid())
             {
@@ -416,9 +426,7 @@ namespace microsoft_azure {
 
             try
             {
-                auto task = m_blobClient->upload_block_blob_from_stream(container, blob, is, metadata);
-                task.wait();
-                auto result = task.get();
+                auto result = m_blobClient->upload_block_blob_from_stream_sync(container, blob, is, metadata, returned_props);
                 if(!result.success())
                 {
                     errno = std::stoi(result.error().code);
@@ -439,6 +447,12 @@ namespace microsoft_azure {
         }
 
         void blob_client_wrapper::upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel)
+        {
+            blob_property props(false);
+            upload_file_to_blob(sourcePath, container, blob, metadata, parallel, props);
+        }
+
+        void blob_client_wrapper::upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel, blob_property &returned_props)
         {
             if(!is_valid())
             {
@@ -461,7 +475,7 @@ namespace microsoft_azure {
 
             if(fileSize <= 64*1024*1024)
             {
-                put_blob(sourcePath, container, blob, metadata);
+                put_blob(sourcePath, container, blob, metadata, returned_props);
                 // put_blob sets errno
 		return;
             }
@@ -597,7 +611,8 @@ namespace microsoft_azure {
             }
             if(result == 0)
             {
-                const auto r = m_blobClient->put_block_list(container, blob, block_list, metadata).get();
+                const auto r = m_blobClient->put_block_list_sync(container, blob, block_list, metadata, returned_props);
+                returned_props.size = fileSize;
                 if(!r.success())
                 {
                     result = std::stoi(r.error().code);
@@ -653,7 +668,51 @@ namespace microsoft_azure {
             }
         }
 
+        chunk_property blob_client_wrapper::download_chunk_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os)
+        {
+            if(!is_valid())
+            {
+                errno = client_not_init;
+                return chunk_property();
+            }
+
+            try
+            {
+                auto result = m_blobClient->get_chunk_to_stream_sync(container, blob, offset, size, os);
+                if(!result.success())
+                {
+                    errno = std::stoi(result.error().code);
+                    return chunk_property();
+                }
+                else
+                {
+                    errno = 0;
+                    return result.response();
+                }
+            }
+            catch(const std::exception &ex)
+            {
+                syslog(LOG_ERR, "Unknown failure in download_chunk_to_stream.  ex.what() = %s, container = %s, blob = %s.", ex.what(), container.c_str(), blob.c_str());
+                errno = unknown_error;
+                return chunk_property();
+            }
+        }
+
         void blob_client_wrapper::download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, size_t parallel)
+        {
+            std::string etag;
+            download_blob_to_file(container, blob, destPath, returned_last_modified, etag, parallel);
+        }
+
+        void blob_client_wrapper::download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, std::string &returned_etag, size_t parallel)
+        {
+            blob_property props(false);
+            download_blob_to_file(container, blob, destPath, props, parallel);
+            returned_last_modified = props.last_modified;
+            returned_etag = props.etag;
+        }
+
+        void blob_client_wrapper::download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, blob_property &returned_props, size_t parallel)
         {
             if(!is_valid())
             {
@@ -668,7 +727,7 @@ namespace microsoft_azure {
                 // Download the first chunk of the blob. The response will contain required blob metadata as well.
                 int errcode = 0;
                 std::ofstream os(destPath.c_str(), std::ofstream::binary | std::ofstream::out);
-                firstChunk = m_blobClient->get_chunk_to_stream_sync(container, blob, 0, DOWNLOAD_CHUNK_SIZE, os);
+                firstChunk = m_blobClient->get_chunk_to_stream_sync(container, blob, 0, DOWNLOAD_CHUNK_SIZE, os, returned_props);
                 os.close();
                 if (!os) {
                     syslog(LOG_ERR, "get_chunk_to_stream_async failed for firstchunk in download_blob_to_file.  container = %s, blob = %s, destPath = %s.", container.c_str(), blob.c_str(), destPath.c_str());
@@ -759,7 +818,13 @@ namespace microsoft_azure {
                 return;
             }
 
-            returned_last_modified = firstChunk.response().last_modified;
+            if (!firstChunk.success())
+            {
+                // The blob is empty, so there were no headers to read its properties from.
+                returned_props.set_valid(false);
+                returned_props.last_modified = firstChunk.response().last_modified;
+                returned_props.etag = firstChunk.response().etag;
+            }
             return;
         }
 
@@ -793,6 +858,11 @@ namespace microsoft_azure {
             }
         }
 
+        blob_property blob_client_wrapper::get_blob_property(const std::string &container, const std::string &blob, bool /*assume_cache_invalid*/)
+        {
+            return get_blob_property(container, blob);
+        }
+
         bool blob_client_wrapper::blob_exists(const std::string &container, const std::string &blob)
         {
             if(!is_valid())
@@ -856,6 +926,12 @@ namespace microsoft_azure {
         }
 
         void blob_client_wrapper::start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob)
+        {
+            blob_property props(false);
+            start_copy(sourceContainer, sourceBlob, destContainer, destBlob, props);
+        }
+
+        void blob_client_wrapper::start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props)
         {
 
             if(!is_valid())
@@ -872,9 +948,7 @@ namespace microsoft_azure {
 
             try
             {
-                auto task = m_blobClient->start_copy(sourceContainer, sourceBlob, destContainer, destBlob);
-                task.wait();
-                auto result = task.get();
+                auto result = m_blobClient->start_copy_sync(sourceContainer, sourceBlob, destContainer, destBlob, returned_props);
 
                 if(!result.success())
                 {
@@ -893,5 +967,117 @@ namespace microsoft_azure {
             }
         }
 
+    
+
+        get_block_list_response blob_client_wrapper::get_block_list(const std::string &container, const std::string &blob)
+        {
+            if(!is_valid())
+            {
+                errno = client_not_init;
+                return get_block_list_response();
+            }
+            if(container.empty() || blob.empty())
+            {
+                errno = invalid_parameters;
+                return get_block_list_response();
+            }
+
+            try
+            {
+                auto task = m_blobClient->get_block_list(container, blob);
+                auto result = task.get();
+                if(!result.success())
+                {
+                    errno = std::stoi(result.error().code);
+                    return get_block_list_response();
+                }
+                else
+                {
+                    errno = 0;
+                    return result.response();
+                }
+            }
+            catch(const std::exception &ex)
+            {
+                syslog(LOG_ERR, "Unknown failure in get_block_list.  ex.what() = %s, container = %s, blob = %s.", ex.what(), container.c_str(), blob.c_str());
+                errno = unknown_error;
+                return get_block_list_response();
+            }
+        }
+
+        void blob_client_wrapper::upload_block_from_stream(const std::string &container, const std::string blob, const std::string &blockid, std::istream &is)
+        {
+            if(!is_valid())
+            {
+                errno = client_not_init;
+                return;
+            }
+            if(container.empty() || blob.empty() || blockid.empty())
+            {
+                errno = invalid_parameters;
+                return;
+            }
+
+            try
+            {
+                auto task = m_blobClient->upload_block_from_stream(container, blob, blockid, is);
+                auto result = task.get();
+                if(!result.success())
+                {
+                    errno = std::stoi(result.error().code);
+                }
+                else
+                {
+                    errno = 0;
+                }
+            }
+            catch(const std::exception &ex)
+            {
+                syslog(LOG_ERR, "Unknown failure in upload_block_from_stream.  ex.what() = %s, container = %s, blob = %s, blockid = %s.", ex.what(), container.c_str(), blob.c_str(), blockid.c_str());
+                errno = unknown_error;
+                return;
+            }
+        }
+
+        void blob_client_wrapper::put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata)
+        {
+            blob_property props(false);
+            put_block_list(container, blob, block_list, metadata, 0, props);
+        }
+
+        void blob_client_wrapper::put_block_list(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, unsigned long long size, blob_property &returned_props)
+        {
+            if(!is_valid())
+            {
+                errno = client_not_init;
+                return;
+            }
+            if(container.empty() || blob.empty())
+            {
+                errno = invalid_parameters;
+                return;
+            }
+
+            try
+            {
+                auto result = m_blobClient->put_block_list_sync(container, blob, block_list, metadata, returned_props);
+                returned_props.size = size;
+                if(!result.success())
+                {
+                    errno = std::stoi(result.error().code);
+                }
+                else
+                {
+                    errno = 0;
+                }
+            }
+            catch(const std::exception &ex)
+            {
+                syslog(LOG_ERR, "Unknown failure in put_block_list.  ex.what() = %s, container = %s, blob = %s.", ex.what(), container.c_str(), blob.c_str());
+                errno = unknown_error;
+                return;
+            }
+        }
+
     }
 } // microsoft_azure::storage
@@ -252,6 +252,7 @@ list_blobs_hierarchical_item tinyxml2_parser::parse_list_blobs_hierarchical_item
                 item.status = parse_lease_status(parse_text(xproperty, "LeaseStatus"));
                 item.state = parse_lease_state(parse_text(xproperty, "LeaseState"));
                 item.duration = parse_lease_duration(parse_text(xproperty, "LeaseDuration"));
+                item.copy_status = parse_text(xproperty, "CopyStatus");
                 auto xmetadata = ele->FirstChildElement("Metadata");
                 if (xmetadata)
                 {
@@ -342,7 +343,7 @@ get_block_list_response tinyxml2_parser::parse_get_block_list_response(const std
                 }
 
                 xitems = xresults->FirstChildElement("UncommittedBlocks");
-                xitem = xitems->FirstChildElement("Block");
+                xitem = xitems ? xitems->FirstChildElement("Block") : nullptr;
                 while (xitem) {
                     response.uncommitted.push_back(parse_get_block_list_item(xitem));
                     xitem = xitem->NextSiblingElement("Block");
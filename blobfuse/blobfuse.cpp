@@ -22,6 +22,24 @@ struct options
     const char *container_name; //container to mount. Used only if config_file is not provided
     const char *log_level; // Sets the level at which the process should log to syslog.
     const char *use_attr_cache; // True if the cache for blob attributes should be used.
+    const char *attr_timeout; // How long blob attributes are cached for, in seconds (defaults to no limit)
+    const char *attr_cache_max_entries; // Maximum number of blobs in the attribute cache (defaults to no limit)
+    const char *attr_cache_max_mb; // Maximum memory used by the attribute cache (defaults to no limit)
+    const char *negative_cache_timeout; // How long paths found not to exist are remembered, in seconds (defaults to 0, disabled)
+    const char *listing_cache_timeout; // How long directory listings are kept, in seconds (defaults to 0, disabled)
+    const char *preload_metadata; // True if the whole container should be listed at mount (requires --listing-cache-timeout)
+    const char *lazy_dir_emptiness; // True if getattr on a directory shouldn't list it to set nlink (defaults to false)
+    const char *rename_concurrency; // Number of files moved at once when a directory is renamed (defaults to 8)
+    const char *use_block_cache; // True if blobs opened for reading should be downloaded block-by-block as they are read, instead of in full on open.
+    const char *block_size_in_mb; // Size of the blocks downloaded when the block cache is enabled (defaults to 4MB)
+    const char *max_read_ahead_in_mb; // Maximum amount of data to prefetch ahead of a sequential reader when the block cache is enabled (defaults to 64MB)
+    const char *use_write_behind; // True if files should be uploaded in the background after close(), instead of before close() returns.
+    const char *max_pending_upload_in_mb; // Maximum total size of files waiting to be uploaded in the background (defaults to 1024MB)
+    const char *use_streaming_upload; // True if blocks of large files that are written sequentially should be uploaded while the file is still being written.
+    const char *cache_size_mb; // Maximum total size of the files in the file cache; the least recently used files are evicted beyond it.
+    const char *use_incremental_refresh; // True if only the changed blocks of large files in the cache should be downloaded when their blob changes.
+    const char *use_persistent_cache; // True if the file cache should be kept across mounts, instead of being cleared on unmount.
+    const char *use_flat_cache; // True if files in the cache should be stored under hashed names, instead of in a copy of the directory tree.
     const char *version; // print blobfuse version
     const char *help; // print blobfuse usage
 };
@@ -41,6 +59,24 @@ const struct fuse_opt option_spec[] =
     OPTION("--container-name=%s", container_name),
     OPTION("--log-level=%s", log_level),
     OPTION("--use-attr-cache=%s", use_attr_cache),
+    OPTION("--attr-timeout=%s", attr_timeout),
+    OPTION("--attr-cache-max-entries=%s", attr_cache_max_entries),
+    OPTION("--attr-cache-max-mb=%s", attr_cache_max_mb),
+    OPTION("--negative-cache-timeout=%s", negative_cache_timeout),
+    OPTION("--listing-cache-timeout=%s", listing_cache_timeout),
+    OPTION("--preload-metadata=%s", preload_metadata),
+    OPTION("--lazy-dir-emptiness=%s", lazy_dir_emptiness),
+    OPTION("--rename-concurrency=%s", rename_concurrency),
+    OPTION("--use-block-cache=%s", use_block_cache),
+    OPTION("--block-size-in-mb=%s", block_size_in_mb),
+    OPTION("--max-read-ahead-in-mb=%s", max_read_ahead_in_mb),
+    OPTION("--use-write-behind=%s", use_write_behind),
+    OPTION("--max-pending-upload-in-mb=%s", max_pending_upload_in_mb),
+    OPTION("--use-streaming-upload=%s", use_streaming_upload),
+    OPTION("--use-incremental-refresh=%s", use_incremental_refresh),
+    OPTION("--cache-size-mb=%s", cache_size_mb),
+    OPTION("--persistent-cache=%s", use_persistent_cache),
+    OPTION("--use-flat-cache=%s", use_flat_cache),
     OPTION("--version", version),
     OPTION("-v", version),
     OPTION("--help", help),
@@ -193,8 +229,10 @@ void *azs_init(struct fuse_conn_info * conn)
 {
     if (str_options.use_attr_cache)
     {
-        azure_blob_client_wrapper = std::make_shared<blob_client_attr_cache_wrapper>(blob_client_attr_cache_wrapper::blob_client_attr_cache_wrapper_init(str_options.accountName, str_options.accountKey, str_options.sasToken, 20/*concurrency*/, str_options.use_https,
+        std::shared_ptr<blob_client_attr_cache_wrapper> attr_cache_wrapper = std::make_shared<blob_client_attr_cache_wrapper>(blob_client_attr_cache_wrapper::blob_client_attr_cache_wrapper_init(str_options.accountName, str_options.accountKey, str_options.sasToken, 20/*concurrency*/, str_options.use_https,
                                                                                                                     str_options.blobEndpoint));
+        attr_cache_wrapper->set_cache_limits(str_options.attr_timeout, str_options.attr_cache_max_entries, str_options.attr_cache_max_bytes);
+        azure_blob_client_wrapper = attr_cache_wrapper;
     }
     else
     {
@@ -221,8 +259,46 @@ void *azs_init(struct fuse_conn_info * conn)
     conn->max_background = 128;
     //  conn->want |= FUSE_CAP_WRITEBACK_CACHE | FUSE_CAP_EXPORT_SUPPORT; // TODO: Investigate putting this back in when we downgrade to fuse 2.9
 
+    if (str_options.preload_metadata)
+    {
+        preload_metadata();
+    }
+
+    if (str_options.use_persistent_cache)
+    {
+        // Pick up the files left in the cache by the last mount before the GC thread starts ageing them out.
+        load_cache_index();
+    }
     g_gc_cache.run();
 
+    if (str_options.use_block_cache && (str_options.max_read_ahead_blocks > 0))
+    {
+        g_read_ahead_pool = std::make_shared<worker_pool>(READ_AHEAD_THREAD_COUNT);
+    }
+
+    if (str_options.use_write_behind)
+    {
+        // The journal lives outside of the file cache, so that it survives azs_destroy() clearing the cache.
+        std::string journal_dir = str_options.tmpPath + "/writebehind";
+        if ((mkdir(journal_dir.c_str(), S_IRWXU) != 0) && (errno != EEXIST))
+        {
+            syslog(LOG_CRIT, "azs_init - Failed to create write-behind journal directory %s: errno = %d.  Files will be uploaded on close.\n", journal_dir.c_str(), errno);
+        }
+        else
+        {
+            g_write_behind = std::make_shared<write_behind_queue>(journal_dir, WRITE_BEHIND_THREAD_COUNT, str_options.max_pending_upload_bytes);
+            g_write_behind->resume();
+        }
+    }
+
+    // After write-behind has picked up its uploads, since moving a file waits for its upload.
+    start_resuming_directory_renames();
+
+    if (str_options.use_streaming_upload)
+    {
+        g_streaming_upload_pool = std::make_shared<worker_pool>(STREAMING_UPLOAD_THREAD_COUNT);
+    }
+
     return NULL;
 }
 
@@ -230,7 +306,12 @@ void *azs_init(struct fuse_conn_info * conn)
 void print_usage()
 {
     fprintf(stdout, "Usage: blobfuse <mount-folder> --tmp-path=</path/to/fusecache> [--config-file=</path/to/config.cfg> | --container-name=<containername>]");
-    fprintf(stdout, "    [--use-https=true] [--file-cache-timeout-in-seconds=120] [--log-level=LOG_OFF|LOG_CRIT|LOG_ERR|LOG_WARNING|LOG_INFO|LOG_DEBUG] [--use-attr-cache=true]\n\n");
+    fprintf(stdout, "    [--use-https=true] [--file-cache-timeout-in-seconds=120] [--log-level=LOG_OFF|LOG_CRIT|LOG_ERR|LOG_WARNING|LOG_INFO|LOG_DEBUG] [--use-attr-cache=true]\n");
+    fprintf(stdout, "    [--attr-timeout=<seconds>] [--attr-cache-max-entries=<count>] [--attr-cache-max-mb=<size>] [--negative-cache-timeout=<seconds>]\n");
+    fprintf(stdout, "    [--listing-cache-timeout=<seconds>] [--preload-metadata=true] [--lazy-dir-emptiness=true] [--rename-concurrency=8]\n");
+    fprintf(stdout, "    [--use-block-cache=true] [--block-size-in-mb=4] [--max-read-ahead-in-mb=64] [--use-write-behind=true] [--max-pending-upload-in-mb=1024]\n");
+    fprintf(stdout, "    [--use-streaming-upload=true] [--use-incremental-refresh=true] [--cache-size-mb=<size>]\n");
+    fprintf(stdout, "    [--persistent-cache=true] [--use-flat-cache=true]\n\n");
     fprintf(stdout, "In addition to setting --tmp-path parameter, you must also do one of the following:\n");
     fprintf(stdout, "1. Specify a config file (using --config-file]=) with account name, account key, and container name, OR\n");
     fprintf(stdout, "2. Set the environment variables AZURE_STORAGE_ACCOUNT and AZURE_STORAGE_ACCESS_KEY, and specify the container name with --container-name=\n\n");
@@ -303,7 +384,9 @@ void set_up_callbacks()
     azs_blob_operations.statfs = azs_statfs;
     azs_blob_operations.access = azs_access;
     azs_blob_operations.readlink = azs_readlink;
+    azs_blob_operations.opendir = azs_opendir;
     azs_blob_operations.readdir = azs_readdir;
+    azs_blob_operations.releasedir = azs_releasedir;
     azs_blob_operations.open = azs_open;
     azs_blob_operations.read = azs_read;
     azs_blob_operations.release = azs_release;
@@ -435,6 +518,181 @@ int read_and_set_arguments(int argc, char *argv[], struct fuse_args *args)
         }
     }
 
+    str_options.attr_timeout = -1;
+    if (options.attr_timeout != NULL)
+    {
+        std::string attr_timeout(options.attr_timeout);
+        str_options.attr_timeout = stoi(attr_timeout);
+    }
+
+    str_options.attr_cache_max_entries = 0;
+    if (options.attr_cache_max_entries != NULL)
+    {
+        std::string max_entries(options.attr_cache_max_entries);
+        str_options.attr_cache_max_entries = stoull(max_entries);
+    }
+
+    unsigned long long attr_cache_max_mb = 0;
+    if (options.attr_cache_max_mb != NULL)
+    {
+        std::string max_mb(options.attr_cache_max_mb);
+        attr_cache_max_mb = stoull(max_mb);
+    }
+    str_options.attr_cache_max_bytes = attr_cache_max_mb * 1024 * 1024;
+
+    str_options.negative_cache_timeout = 0;
+    if (options.negative_cache_timeout != NULL)
+    {
+        std::string negative_cache_timeout(options.negative_cache_timeout);
+        str_options.negative_cache_timeout = stoi(negative_cache_timeout);
+    }
+
+    str_options.listing_cache_timeout = 0;
+    if (options.listing_cache_timeout != NULL)
+    {
+        std::string listing_cache_timeout(options.listing_cache_timeout);
+        str_options.listing_cache_timeout = stoi(listing_cache_timeout);
+    }
+
+    str_options.preload_metadata = false;
+    if (options.preload_metadata != NULL)
+    {
+        std::string preload_metadata(options.preload_metadata);
+        if (preload_metadata == "true")
+        {
+            if (str_options.listing_cache_timeout <= 0)
+            {
+                fprintf(stderr, "Error: --preload-metadata requires --listing-cache-timeout.\n");
+                print_usage();
+                return 1;
+            }
+            str_options.preload_metadata = true;
+        }
+    }
+
+    str_options.lazy_dir_emptiness = false;
+    if (options.lazy_dir_emptiness != NULL)
+    {
+        std::string lazy_dir_emptiness(options.lazy_dir_emptiness);
+        if (lazy_dir_emptiness == "true")
+        {
+            str_options.lazy_dir_emptiness = true;
+        }
+    }
+
+    str_options.rename_concurrency = DEFAULT_RENAME_CONCURRENCY;
+    if (options.rename_concurrency != NULL)
+    {
+        std::string rename_concurrency(options.rename_concurrency);
+        int concurrency = stoi(rename_concurrency);
+        if (concurrency < 1)
+        {
+            fprintf(stderr, "Error: --rename-concurrency must be at least 1.\n");
+            print_usage();
+            return 1;
+        }
+        str_options.rename_concurrency = concurrency;
+    }
+
+    str_options.use_block_cache = false;
+    if (options.use_block_cache != NULL)
+    {
+        std::string block_cache(options.use_block_cache);
+        if (block_cache == "true")
+        {
+            str_options.use_block_cache = true;
+        }
+    }
+
+    str_options.block_size = 4 * 1024 * 1024;
+    if (options.block_size_in_mb != NULL)
+    {
+        std::string block_size(options.block_size_in_mb);
+        int block_size_in_mb = stoi(block_size);
+        if (block_size_in_mb <= 0)
+        {
+            fprintf(stderr, "Error: --block-size-in-mb must be greater than zero.\n");
+            print_usage();
+            return 1;
+        }
+        str_options.block_size = (unsigned long long)block_size_in_mb * 1024 * 1024;
+    }
+
+    unsigned long long max_read_ahead_in_mb = 64;
+    if (options.max_read_ahead_in_mb != NULL)
+    {
+        std::string max_read_ahead(options.max_read_ahead_in_mb);
+        max_read_ahead_in_mb = stoull(max_read_ahead);
+    }
+    // Round up, so that any non-zero value allows prefetching at least one block.
+    str_options.max_read_ahead_blocks = (max_read_ahead_in_mb * 1024 * 1024 + str_options.block_size - 1) / str_options.block_size;
+
+    str_options.use_write_behind = false;
+    if (options.use_write_behind != NULL)
+    {
+        std::string write_behind(options.use_write_behind);
+        if (write_behind == "true")
+        {
+            str_options.use_write_behind = true;
+        }
+    }
+
+    unsigned long long max_pending_upload_in_mb = 1024;
+    if (options.max_pending_upload_in_mb != NULL)
+    {
+        std::string max_pending_upload(options.max_pending_upload_in_mb);
+        max_pending_upload_in_mb = stoull(max_pending_upload);
+    }
+    str_options.max_pending_upload_bytes = max_pending_upload_in_mb * 1024 * 1024;
+
+    unsigned long long cache_size_mb = 0;
+    if (options.cache_size_mb != NULL)
+    {
+        std::string cache_size(options.cache_size_mb);
+        cache_size_mb = stoull(cache_size);
+    }
+    str_options.max_cache_bytes = cache_size_mb * 1024 * 1024;
+
+    str_options.use_streaming_upload = false;
+    if (options.use_streaming_upload != NULL)
+    {
+        std::string streaming_upload(options.use_streaming_upload);
+        if (streaming_upload == "true")
+        {
+            str_options.use_streaming_upload = true;
+        }
+    }
+
+    str_options.use_incremental_refresh = false;
+    if (options.use_incremental_refresh != NULL)
+    {
+        std::string incremental_refresh(options.use_incremental_refresh);
+        if (incremental_refresh == "true")
+        {
+            str_options.use_incremental_refresh = true;
+        }
+    }
+
+    str_options.use_persistent_cache = false;
+    if (options.use_persistent_cache != NULL)
+    {
+        std::string persistent_cache(options.use_persistent_cache);
+        if (persistent_cache == "true")
+        {
+            str_options.use_persistent_cache = true;
+        }
+    }
+
+    str_options.use_flat_cache = false;
+    if (options.use_flat_cache != NULL)
+    {
+        std::string flat_cache(options.use_flat_cache);
+        if (flat_cache == "true")
+        {
+            str_options.use_flat_cache = true;
+        }
+    }
+
     if (options.file_cache_timeout_in_seconds != NULL)
     {
         std::string timeout(options.file_cache_timeout_in_seconds);
@@ -516,6 +774,21 @@ void configure_fuse(struct fuse_args *args)
 
 int initialize_blobfuse()
 {
+    missing_path_map::get_instance()->set_timeout(str_options.negative_cache_timeout);
+    namespace_tree::get_instance()->set_timeout(str_options.listing_cache_timeout);
+
+    if (str_options.use_flat_cache)
+    {
+        std::string objects_dir = str_options.tmpPath + "/objects";
+        int init_result = file_cache_map::get_instance()->init(objects_dir);
+        if (init_result != 0)
+        {
+            syslog(LOG_CRIT, "Unable to start blobfuse.  Failed to create directories for the flat cache layout under %s, errno = %d.\n", objects_dir.c_str(), init_result);
+            fprintf(stderr, "Failed to create directories for the flat cache layout under %s, errno = %d.\n", objects_dir.c_str(), init_result);
+            return 1;
+        }
+        return 0;
+    }
     if(0 != ensure_files_directory_exists_in_cache(prepend_mnt_path_string("/placeholder")))
     {
         syslog(LOG_CRIT, "Unable to start blobfuse.  Failed to create directory on cache directory: %s, errno = %d.\n", prepend_mnt_path_string("/placeholder").c_str(),  errno);
@@ -17,6 +17,15 @@
 #include <memory>
 #include <dirent.h>
 #include <deque>
+#include <list>
+#include <queue>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <chrono>
 #include <gnutls/gnutls.h>
 #include <gcrypt.h>
 #include <pthread.h>
@@ -38,6 +47,64 @@
 #define HIGH_THRESHOLD_VALUE 90
 #define LOW_THRESHOLD_VALUE 80
 
+/* How often the file cache GC checks the disk usage of the cache when nothing else wakes it up, in seconds. */
+#define GC_DISK_CHECK_INTERVAL 5
+
+/* How often the persistent cache index is saved while mounted, in seconds, so that little is lost if blobfuse doesn't shut down cleanly. */
+#define CACHE_INDEX_SAVE_INTERVAL 60
+
+/* Number of threads used to scan the file cache at mount when the persistent cache is enabled. */
+#define CACHE_INDEX_SCAN_THREAD_COUNT 8
+
+/* Number of independently locked tables the per-path mutexes of file_lock_map are spread over. */
+#define FILE_LOCK_MAP_STRIPES 256
+
+/* Number of directories the files of the flat cache layout are spread over.  Each file goes in the directory named by the first byte of its hash. */
+#define FLAT_CACHE_FANOUT 256
+
+/* Number of background threads used to prefetch blocks ahead of sequential readers.  Kept well below the blob client's concurrency (20), so that
+   prefetching cannot starve foreground requests of connections. */
+#define READ_AHEAD_THREAD_COUNT 8
+
+/* Number of files uploaded at once in the background when write-behind is enabled.  Each upload uses up to 8 connections of its own. */
+#define WRITE_BEHIND_THREAD_COUNT 2
+
+/* Number of top-level directories listed at once when metadata is preloaded at mount.  Kept below the blob client's concurrency (20). */
+#define PRELOAD_THREAD_COUNT 16
+
+/* Number of background threads staging completely written blocks when streaming upload is enabled, and the limit on blocks being staged per file. */
+#define STREAMING_UPLOAD_THREAD_COUNT 4
+#define MAX_STAGING_BLOCKS 8
+
+/* Default number of files moved at once when a directory is renamed (--rename-concurrency.)  Each move is a copy and a delete on the service. */
+#define DEFAULT_RENAME_CONCURRENCY 8
+
+/* Number of times a file is moved when the service is busy during a directory rename.  The wait before each retry doubles from RENAME_BACKOFF_MS, up
+   to RENAME_MAX_BACKOFF_MS, and all of the rename's workers wait it out. */
+#define RENAME_MAX_ATTEMPTS 8
+#define RENAME_BACKOFF_MS 200
+#define RENAME_MAX_BACKOFF_MS 10000
+
+/* Copies still pending after start_copy() are polled with a wait that starts at COPY_POLL_INITIAL_MS and doubles up to COPY_POLL_MAX_MS.  A copy is
+   given up on after COPY_POLL_MAX_ERRORS failed polls in a row. */
+#define COPY_POLL_INITIAL_MS 50
+#define COPY_POLL_MAX_MS 2000
+#define COPY_POLL_MAX_ERRORS 10
+
+/* Number of pending copies into one directory at which they are polled with one listing of the directory, instead of a HEAD request each. */
+#define COPY_POLL_LIST_THRESHOLD 4
+
+/* Number of times a background upload is attempted before giving up and reporting the error to fsync().  The wait before a retry starts at twice
+   WRITE_BEHIND_RETRY_MS, and doubles with each one. */
+#define WRITE_BEHIND_MAX_ATTEMPTS 3
+#define WRITE_BEHIND_RETRY_MS 1000
+
+/* Files no larger than this are uploaded with a single put_blob by the storage library, so there is no block list to reuse when they change. */
+#define INCREMENTAL_UPLOAD_MIN_SIZE (64ULL * 1024 * 1024)
+/* Largest block uploaded when re-uploading the modified parts of a file, and the service's limit on the number of blocks in a blob. */
+#define INCREMENTAL_UPLOAD_BLOCK_SIZE (16ULL * 1024 * 1024)
+#define MAX_BLOCK_COUNT 50000
+
 /* Define errors and return codes */
 #define D_NOTEXIST -1
 #define D_EMPTY 0
@@ -58,14 +125,55 @@ using namespace microsoft_azure::storage;
 // Blob download should hold the flock lock in exclusive mode.  Read/write operations should hold it in shared mode.
 // Explanations for why we lock in various places are in-line.
 
+struct file_lock_entry
+{
+    std::mutex mutex;
+    std::string path;
+    size_t refs; // Number of file_lock_handles to the entry.  Guarded by the mutex of the stripe the entry is in.
+};
+
+struct file_lock_stripe
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<file_lock_entry>> entries;
+};
+
+// A reference to the mutex for a path, returned by file_lock_map::get_mutex().  Dereferences to the mutex.  The mutex exists for as long as any handle
+// to it does, so the handle must outlive any lock taken on it.
+class file_lock_handle
+{
+public:
+    file_lock_handle(file_lock_stripe *stripe, file_lock_entry *entry) : m_stripe(stripe), m_entry(entry)
+    {
+    }
+
+    file_lock_handle(file_lock_handle&& other) : m_stripe(other.m_stripe), m_entry(other.m_entry)
+    {
+        other.m_entry = nullptr;
+    }
+
+    file_lock_handle(const file_lock_handle&) = delete;
+    file_lock_handle& operator=(const file_lock_handle&) = delete;
+
+    ~file_lock_handle();
+
+    std::mutex& operator*() const { return m_entry->mutex; }
+
+private:
+    file_lock_stripe *m_stripe;
+    file_lock_entry *m_entry;
+};
+
 // This class contains mutexes that we use to lock file paths during blob upload / download / delete.
 // Each blob / file path gets its own mutex.
 // This mutex should never be held when control is not in an open(), flush(), or unlink() method.
+// Mutexes only exist while they are in use: the entry for a path is created by the first get_mutex() call for it, and dropped along with the last
+// handle.  The entries are spread over FILE_LOCK_MAP_STRIPES independently locked tables, so that threads working on different paths rarely contend.
 class file_lock_map
 {
 public:
     static file_lock_map* get_instance();
-    std::shared_ptr<std::mutex> get_mutex(const std::string& path);
+    file_lock_handle get_mutex(const std::string& path);
 
 private:
     file_lock_map()
@@ -74,49 +182,702 @@ private:
 
     static std::shared_ptr<file_lock_map> s_instance;
     static std::mutex s_mutex;
+    file_lock_stripe m_stripes[FILE_LOCK_MAP_STRIPES];
+};
+
+// Map from file path to the ETag of the blob version held in the file cache.
+// An entry means the cache file still has exactly the contents of that version, so when the cache timeout expires, open() can revalidate the file with
+// a HEAD request rather than download it again.  Entries must be removed whenever the cache file may be changed locally (opened for writing, truncated,
+// renamed or deleted); this should be done while holding the file_lock_map mutex for the path.
+// Files restored from the persistent cache at mount are also marked unverified, so that the first open() revalidates them regardless of the timeout.
+class file_etag_map
+{
+public:
+    static file_etag_map* get_instance();
+    bool get_etag(const std::string& path, std::string& etag);
+    void set_etag(const std::string& path, const std::string& etag);
+    void remove_etag(const std::string& path);
+    void add_unverified(const std::string& path);
+    bool is_unverified(const std::string& path);
+
+private:
+    file_etag_map()
+    {
+    }
+
+    static std::shared_ptr<file_etag_map> s_instance;
+    static std::mutex s_mutex;
     std::mutex m_mutex;
-    std::map<std::string, std::shared_ptr<std::mutex>> m_lock_map;
+    std::map<std::string, std::string> m_etag_map;
+    std::set<std::string> m_unverified;
 };
 
-// deque to age cached files based on timeout
+// Paths recently found to exist neither as a blob nor as a directory on the service (--negative-cache-timeout.)
+// getattr() records a path here after a HEAD request returns 404 and the listing of its prefix comes back empty, and answers ENOENT from it until the
+// entry times out, so that probing for missing files makes no calls to the service.  Creating a file or directory, or renaming onto a path, through this
+// mount removes the entries for the path, its ancestors and its descendants.  A lookup only records its result if nothing was removed since it began
+// (see begin_lookup()), so it cannot undo a concurrent create.  Changes made by other clients are seen once the entry times out.
+class missing_path_map
+{
+public:
+    static missing_path_map* get_instance();
+    void set_timeout(int timeout_in_seconds);
+    bool enabled() const { return m_timeout > 0; }
+    unsigned long long begin_lookup();
+    void add_missing(const std::string& path, unsigned long long lookup);
+    bool is_missing(const std::string& path);
+    void remove_path(const std::string& path);
+
+private:
+    missing_path_map() : m_timeout(0), m_generation(0), m_sweep_size(1024)
+    {
+    }
+
+    static std::shared_ptr<missing_path_map> s_instance;
+    static std::mutex s_mutex;
+    std::mutex m_mutex;
+    int m_timeout;
+    unsigned long long m_generation; // Bumped by every remove_path().
+    size_t m_sweep_size; // Size of m_expiry at which expired entries are next swept out.
+    std::map<std::string, time_t> m_expiry;
+};
+
+// A child of a directory, as found by listing the directory on the service.
+struct listing_entry
+{
+    bool is_directory;
+    bool has_children; // For a directory, true if anything is stored under its prefix, rather than only a marker blob.
+    unsigned long long size;
+    time_t last_modified;
+};
+
+typedef std::map<std::string, listing_entry> listing_children;
+
+// Results of namespace_tree::lookup().
+#define NS_UNKNOWN 0
+#define NS_FOUND 1
+#define NS_MISSING 2
+
+// The namespace of the container as found by listing directories on the service, kept for --listing-cache-timeout seconds.
+// It is a tree of path components: every node is a file or directory found in the listing of its parent, with its attributes, and a directory that was
+// itself listed is marked as fully listed until its listing times out.  Until then readdir() on the directory, and getattr() on it and its children, are
+// answered from the tree; a name missing from a fully listed directory does not exist.  Changing a blob through this mount removes it from the tree and
+// clears the flag on its ancestors (see invalidate()).  A listing is only stored if nothing was invalidated since it began (see begin_listing()), so it
+// cannot undo a concurrent change.  Changes made by other clients are seen once the listing times out.
+// Nodes live in one vector and refer to each other by index, and names are interned, so a node costs a few dozen bytes plus its share of a name; the
+// children of a directory are kept sorted by name for binary search.  Paths are as seen through FUSE, without a trailing slash ("/" for the root.)
+class namespace_tree
+{
+public:
+    static namespace_tree* get_instance();
+    void set_timeout(int timeout_in_seconds);
+    bool enabled() const { return m_timeout > 0; }
+    unsigned long long begin_listing();
+    void add_listing(const std::string& dir, const listing_children& children, unsigned long long listing);
+    // NS_FOUND (and the entry) if the parent of the path is fully listed and holds it, NS_MISSING if the parent is fully listed and does not, and
+    // NS_UNKNOWN otherwise.  For a directory that is itself fully listed, has_children says whether it holds anything other than a .directory blob.
+    int lookup(const std::string& path, listing_entry& entry);
+    bool list(const std::string& dir, listing_children& children);
+    // Sets state to what is_directory_empty() would return, if the directory is fully listed.
+    bool get_directory_state(const std::string& dir, bool dir_blob_exists, int& state);
+    void invalidate(const std::string& path);
+    // Number of nodes in the tree, including the root.
+    size_t size();
+
+private:
+    struct node
+    {
+        uint32_t name;
+        bool is_directory;
+        bool has_children;
+        bool listed;
+        unsigned long long size;
+        time_t last_modified;
+        time_t expiry; // When the listing of a fully listed directory times out.
+        std::vector<uint32_t> children; // Sorted by name.
+    };
+
+    namespace_tree();
+    uint32_t intern(const std::string& name);
+    void release(uint32_t name);
+    uint32_t new_node(const std::string& name);
+    void remove_subtree(uint32_t index);
+    size_t find_child(uint32_t parent, const std::string& name);
+    bool is_child(uint32_t parent, size_t position, const std::string& name);
+    uint32_t find_node(const std::string& path, bool create);
+    bool is_listed(uint32_t index, time_t now);
+    bool get_directory_state_locked(uint32_t index, bool dir_blob_exists, time_t now, int& state);
+    bool prune(uint32_t index, time_t now);
+    size_t node_count();
+
+    static std::shared_ptr<namespace_tree> s_instance;
+    static std::mutex s_mutex;
+    std::mutex m_mutex;
+    int m_timeout;
+    unsigned long long m_generation; // Bumped by every invalidate().
+    size_t m_sweep_size; // Number of nodes at which the nodes that are no longer needed are next swept out.
+    std::vector<node> m_nodes; // m_nodes[0] is the root.
+    std::vector<uint32_t> m_free_nodes;
+    std::unordered_map<std::string, uint32_t> m_name_ids;
+    std::vector<const std::string*> m_names; // Keys of m_name_ids, by ID.
+    std::vector<uint32_t> m_name_refs;
+    std::vector<uint32_t> m_free_names;
+};
+
+// Adds the items of one page of the listing of the directory with the given prefix (ending in '/', or empty for the root) to its children, from
+// items[start] on.
+void add_listing_items(const std::vector<list_blobs_hierarchical_item>& items, size_t start, const std::string& prefix, listing_children& children);
+
+// Builds the children of the directory with the given prefix (ending in '/', or empty for the root) from the result of list_all_blobs_hierarchical().
+listing_children build_listing(const std::vector<std::pair<std::vector<list_blobs_hierarchical_item>, bool>>& list_results, const std::string& prefix);
+
+// Lists the whole container into the namespace tree (--preload-metadata.)  The root is listed first, then each top-level directory with a flat listing,
+// PRELOAD_THREAD_COUNT at a time.  Called from azs_init(), so no request is answered until it returns.
+void preload_metadata();
+
+// A set of names, used to de-duplicate the entries of a directory found both in the local cache and on the service.
+// It is an open-addressing hash table with linear probing.  The names are copied end to end into one buffer, and the slots refer to them by offset and
+// length, so a name costs its length plus a slot, and inserting does not allocate except when the buffer or the table grows.  Names cannot be removed.
+class name_set
+{
+public:
+    name_set();
+    // Returns true if the name was not already in the set.
+    bool insert(const std::string& name);
+    bool contains(const std::string& name) const;
+    size_t size() const { return m_count; }
+    void clear();
+
+private:
+    struct slot
+    {
+        uint64_t hash;
+        size_t offset; // Offset of the name in m_names, or empty_slot.
+        size_t length;
+    };
+
+    static const size_t empty_slot = SIZE_MAX;
+    static uint64_t hash_name(const char *data, size_t length);
+    size_t find_slot(const char *data, size_t length, uint64_t hash) const;
+    void grow();
+
+    std::vector<slot> m_slots; // The size is always a power of two.
+    std::string m_names;
+    size_t m_count;
+};
+
+// Map from file path to the file holding it in the cache, for the flat cache layout (--use-flat-cache.)
+// Instead of mirroring the blob namespace under tmpPath/root, each file is stored as tmpPath/objects/<xx>/<hash of path>, where the fan-out directories
+// are all created at mount.  Opening a file then never has to create directories, and renaming one only changes the map.
+// A path gets a file when add_path() is called, just before the file is created, and loses it on remove_path(), just after the file is deleted; this
+// should be done while holding the file_lock_map mutex for the path.  Directories only exist implicitly, as prefixes of the paths in the map.
+class file_cache_map
+{
+public:
+    static file_cache_map* get_instance();
+
+    // Creates the fan-out directories under objects_dir.  Returns 0 or an errno.
+    int init(const std::string& objects_dir);
+
+    // The file in the cache for path.  If path has none, the file that add_path() would give it.
+    std::string get_cache_path(const std::string& path);
+    std::string add_path(const std::string& path);
+    void remove_path(const std::string& path);
+
+    // Gives the file of src to dst.  Returns the file dst had before, if any, which the caller should delete.
+    std::string rename_path(const std::string& src, const std::string& dst);
+
+    // The path that the file in the cache holds, or an empty string if it no longer holds one.
+    std::string get_path(const std::string& cache_path);
+
+    // The names of the files and directories in the cache directly under dir, and whether each is a directory.
+    std::vector<std::pair<std::string, bool>> list_children(const std::string& dir);
+    bool has_children(const std::string& dir);
+
+    // Restores a mapping saved by an earlier mount.  Returns false if the file is already taken.
+    bool restore_path(const std::string& path, const std::string& object);
+    std::string get_object(const std::string& path);
+
+private:
+    file_cache_map()
+    {
+    }
+
+    std::string find_object(const std::string& path);
+    std::string object_path(const std::string& object);
+
+    static std::shared_ptr<file_cache_map> s_instance;
+    static std::mutex s_mutex;
+    std::mutex m_mutex;
+    std::string m_objects_dir;
+    std::map<std::string, std::string> m_objects; // Path to the name of its file, ordered so that the contents of a directory are adjacent.
+    std::unordered_map<std::string, std::string> m_paths; // Name of a file to the path it holds.
+};
+
+// heap to age cached files based on timeout
 struct file_to_delete
 {
     std::string path;
     time_t closed_time;    
 };
 
+// A file in the cache, and when it was last used.
+struct cached_file
+{
+    std::string path;
+    time_t last_access;
+};
+
+// Orders the heap of files to delete so that the file that was closed first is on top.
+struct closed_later
+{
+    bool operator()(const file_to_delete& a, const file_to_delete& b) const
+    {
+        return a.closed_time > b.closed_time;
+    }
+};
+
+// Files in the cache are deleted once they have been closed for file_cache_timeout_in_seconds, or when the disk holding the cache is nearly full.
+// If --cache-size-mb is set, the least recently used files are also deleted whenever the files in the cache take up more than that.  Recency and sizes
+// are kept in an LRU list with an index by path, so that recording an access is O(1), and the total is kept up to date as files are added and removed.
+// The GC thread sleeps until the next file expires, the cache grows past its size limit, or the disk usage is due to be checked again.
 class gc_cache
 {
     public:
-        gc_cache() : disk_threshold_reached(false){}
+        gc_cache() : disk_threshold_reached(false), m_wakeup(false), m_next_disk_check(0), m_next_index_save(0), m_pressure_start(0), m_cached_bytes(0), m_disk_total_bytes(0), m_disk_used_bytes(0) {}
         void run();
         void add_file(std::string path);
+        void touch_file(const std::string& path);
+        void remove_file(const std::string& path);
+        void rename_file(const std::string& src, const std::string& dst);
+        void add_cached_file(const std::string& path, time_t last_access);
+        std::vector<cached_file> get_cached_files();
+        // Deletes the least recently used files until the cache is within --cache-size-mb.  Called by the GC thread.
+        void evict_over_budget();
 
     private:
+        struct lru_entry
+        {
+            std::list<std::string>::iterator position;
+            unsigned long long size;
+            time_t last_access;
+        };
+
         bool disk_threshold_reached;
         const double high_threshold = HIGH_THRESHOLD_VALUE;
         const double low_threshold = LOW_THRESHOLD_VALUE;
-        std::deque<file_to_delete> m_cleanup;
+        std::priority_queue<file_to_delete, std::vector<file_to_delete>, closed_later> m_cleanup;
         std::mutex m_deque_lock;
+        std::condition_variable m_cv;
+        bool m_wakeup;
+        time_t m_next_disk_check;
+        time_t m_next_index_save;
+        time_t m_pressure_start; // Under disk pressure, files closed before this are deleted without waiting for them to expire.
+        std::mutex m_lru_lock;
+        std::list<std::string> m_lru; // Most recently used first.
+        std::unordered_map<std::string, lru_entry> m_lru_map;
+        unsigned long long m_cached_bytes;
+        unsigned long long m_disk_total_bytes;
+        unsigned long long m_disk_used_bytes;
         void run_gc_cache();
+        void update_file(const std::string& path, time_t last_access);
+        void wake();
+        bool delete_cached_file(const std::string& path);
         bool check_disk_space();
+        bool disk_over_threshold();
 };
 
 extern gc_cache g_gc_cache;
 
+// A fixed-size pool of threads that run queued tasks in the background.
+// Tasks still queued when the pool is destroyed are dropped; tasks that are running are waited for.
+class worker_pool
+{
+public:
+    explicit worker_pool(size_t thread_count);
+    ~worker_pool();
+    void submit(std::function<void()> task);
+
+private:
+    void run();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+};
+
+// Used to prefetch blocks for sequential readers when the block cache is enabled.  nullptr if read-ahead is disabled.
+extern std::shared_ptr<worker_pool> g_read_ahead_pool;
+
+// Tracks server-side copies that are still pending after start_copy(), for every thread that is waiting on one.  A single thread polls all of them, each
+// with its own doubling wait, and checks the copies into one directory with a listing of the directory once there are COPY_POLL_LIST_THRESHOLD of them.
+// The thread is started by the first wait(), and exits when nothing is pending.
+class copy_poller
+{
+public:
+    static copy_poller* get_instance();
+    // Waits for the copy to the blob to finish.  Returns 0 with status set to the final copy status and etag to the ETag of the blob, or the storage
+    // errno of the last failed poll.
+    int wait(const std::string& blob, std::string& status, std::string& etag);
+
+private:
+    struct pending_copy
+    {
+        std::string status;
+        std::string etag;
+        int error;
+        int error_count; // Failed polls in a row.
+        bool done;
+        long long interval; // Milliseconds.
+        long long next_poll; // Milliseconds on the steady clock.
+    };
+
+    // The result of polling one copy.
+    struct poll_result
+    {
+        std::shared_ptr<pending_copy> copy;
+        std::string status;
+        std::string etag;
+        int error;
+    };
+
+    copy_poller() : m_running(false)
+    {
+    }
+
+    void run();
+    void poll_directory(const std::string& prefix, const std::vector<std::pair<std::string, std::shared_ptr<pending_copy>>>& copies, std::vector<poll_result>& results);
+    void poll_blob(const std::string& blob, std::shared_ptr<pending_copy> copy, std::vector<poll_result>& results);
+
+    static std::shared_ptr<copy_poller> s_instance;
+    static std::mutex s_mutex;
+    std::mutex m_mutex;
+    std::condition_variable m_poll_cv; // Wakes the polling thread when a copy is added.
+    std::condition_variable m_done_cv; // Wakes waiters when a copy finishes.
+    bool m_running;
+    std::map<std::string, std::shared_ptr<pending_copy>> m_pending;
+};
+
+class file_write_state;
+
+// A block of a file that has already been uploaded, but not yet committed.
+struct staged_block
+{
+    unsigned long long size;
+    std::string id;
+};
+
+// What a file_write_state hands to an upload: the ranges written since the last upload, the blocks of them already staged, and the generation.
+struct write_snapshot
+{
+    std::map<unsigned long long, unsigned long long> dirty; // Start offset -> end offset.
+    std::string staged_blob; // Blob the staged blocks were uploaded to.
+    std::map<unsigned long long, staged_block> staged; // Start offset -> block.
+    unsigned long long generation;
+    write_snapshot() : generation(0)
+    {
+    }
+};
+
+// Uploads files in the background when write-behind is enabled, so that close() doesn't have to wait for the upload.
+// flush() takes a snapshot of the file (a reflink where the file system supports it, otherwise a copy) into the journal directory, records the blob it
+// belongs to next to it, and queues it.  Entries are only removed from the journal once the upload succeeds (or is cancelled), so uploads that were
+// pending when blobfuse stopped are resumed by resume() on the next mount.
+// Uploads of the same file run one at a time and in order; a snapshot that is still waiting is replaced by a newer one.  The total size of queued
+// snapshots is capped - flush() waits for earlier uploads to finish rather than exceed it.  A failed upload goes back to the front of its file's queue
+// until its retry is due, so that it doesn't hold a worker while it waits.
+class write_behind_queue
+{
+public:
+    write_behind_queue(const std::string& journal_dir, size_t thread_count, unsigned long long max_pending_bytes,
+        unsigned long long retry_ms = WRITE_BEHIND_RETRY_MS);
+    ~write_behind_queue();
+    // Queues uploads left in the journal by a previous mount.
+    void resume();
+    // Snapshots the file in the cache at mntPath and queues it for upload to the blob for path.  Returns 0 or a negative errno.
+    int enqueue(const std::string& path, const std::string& mntPath);
+    // Waits until there are no queued or running uploads for path or anything under it.  Returns (and clears) the error from the last failed upload, if any.
+    int wait(const std::string& path);
+    // Drops the queued uploads for path, and waits for a running one to finish.  Used when the blob is about to be deleted or replaced.
+    void cancel(const std::string& path);
+    bool has_pending(const std::string& path);
+    void wait_all();
+
+private:
+    struct upload_job
+    {
+        unsigned long long id;
+        unsigned long long size;
+        int attempt;
+        std::shared_ptr<file_write_state> writes;
+        write_snapshot snapshot;
+        upload_job() : id(0), size(0), attempt(1)
+        {
+        }
+    };
+    struct path_uploads
+    {
+        std::deque<upload_job> queued;
+        bool running; // True while a worker is uploading the file, or its retry is waiting to be due.
+        bool retry_pending;
+        unsigned long long cancelled_below; // Jobs with a lower ID were queued before the last cancel(), and are not retried.
+        path_uploads() : running(false), retry_pending(false), cancelled_below(0)
+        {
+        }
+    };
+
+    void add_job(const std::string& path, upload_job job);
+    void run_uploads(const std::string& path);
+    void run_retries();
+    bool is_pending_locked(const std::string& path);
+    std::string journal_file(unsigned long long id, const char *extension);
+    void remove_job_files(unsigned long long id);
+
+    std::string m_journal_dir;
+    unsigned long long m_max_pending_bytes;
+    unsigned long long m_retry_ms;
+    unsigned long long m_pending_bytes;
+    unsigned long long m_next_id;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<std::string, path_uploads> m_uploads;
+    std::map<std::string, int> m_errors;
+    std::multimap<std::chrono::steady_clock::time_point, std::string> m_retries; // When each retry is due, and its path.
+    std::condition_variable m_retry_cv;
+    bool m_stop;
+    std::thread m_retry_thread; // Hands retries that are due to the pool.
+    worker_pool m_pool;
+};
+
+// nullptr if write-behind is disabled.
+extern std::shared_ptr<write_behind_queue> g_write_behind;
+
+// Used to stage blocks of files that are being written, when streaming upload is enabled.  nullptr otherwise.
+extern std::shared_ptr<worker_pool> g_streaming_upload_pool;
+
+// When the block cache is enabled, opening a blob for reading does not download it.  Instead, the file in the cache is created as a sparse file
+// of the blob's size, and fixed-size blocks are downloaded into it the first time they are read.
+// This class tracks which blocks of one such file have been downloaded.  Files with no file_block_state are either fully downloaded, or were created locally.
+class file_block_state : public std::enable_shared_from_this<file_block_state>
+{
+public:
+    file_block_state(const std::string& blob, unsigned long long size, const std::string& etag, unsigned long long block_size);
+
+    // Download any blocks overlapping the range [offset, offset + size) that are not yet in the cache file.
+    // fd is an open handle to the cache file; it may be read-only.
+    // Returns 0 on success, or a negative errno.
+    int ensure_range(int fd, off_t offset, size_t size);
+
+    // Download all blocks that are not yet in the cache file.  Used before a partially downloaded file is opened for writing.
+    int ensure_all(int fd);
+
+    // Queue up to count blocks starting at first on g_read_ahead_pool, skipping blocks that are present, queued or being downloaded.  Does not wait.
+    // A reader that needs a queued block downloads it itself rather than wait behind the pool's queue; the worker then skips it.
+    void prefetch(int fd, size_t first, size_t count);
+
+    unsigned long long block_size() const { return m_block_size; }
+
+    // True if every block of the blob is in the cache file.
+    bool is_complete();
+
+    // True if the blob on the service has changed since this file was opened, and the cache file needs to be refreshed.
+    bool is_stale();
+
+    // Point at a new blob (after a rename.)  The etag changes, because a copied blob is a new blob.
+    void set_blob(const std::string& blob, const std::string& etag);
+
+    // Which blocks are in the cache file.  Used to save the state in the persistent cache index, and restore it at the next mount.
+    std::vector<bool> get_present();
+    void set_present(const std::vector<bool>& present);
+
+private:
+    int ensure_block(int fd, size_t idx);
+    void complete_block(size_t idx, int result);
+    bool claim_queued_block(size_t idx);
+    int download_block(int write_fd, size_t idx);
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv; // Signalled when a block download completes.
+    std::string m_blob;
+    std::string m_etag;
+    unsigned long long m_size;
+    unsigned long long m_block_size;
+    std::vector<bool> m_present;
+    std::vector<bool> m_in_flight; // Being downloaded.
+    std::vector<bool> m_queued; // Queued for prefetch on g_read_ahead_pool, but not yet picked up by a worker.
+    size_t m_missing;
+    bool m_stale;
+};
+
+// Map from file path to the block state of a partially downloaded file in the cache.
+// Entries must be removed or renamed whenever the corresponding cache file is deleted or renamed; this should be done while holding the file_lock_map mutex for the path.
+class file_block_map
+{
+public:
+    static file_block_map* get_instance();
+    std::shared_ptr<file_block_state> get_state(const std::string& path);
+    void add_state(const std::string& path, std::shared_ptr<file_block_state> state);
+    void remove_state(const std::string& path);
+    void rename_state(const std::string& src, const std::string& dst);
+
+private:
+    file_block_map()
+    {
+    }
+
+    static std::shared_ptr<file_block_map> s_instance;
+    static std::mutex s_mutex;
+    std::mutex m_mutex;
+    std::map<std::string, std::shared_ptr<file_block_state>> m_block_map;
+};
+
+// Tracks the pattern of reads through one file handle, to decide how far ahead to prefetch.
+// The window (in blocks) starts at one block and doubles each time a sequential reader moves into a new block, like TCP slow start.  A random read halves it.
+struct read_ahead_state
+{
+    std::mutex mutex;
+    off_t next_offset; // Offset just past the previous read.
+    size_t last_block; // Block containing the end of the previous read.
+    size_t window; // Number of blocks to keep prefetched ahead of the reader.
+    size_t prefetch_end; // Block index just past the last block queued for prefetch.
+    read_ahead_state() : next_offset(0), last_block(0), window(0), prefetch_end(0)
+    {
+    }
+};
+
+// Tracks the byte ranges of a file in the cache that have been written since the file was last uploaded, along with the committed block list of the blob
+// that the rest of the file matches (the "base").  With a base, azs_flush() only has to upload the blocks that overlap written ranges, and can commit the
+// rest of the blob by reusing the existing block IDs.
+// Without a base (small files, or a cache file we can't prove matches the blob), the whole file is uploaded, as before.
+// Every modification also bumps a generation counter, and each successful upload records the generation it uploaded, so that a flush with nothing new to
+// upload (a second flush of the same close, or closing a read/write handle that was never written to) makes no calls to the service.
+// With streaming upload enabled, blocks that have been completely written are uploaded ("staged") in the background while the file is still being
+// written, so that flush only has to upload the rest and commit.  The stream starts at offset zero (or at the end of the committed blocks, for appends),
+// and only once more than INCREMENTAL_UPLOAD_MIN_SIZE of it has been written.  Writing to a staged block again drops it.
+class file_write_state
+{
+public:
+    file_write_state() : m_generation(0), m_uploaded_generation(0), m_queued_generation(0), m_stream_end(0), m_stage_epoch(0)
+    {
+    }
+
+    // Records that [offset, offset + size) has been written.
+    void add_dirty(unsigned long long offset, unsigned long long size);
+    // Records that the file has been truncated (or extended) to size; everything from there on has to be re-uploaded.
+    void truncate(unsigned long long size);
+    // Records that the file has to be uploaded even though nothing has been written; used for newly created files, which don't have a blob yet.
+    void mark_modified();
+    // True if nothing has changed since the last successful upload (or since the file was downloaded), or since the last snapshot queued for upload.
+    bool is_clean();
+    // Removes and returns the written ranges and staged blocks to be uploaded, along with the current generation.  Waits for staging uploads that are
+    // already running first.  If the upload fails, the snapshot has to be given back with restore(); if it succeeds, it has to be passed to
+    // mark_uploaded().
+    write_snapshot take_snapshot();
+    void restore(const write_snapshot& snapshot);
+    void mark_uploaded(const write_snapshot& snapshot);
+    // With write-behind, records the generation of a snapshot queued for upload.  If that upload fails, clear_queued() forgets it again.
+    void mark_queued(unsigned long long generation);
+    void clear_queued();
+
+    bool has_base(const std::string& blob);
+    bool get_base(const std::string& blob, std::vector<get_block_list_item>& blocks);
+    void set_base(const std::string& blob, const std::vector<get_block_list_item>& blocks);
+    void clear_base();
+
+    // If the next block of the stream has been completely written, reserves it for staging and returns true.
+    bool next_block_to_stage(const std::string& blob, unsigned long long& offset, unsigned long long& size, std::string& id, unsigned long long& epoch);
+    // Records the result of uploading a block returned by next_block_to_stage().
+    void complete_staging(unsigned long long offset, unsigned long long epoch, bool success);
+
+private:
+    struct staging_block
+    {
+        staged_block block;
+        unsigned long long epoch;
+        bool valid;
+    };
+
+    void add_dirty_locked(unsigned long long start, unsigned long long end);
+    void drop_staged_locked(unsigned long long start, unsigned long long end);
+    void discard_staged_locked();
+
+    std::mutex m_mutex;
+    std::map<unsigned long long, unsigned long long> m_dirty; // Start offset -> end offset of each written range.  Ranges never overlap or touch.
+    unsigned long long m_generation; // Bumped on every modification.
+    unsigned long long m_uploaded_generation; // Generation of the last successful upload.
+    unsigned long long m_queued_generation; // Generation of the last snapshot queued for upload.
+    std::string m_base_blob; // Blob that m_base_blocks belongs to; empty if there is no base.
+    std::vector<get_block_list_item> m_base_blocks;
+    std::string m_staged_blob; // Blob that m_staged and m_staging were uploaded to.
+    std::map<unsigned long long, staged_block> m_staged; // Start offset -> block, for blocks that have been uploaded but not committed.
+    std::map<unsigned long long, staging_block> m_staging; // Start offset -> block, for blocks that are being uploaded.
+    unsigned long long m_stream_end; // Offset of the next block to stage.
+    unsigned long long m_stage_epoch; // Bumped by every commit, which makes the service discard uncommitted blocks that were not part of it.
+    std::condition_variable m_staging_cv;
+};
+
+// Map from file path to the write state of the file in the cache.
+// Like file_block_map, entries must be removed or renamed along with the cache file, while holding the file_lock_map mutex for the path.
+class file_write_map
+{
+public:
+    static file_write_map* get_instance();
+    std::shared_ptr<file_write_state> get_state(const std::string& path);
+    std::shared_ptr<file_write_state> get_or_create_state(const std::string& path);
+    void remove_state(const std::string& path);
+    void rename_state(const std::string& src, const std::string& dst);
+
+private:
+    file_write_map()
+    {
+    }
+
+    static std::shared_ptr<file_write_map> s_instance;
+    static std::mutex s_mutex;
+    std::mutex m_mutex;
+    std::map<std::string, std::shared_ptr<file_write_state>> m_write_map;
+};
+
 // FUSE gives you one 64-bit pointer to use for communication between API's.
 // An instance of this struct is pointed to by that pointer.
 struct fhwrapper
 {
     int fh; // The handle to the file in the file cache to use for read/write operations.
-    bool upload; // True if the blob should be uploaded when the file is closed.  (False when the file was opened in read-only mode.)
-    fhwrapper(int fh, bool upload) : fh(fh), upload(upload)
+    bool upload; // True if the blob may need to be uploaded when the file is closed.  (False when the file was opened in read-only mode.)
+    std::shared_ptr<file_block_state> blocks; // Block state of the file in the cache, if it has not been fully downloaded.
+    std::shared_ptr<file_write_state> writes; // Ranges written through this handle are recorded here.  Set only for handles opened for writing.
+    read_ahead_state read_ahead;
+    fhwrapper(int fh, bool upload) : fh(fh), upload(upload), blocks(), writes()
     {
 
     }
 };
 
 
+// State of a directory opened with opendir(), pointed to by the fh of its fuse_file_info.
+// readdir() hands the listing of the directory to the kernel a page at a time, using FUSE's offsets, and the next call picks up where the last one
+// stopped, so only the current page is held in memory.  The offset of an entry is its position in the stream plus one, counting "." and "..".
+struct dirhandle
+{
+    std::mutex mutex;
+    off_t start; // Offset in the stream of the entry before entries[0].
+    std::vector<std::pair<std::string, struct stat>> entries; // The current page.
+    bool started; // True once the stream has been started.
+    bool done; // True once the last page has been read.
+    std::string continuation; // Marker of the next page to list on the service.
+    std::string prior; // Name of the last item of the previous page, which the service can repeat at the start of the next.
+    name_set seen; // Names found in the local cache, and directories found on the service, which are not listed again.
+    unsigned long long listing; // See namespace_tree::begin_listing().
+    listing_children children; // The whole listing, collected for the namespace tree when it is enabled.
+    uid_t uid; // Owner of the entries: the user that opened the directory.
+    gid_t gid;
+    dirhandle() : start(0), started(false), done(false), listing(0), uid(0), gid(0)
+    {
+    }
+};
+
 // Global struct storing the Storage connection information and the tmpPath.
 struct str_options
 {
@@ -128,6 +889,24 @@ struct str_options
     std::string tmpPath;
     bool use_https;
     bool use_attr_cache;
+    int attr_timeout; // How long the attribute cache trusts blob properties, in seconds.  Negative means no limit.
+    size_t attr_cache_max_entries; // Zero means no limit.
+    unsigned long long attr_cache_max_bytes; // Zero means no limit.
+    int negative_cache_timeout; // How long getattr() remembers that a path does not exist, in seconds.  Zero disables the negative cache.
+    int listing_cache_timeout; // How long the listing of a directory is used for readdir() and getattr(), in seconds.  Zero disables the listing cache.
+    bool preload_metadata; // True if the whole container should be listed into the namespace tree at mount.
+    bool lazy_dir_emptiness; // True if getattr() on a directory marker blob should not list the directory to find out whether it is empty.
+    size_t rename_concurrency; // Number of files moved at once when a directory is renamed.
+    bool use_block_cache;
+    unsigned long long block_size; // Size of the blocks downloaded when the block cache is enabled, in bytes.
+    size_t max_read_ahead_blocks; // Maximum read-ahead window, in blocks.  Zero disables read-ahead.
+    bool use_write_behind;
+    bool use_streaming_upload;
+    bool use_incremental_refresh;
+    unsigned long long max_pending_upload_bytes; // Cap on the total size of snapshots waiting to be uploaded when write-behind is enabled.
+    unsigned long long max_cache_bytes; // Size the file cache is kept under by evicting the least recently used files.  Zero means no limit.
+    bool use_persistent_cache; // True if the file cache should be kept across mounts, along with an index of what it holds.
+    bool use_flat_cache; // True if files in the cache are stored under hashed names (see file_cache_map), rather than in a copy of the directory tree.
 };
 
 extern struct str_options str_options;
@@ -159,6 +938,80 @@ int read_config(std::string configFile);
 // Input is the logical file name being input to the FUSE API, output is the file name of the on-disk file in the file cache.
 std::string prepend_mnt_path_string(const std::string& path);
 
+// Helper function to make room in the file cache for the file at path, before it is created there.  Updates mntPathString to where it must be created,
+// which can change with the flat cache layout.  Returns 0, or -1 and sets errno.
+int ensure_cache_path(const std::string& path, std::string& mntPathString);
+
+// Helper function to create the sparse file in the file cache for a blob that will be downloaded block-by-block, and register its block state.
+// Only the properties of the blob are fetched.  Returns nullptr and sets errno on failure, returns nullptr with errno = 0 if the blob is empty.
+std::shared_ptr<file_block_state> create_block_cache_file(const std::string& path, time_t& last_modified, std::string& etag);
+
+// Helper function to detect sequential reads through a file handle, and prefetch blocks ahead of the reader.
+void read_ahead(struct fhwrapper *fhwrap, off_t offset, size_t size);
+
+// Helper function to write all of data to fd.  Returns 0 or an errno.
+int write_all(int fd, const char *data, size_t size);
+
+// Helper functions for the persistent cache.  load_cache_index() restores the state of the files left in the cache by an earlier mount, using the index
+// saved by save_cache_index() where it is still accurate, and the cache directory itself otherwise.  Restored files are revalidated on first open.
+void load_cache_index();
+void save_cache_index();
+
+// Helper function to fetch the committed block list of the blob, and check that the blocks add up to the expected size.
+// Returns false (and logs) if the list can't be used as a base for incremental uploads or refreshes.
+bool fetch_committed_blocks(const std::string& blob, unsigned long long size, std::vector<get_block_list_item>& blocks);
+
+// Helper function to fetch the committed block list of the blob for a file in the cache that is being opened for writing, so that the next flush
+// can reuse the unmodified blocks.  fresh should be true if the file was downloaded from the blob during this open().
+void load_committed_blocks(const std::string& path, int fd, bool fresh);
+
+// Helper function to bring a file in the cache up to date with a blob that has changed, by downloading only the blocks whose IDs differ from the block
+// list the file was cached with.  Must be called with the file_lock_map mutex held and no open handles to the file.  Returns true on success, with
+// last_modified and etag set for the new version; otherwise the file in the cache may be partially updated, and must be downloaded in full.
+bool refresh_changed_blocks(const std::string& path, const std::string& mntPath, time_t& last_modified, std::string& etag);
+
+// A range of the blob to download into the cache file.
+struct refresh_range
+{
+    unsigned long long offset;
+    unsigned long long size;
+};
+
+// Works out which ranges of a blob to download to bring a file that matches old_blocks up to date with new_blocks.  A block that has the same ID and
+// size at the same offset as before still has the same contents; everything else is downloaded, in ranges of at most INCREMENTAL_UPLOAD_BLOCK_SIZE.
+// Sets reused to the number of bytes that are kept.
+std::vector<refresh_range> plan_refresh(const std::vector<get_block_list_item>& old_blocks, const std::vector<get_block_list_item>& new_blocks,
+    unsigned long long& reused);
+
+// Helper function to upload a file in the cache to its blob.  Only the modified blocks are uploaded if possible, otherwise the whole file.
+// path is the path of the file as seen through FUSE.  Returns 0 on success or a negative errno.
+int upload_cache_file(const std::string& path, const std::string& mntPath);
+
+// A piece of the new blob: an existing committed block, a block that was staged while the file was being written, or a range of the file to upload as a
+// new block.
+struct upload_segment
+{
+    std::string id;
+    bool committed;
+    bool uploaded;
+    unsigned long long offset;
+    unsigned long long size;
+};
+
+// Works out the block list for a file of the given size.  Committed blocks that lie entirely within the file and don't overlap any dirty range are
+// reused, as are staged blocks that lie within the file; everything else is cut into new blocks of at most INCREMENTAL_UPLOAD_BLOCK_SIZE.
+// Returns no segments if the file is empty or would need more than MAX_BLOCK_COUNT blocks, in which case the whole file is uploaded instead.
+std::vector<upload_segment> plan_upload(const std::vector<get_block_list_item>& base, const std::map<unsigned long long, staged_block>& staged,
+    const std::map<unsigned long long, unsigned long long>& dirty, unsigned long long size, size_t id_length);
+
+// Helper function to upload source_path, which is either the file in the cache or a snapshot of it, to the blob for path.  snapshot must have been taken
+// from writes with take_snapshot() before the contents of source_path were captured.  Returns 0 on success or a negative errno.
+int upload_file_contents(std::shared_ptr<file_write_state> writes, const std::string& path, const std::string& source_path, unsigned long long size,
+    const write_snapshot& snapshot);
+
+// Helper function to start uploading the blocks a handle has finished writing, when streaming upload is enabled.
+void stage_written_blocks(struct fhwrapper *fhwrap, const std::string& path);
+
 // Helper function to acquire a shared file lock while the file is open
 int shared_lock_file(int flags, int fd);
 
@@ -214,19 +1067,38 @@ int azs_statfs(const char *path, struct statvfs *stbuf);
  */
 int azs_mkdir(const char *path, mode_t mode);
 
+/**
+ * Open a directory for reading.  Allocates the dirhandle that readdir() keeps its place in.
+ *
+ * @param  path Path to the directory to open.
+ * @param  fi   File info.  The fh is set to the dirhandle.
+ * @return      0.
+ */
+int azs_opendir(const char *path, struct fuse_file_info *fi);
+
 /**
  * Read the contents of a directory.  For each entry to add, call the filler function with the input buffer,
- * the name of the entry, and additional data about the entry.  TODO: Keep the data (somehow) for latter getattr calls.
+ * the name of the entry, and additional data about the entry.  The listing on the service is read a page at a time, and each page is handed to the
+ * filler before the next is listed.  With --listing-cache-timeout, the listing is kept for later readdir and getattr calls.
  *
  * @param  path   Path to the directory to read.
  * @param  buf    Buffer to pass into the filler function.  Not otherwise used in this function.
  * @param  filler Function to call to add directories and files as they are discovered.
- * @param  offset Not used
- * @param  fi     File info about the directory to be read.
- * @return        TODO: error codes.
+ * @param  offset Offset of the last entry the kernel received, or 0 to read from the beginning.
+ * @param  fi     File info about the directory to be read, containing the dirhandle.
+ * @return        0, or a negative errno if listing the directory on the service failed.
  */
 int azs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);
 
+/**
+ * Release a directory opened with opendir().
+ *
+ * @param  path Path to the directory to release.
+ * @param  fi   File info, containing the dirhandle, which is freed.
+ * @return      0.
+ */
+int azs_releasedir(const char *path, struct fuse_file_info *fi);
+
 
 /**
  * Open an item (a file) for writing or reading.
@@ -374,6 +1246,32 @@ int azs_removexattr(const char *path, const char *name);
 /** Internal method, used to rename a single file in a (hopefully) lock-safe manner. */
 int azs_rename_single_file(const char *src, const char *dst);
 
+/** As azs_rename_single_file(), and sets storage_errno to the errno of the storage call that failed, so that callers can retry when the service is busy. */
+int rename_single_file(const char *src, const char *dst, int& storage_errno);
+
+/**
+ * Helper function to copy the blob for src to dst on the service, wait for the copy to finish, and delete the source blob.  The local cache is not
+ * touched.  Returns 0 or a negative errno, and sets storage_errno to the errno of the storage call that failed.
+ */
+int move_blob(const std::string& srcPathString, const std::string& dstPathString, int& storage_errno);
+
+/**
+ * Internal method, used to rename a directory.  Everything under it is listed once, then moved rename_concurrency files at a time.  The list is kept
+ * in a journal under tmpPath/renames until the rename ends, so that a rename interrupted by a crash or unmount is finished at the next mount.  A rename
+ * that fails is not: it returns the error, and the files that were moved stay in dst.
+ */
+int azs_rename_directory(const char *src, const char *dst);
+
+/**
+ * Starts finishing the directory renames left in the journal by an earlier mount, in the order they were started, on a background thread.  Called from
+ * azs_init(); the mount answers requests meanwhile, and the directories being renamed show the files of a rename under src or dst until it is done.
+ * New directory renames wait until it finishes.
+ */
+void start_resuming_directory_renames();
+
+/** Finishes the directory renames left in the journal by an earlier mount, in the order they were started, and returns when they are done. */
+void resume_directory_renames();
+
 /**
 * Convert a value into a string.
 */
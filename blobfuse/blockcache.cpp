@@ -0,0 +1,431 @@
+#include "blobfuse.h"
+#include <fcntl.h>
+#include <future>
+#include <atomic>
+
+file_block_map* file_block_map::get_instance()
+{
+    if(nullptr == s_instance.get())
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if(nullptr == s_instance.get())
+        {
+            s_instance.reset(new file_block_map());
+        }
+    }
+    return s_instance.get();
+}
+
+std::shared_ptr<file_block_state> file_block_map::get_state(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_block_map.find(path);
+    if(iter == m_block_map.end())
+    {
+        return nullptr;
+    }
+    return iter->second;
+}
+
+void file_block_map::add_state(const std::string& path, std::shared_ptr<file_block_state> state)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_block_map[path] = state;
+}
+
+void file_block_map::remove_state(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_block_map.erase(path);
+}
+
+void file_block_map::rename_state(const std::string& src, const std::string& dst)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_block_map.erase(dst);
+    auto iter = m_block_map.find(src);
+    if(iter != m_block_map.end())
+    {
+        m_block_map[dst] = iter->second;
+        m_block_map.erase(iter);
+    }
+}
+
+std::shared_ptr<file_block_map> file_block_map::s_instance;
+std::mutex file_block_map::s_mutex;
+
+file_block_state::file_block_state(const std::string& blob, unsigned long long size, const std::string& etag, unsigned long long block_size)
+    : m_blob(blob), m_etag(etag), m_size(size), m_block_size(block_size), m_stale(false)
+{
+    size_t block_count = (size + block_size - 1) / block_size;
+    m_present.resize(block_count, false);
+    m_in_flight.resize(block_count, false);
+    m_queued.resize(block_count, false);
+    m_missing = block_count;
+}
+
+bool file_block_state::is_complete()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_missing == 0;
+}
+
+bool file_block_state::is_stale()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stale;
+}
+
+void file_block_state::set_blob(const std::string& blob, const std::string& etag)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_blob = blob;
+    m_etag = etag;
+}
+
+std::vector<bool> file_block_state::get_present()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_present;
+}
+
+void file_block_state::set_present(const std::vector<bool>& present)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_missing = 0;
+    for (size_t idx = 0; idx < m_present.size(); idx++)
+    {
+        m_present[idx] = (idx < present.size()) && present[idx];
+        if (!m_present[idx])
+        {
+            m_missing++;
+        }
+    }
+}
+
+int file_block_state::ensure_range(int fd, off_t offset, size_t size)
+{
+    if ((size == 0) || (offset < 0) || ((unsigned long long)offset >= m_size))
+    {
+        return 0;
+    }
+
+    unsigned long long end = std::min((unsigned long long)offset + size, m_size);
+    for (size_t idx = offset / m_block_size; idx <= (end - 1) / m_block_size; idx++)
+    {
+        int res = ensure_block(fd, idx);
+        if (res != 0)
+        {
+            return res;
+        }
+    }
+    return 0;
+}
+
+int file_block_state::ensure_all(int fd)
+{
+    // Fetch the missing blocks in parallel, the same way download_blob_to_file does for a whole blob.
+    static const size_t max_downloaders = 8;
+    size_t block_count = m_present.size();
+    std::atomic<size_t> next_block(0);
+    std::vector<std::future<int>> task_list;
+    for (size_t i = 0; i < std::min(max_downloaders, block_count); i++)
+    {
+        task_list.push_back(std::async(std::launch::async, [this, fd, block_count, &next_block]() {
+            int result = 0;
+            for (size_t idx = next_block++; (idx < block_count) && (result == 0); idx = next_block++)
+            {
+                result = ensure_block(fd, idx);
+            }
+            return result;
+        }));
+    }
+
+    int errcode = 0;
+    for (size_t i = 0; i < task_list.size(); i++)
+    {
+        int result = task_list[i].get();
+        // Report the first encountered error.
+        if ((result != 0) && (errcode == 0))
+        {
+            errcode = result;
+        }
+    }
+    return errcode;
+}
+
+// Ensures that a single block is present in the cache file.
+// If another thread is already downloading the block, wait for it rather than downloading it twice.  A block that is only queued for prefetch is
+// downloaded here, so that the reader doesn't wait behind the prefetches of other files.
+int file_block_state::ensure_block(int fd, size_t idx)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this, idx]() { return m_present[idx] || !m_in_flight[idx]; });
+        if (m_present[idx])
+        {
+            return 0;
+        }
+        m_in_flight[idx] = true;
+    }
+
+    // The handle we were given may be read-only, so we open a writable handle to the same file.  Going through /proc/self/fd means this works even if
+    // the file has been renamed or unlinked since it was opened.
+    char path_link_buffer[50];
+    snprintf(path_link_buffer, 50, "/proc/self/fd/%d", fd);
+    int write_fd = open(path_link_buffer, O_WRONLY);
+    int res;
+    if (write_fd == -1)
+    {
+        res = -errno;
+        syslog(LOG_ERR, "Failed to open cache file to write block %s.  errno = %d.\n", to_str(idx).c_str(), -res);
+    }
+    else
+    {
+        res = download_block(write_fd, idx);
+        close(write_fd);
+    }
+
+    complete_block(idx, res);
+    return res;
+}
+
+void file_block_state::complete_block(size_t idx, int result)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_in_flight[idx] = false;
+    if (result == 0)
+    {
+        m_present[idx] = true;
+        m_missing--;
+    }
+    m_cv.notify_all();
+}
+
+// Called by a read-ahead worker before downloading a block it was queued for.  Returns false if the block has since been downloaded, or claimed by a
+// reader.
+bool file_block_state::claim_queued_block(size_t idx)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queued[idx] = false;
+    if (m_present[idx] || m_in_flight[idx])
+    {
+        return false;
+    }
+    m_in_flight[idx] = true;
+    return true;
+}
+
+void file_block_state::prefetch(int fd, size_t first, size_t count)
+{
+    if (!g_read_ahead_pool)
+    {
+        return;
+    }
+
+    std::vector<size_t> to_fetch;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t idx = first; (idx < first + count) && (idx < m_present.size()); idx++)
+        {
+            if (!m_present[idx] && !m_in_flight[idx] && !m_queued[idx])
+            {
+                m_queued[idx] = true;
+                to_fetch.push_back(idx);
+            }
+        }
+    }
+    if (to_fetch.empty())
+    {
+        return;
+    }
+
+    // The prefetch may run after the handle that triggered it has been closed (and its fd number reused), so the workers get their own handle to the file.
+    char path_link_buffer[50];
+    snprintf(path_link_buffer, 50, "/proc/self/fd/%d", fd);
+    int write_fd = open(path_link_buffer, O_WRONLY);
+    if (write_fd == -1)
+    {
+        syslog(LOG_WARNING, "Failed to open cache file for prefetch.  errno = %d.\n", errno);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < to_fetch.size(); i++)
+        {
+            m_queued[to_fetch[i]] = false;
+        }
+        return;
+    }
+    std::shared_ptr<int> shared_fd(new int(write_fd), [](int *p) { close(*p); delete p; });
+
+    AZS_DEBUGLOGV("Prefetching %s blocks starting at block %s.\n", to_str(to_fetch.size()).c_str(), to_str(to_fetch[0]).c_str());
+    std::shared_ptr<file_block_state> self = shared_from_this();
+    for (size_t i = 0; i < to_fetch.size(); i++)
+    {
+        size_t idx = to_fetch[i];
+        g_read_ahead_pool->submit([self, shared_fd, idx]() {
+            if (self->claim_queued_block(idx))
+            {
+                self->complete_block(idx, self->download_block(*shared_fd, idx));
+            }
+        });
+    }
+}
+
+// Downloads a single block, and writes it into the cache file through write_fd.
+int file_block_state::download_block(int write_fd, size_t idx)
+{
+    std::string blob;
+    std::string etag;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        blob = m_blob;
+        etag = m_etag;
+    }
+    unsigned long long offset = idx * m_block_size;
+    unsigned long long length = std::min(m_block_size, m_size - offset);
+
+    AZS_DEBUGLOGV("Downloading block %s of blob %s into the file cache.\n", to_str(idx).c_str(), blob.c_str());
+    std::ostringstream os;
+    errno = 0;
+    chunk_property props = azure_blob_client_wrapper->download_chunk_to_stream(str_options.containerName, blob, offset, length, os);
+    if (errno != 0)
+    {
+        int storage_errno = errno;
+        syslog(LOG_ERR, "Failed to download block %s of blob %s into cache.  storage errno = %d.\n", to_str(idx).c_str(), blob.c_str(), storage_errno);
+        if (storage_errno == 416)
+        {
+            // The blob has been replaced by a smaller one since it was opened - ask the user to retry.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stale = true;
+            return -EAGAIN;
+        }
+        return 0 - map_errno(storage_errno);
+    }
+    if (props.etag != etag)
+    {
+        // The blob has been modified since it was opened, so this block does not belong with the blocks we already have.  Ask the user to retry;
+        // the next open() will refresh the file.
+        syslog(LOG_WARNING, "Blob %s changed on the service while it was being read; etag was %s, is now %s.\n", blob.c_str(), etag.c_str(), props.etag.c_str());
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stale = true;
+        return -EAGAIN;
+    }
+
+    const std::string data = os.str();
+    if (data.size() != length)
+    {
+        syslog(LOG_ERR, "Downloaded %s bytes for block %s of blob %s, expected %s.\n", to_str(data.size()).c_str(), to_str(idx).c_str(), blob.c_str(), to_str(length).c_str());
+        return -EIO;
+    }
+
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t res = pwrite(write_fd, data.data() + written, data.size() - written, offset + written);
+        if (res == -1)
+        {
+            int write_errno = errno;
+            syslog(LOG_ERR, "Failed to write block %s of blob %s into cache.  errno = %d.\n", to_str(idx).c_str(), blob.c_str(), write_errno);
+            return -write_errno;
+        }
+        written += res;
+    }
+    return 0;
+}
+
+std::shared_ptr<file_block_state> create_block_cache_file(const std::string& path, time_t& last_modified, std::string& etag)
+{
+    std::string mntPathString = prepend_mnt_path_string(path);
+
+    errno = 0;
+    blob_property props = azure_blob_client_wrapper->get_blob_property(str_options.containerName, path.substr(1));
+    if (errno != 0)
+    {
+        errno = map_errno(errno);
+        return nullptr;
+    }
+    if (!props.valid())
+    {
+        errno = ENOENT;
+        return nullptr;
+    }
+
+    // Create the file at its full size; the parts that haven't been downloaded yet are holes, and take no space on disk.
+    int fd = open(mntPathString.c_str(), O_WRONLY | O_CREAT | O_TRUNC, default_permission);
+    if (fd == -1)
+    {
+        return nullptr;
+    }
+    if (ftruncate(fd, props.size) == -1)
+    {
+        int truncate_errno = errno;
+        close(fd);
+        errno = truncate_errno;
+        return nullptr;
+    }
+    close(fd);
+
+    last_modified = props.last_modified;
+    etag = props.etag;
+    errno = 0;
+    if (props.size == 0)
+    {
+        // Nothing to download.
+        return nullptr;
+    }
+
+    auto state = std::make_shared<file_block_state>(path.substr(1), props.size, props.etag, str_options.block_size);
+    file_block_map::get_instance()->add_state(path, state);
+    return state;
+}
+
+void read_ahead(struct fhwrapper *fhwrap, off_t offset, size_t size)
+{
+    std::shared_ptr<file_block_state> blocks = fhwrap->blocks;
+    if (!blocks || !g_read_ahead_pool || (size == 0) || (str_options.max_read_ahead_blocks == 0))
+    {
+        return;
+    }
+
+    size_t first = 0;
+    size_t count = 0;
+    {
+        read_ahead_state &state = fhwrap->read_ahead;
+        std::lock_guard<std::mutex> lock(state.mutex);
+        size_t current_block = offset / blocks->block_size();
+        size_t end_block = (offset + size - 1) / blocks->block_size();
+
+        // The kernel may have several reads on the same handle in flight at once, and they can arrive slightly out of order.
+        // So rather than requiring the exact next offset, treat any read that starts in the previous block or the one after it as sequential.
+        bool sequential = (offset == state.next_offset) || ((current_block >= state.last_block) && (current_block <= state.last_block + 1));
+        if (sequential)
+        {
+            if ((state.window == 0) || (current_block != state.last_block))
+            {
+                state.window = std::min(std::max(state.window * 2, (size_t)1), str_options.max_read_ahead_blocks);
+            }
+        }
+        else
+        {
+            state.window /= 2;
+            state.prefetch_end = 0;
+        }
+        state.next_offset = offset + size;
+        state.last_block = end_block;
+
+        if (state.window > 0)
+        {
+            first = std::max(end_block + 1, state.prefetch_end);
+            size_t end = end_block + 1 + state.window;
+            if (end > first)
+            {
+                count = end - first;
+                state.prefetch_end = end;
+            }
+        }
+    }
+
+    if (count > 0)
+    {
+        blocks->prefetch(fhwrap->fh, first, count);
+    }
+}
@@ -0,0 +1,453 @@
+#include "blobfuse.h"
+#include <fcntl.h>
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <unordered_map>
+
+// The index is a header, one record per file in the cache, and a trailer holding the number of records.  A file that was cut short by a crash has no
+// trailer, and is ignored.
+static const char INDEX_MAGIC[8] = {'B', 'F', 'C', 'I', 'D', 'X', '0', '2'};
+static const char INDEX_TRAILER[8] = {'B', 'F', 'C', 'I', 'E', 'N', 'D', '1'};
+
+// What the index records about one file in the cache.
+struct cache_index_entry
+{
+    std::string object; // Name of the file holding it with the flat cache layout, otherwise empty.
+    std::string etag; // Empty if the file was changed locally, or its ETag was not known.
+    unsigned long long size;
+    long long mtime;
+    long long last_access;
+    unsigned long long block_size; // Zero unless the file was only partially downloaded.
+    std::vector<bool> present;     // Which blocks are in the file, if it was only partially downloaded.
+};
+
+static std::string cache_index_path()
+{
+    return str_options.tmpPath + "/cache.index";
+}
+
+static void append_u64(std::string& buffer, unsigned long long value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        buffer.push_back((char)((value >> (8 * i)) & 0xff));
+    }
+}
+
+static void append_string(std::string& buffer, const std::string& value)
+{
+    append_u64(buffer, value.size());
+    buffer.append(value);
+}
+
+// Reads fields from the index, tracking whether it ran past the end.
+class index_reader
+{
+public:
+    index_reader(const std::string& data) : m_data(data), m_pos(0), m_ok(true)
+    {
+    }
+
+    bool ok() const { return m_ok; }
+    bool at_end() const { return m_pos == m_data.size(); }
+
+    unsigned long long read_u64()
+    {
+        if (!m_ok || (m_data.size() - m_pos < 8))
+        {
+            m_ok = false;
+            return 0;
+        }
+        unsigned long long value = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            value |= ((unsigned long long)(unsigned char)m_data[m_pos + i]) << (8 * i);
+        }
+        m_pos += 8;
+        return value;
+    }
+
+    std::string read_bytes(unsigned long long size)
+    {
+        if (!m_ok || (m_data.size() - m_pos < size))
+        {
+            m_ok = false;
+            return std::string();
+        }
+        std::string value = m_data.substr(m_pos, size);
+        m_pos += size;
+        return value;
+    }
+
+    std::string read_string()
+    {
+        return read_bytes(read_u64());
+    }
+
+private:
+    const std::string& m_data;
+    size_t m_pos;
+    bool m_ok;
+};
+
+// Parses the index into entries keyed by path.  Returns false if the index is missing or damaged, in which case none of it is used.
+static bool read_cache_index(std::unordered_map<std::string, cache_index_entry>& entries)
+{
+    std::ifstream file(cache_index_path(), std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    index_reader reader(data);
+    if (reader.read_bytes(sizeof(INDEX_MAGIC)) != std::string(INDEX_MAGIC, sizeof(INDEX_MAGIC)))
+    {
+        return false;
+    }
+    unsigned long long count = 0;
+    while (reader.ok())
+    {
+        std::string tag = reader.read_bytes(1);
+        if (tag == "E")
+        {
+            break;
+        }
+        if (tag != "F")
+        {
+            return false;
+        }
+        std::string path = reader.read_string();
+        cache_index_entry entry;
+        entry.object = reader.read_string();
+        entry.etag = reader.read_string();
+        entry.size = reader.read_u64();
+        entry.mtime = (long long)reader.read_u64();
+        entry.last_access = (long long)reader.read_u64();
+        entry.block_size = reader.read_u64();
+        unsigned long long block_count = reader.read_u64();
+        std::string bits = reader.read_bytes((block_count + 7) / 8);
+        if (!reader.ok())
+        {
+            return false;
+        }
+        entry.present.resize(block_count);
+        for (unsigned long long idx = 0; idx < block_count; idx++)
+        {
+            entry.present[idx] = (bits[idx / 8] >> (idx % 8)) & 1;
+        }
+        entries[path] = entry;
+        count++;
+    }
+    if ((reader.read_bytes(sizeof(INDEX_TRAILER)) != std::string(INDEX_TRAILER, sizeof(INDEX_TRAILER))) || (reader.read_u64() != count) || !reader.at_end())
+    {
+        return false;
+    }
+    return true;
+}
+
+void save_cache_index()
+{
+    // Saved both by the GC thread and at unmount.
+    static std::mutex save_mutex;
+    std::lock_guard<std::mutex> lock(save_mutex);
+
+    std::vector<cached_file> files = g_gc_cache.get_cached_files();
+    std::string buffer(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    unsigned long long count = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        struct stat buf;
+        if (stat(prepend_mnt_path_string(files[i].path).c_str(), &buf) != 0)
+        {
+            continue;
+        }
+        std::string etag;
+        file_etag_map::get_instance()->get_etag(files[i].path, etag);
+        std::shared_ptr<file_block_state> blocks = file_block_map::get_instance()->get_state(files[i].path);
+        std::vector<bool> present;
+        unsigned long long block_size = 0;
+        if (blocks && !blocks->is_complete())
+        {
+            present = blocks->get_present();
+            block_size = blocks->block_size();
+        }
+
+        buffer.push_back('F');
+        append_string(buffer, files[i].path);
+        append_string(buffer, file_cache_map::get_instance()->get_object(files[i].path));
+        append_string(buffer, etag);
+        append_u64(buffer, buf.st_size);
+        append_u64(buffer, (unsigned long long)buf.st_mtime);
+        append_u64(buffer, (unsigned long long)files[i].last_access);
+        append_u64(buffer, block_size);
+        append_u64(buffer, present.size());
+        std::string bits((present.size() + 7) / 8, '\0');
+        for (size_t idx = 0; idx < present.size(); idx++)
+        {
+            if (present[idx])
+            {
+                bits[idx / 8] |= (char)(1 << (idx % 8));
+            }
+        }
+        buffer.append(bits);
+        count++;
+    }
+    buffer.push_back('E');
+    buffer.append(INDEX_TRAILER, sizeof(INDEX_TRAILER));
+    append_u64(buffer, count);
+
+    // Replace the index atomically, so that a crash leaves either the old index or the new one.
+    std::string index_file = cache_index_path();
+    std::string tmp_file = index_file + ".tmp";
+    int result = 0;
+    int fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+        result = errno;
+    }
+    else
+    {
+        result = write_all(fd, buffer.data(), buffer.size());
+        if ((result == 0) && (fsync(fd) != 0))
+        {
+            result = errno;
+        }
+        close(fd);
+        if ((result == 0) && (rename(tmp_file.c_str(), index_file.c_str()) != 0))
+        {
+            result = errno;
+        }
+    }
+    if (result != 0)
+    {
+        syslog(LOG_ERR, "Failed to save the file cache index to %s.  errno = %d.\n", index_file.c_str(), result);
+        unlink(tmp_file.c_str());
+        return;
+    }
+    AZS_DEBUGLOGV("Saved %s files to the file cache index.\n", to_str(count).c_str());
+}
+
+// Decides what to do with one file found in the cache at mount.  Returns false if the file was deleted.
+static bool restore_cached_file(const std::string& path, const std::unordered_map<std::string, cache_index_entry>& entries, cached_file& file)
+{
+    std::string mntPathString = prepend_mnt_path_string(path);
+    struct stat buf;
+    if (stat(mntPathString.c_str(), &buf) != 0)
+    {
+        return false;
+    }
+    file.path = path;
+    file.last_access = buf.st_mtime;
+
+    auto iter = entries.find(path);
+    if ((iter != entries.end()) && (iter->second.size == (unsigned long long)buf.st_size) && (iter->second.mtime == (long long)buf.st_mtime))
+    {
+        const cache_index_entry& entry = iter->second;
+        file.last_access = entry.last_access;
+        if (entry.block_size != 0)
+        {
+            // A partially downloaded file can only be used if it is read the same way it was written.
+            if (!str_options.use_block_cache || (entry.block_size != str_options.block_size) || entry.etag.empty())
+            {
+                unlink(mntPathString.c_str());
+                return false;
+            }
+            std::shared_ptr<file_block_state> blocks = std::make_shared<file_block_state>(path.substr(1), entry.size, entry.etag, entry.block_size);
+            blocks->set_present(entry.present);
+            file_block_map::get_instance()->add_state(path, blocks);
+        }
+        if (!entry.etag.empty())
+        {
+            file_etag_map::get_instance()->set_etag(path, entry.etag);
+        }
+    }
+    else if (str_options.use_flat_cache)
+    {
+        // The file was changed after the index was saved.
+        unlink(mntPathString.c_str());
+        return false;
+    }
+    else
+    {
+        // Without an index entry there is no telling which parts of a sparse file were downloaded.
+        int fd = open(mntPathString.c_str(), O_RDONLY);
+        off_t hole = (fd == -1) ? -1 : lseek(fd, 0, SEEK_HOLE);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        if ((hole == -1) || (hole < buf.st_size))
+        {
+            AZS_DEBUGLOGV("Discarding %s from the file cache, because it may be a partial download.\n", path.c_str());
+            unlink(mntPathString.c_str());
+            return false;
+        }
+    }
+
+    file_etag_map::get_instance()->add_unverified(path);
+    return true;
+}
+
+// Walks a directory of the cache, restoring the files in it.
+static void scan_cache_directory(const std::string& path, const std::unordered_map<std::string, cache_index_entry>& entries, std::vector<cached_file>& files)
+{
+    DIR *dir = opendir(prepend_mnt_path_string(path).c_str());
+    if (dir == NULL)
+    {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        std::string name(entry->d_name);
+        if ((name == ".") || (name == ".."))
+        {
+            continue;
+        }
+        std::string child = path + "/" + name;
+        if (entry->d_type == DT_DIR)
+        {
+            scan_cache_directory(child, entries, files);
+        }
+        else if (entry->d_type == DT_REG)
+        {
+            cached_file file;
+            if (restore_cached_file(child, entries, file))
+            {
+                files.push_back(file);
+            }
+        }
+    }
+    closedir(dir);
+}
+
+// Hands the restored files to the GC, oldest first, so that the LRU list and the GC heap end up in the order the files were used.
+static void restore_cached_files(std::vector<cached_file>& files)
+{
+    std::sort(files.begin(), files.end(), [](const cached_file& a, const cached_file& b) { return a.last_access < b.last_access; });
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        g_gc_cache.add_cached_file(files[i].path, files[i].last_access);
+    }
+    syslog(LOG_INFO, "Restored %s files to the file cache from an earlier mount.\n", to_str(files.size()).c_str());
+}
+
+// With the flat cache layout, only the index knows which path each file holds, so the files are restored from the index, and the rest deleted.
+static void restore_flat_cache(const std::unordered_map<std::string, cache_index_entry>& entries, std::vector<cached_file>& files)
+{
+    for (auto iter = entries.begin(); iter != entries.end(); ++iter)
+    {
+        const std::string& object = iter->second.object;
+        if ((object.size() < 2) || (object.find('/') != std::string::npos) || (object[0] == '.'))
+        {
+            continue;
+        }
+        if (!file_cache_map::get_instance()->restore_path(iter->first, object))
+        {
+            continue;
+        }
+        cached_file file;
+        if (restore_cached_file(iter->first, entries, file))
+        {
+            files.push_back(file);
+        }
+        else
+        {
+            file_cache_map::get_instance()->remove_path(iter->first);
+        }
+    }
+
+    std::string objects_dir = str_options.tmpPath + "/objects";
+    for (int i = 0; i < FLAT_CACHE_FANOUT; i++)
+    {
+        char name[3];
+        snprintf(name, sizeof(name), "%02x", i);
+        std::string dir_path = objects_dir + "/" + name;
+        DIR *dir = opendir(dir_path.c_str());
+        if (dir == NULL)
+        {
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if ((entry->d_type == DT_REG) && file_cache_map::get_instance()->get_path(entry->d_name).empty())
+            {
+                unlinkat(dirfd(dir), entry->d_name, 0);
+            }
+        }
+        closedir(dir);
+    }
+}
+
+void load_cache_index()
+{
+    std::unordered_map<std::string, cache_index_entry> entries;
+    if (!read_cache_index(entries))
+    {
+        entries.clear();
+        syslog(LOG_INFO, "No usable file cache index in %s; rebuilding it from the cache directory.\n", str_options.tmpPath.c_str());
+    }
+
+    std::vector<cached_file> files;
+    if (str_options.use_flat_cache)
+    {
+        restore_flat_cache(entries, files);
+        restore_cached_files(files);
+        return;
+    }
+
+    // The top level of the cache is split between threads, since the walk is dominated by waiting on the file system.
+    std::vector<std::string> top_dirs;
+    DIR *dir = opendir(prepend_mnt_path_string("").c_str());
+    if (dir == NULL)
+    {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        std::string name(entry->d_name);
+        if ((name == ".") || (name == ".."))
+        {
+            continue;
+        }
+        if (entry->d_type == DT_DIR)
+        {
+            top_dirs.push_back("/" + name);
+        }
+        else if (entry->d_type == DT_REG)
+        {
+            cached_file file;
+            if (restore_cached_file("/" + name, entries, file))
+            {
+                files.push_back(file);
+            }
+        }
+    }
+    closedir(dir);
+
+    std::atomic<size_t> next(0);
+    std::vector<std::future<std::vector<cached_file>>> task_list;
+    for (size_t i = 0; i < std::min((size_t)CACHE_INDEX_SCAN_THREAD_COUNT, top_dirs.size()); i++)
+    {
+        task_list.push_back(std::async(std::launch::async, [&]() {
+            std::vector<cached_file> found;
+            for (size_t idx = next++; idx < top_dirs.size(); idx = next++)
+            {
+                scan_cache_directory(top_dirs[idx], entries, found);
+            }
+            return found;
+        }));
+    }
+    for (size_t i = 0; i < task_list.size(); i++)
+    {
+        std::vector<cached_file> found = task_list[i].get();
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    restore_cached_files(files);
+}
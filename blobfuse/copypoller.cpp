@@ -0,0 +1,211 @@
+#include "blobfuse.h"
+#include <chrono>
+
+copy_poller* copy_poller::get_instance()
+{
+    if(nullptr == s_instance.get())
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if(nullptr == s_instance.get())
+        {
+            s_instance.reset(new copy_poller());
+        }
+    }
+    return s_instance.get();
+}
+
+std::shared_ptr<copy_poller> copy_poller::s_instance;
+std::mutex copy_poller::s_mutex;
+
+static long long steady_now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int copy_poller::wait(const std::string& blob, std::string& status, std::string& etag)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // A copy that is done may not have been removed by its waiters yet; a new copy to the same blob is tracked on its own.
+    std::shared_ptr<pending_copy>& entry = m_pending[blob];
+    if (!entry || entry->done)
+    {
+        entry = std::make_shared<pending_copy>();
+        entry->error = 0;
+        entry->error_count = 0;
+        entry->done = false;
+        entry->interval = COPY_POLL_INITIAL_MS;
+        entry->next_poll = steady_now_ms() + COPY_POLL_INITIAL_MS;
+    }
+    std::shared_ptr<pending_copy> copy = entry;
+    if (!m_running)
+    {
+        m_running = true;
+        std::thread(std::bind(&copy_poller::run, this)).detach();
+    }
+    m_poll_cv.notify_one();
+
+    m_done_cv.wait(lock, [&copy]() { return copy->done; });
+    auto iter = m_pending.find(blob);
+    if ((iter != m_pending.end()) && (iter->second == copy))
+    {
+        m_pending.erase(iter);
+    }
+    status = copy->status;
+    etag = copy->etag;
+    return copy->error;
+}
+
+void copy_poller::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        // Group the copies that are due by the directory they are copied into.
+        long long now = steady_now_ms();
+        long long next_poll = 0;
+        bool any_pending = false;
+        std::map<std::string, std::vector<std::pair<std::string, std::shared_ptr<pending_copy>>>> due;
+        for (auto iter = m_pending.begin(); iter != m_pending.end(); ++iter)
+        {
+            if (iter->second->done)
+            {
+                continue;
+            }
+            any_pending = true;
+            if (iter->second->next_poll <= now)
+            {
+                size_t slash = iter->first.rfind('/');
+                std::string prefix = (slash == std::string::npos) ? std::string() : iter->first.substr(0, slash + 1);
+                due[prefix].push_back(std::make_pair(iter->first, iter->second));
+            }
+            else if ((next_poll == 0) || (iter->second->next_poll < next_poll))
+            {
+                next_poll = iter->second->next_poll;
+            }
+        }
+        if (!any_pending)
+        {
+            m_running = false;
+            return;
+        }
+        if (due.empty())
+        {
+            m_poll_cv.wait_for(lock, std::chrono::milliseconds(next_poll - now));
+            continue;
+        }
+
+        lock.unlock();
+        std::vector<poll_result> results;
+        for (auto iter = due.begin(); iter != due.end(); ++iter)
+        {
+            if (iter->second.size() >= COPY_POLL_LIST_THRESHOLD)
+            {
+                poll_directory(iter->first, iter->second, results);
+            }
+            else
+            {
+                for (size_t i = 0; i < iter->second.size(); i++)
+                {
+                    poll_blob(iter->second[i].first, iter->second[i].second, results);
+                }
+            }
+        }
+        lock.lock();
+
+        now = steady_now_ms();
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            pending_copy& copy = *results[i].copy;
+            if ((results[i].error == 0) && (results[i].status.compare(0, 7, "pending") != 0))
+            {
+                copy.status = results[i].status;
+                copy.etag = results[i].etag;
+                copy.done = true;
+                continue;
+            }
+            if (results[i].error != 0)
+            {
+                copy.error_count++;
+                // The destination blob is gone, so the copy was aborted or overwritten.
+                if ((results[i].error == 404) || (copy.error_count >= COPY_POLL_MAX_ERRORS))
+                {
+                    copy.error = results[i].error;
+                    copy.done = true;
+                    continue;
+                }
+            }
+            else
+            {
+                copy.error_count = 0;
+            }
+            copy.interval = std::min(copy.interval * 2, (long long)COPY_POLL_MAX_MS);
+            copy.next_poll = now + copy.interval;
+        }
+        m_done_cv.notify_all();
+    }
+}
+
+// Lists the directory until all of the copies into it have been seen.  The listing is in name order, so it stops at the page past the last of them.
+// Copies the listing doesn't find are polled with HEAD requests.
+void copy_poller::poll_directory(const std::string& prefix, const std::vector<std::pair<std::string, std::shared_ptr<pending_copy>>>& copies,
+    std::vector<poll_result>& results)
+{
+    // copies is in name order, as it was built from m_pending.
+    std::map<std::string, std::shared_ptr<pending_copy>> remaining(copies.begin(), copies.end());
+    const std::string last = copies.back().first;
+    std::string continuation;
+    do
+    {
+        errno = 0;
+        list_blobs_hierarchical_response response = azure_blob_client_wrapper->list_blobs_hierarchical(str_options.containerName, "/", continuation, prefix);
+        if (errno != 0)
+        {
+            syslog(LOG_WARNING, "Failed to list %s to poll %s pending copies.  errno = %d.\n", prefix.c_str(), to_str(copies.size()).c_str(), errno);
+            break;
+        }
+        for (size_t i = 0; i < response.blobs.size(); i++)
+        {
+            auto iter = remaining.find(response.blobs[i].name);
+            if ((iter != remaining.end()) && !response.blobs[i].is_directory)
+            {
+                poll_result result;
+                result.copy = iter->second;
+                result.status = response.blobs[i].copy_status;
+                result.etag = response.blobs[i].etag;
+                result.error = 0;
+                results.push_back(result);
+                remaining.erase(iter);
+            }
+        }
+        continuation = response.next_marker;
+        if (!response.blobs.empty() && (response.blobs.back().name >= last))
+        {
+            break;
+        }
+    } while (!remaining.empty() && !continuation.empty());
+
+    for (auto iter = remaining.begin(); iter != remaining.end(); ++iter)
+    {
+        poll_blob(iter->first, iter->second, results);
+    }
+}
+
+void copy_poller::poll_blob(const std::string& blob, std::shared_ptr<pending_copy> copy, std::vector<poll_result>& results)
+{
+    // The attribute cache may hold the properties from an earlier poll, so they are always fetched from the service.
+    errno = 0;
+    blob_property props = azure_blob_client_wrapper->get_blob_property(str_options.containerName, blob, true);
+    poll_result result;
+    result.copy = copy;
+    result.error = errno;
+    if ((result.error == 0) && !props.valid())
+    {
+        result.error = 404;
+    }
+    if (result.error == 0)
+    {
+        result.status = props.copy_status;
+        result.etag = props.etag;
+    }
+    results.push_back(result);
+}
@@ -12,8 +12,9 @@ int azs_mkdir(const char *path, mode_t)
 
     std::vector<std::pair<std::string, std::string>> metadata;
     metadata.push_back(std::make_pair("hdi_isfolder", "true"));
+    blob_property props(false);
     errno = 0;
-    azure_blob_client_wrapper->upload_block_blob_from_stream(str_options.containerName, pathstr.substr(1), emptyDataStream, metadata);
+    azure_blob_client_wrapper->upload_block_blob_from_stream(str_options.containerName, pathstr.substr(1), emptyDataStream, metadata, props);
     if (errno != 0)
     {
         int storage_errno = errno;
@@ -24,170 +25,282 @@ int azs_mkdir(const char *path, mode_t)
     {
         syslog(LOG_INFO, "Successfully uploaded zero-length directory marker for path %s to blob %s. ", path, pathstr.c_str()+1);
     }
+    missing_path_map::get_instance()->remove_path(pathstr);
+    namespace_tree::get_instance()->invalidate(pathstr);
     return 0;
 }
 
-/**
- * Read the contents of a directory.  For each entry to add, call the filler function with the input buffer,
- * the name of the entry, and additional data about the entry.  TODO: Keep the data (somehow) for latter getattr calls.
- *
- * @param  path   Path to the directory to read.
- * @param  buf    Buffer to pass into the filler function.  Not otherwise used in this function.
- * @param  filler Function to call to add directories and files as they are discovered.
- * @param  offset Not used
- * @param  fi     File info about the directory to be read.
- * @param  flags  Not used.  TODO: Consider prefetching on FUSE_READDIR_PLUS.
- * @return        TODO: error codes.
- */
-int azs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t, struct fuse_file_info *)
+// Adds an entry to the current page of the directory stream.
+static void add_directory_entry(struct dirhandle *dh, const std::string& name, bool is_directory, off_t size)
 {
-    AZS_DEBUGLOGV("azs_readdir called with path = %s\n", path);
-    std::string pathStr(path);
-    if (pathStr.size() > 1)
+    struct stat stbuf = {};
+    stbuf.st_uid = dh->uid;
+    stbuf.st_gid = dh->gid;
+    if (is_directory)
     {
-        pathStr.push_back('/');
+        stbuf.st_mode = S_IFDIR | default_permission;
+        stbuf.st_nlink = 2;
+        stbuf.st_size = 4096;
     }
+    else
+    {
+        stbuf.st_mode = S_IFREG | default_permission; // Regular file (not a directory)
+        stbuf.st_nlink = 1;
+        stbuf.st_size = size;
+    }
+    dh->entries.push_back(std::make_pair(name, stbuf));
+}
 
-    std::vector<std::string> local_list_results;
-
-    // Scan for any files that exist in the local cache.
-    // It is possible that there are files in the cache that aren't on the service - if a file has been opened but not yet uplaoded, for example.
+// Scan for any files that exist in the local cache.
+// It is possible that there are files in the cache that aren't on the service - if a file has been opened but not yet uplaoded, for example.
+static void add_local_entries(const std::string& pathStr, struct dirhandle *dh)
+{
     std::string mntPathString = prepend_mnt_path_string(pathStr);
-    DIR *dir_stream = opendir(mntPathString.c_str());
-    if (dir_stream != NULL)
+    if (str_options.use_flat_cache)
     {
-        AZS_DEBUGLOGV("Reading contents of local cache directory %s.\n", mntPathString.c_str());
-        struct dirent* dir_ent = readdir(dir_stream);
-        while (dir_ent != NULL)
+        // There is no directory to read with the flat cache layout; the map knows which files are in it.
+        std::vector<std::pair<std::string, bool>> children = file_cache_map::get_instance()->list_children(pathStr);
+        for (size_t i = 0; i < children.size(); i++)
         {
-            if (dir_ent->d_name[0] != '.')
+            off_t size = 0;
+            if (!children[i].second)
             {
-                if (dir_ent->d_type == DT_DIR)
-                {
-                    struct stat stbuf;
-                    stbuf.st_mode = S_IFDIR | default_permission;
-                    stbuf.st_uid = fuse_get_context()->uid;
-                    stbuf.st_gid = fuse_get_context()->gid;
-                    stbuf.st_nlink = 2;
-                    stbuf.st_size = 4096;
-                    filler(buf, dir_ent->d_name, &stbuf, 0);
-                    AZS_DEBUGLOGV("Subdirectory %s found in local cache directory %s during readdir operation.\n", dir_ent->d_name, mntPathString.c_str());
-                }
-                else
+                struct stat buffer;
+                if (stat(prepend_mnt_path_string(pathStr + children[i].first).c_str(), &buffer) != 0)
                 {
-                    struct stat buffer;
-                    stat((mntPathString + dir_ent->d_name).c_str(), &buffer);
-
-                    struct stat stbuf;
-                    stbuf.st_mode = S_IFREG | default_permission; // Regular file (not a directory)
-                    stbuf.st_uid = fuse_get_context()->uid;
-                    stbuf.st_gid = fuse_get_context()->gid;
-                    stbuf.st_nlink = 1;
-                    stbuf.st_size = buffer.st_size;
-                    filler(buf, dir_ent->d_name, &stbuf, 0); // TODO: Add stat information.  Consider FUSE_FILL_DIR_PLUS.
-                    AZS_DEBUGLOGV("File %s found in local cache directory %s during readdir operation.\n", dir_ent->d_name, mntPathString.c_str());
+                    continue;
                 }
-
-                std::string dir_str(dir_ent->d_name);
-                local_list_results.push_back(dir_str);
+                size = buffer.st_size;
             }
-
-            dir_ent = readdir(dir_stream);
+            add_directory_entry(dh, children[i].first, children[i].second, size);
+            dh->seen.insert(children[i].first);
         }
-        closedir(dir_stream);
+        return;
     }
-    else
+
+    DIR *dir_stream = opendir(mntPathString.c_str());
+    if (dir_stream == NULL)
     {
-        AZS_DEBUGLOGV("Directory %s not found in file cache during readdir operation for %s.\n", mntPathString.c_str(), path);
+        AZS_DEBUGLOGV("Directory %s not found in file cache during readdir operation.\n", mntPathString.c_str());
+        return;
     }
+    AZS_DEBUGLOGV("Reading contents of local cache directory %s.\n", mntPathString.c_str());
+    struct dirent* dir_ent = readdir(dir_stream);
+    while (dir_ent != NULL)
+    {
+        if (dir_ent->d_name[0] != '.')
+        {
+            if (dir_ent->d_type == DT_DIR)
+            {
+                add_directory_entry(dh, dir_ent->d_name, true, 0);
+                AZS_DEBUGLOGV("Subdirectory %s found in local cache directory %s during readdir operation.\n", dir_ent->d_name, mntPathString.c_str());
+            }
+            else
+            {
+                struct stat buffer;
+                stat((mntPathString + dir_ent->d_name).c_str(), &buffer);
+                add_directory_entry(dh, dir_ent->d_name, false, buffer.st_size);
+                AZS_DEBUGLOGV("File %s found in local cache directory %s during readdir operation.\n", dir_ent->d_name, mntPathString.c_str());
+            }
+            dh->seen.insert(dir_ent->d_name);
+        }
 
-    errno = 0;
-    std::vector<std::pair<std::vector<list_blobs_hierarchical_item>, bool>> listResults = list_all_blobs_hierarchical(str_options.containerName, "/", pathStr.substr(1));
-    if (errno != 0)
+        dir_ent = readdir(dir_stream);
+    }
+    closedir(dir_stream);
+}
+
+// Adds a child found on the service to the current page, unless it was already listed.
+static void add_service_entry(struct dirhandle *dh, const std::string& name, bool is_directory, off_t size)
+{
+    // Any files that exist both on the service and in the local cache will be in both lists, we need to de-dup them.
+    if (dh->seen.contains(name))
     {
-        int storage_errno = errno;
-        syslog(LOG_ERR, "Failed to list blobs under directory %s on the service during readdir operation.  errno = %d.\n", mntPathString.c_str(), storage_errno);
-        return 0 - map_errno(storage_errno);
+        AZS_DEBUGLOGV("Skipping adding blob %s to readdir results because it was already added.\n", name.c_str());
+        return;
     }
-    else
+    if (is_directory)
+    {
+        // Avoid duplicate directories - this avoids duplicate entries of legacy WASB and HNS directories
+        dh->seen.insert(name);
+        add_directory_entry(dh, name, true, 0);
+    }
+    else if (name != former_directory_signifier)
     {
-        AZS_DEBUGLOGV("Reading blobs of directory %s on the service.  Total blob lists found = %s.\n", pathStr.c_str()+1, to_str(listResults.size()).c_str());
+        add_directory_entry(dh, name, false, size);
     }
+}
+
+// Starts the directory stream over: ".", "..", the files in the local cache, and then the listing on the service.  If the namespace tree holds a
+// listing of the directory, the whole stream comes from it.
+static void start_directory_stream(const std::string& pathStr, struct dirhandle *dh)
+{
+    dh->start = 0;
+    dh->entries.clear();
+    dh->started = true;
+    dh->done = false;
+    dh->continuation.clear();
+    dh->prior.clear();
+    dh->seen.clear();
+    dh->children.clear();
 
     // Fill the blobfuse current and parent directories
-    struct stat stcurrentbuf, stparentbuf;
+    struct stat stcurrentbuf = {}, stparentbuf = {};
     stcurrentbuf.st_mode = S_IFDIR | default_permission;
     stparentbuf.st_mode = S_IFDIR;
+    dh->entries.push_back(std::make_pair(std::string("."), stcurrentbuf));
+    dh->entries.push_back(std::make_pair(std::string(".."), stparentbuf));
 
-    filler(buf, ".", &stcurrentbuf, 0);
-    filler(buf, "..", &stparentbuf, 0);
+    add_local_entries(pathStr, dh);
 
-    // Enumerating segments of list_blobs response
-    for (size_t result_lists_index = 0; result_lists_index < listResults.size(); result_lists_index++)
+    std::string dirStr = (pathStr.size() > 1) ? pathStr.substr(0, pathStr.size() - 1) : pathStr;
+    listing_children children;
+    if (namespace_tree::get_instance()->list(dirStr, children))
     {
-        // Check to see if the first list_blobs__hierarchical_item can be skipped to avoid duplication
-        int start = listResults[result_lists_index].second ? 1 : 0;
-        for (size_t i = start; i < listResults[result_lists_index].first.size(); i++)
+        AZS_DEBUGLOGV("Using the cached listing of directory %s during readdir operation.  Total children = %s.\n", pathStr.c_str()+1, to_str(children.size()).c_str());
+        for (auto iter = children.begin(); iter != children.end(); ++iter)
         {
-            int fillerResult;
-            // We need to parse out just the trailing part of the path name.
-            int len = listResults[result_lists_index].first[i].name.size();
-            if (len > 0)
-            {
-                std::string prev_token_str;
-                if (listResults[result_lists_index].first[i].name.back() == '/')
-                {
-                    prev_token_str = listResults[result_lists_index].first[i].name.substr(pathStr.size() - 1, listResults[result_lists_index].first[i].name.size() - pathStr.size());
-                }
-                else
-                {
-                    prev_token_str = listResults[result_lists_index].first[i].name.substr(pathStr.size() - 1);
-                }
+            add_service_entry(dh, iter->first, iter->second.is_directory, iter->second.size);
+        }
+        dh->done = true;
+    }
+    dh->listing = namespace_tree::get_instance()->begin_listing();
+}
 
-                // Any files that exist both on the service and in the local cache will be in both lists, we need to de-dup them.
-                // TODO: order or hash the list to improve perf
-                if (std::find(local_list_results.begin(), local_list_results.end(), prev_token_str) == local_list_results.end())
-                {
-                    if (!listResults[result_lists_index].first[i].is_directory && !is_directory_blob(listResults[result_lists_index].first[i].content_length, listResults[result_lists_index].first[i].metadata))
-                    {
-                        if ((prev_token_str.size() > 0) && (strcmp(prev_token_str.c_str(), former_directory_signifier.c_str()) != 0))
-                        {
-                            struct stat stbuf;
-                            stbuf.st_mode = S_IFREG | default_permission; // Regular file (not a directory)
-                            stbuf.st_uid = fuse_get_context()->uid;
-                            stbuf.st_gid = fuse_get_context()->gid;
-                            stbuf.st_nlink = 1;
-                            stbuf.st_size = listResults[result_lists_index].first[i].content_length;
-                            fillerResult = filler(buf, prev_token_str.c_str(), &stbuf, 0); // TODO: Add stat information.  Consider FUSE_FILL_DIR_PLUS.
-                            AZS_DEBUGLOGV("Blob %s found in directory %s on the service during readdir operation.  Adding to readdir list; fillerResult = %d.\n", prev_token_str.c_str(), pathStr.c_str()+1, fillerResult);
-                        }
-                    }
-                    else
-                    {
-                        if (prev_token_str.size() > 0)
-                        {
-
-                            // Avoid duplicate directories - this avoids duplicate entries of legacy WASB and HNS directories
-                   	    local_list_results.push_back(prev_token_str);
-
-                            struct stat stbuf;
-                            stbuf.st_mode = S_IFDIR | default_permission;
-                            stbuf.st_uid = fuse_get_context()->uid;
-                            stbuf.st_gid = fuse_get_context()->gid;
-                            stbuf.st_nlink = 2;
-                            fillerResult = filler(buf, prev_token_str.c_str(), &stbuf, 0);
-                            AZS_DEBUGLOGV("Blob directory %s found in directory %s on the service during readdir operation.  Adding to readdir list; fillerResult = %d.\n", prev_token_str.c_str(), pathStr.c_str()+1, fillerResult);
-                        }
-                    }
+// Replaces the current page with the next page of the listing on the service.  Returns 0 or a negative errno.
+static int read_directory_page(const std::string& pathStr, struct dirhandle *dh)
+{
+    static const int maxFailCount = 20;
+    std::string prefix = pathStr.substr(1);
+    dh->start += dh->entries.size();
+    dh->entries.clear();
 
-                }
-                else
-                {
-                    AZS_DEBUGLOGV("Skipping adding blob %s to readdir results because it was already added from the local cache.\n", prev_token_str.c_str());
-                }
+    list_blobs_hierarchical_response response;
+    int failcount = 0;
+    while (true)
+    {
+        AZS_DEBUGLOGV("About to call list_blobs_hierarchial.  Container = %s, continuation = %s, prefix = %s\n", str_options.containerName.c_str(), dh->continuation.c_str(), prefix.c_str());
+        errno = 0;
+        response = azure_blob_client_wrapper->list_blobs_hierarchical(str_options.containerName, "/", dh->continuation, prefix);
+        if (errno == 0)
+        {
+            break;
+        }
+        failcount++;
+        syslog(LOG_WARNING, "list_blobs_hierarchical failed for the %d time with errno = %d.\n", failcount, errno);
+        if (failcount >= maxFailCount)
+        {
+            int storage_errno = errno;
+            syslog(LOG_ERR, "Failed to list blobs under directory %s on the service during readdir operation.  errno = %d.\n", pathStr.c_str()+1, storage_errno);
+            return 0 - map_errno(storage_errno);
+        }
+    }
+    AZS_DEBUGLOGV("Reading a page of blobs of directory %s on the service.  Blobs found = %s, next_marker = %s.\n", pathStr.c_str()+1, to_str(response.blobs.size()).c_str(), response.next_marker.c_str());
+
+    // Check to see if the first list_blobs__hierarchical_item can be skipped to avoid duplication
+    size_t start = (!response.blobs.empty() && (response.blobs[0].name == dh->prior)) ? 1 : 0;
+    for (size_t i = start; i < response.blobs.size(); i++)
+    {
+        const list_blobs_hierarchical_item& item = response.blobs[i];
+
+        // We need to parse out just the trailing part of the path name.
+        std::string name = item.name.substr(prefix.size());
+        if (!name.empty() && (name.back() == '/'))
+        {
+            name.pop_back();
+        }
+        if (!name.empty())
+        {
+            bool is_directory = item.is_directory || is_directory_blob(item.content_length, item.metadata);
+            add_service_entry(dh, name, is_directory, item.content_length);
+        }
+    }
+    if (namespace_tree::get_instance()->enabled())
+    {
+        add_listing_items(response.blobs, start, prefix, dh->children);
+    }
+    if (!response.blobs.empty())
+    {
+        dh->prior = response.blobs.back().name;
+    }
+
+    dh->continuation = response.next_marker;
+    if (dh->continuation.empty())
+    {
+        dh->done = true;
+        std::string dirStr = (pathStr.size() > 1) ? pathStr.substr(0, pathStr.size() - 1) : pathStr;
+        namespace_tree::get_instance()->add_listing(dirStr, dh->children, dh->listing);
+        dh->children.clear();
+    }
+    return 0;
+}
+
+int azs_opendir(const char *path, struct fuse_file_info *fi)
+{
+    AZS_DEBUGLOGV("azs_opendir called with path = %s\n", path);
+    struct dirhandle *dh = new dirhandle();
+    dh->uid = fuse_get_context()->uid;
+    dh->gid = fuse_get_context()->gid;
+    fi->fh = (long unsigned int)dh;
+    return 0;
+}
+
+/**
+ * Read the contents of a directory.  For each entry to add, call the filler function with the input buffer,
+ * the name of the entry, and additional data about the entry.  The listing on the service is streamed a page at a time, and the kernel's offset says
+ * where to pick up.  With --listing-cache-timeout, the listing is kept for later readdir and getattr calls.
+ *
+ * @param  path   Path to the directory to read.
+ * @param  buf    Buffer to pass into the filler function.  Not otherwise used in this function.
+ * @param  filler Function to call to add directories and files as they are discovered.
+ * @param  offset Offset of the last entry the kernel received, or 0 to read from the beginning.
+ * @param  fi     File info about the directory to be read, containing the dirhandle.
+ * @param  flags  Not used.  TODO: Consider prefetching on FUSE_READDIR_PLUS.
+ * @return        0, or a negative errno if listing the directory on the service failed.
+ */
+int azs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+{
+    AZS_DEBUGLOGV("azs_readdir called with path = %s, offset = %s\n", path, to_str(offset).c_str());
+    std::string pathStr(path);
+    if (pathStr.size() > 1)
+    {
+        pathStr.push_back('/');
+    }
+
+    struct dirhandle *dh = (struct dirhandle *)fi->fh;
+    std::lock_guard<std::mutex> lock(dh->mutex);
+
+    // Start over when reading from the beginning, or when the reader went back past the current page.
+    if (!dh->started || (offset == 0) || (offset < dh->start))
+    {
+        start_directory_stream(pathStr, dh);
+    }
+    while (true)
+    {
+        for (size_t i = (offset > dh->start) ? offset - dh->start : 0; i < dh->entries.size(); i++)
+        {
+            if (filler(buf, dh->entries[i].first.c_str(), &dh->entries[i].second, dh->start + i + 1) != 0)
+            {
+                // The kernel's buffer is full; it will ask again from the offset of the last entry it took.
+                return 0;
             }
         }
+        if (dh->done)
+        {
+            return 0;
+        }
+        int res = read_directory_page(pathStr, dh);
+        if (res != 0)
+        {
+            return res;
+        }
     }
+}
+
+int azs_releasedir(const char *path, struct fuse_file_info *fi)
+{
+    AZS_DEBUGLOGV("azs_releasedir called with path = %s\n", path);
+    delete (struct dirhandle *)fi->fh;
     return 0;
 }
 
@@ -204,7 +317,11 @@ int azs_rmdir(const char *path)
     remove(mntPath); // This will fail if the cache is not empty, which is fine, as in this case it will also fail later, after the server-side check.
 
     errno = 0;
-    int dirStatus = is_directory_empty(str_options.containerName, pathString.substr(1));
+    int dirStatus;
+    if (!namespace_tree::get_instance()->get_directory_state(pathString, true, dirStatus))
+    {
+        dirStatus = is_directory_empty(str_options.containerName, pathString.substr(1));
+    }
     if (errno != 0)
     {
         int storage_errno = errno;
@@ -251,6 +368,7 @@ int azs_rmdir(const char *path)
             return 0 - map_errno(dir_blob_delete_errno);
         }
     }
+    namespace_tree::get_instance()->invalidate(path);
 
     return 0;
 }
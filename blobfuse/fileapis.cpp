@@ -14,25 +14,98 @@ file_lock_map* file_lock_map::get_instance()
     return s_instance.get();
 }
 
-std::shared_ptr<std::mutex> file_lock_map::get_mutex(const std::string& path)
+file_lock_handle file_lock_map::get_mutex(const std::string& path)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    auto iter = m_lock_map.find(path);
-    if(iter == m_lock_map.end())
+    file_lock_stripe *stripe = &m_stripes[std::hash<std::string>()(path) % FILE_LOCK_MAP_STRIPES];
+    std::lock_guard<std::mutex> lock(stripe->mutex);
+    std::unique_ptr<file_lock_entry>& entry = stripe->entries[path];
+    if (!entry)
     {
-        auto file_mutex = std::make_shared<std::mutex>();
-        m_lock_map[path] = file_mutex;
-        return file_mutex;
+        entry.reset(new file_lock_entry());
+        entry->path = path;
+        entry->refs = 0;
     }
-    else
+    entry->refs++;
+    return file_lock_handle(stripe, entry.get());
+}
+
+file_lock_handle::~file_lock_handle()
+{
+    if (m_entry == nullptr)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_stripe->mutex);
+    if (--m_entry->refs == 0)
     {
-        return iter->second;
+        m_stripe->entries.erase(m_entry->path);
     }
 }
 
 std::shared_ptr<file_lock_map> file_lock_map::s_instance;
 std::mutex file_lock_map::s_mutex;
 
+file_etag_map* file_etag_map::get_instance()
+{
+    if(nullptr == s_instance.get())
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if(nullptr == s_instance.get())
+        {
+            s_instance.reset(new file_etag_map());
+        }
+    }
+    return s_instance.get();
+}
+
+bool file_etag_map::get_etag(const std::string& path, std::string& etag)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_etag_map.find(path);
+    if(iter == m_etag_map.end())
+    {
+        return false;
+    }
+    etag = iter->second;
+    return true;
+}
+
+void file_etag_map::set_etag(const std::string& path, const std::string& etag)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_unverified.erase(path);
+    if (etag.empty())
+    {
+        m_etag_map.erase(path);
+    }
+    else
+    {
+        m_etag_map[path] = etag;
+    }
+}
+
+void file_etag_map::remove_etag(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_etag_map.erase(path);
+    m_unverified.erase(path);
+}
+
+void file_etag_map::add_unverified(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_unverified.insert(path);
+}
+
+bool file_etag_map::is_unverified(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_unverified.find(path) != m_unverified.end();
+}
+
+std::shared_ptr<file_etag_map> file_etag_map::s_instance;
+std::mutex file_etag_map::s_mutex;
+
 std::deque<file_to_delete> cleanup;
 std::mutex deque_lock;
 
@@ -56,10 +129,16 @@ int azs_open(const char *path, struct fuse_file_info *fi)
     // If the file/blob being opened does not exist in the cache, or the version in the cache is too old, we need to download / refresh the data from the service.
     // If the file hasn't been modified, st_ctime is the time when the file was originally downloaded or created.  st_mtime is the time when the file was last modified.  
     // We only want to refresh if enough time has passed that both are more than cache_timeout seconds ago.
+    // A partially downloaded file also needs to be refreshed if the blob changed underneath it, and a file left in the cache by an earlier mount needs to be
+    // checked against the blob before it is first used.
     struct stat buf;
     int statret = stat(mntPath, &buf);
     time_t now = time(NULL);
-    if ((statret != 0) || (((now - buf.st_mtime) > file_cache_timeout_in_seconds) && ((now - buf.st_ctime) > file_cache_timeout_in_seconds)))
+    std::shared_ptr<file_block_state> blocks = file_block_map::get_instance()->get_state(pathString);
+    bool stale_blocks = blocks && blocks->is_stale();
+    bool unverified = file_etag_map::get_instance()->is_unverified(pathString);
+    bool fresh = false;
+    if ((statret != 0) || stale_blocks || unverified || (((now - buf.st_mtime) > file_cache_timeout_in_seconds) && ((now - buf.st_ctime) > file_cache_timeout_in_seconds)))
     {
         bool skipCacheUpdate = false;
         if (statret == 0) // File exists
@@ -101,30 +180,103 @@ int azs_open(const char *path, struct fuse_file_info *fi)
             // We now know that there are no other open file handles to the file.  We're safe to continue with the cache update.
         }
 
+        if (!skipCacheUpdate && g_write_behind && (g_write_behind->wait(pathString) != 0))
+        {
+            // The file in the cache has changes that failed to upload; don't replace it with the older contents of the blob.
+            syslog(LOG_WARNING, "Not refreshing %s in the file cache, because its last background upload failed.\n", path);
+            skipCacheUpdate = true;
+        }
+
+        std::string cached_etag;
+        bool have_etag = file_etag_map::get_instance()->get_etag(pathString, cached_etag);
+        if (!skipCacheUpdate && (statret == 0) && !stale_blocks && (have_etag || unverified))
+        {
+            // The file in the cache is an unmodified copy of the blob.  If the blob hasn't changed since, keep the copy and restart the cache timeout.
+            // A file restored from an earlier mount without its ETag is compared by last modified time instead, which the cache file keeps as its st_mtime.
+            errno = 0;
+            blob_property props = azure_blob_client_wrapper->get_blob_property(str_options.containerName, pathString.substr(1), true);
+            bool unchanged = have_etag ? (props.etag == cached_etag) : (props.last_modified == buf.st_mtime);
+            if ((errno == 0) && props.valid() && unchanged && (props.size == (unsigned long long)buf.st_size))
+            {
+                // The timeout is measured from st_ctime, which chmod() updates without changing st_mtime (the blob's last modified time.)
+                chmod(mntPath, buf.st_mode & 07777);
+                file_etag_map::get_instance()->set_etag(pathString, props.etag);
+                AZS_DEBUGLOGV("Blob %s has not changed since it was downloaded; keeping the file in the cache.\n", pathString.c_str()+1);
+                skipCacheUpdate = true;
+            }
+        }
+
+        if (!skipCacheUpdate && str_options.use_incremental_refresh && (statret == 0) && !blocks)
+        {
+            // The blob has changed.  If we know which blocks the file in the cache was made of, only download the blocks that are different now.
+            time_t last_modified = {};
+            std::string etag;
+            if (refresh_changed_blocks(pathString, mntPathString, last_modified, etag))
+            {
+                struct utimbuf new_time;
+                new_time.modtime = last_modified;
+                new_time.actime = 0;
+                utime(mntPathString.c_str(), &new_time);
+                file_etag_map::get_instance()->set_etag(pathString, etag);
+                fresh = true;
+                skipCacheUpdate = true;
+            }
+        }
+
         if (!skipCacheUpdate)
         {
             remove(mntPath);
+            file_block_map::get_instance()->remove_state(pathString);
+            file_write_map::get_instance()->remove_state(pathString);
+            file_etag_map::get_instance()->remove_etag(pathString);
+            blocks = nullptr;
 
-            if(0 != ensure_files_directory_exists_in_cache(mntPathString))
+            if(0 != ensure_cache_path(pathString, mntPathString))
             {
                 syslog(LOG_ERR, "Failed to create file or directory on cache directory: %s, errno = %d.\n", mntPathString.c_str(),  errno);
                 return -1;
             }
+            mntPath = mntPathString.c_str();
 
             errno = 0;
             time_t last_modified = {};
-            azure_blob_client_wrapper->download_blob_to_file(str_options.containerName, pathString.substr(1), mntPathString, last_modified);
-            if (errno != 0)
+            std::string etag;
+            if (str_options.use_block_cache && ((fi->flags & (O_WRONLY | O_RDWR)) == 0))
             {
-                int storage_errno = errno;
-                syslog(LOG_ERR, "Failed to download blob into cache.  Blob name: %s, file name = %s, storage errno = %d.\n", pathString.c_str()+1, mntPathString.c_str(),  errno);
+                // Only fetch the properties of the blob here; the data is downloaded block-by-block in azs_read().
+                // Files opened for writing are still downloaded in full, because they may be uploaded again in azs_flush().
+                blocks = create_block_cache_file(pathString, last_modified, etag);
+                if (errno != 0)
+                {
+                    int storage_errno = errno;
+                    syslog(LOG_ERR, "Failed to create block cache file.  Blob name: %s, file name = %s, errno = %d.\n", pathString.c_str()+1, mntPathString.c_str(), storage_errno);
 
-                remove(mntPath);
-                return 0 - map_errno(storage_errno);
+                    remove(mntPath);
+                    file_cache_map::get_instance()->remove_path(pathString);
+                    return 0 - storage_errno;
+                }
+                syslog(LOG_INFO, "Created sparse file %s in file cache for blob %s.\n", mntPathString.c_str(), pathString.c_str()+1);
             }
             else
             {
-                syslog(LOG_INFO, "Successfully downloaded blob %s into file cache as %s.\n", pathString.c_str()+1, mntPathString.c_str());
+                blob_property props(false);
+                azure_blob_client_wrapper->download_blob_to_file(str_options.containerName, pathString.substr(1), mntPathString, props);
+                last_modified = props.last_modified;
+                etag = props.etag;
+                if (errno != 0)
+                {
+                    int storage_errno = errno;
+                    syslog(LOG_ERR, "Failed to download blob into cache.  Blob name: %s, file name = %s, storage errno = %d.\n", pathString.c_str()+1, mntPathString.c_str(),  errno);
+
+                    remove(mntPath);
+                    file_cache_map::get_instance()->remove_path(pathString);
+                    return 0 - map_errno(storage_errno);
+                }
+                else
+                {
+                    syslog(LOG_INFO, "Successfully downloaded blob %s into file cache as %s.\n", pathString.c_str()+1, mntPathString.c_str());
+                    fresh = true;
+                }
             }
             
             // preserve the last modified time
@@ -132,6 +284,7 @@ int azs_open(const char *path, struct fuse_file_info *fi)
             new_time.modtime = last_modified;
             new_time.actime = 0;
             utime(mntPathString.c_str(), &new_time);
+            file_etag_map::get_instance()->set_etag(pathString, etag);
 
         }
     }
@@ -161,10 +314,44 @@ int azs_open(const char *path, struct fuse_file_info *fi)
     // TODO: Actual access control
     fchmod(res, default_permission);
 
-    // Store the open file handle, and whether or not the file should be uploaded on close().
-    // TODO: Optimize the scenario where the file is open for read/write, but no actual writing occurs, to not upload the blob.
-    struct fhwrapper *fhwrap = new fhwrapper(res, (((fi->flags & O_WRONLY) == O_WRONLY) || ((fi->flags & O_RDWR) == O_RDWR)));
+    bool write_access = (((fi->flags & O_WRONLY) == O_WRONLY) || ((fi->flags & O_RDWR) == O_RDWR));
+    if (write_access)
+    {
+        // The file may be changed locally from here on, so it can no longer be revalidated against the blob's ETag.
+        file_etag_map::get_instance()->remove_etag(pathString);
+    }
+    if (blocks && write_access)
+    {
+        // The file was partially downloaded by an earlier read-only open.  Finish downloading it before allowing writes, so that we never upload a file with holes in it.
+        int ensure_result = blocks->ensure_all(res);
+        if (ensure_result != 0)
+        {
+            syslog(LOG_ERR, "Failed to download remaining blocks of %s before opening it for writing.  errno = %d.", path, -ensure_result);
+            flock(res, LOCK_UN);
+            close(res);
+            return ensure_result;
+        }
+    }
+
+    // Store the open file handle, and whether or not the file may need to be uploaded on close().
+    // Whether it actually does is decided in azs_flush(), based on whether anything has been written since the last upload.
+    struct fhwrapper *fhwrap = new fhwrapper(res, write_access);
+    if (blocks && !blocks->is_complete())
+    {
+        fhwrap->blocks = blocks;
+    }
+    if (write_access || (fresh && str_options.use_incremental_refresh))
+    {
+        // Remember which blocks the blob is made of, so that flush only has to upload the ones that get written to, and a refresh only has to
+        // download the ones that changed.
+        load_committed_blocks(pathString, res, fresh);
+    }
+    if (write_access)
+    {
+        fhwrap->writes = file_write_map::get_instance()->get_or_create_state(pathString);
+    }
     fi->fh = (long unsigned int)fhwrap; // Store the file handle for later use.
+    g_gc_cache.touch_file(pathString);
 
     AZS_DEBUGLOGV("Returning success from azs_open, file = %s\n", path);
     return 0;
@@ -185,6 +372,19 @@ int azs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse
 {
     int fd = ((struct fhwrapper *)fi->fh)->fh;
 
+    // If the file in the cache is only partially downloaded, fetch the blocks we're about to read.
+    // For sequential readers, also start fetching the blocks after them in the background.
+    std::shared_ptr<file_block_state> blocks = ((struct fhwrapper *)fi->fh)->blocks;
+    if (blocks)
+    {
+        read_ahead((struct fhwrapper *)fi->fh, offset, size);
+        int ensure_result = blocks->ensure_range(fd, offset, size);
+        if (ensure_result != 0)
+        {
+            return ensure_result;
+        }
+    }
+
     errno = 0;
     int res = pread(fd, buf, size, offset);
     if (res == -1)
@@ -208,7 +408,8 @@ int azs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
     std::string mntPathString = prepend_mnt_path_string(pathString);
     mntPath = mntPathString.c_str();
     int res;
-    ensure_files_directory_exists_in_cache(mntPathString);
+    ensure_cache_path(pathString, mntPathString);
+    mntPath = mntPathString.c_str();
 
     // FUSE will set the O_CREAT and O_WRONLY flags, but not O_EXCL, which is generally assumed for 'create' semantics.
     res = open(mntPath, fi->flags | O_EXCL, default_permission);
@@ -226,6 +427,13 @@ int azs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
     }
 
     struct fhwrapper *fhwrap = new fhwrapper(res, true);
+    // This is a new file, so any state left over from a previous file at this path no longer applies.
+    file_write_map::get_instance()->remove_state(pathString);
+    file_etag_map::get_instance()->remove_etag(pathString);
+    fhwrap->writes = file_write_map::get_instance()->get_or_create_state(pathString);
+    fhwrap->writes->mark_modified();
+    missing_path_map::get_instance()->remove_path(pathString);
+    namespace_tree::get_instance()->invalidate(pathString);
     fi->fh = (long unsigned int)fhwrap;
     syslog(LOG_INFO, "Successfully created file %s in file cache.\n", path);
     AZS_DEBUGLOGV("Returning success from azs_create with file %s.\n", path);
@@ -237,6 +445,7 @@ int azs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
  * Write data to the file.
  *
  * Here, we are still just writing data to the local buffer, not forwarding to Storage.
+ * The written range is recorded, so that flush knows which blocks of the blob need to be uploaded again.
  * TODO: possible in-memory caching?
  * TODO: for very large files, start uploading to Storage before all the data has been written here.
  * @param  path   Path to the file to write.
@@ -254,6 +463,14 @@ int azs_write(const char *path, const char *buf, size_t size, off_t offset, stru
     int res = pwrite(fd, buf, size, offset);
     if (res == -1)
         res = -errno;
+    else if (((struct fhwrapper *)fi->fh)->writes)
+    {
+        ((struct fhwrapper *)fi->fh)->writes->add_dirty(offset, res);
+        if (g_streaming_upload_pool && (path != NULL))
+        {
+            stage_written_blocks((struct fhwrapper *)fi->fh, path);
+        }
+    }
 
     return res;
 }
@@ -284,9 +501,11 @@ int azs_flush(const char *path, struct fuse_file_info *fi)
     }
 
     // Note that we don't have to prepend the tmpPath, because we already have it, because we're not using the input path but instead are querying for it.
+    // The path of the file is worked out the other way around, from where it is in the cache.
     std::string mntPathString(path_buffer);
     const char * mntPath = path_buffer;
-    if (access(mntPath, F_OK) != -1 )
+    std::string pathString = str_options.use_flat_cache ? file_cache_map::get_instance()->get_path(mntPathString) : mntPathString.substr(str_options.tmpPath.size() + 5);
+    if (!pathString.empty() && (access(mntPath, F_OK) != -1))
     {
         // We cannot close the actual file handle to the temp file, because of the possibility of flush being called multiple times for a given call to open().
         // For some file systems, however, close() flushes data, so we do want to do that before uploading data to a blob.
@@ -299,7 +518,7 @@ int azs_flush(const char *path, struct fuse_file_info *fi)
             // If the blob upload occurred during that window, this could result in the blob being over-written with a zero-length blob, causing data loss.
             // An flock exclusive lock is not good enough here, because it does not hold across unlink and re-creates, and because the flosk is not acquired in open() before remove() is called during cache refresh.
             // We are not concerned with the possibility of writes from another process occurring during blob upload, because when that other process flushes the file, it will re-upload the blob, correcting any potential errors.
-            auto fmutex = file_lock_map::get_instance()->get_mutex(mntPathString.substr(str_options.tmpPath.size() + 5));
+            auto fmutex = file_lock_map::get_instance()->get_mutex(pathString);
             std::lock_guard<std::mutex> lock(*fmutex);
 
             // Check to ensure that the file still exists; that unlink() hasn't been called previously.
@@ -327,22 +546,36 @@ int azs_flush(const char *path, struct fuse_file_info *fi)
                 }
             }
 
-            // TODO: This will currently upload the full file on every flush() call.  We may want to keep track of whether
-            // or not flush() has been called already, and not re-upload the file each time.
-            std::vector<std::pair<std::string, std::string>> metadata;
-            std::string blob_name = mntPathString.substr(str_options.tmpPath.size() + 6 /* there are six characters in "/root/" */);
-            errno = 0;
-            azure_blob_client_wrapper->upload_file_to_blob(mntPath, str_options.containerName, blob_name, metadata, 8);
-            if (errno != 0)
+            // flush() is often called more than once per close() (and a file can be opened for writing without being written to), so skip the upload if
+            // nothing has changed since the last one.  If there is no write state for the file, we don't know, so upload anyway.
+            std::string blob_name = pathString.substr(1);
+            std::shared_ptr<file_write_state> writes = file_write_map::get_instance()->get_state(pathString);
+            if (writes && writes->is_clean())
             {
-                int storage_errno = errno;
-                syslog(LOG_ERR, "Failing blob upload in azs_flush with input path %s because of an error from upload_file_to_blob().  Errno = %d.\n", path, storage_errno);
+                AZS_DEBUGLOGV("Skipped blob upload in azs_flush with input path %s because the file has not changed since it was last uploaded.\n", path);
+                free(path_buffer);
+                return 0;
+            }
+
+            // With write-behind, the file is only snapshotted and queued here; errors from the upload itself are reported by fsync().
+            int upload_result;
+            if (g_write_behind)
+            {
+                upload_result = g_write_behind->enqueue(pathString, mntPathString);
+            }
+            else
+            {
+                upload_result = upload_cache_file(pathString, mntPathString);
+            }
+            if (upload_result != 0)
+            {
+                syslog(LOG_ERR, "Failing blob upload in azs_flush with input path %s because of an error from upload_cache_file().  Errno = %d.\n", path, -upload_result);
                 free(path_buffer);
-                return 0 - map_errno(storage_errno);
+                return upload_result;
             }
             else
             {
-                syslog(LOG_INFO, "Successfully uploaded file %s to blob %s.\n", path, blob_name.c_str());
+                syslog(LOG_INFO, "Successfully %s file %s to blob %s.\n", g_write_behind ? "queued upload of" : "uploaded", path, blob_name.c_str());
             }
         }
     }
@@ -411,7 +644,17 @@ int azs_unlink(const char *path)
     // Acquiring the mutex here guards against that condition.
     auto fmutex = file_lock_map::get_instance()->get_mutex(path);
     std::lock_guard<std::mutex> lock(*fmutex);
+    if (g_write_behind)
+    {
+        // A queued upload would bring the blob back after it's deleted.
+        g_write_behind->cancel(pathString);
+    }
     int remove_success = remove(mntPath);
+    file_cache_map::get_instance()->remove_path(pathString);
+    file_block_map::get_instance()->remove_state(pathString);
+    file_write_map::get_instance()->remove_state(pathString);
+    file_etag_map::get_instance()->remove_etag(pathString);
+    g_gc_cache.remove_file(pathString);
     // We don't fail if the remove() failed, because that's just removing the file in the local file cache, which may or may not be there.
 
     if (remove_success)
@@ -456,6 +699,7 @@ int azs_unlink(const char *path)
         AZS_DEBUGLOGV("Attempting to remove directory %s from local file cache, in case all files have been deleted.", mntPathString.substr(0, last_slash_idx).c_str());
         remove(mntPathString.substr(0, last_slash_idx).c_str());
     }
+    namespace_tree::get_instance()->invalidate(pathString);
     return retval;
 }
 
@@ -485,6 +729,7 @@ int azs_truncate(const char * path, off_t off)
         if (truncret == 0)
         {
             AZS_DEBUGLOGV("Successfully truncated file %s in the local file cache.", mntPath);
+            ((struct fhwrapper *)fi.fh)->writes->truncate(off);
             int flushret = azs_flush(path, &fi);
             if(flushret != 0)
             {
@@ -513,17 +758,27 @@ int azs_truncate(const char * path, off_t off)
     if (statret == 0)
     {
         // The file exists in the local cache.  So, we call truncate() on the file in the cache, then upload a zero-length blob to the service, overriding any data.
+        // An empty file has no blocks left to download.
+        file_block_map::get_instance()->remove_state(pathString);
+        file_write_map::get_instance()->remove_state(pathString);
+        file_etag_map::get_instance()->remove_etag(pathString);
+        if (g_write_behind)
+        {
+            g_write_behind->cancel(pathString);
+        }
         int truncret = truncate(mntPath, 0);
         if (truncret == 0)
         {
             AZS_DEBUGLOGV("Successfully truncated file %s in the local file cache.", mntPath);
+            g_gc_cache.touch_file(pathString);
 
             // We want to upload a zero-length blob.
             std::istringstream emptyDataStream("");
 
             std::vector<std::pair<std::string, std::string>> metadata;
+            blob_property props(false);
             errno = 0;
-            azure_blob_client_wrapper->upload_block_blob_from_stream(str_options.containerName, pathString.substr(1), emptyDataStream, metadata);
+            azure_blob_client_wrapper->upload_block_blob_from_stream(str_options.containerName, pathString.substr(1), emptyDataStream, metadata, props);
             if (errno != 0)
             {
                 syslog(LOG_ERR, "Failed to upload zero-length blob to %s from azs_truncate.  errno = %d\n.", pathString.c_str()+1, errno);
@@ -532,6 +787,7 @@ int azs_truncate(const char * path, off_t off)
             else
             {
                 syslog(LOG_INFO, "Successfully uploaded zero-length blob to path %s from azs_truncate.", pathString.c_str()+1);
+                namespace_tree::get_instance()->invalidate(pathString);
                 return 0;
             }
 
@@ -551,6 +807,8 @@ int azs_truncate(const char * path, off_t off)
         {
             AZS_DEBUGLOGV("Blob %s representing file %s exists on the service.\n", pathString.c_str()+1, path);
 
+            ensure_cache_path(pathString, mntPathString);
+            mntPath = mntPathString.c_str();
             int fd = open(mntPath, O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU | S_IRWXG);  //TODO: Consider removing this, I don't think the optimization will really be worth it.
             if (fd != 0)
             {
@@ -562,8 +820,9 @@ int azs_truncate(const char * path, off_t off)
             std::istringstream emptyDataStream("");
 
             std::vector<std::pair<std::string, std::string>> metadata;
+            blob_property props(false);
             errno = 0;
-            azure_blob_client_wrapper->upload_block_blob_from_stream(str_options.containerName, pathString.substr(1), emptyDataStream, metadata);
+            azure_blob_client_wrapper->upload_block_blob_from_stream(str_options.containerName, pathString.substr(1), emptyDataStream, metadata, props);
             if (errno != 0)
             {
                 int storage_errno = errno;
@@ -573,6 +832,7 @@ int azs_truncate(const char * path, off_t off)
             else
             {
                 syslog(LOG_INFO, "Successfully uploaded zero-length blob to path %s from azs_truncate.", pathString.c_str()+1);
+                namespace_tree::get_instance()->invalidate(pathString);
                 return 0;
             }
         }
@@ -585,10 +845,95 @@ int azs_truncate(const char * path, off_t off)
     return 0;
 }
 
+int move_blob(const std::string& srcPathString, const std::string& dstPathString, int& storage_errno)
+{
+    errno = 0;
+    blob_property props(false);
+    azure_blob_client_wrapper->start_copy(str_options.containerName, srcPathString.substr(1), str_options.containerName, dstPathString.substr(1), props);
+    if (errno != 0)
+    {
+        storage_errno = errno;
+        syslog(LOG_ERR, "Attempt to call start_copy from %s to %s failed.  errno = %d\n.", srcPathString.c_str()+1, dstPathString.c_str()+1, storage_errno);
+        return 0 - map_errno(storage_errno);
+    }
+    else
+    {
+        syslog(LOG_INFO, "Successfully called start_copy from blob %s to blob %s\n", srcPathString.c_str()+1, dstPathString.c_str()+1);
+    }
+
+    // Copies within the account usually finish before start_copy returns.  Those that don't are left to the copy poller.
+    std::string copy_status = props.copy_status;
+    std::string etag = props.etag;
+    if (copy_status.empty() || (copy_status.compare(0, 7, "pending") == 0))
+    {
+        int poll_errno = copy_poller::get_instance()->wait(dstPathString.substr(1), copy_status, etag);
+        if (poll_errno != 0)
+        {
+            storage_errno = poll_errno;
+            syslog(LOG_ERR, "Failed to poll the copy from %s to %s.  errno = %d.\n", srcPathString.c_str()+1, dstPathString.c_str()+1, storage_errno);
+            return 0 - map_errno(storage_errno);
+        }
+    }
+    if(copy_status.compare(0, 7, "success") == 0)
+    {
+        syslog(LOG_INFO, "Copy operation from %s to %s succeeded.", srcPathString.c_str()+1, dstPathString.c_str()+1);
+
+        // Any blocks of the file that are not yet downloaded now have to come from the destination blob.
+        std::shared_ptr<file_block_state> blocks = file_block_map::get_instance()->get_state(dstPathString);
+        if (blocks)
+        {
+            blocks->set_blob(dstPathString.substr(1), etag);
+        }
+
+        errno = 0;
+        azure_blob_client_wrapper->delete_blob(str_options.containerName, srcPathString.substr(1));
+        if(errno != 0)
+        {
+            storage_errno = errno;
+            syslog(LOG_ERR, "Failed to delete source blob %s during rename operation.  errno = %d\n.", srcPathString.c_str()+1, storage_errno);
+            return 0 - map_errno(storage_errno);
+        }
+        else
+        {
+            syslog(LOG_INFO, "Successfully deleted source blob %s during rename operation.\n", srcPathString.c_str()+1);
+        }
+    }
+    else
+    {
+        syslog(LOG_ERR, "Copy operation from %s to %s failed on the service.  Copy status = %s.\n", srcPathString.c_str()+1, dstPathString.c_str()+1, copy_status.c_str());
+        return -EFAULT;
+    }
+
+    // in the case of directory_rename, there may be local cache
+    // store the file in the cleanup list
+    g_gc_cache.add_file(dstPathString);
+
+    return 0;
+}
+
 int azs_rename_single_file(const char *src, const char *dst)
 {
+    int storage_errno = 0;
+    return rename_single_file(src, dst, storage_errno);
+}
+
+int rename_single_file(const char *src, const char *dst, int& storage_errno)
+{
+    storage_errno = 0;
     AZS_DEBUGLOGV("Renaming a single file.  src = %s, dst = %s.\n", src, dst);
 
+    // With write-behind, the source blob has to be up to date before it's copied, and queued uploads of the destination must not overwrite the copy.
+    if (g_write_behind)
+    {
+        int upload_result = g_write_behind->wait(src);
+        if (upload_result != 0)
+        {
+            syslog(LOG_ERR, "Failing rename of %s because its background upload failed.  errno = %d.\n", src, -upload_result);
+            return upload_result;
+        }
+        g_write_behind->cancel(dst);
+    }
+
     // TODO: if src == dst, return?
     // TODO: lock in alphabetical order?
     auto fsrcmutex = file_lock_map::get_instance()->get_mutex(src);
@@ -614,9 +959,22 @@ int azs_rename_single_file(const char *src, const char *dst)
         AZS_DEBUGLOGV("Source file %s in rename operation exists in the local cache.\n", src);
 
         // The file exists in the local cache.  Call rename() on it (note this will preserve existing handles.)
-        ensure_files_directory_exists_in_cache(dstMntPath);
+        // With the flat cache layout the file stays where it is, and only the map changes.
         errno = 0;
-        int renameret = rename(srcMntPath, dstMntPath);
+        int renameret = 0;
+        if (str_options.use_flat_cache)
+        {
+            std::string replaced = file_cache_map::get_instance()->rename_path(srcPathString, dstPathString);
+            if (!replaced.empty())
+            {
+                unlink(replaced.c_str());
+            }
+        }
+        else
+        {
+            ensure_files_directory_exists_in_cache(dstMntPath);
+            renameret = rename(srcMntPath, dstMntPath);
+        }
         if (renameret < 0)
         {
             syslog(LOG_ERR, "Failure to rename source file %s in the local cache.  Errno = %d.\n", src, errno);
@@ -626,62 +984,24 @@ int azs_rename_single_file(const char *src, const char *dst)
         {
             AZS_DEBUGLOGV("Successfully to renamed file %s to %s in the local cache.\n", src, dst);
         }
+        file_block_map::get_instance()->rename_state(srcPathString, dstPathString);
+        file_write_map::get_instance()->rename_state(srcPathString, dstPathString);
+        // The blob is copied to its new name, which gives it a new ETag.
+        file_etag_map::get_instance()->remove_etag(srcPathString);
+        file_etag_map::get_instance()->remove_etag(dstPathString);
+        g_gc_cache.rename_file(srcPathString, dstPathString);
+        // A file that has not been uploaded yet is not found on the service.
         errno = 0;
         auto blob_property = azure_blob_client_wrapper->get_blob_property(str_options.containerName, srcPathString.substr(1));
         if ((errno == 0) && blob_property.valid())
         {
             AZS_DEBUGLOGV("Source file %s for rename operation exists as a blob on the service.\n", src);
             // Blob also exists on the service.  Perform a server-side copy.
-            errno = 0;
-            azure_blob_client_wrapper->start_copy(str_options.containerName, srcPathString.substr(1), str_options.containerName, dstPathString.substr(1));
-            if (errno != 0)
-            {
-                int storage_errno = errno;
-                syslog(LOG_ERR, "Attempt to call start_copy from %s to %s failed.  errno = %d\n.", srcPathString.c_str()+1, dstPathString.c_str()+1, storage_errno);
-                return 0 - map_errno(errno);
-            }
-            else
-            {
-                syslog(LOG_INFO, "Successfully called start_copy from blob %s to blob %s\n", srcPathString.c_str()+1, dstPathString.c_str()+1);
-            }
-
-            errno = 0;
-            do
-            {
-                blob_property = azure_blob_client_wrapper->get_blob_property(str_options.containerName, dstPathString.substr(1));
-            }
-            while(errno == 0 && blob_property.valid() && blob_property.copy_status.compare(0, 7, "pending") == 0);
-            if(blob_property.copy_status.compare(0, 7, "success") == 0)
-            {
-                syslog(LOG_INFO, "Copy operation from %s to %s succeeded.", srcPathString.c_str()+1, dstPathString.c_str()+1);
-
-//                int retval = azs_unlink(srcPathString); // This will remove the blob from the service, and also take care of removing the directory in the local file cache.
-                azure_blob_client_wrapper->delete_blob(str_options.containerName, srcPathString.substr(1));
-                if(errno != 0)
-                {
-                    int storage_errno = errno;
-                    syslog(LOG_ERR, "Failed to delete source blob %s during rename operation.  errno = %d\n.", srcPathString.c_str()+1, storage_errno);
-                    return 0 - map_errno(storage_errno);
-                }
-                else
-                {
-                    syslog(LOG_INFO, "Successfully deleted source blob %s during rename operation.\n", srcPathString.c_str()+1);
-                }
-            }
-            else
-            {
-                syslog(LOG_ERR, "Copy operation from %s to %s failed on the service.  Copy status = %s.\n", srcPathString.c_str()+1, dstPathString.c_str()+1, blob_property.copy_status.c_str());
-                return EFAULT;
-            }
-
-            // store the file in the cleanup list
-            g_gc_cache.add_file(dstPathString);
-
-            return 0;
+            return move_blob(srcPathString, dstPathString, storage_errno);
         }
-        else if (errno != 0)
+        else if ((errno != 0) && (errno != 404) && (errno != ENOENT))
         {
-            int storage_errno = errno;
+            storage_errno = errno;
             syslog(LOG_ERR, "Failed to get blob properties for blob %s during rename operation.  errno = %d\n", srcPathString.c_str()+1, storage_errno);
             return 0 - map_errno(storage_errno);
         }
@@ -691,67 +1011,22 @@ int azs_rename_single_file(const char *src, const char *dst)
         AZS_DEBUGLOGV("Source file %s in rename operation does not exist in the local cache.\n", src);
 
         // File does not exist locally.  Just do the blob copy.
-        // TODO: remove duplicated code.
         errno = 0;
         auto blob_property = azure_blob_client_wrapper->get_blob_property(str_options.containerName, srcPathString.substr(1));
         if ((errno == 0) && blob_property.valid())
         {
             AZS_DEBUGLOGV("Source file %s for rename operation exists as a blob on the service.\n", src);
-
-            // Blob also exists on the service.  Perform a server-side copy.
-            errno = 0;
-            azure_blob_client_wrapper->start_copy(str_options.containerName, srcPathString.substr(1), str_options.containerName, dstPathString.substr(1));
-            if (errno != 0)
-            {
-                int storage_errno = errno;
-                syslog(LOG_ERR, "Attempt to call start_copy from %s to %s failed.  errno = %d\n.", srcPathString.c_str()+1, dstPathString.c_str()+1, storage_errno);
-                return 0 - map_errno(storage_errno);
-            }
-            else
-            {
-                syslog(LOG_INFO, "Successfully called start_copy from blob %s to blob %s\n", srcPathString.c_str()+1, dstPathString.c_str()+1);
-            }
-
-            errno = 0;
-            do
-            {
-                blob_property = azure_blob_client_wrapper->get_blob_property(str_options.containerName, dstPathString.substr(1));
-            }
-            while(errno == 0 && blob_property.valid() && blob_property.copy_status.compare(0, 7, "pending") == 0);
-            if(blob_property.copy_status.compare(0, 7, "success") == 0)
-            {
-                syslog(LOG_INFO, "Copy operation from %s to %s succeeded.", srcPathString.c_str()+1, dstPathString.c_str()+1);
-
-                azure_blob_client_wrapper->delete_blob(str_options.containerName, srcPathString.substr(1));
-                if(errno != 0)
-                {
-                    int storage_errno = errno;
-                    syslog(LOG_ERR, "Failed to delete source blob %s during rename operation.  errno = %d\n.", srcPathString.c_str()+1, storage_errno);
-                    return 0 - map_errno(storage_errno);
-                }
-                else
-                {
-                    syslog(LOG_INFO, "Successfully deleted source blob %s during rename operation.\n", srcPathString.c_str()+1);
-                }
-            }
-            else
-            {
-                syslog(LOG_ERR, "Copy operation from %s to %s failed on the service.  Copy status = %s.\n", srcPathString.c_str()+1, dstPathString.c_str()+1, blob_property.copy_status.c_str());
-                return EFAULT;
-            }
-
-            // in the case of directory_rename, there may be local cache
-            // store the file in the cleanup list
-            g_gc_cache.add_file(dstPathString);
-
-            return 0;
+            file_etag_map::get_instance()->remove_etag(dstPathString);
+            return move_blob(srcPathString, dstPathString, storage_errno);
         }
-        else if (errno != 0)
+        else if ((errno != 0) && (errno != 404) && (errno != ENOENT))
         {
-            int storage_errno = errno;
+            storage_errno = errno;
             syslog(LOG_ERR, "Failed to get blob properties for blob %s during rename operation.  errno = %d\n", srcPathString.c_str()+1, storage_errno);
             return 0 - map_errno(storage_errno);
         }
+        syslog(LOG_ERR, "Source file %s in rename operation exists neither in the local cache nor on the service.\n", src);
+        return -ENOENT;
     }
 
     return 0;
@@ -0,0 +1,189 @@
+#include "blobfuse.h"
+
+file_cache_map* file_cache_map::get_instance()
+{
+    if(nullptr == s_instance.get())
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if(nullptr == s_instance.get())
+        {
+            s_instance.reset(new file_cache_map());
+        }
+    }
+    return s_instance.get();
+}
+
+std::shared_ptr<file_cache_map> file_cache_map::s_instance;
+std::mutex file_cache_map::s_mutex;
+
+int file_cache_map::init(const std::string& objects_dir)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_objects_dir = objects_dir;
+    if (ensure_files_directory_exists_in_cache(m_objects_dir + "/") != 0)
+    {
+        return errno;
+    }
+    for (int i = 0; i < FLAT_CACHE_FANOUT; i++)
+    {
+        char name[3];
+        snprintf(name, sizeof(name), "%02x", i);
+        std::string dir = m_objects_dir + "/" + name;
+        if ((mkdir(dir.c_str(), S_IRWXU) != 0) && (errno != EEXIST))
+        {
+            return errno;
+        }
+    }
+    return 0;
+}
+
+// The file name for a path is the SHA-1 of the path.  A path renamed onto from elsewhere keeps the name of its old path, so a name can be taken by
+// another path; in that case a suffix is added.
+std::string file_cache_map::find_object(const std::string& path)
+{
+    unsigned char digest[20];
+    gcry_md_hash_buffer(GCRY_MD_SHA1, digest, path.data(), path.size());
+    char hex[sizeof(digest) * 2 + 1];
+    for (size_t i = 0; i < sizeof(digest); i++)
+    {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+    std::string object(hex);
+    for (unsigned int probe = 1; m_paths.find(object) != m_paths.end(); probe++)
+    {
+        object = std::string(hex) + "-" + to_str(probe);
+    }
+    return object;
+}
+
+std::string file_cache_map::object_path(const std::string& object)
+{
+    std::string result;
+    result.reserve(m_objects_dir.size() + 4 + object.size());
+    return result.append(m_objects_dir).append("/").append(object, 0, 2).append("/").append(object);
+}
+
+std::string file_cache_map::get_cache_path(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_objects.find(path);
+    return object_path((iter == m_objects.end()) ? find_object(path) : iter->second);
+}
+
+std::string file_cache_map::add_path(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_objects.find(path);
+    if (iter != m_objects.end())
+    {
+        return object_path(iter->second);
+    }
+    std::string object = find_object(path);
+    m_objects[path] = object;
+    m_paths[object] = path;
+    return object_path(object);
+}
+
+void file_cache_map::remove_path(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_objects.find(path);
+    if (iter != m_objects.end())
+    {
+        m_paths.erase(iter->second);
+        m_objects.erase(iter);
+    }
+}
+
+std::string file_cache_map::rename_path(const std::string& src, const std::string& dst)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto src_iter = m_objects.find(src);
+    if ((src_iter == m_objects.end()) || (src == dst))
+    {
+        return std::string();
+    }
+    std::string object = src_iter->second;
+    m_objects.erase(src_iter);
+
+    std::string replaced;
+    auto dst_iter = m_objects.find(dst);
+    if (dst_iter != m_objects.end())
+    {
+        m_paths.erase(dst_iter->second);
+        replaced = object_path(dst_iter->second);
+    }
+    m_objects[dst] = object;
+    m_paths[object] = dst;
+    return replaced;
+}
+
+std::string file_cache_map::get_path(const std::string& cache_path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t slash = cache_path.rfind('/');
+    auto iter = m_paths.find((slash == std::string::npos) ? cache_path : cache_path.substr(slash + 1));
+    return (iter == m_paths.end()) ? std::string() : iter->second;
+}
+
+std::vector<std::pair<std::string, bool>> file_cache_map::list_children(const std::string& dir)
+{
+    std::string prefix = dir;
+    if (prefix.empty() || (prefix.back() != '/'))
+    {
+        prefix.push_back('/');
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::pair<std::string, bool>> children;
+    auto iter = m_objects.lower_bound(prefix);
+    while ((iter != m_objects.end()) && (iter->first.compare(0, prefix.size(), prefix) == 0))
+    {
+        size_t slash = iter->first.find('/', prefix.size());
+        if (slash == std::string::npos)
+        {
+            children.push_back(std::make_pair(iter->first.substr(prefix.size()), false));
+            ++iter;
+        }
+        else
+        {
+            // Report the subdirectory once, and skip past everything in it.  '0' is the character after '/'.
+            std::string subdir = iter->first.substr(0, slash);
+            children.push_back(std::make_pair(subdir.substr(prefix.size()), true));
+            iter = m_objects.lower_bound(subdir + "0");
+        }
+    }
+    return children;
+}
+
+bool file_cache_map::has_children(const std::string& dir)
+{
+    std::string prefix = dir;
+    if (prefix.empty() || (prefix.back() != '/'))
+    {
+        prefix.push_back('/');
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_objects.lower_bound(prefix);
+    return (iter != m_objects.end()) && (iter->first.compare(0, prefix.size(), prefix) == 0);
+}
+
+bool file_cache_map::restore_path(const std::string& path, const std::string& object)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ((m_objects.find(path) != m_objects.end()) || (m_paths.find(object) != m_paths.end()))
+    {
+        return false;
+    }
+    m_objects[path] = object;
+    m_paths[object] = path;
+    return true;
+}
+
+std::string file_cache_map::get_object(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_objects.find(path);
+    return (iter == m_objects.end()) ? std::string() : iter->second;
+}
@@ -0,0 +1,98 @@
+#include "blobfuse.h"
+
+const size_t name_set::empty_slot;
+
+name_set::name_set() : m_slots(16), m_count(0)
+{
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        m_slots[i].offset = empty_slot;
+    }
+}
+
+// 64-bit FNV-1a.
+uint64_t name_set::hash_name(const char *data, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Returns the slot holding the name, or the empty slot where it would go.
+size_t name_set::find_slot(const char *data, size_t length, uint64_t hash) const
+{
+    size_t mask = m_slots.size() - 1;
+    for (size_t index = hash & mask; ; index = (index + 1) & mask)
+    {
+        const slot& s = m_slots[index];
+        if ((s.offset == empty_slot) ||
+            ((s.hash == hash) && (s.length == length) && (m_names.compare(s.offset, length, data, length) == 0)))
+        {
+            return index;
+        }
+    }
+}
+
+void name_set::grow()
+{
+    std::vector<slot> slots(m_slots.size() * 2);
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        slots[i].offset = empty_slot;
+    }
+    size_t mask = slots.size() - 1;
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        if (m_slots[i].offset != empty_slot)
+        {
+            size_t index = m_slots[i].hash & mask;
+            while (slots[index].offset != empty_slot)
+            {
+                index = (index + 1) & mask;
+            }
+            slots[index] = m_slots[i];
+        }
+    }
+    m_slots.swap(slots);
+}
+
+bool name_set::insert(const std::string& name)
+{
+    // Keep the table at most 70% full, so that probe sequences stay short.
+    if ((m_count + 1) * 10 > m_slots.size() * 7)
+    {
+        grow();
+    }
+    uint64_t hash = hash_name(name.data(), name.size());
+    slot& s = m_slots[find_slot(name.data(), name.size(), hash)];
+    if (s.offset != empty_slot)
+    {
+        return false;
+    }
+    s.hash = hash;
+    s.offset = m_names.size();
+    s.length = name.size();
+    m_names.append(name);
+    m_count++;
+    return true;
+}
+
+bool name_set::contains(const std::string& name) const
+{
+    return m_slots[find_slot(name.data(), name.size(), hash_name(name.data(), name.size()))].offset != empty_slot;
+}
+
+void name_set::clear()
+{
+    std::vector<slot>(16).swap(m_slots);
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        m_slots[i].offset = empty_slot;
+    }
+    std::string().swap(m_names);
+    m_count = 0;
+}
@@ -0,0 +1,472 @@
+#include "blobfuse.h"
+#include <curl/curl.h>
+
+namespace_tree* namespace_tree::get_instance()
+{
+    if(nullptr == s_instance.get())
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if(nullptr == s_instance.get())
+        {
+            s_instance.reset(new namespace_tree());
+        }
+    }
+    return s_instance.get();
+}
+
+std::shared_ptr<namespace_tree> namespace_tree::s_instance;
+std::mutex namespace_tree::s_mutex;
+
+static const uint32_t no_node = UINT32_MAX;
+
+namespace_tree::namespace_tree() : m_timeout(0), m_generation(0), m_sweep_size(1024)
+{
+    new_node(std::string());
+    m_nodes[0].is_directory = true;
+}
+
+void namespace_tree::set_timeout(int timeout_in_seconds)
+{
+    m_timeout = timeout_in_seconds;
+}
+
+uint32_t namespace_tree::intern(const std::string& name)
+{
+    auto iter = m_name_ids.find(name);
+    if (iter != m_name_ids.end())
+    {
+        m_name_refs[iter->second]++;
+        return iter->second;
+    }
+    uint32_t id;
+    if (m_free_names.empty())
+    {
+        id = m_names.size();
+        m_names.push_back(nullptr);
+        m_name_refs.push_back(0);
+    }
+    else
+    {
+        id = m_free_names.back();
+        m_free_names.pop_back();
+    }
+    // Keys of an unordered_map stay where they are when it rehashes.
+    m_names[id] = &m_name_ids.insert(std::make_pair(name, id)).first->first;
+    m_name_refs[id] = 1;
+    return id;
+}
+
+void namespace_tree::release(uint32_t name)
+{
+    if (--m_name_refs[name] == 0)
+    {
+        m_name_ids.erase(*m_names[name]);
+        m_names[name] = nullptr;
+        m_free_names.push_back(name);
+    }
+}
+
+uint32_t namespace_tree::new_node(const std::string& name)
+{
+    uint32_t index;
+    if (m_free_nodes.empty())
+    {
+        index = m_nodes.size();
+        m_nodes.push_back(node());
+    }
+    else
+    {
+        index = m_free_nodes.back();
+        m_free_nodes.pop_back();
+    }
+    node& n = m_nodes[index];
+    n.name = intern(name);
+    n.is_directory = false;
+    n.has_children = false;
+    n.listed = false;
+    n.size = 0;
+    n.last_modified = 0;
+    n.expiry = 0;
+    return index;
+}
+
+// Frees the node and everything under it.  The caller removes it from the children of its parent.
+void namespace_tree::remove_subtree(uint32_t index)
+{
+    std::vector<uint32_t> children;
+    children.swap(m_nodes[index].children);
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        remove_subtree(children[i]);
+    }
+    release(m_nodes[index].name);
+    m_free_nodes.push_back(index);
+}
+
+size_t namespace_tree::find_child(uint32_t parent, const std::string& name)
+{
+    const std::vector<uint32_t>& children = m_nodes[parent].children;
+    return std::lower_bound(children.begin(), children.end(), name, [this](uint32_t child, const std::string& value) {
+        return *m_names[m_nodes[child].name] < value;
+    }) - children.begin();
+}
+
+bool namespace_tree::is_child(uint32_t parent, size_t position, const std::string& name)
+{
+    const std::vector<uint32_t>& children = m_nodes[parent].children;
+    return (position < children.size()) && (*m_names[m_nodes[children[position]].name] == name);
+}
+
+// Returns the node for the path, or no_node.  With create, the nodes along the path are added as directories if they are missing.
+uint32_t namespace_tree::find_node(const std::string& path, bool create)
+{
+    uint32_t index = 0;
+    size_t start = 1;
+    while (start < path.size())
+    {
+        size_t slash = path.find('/', start);
+        if (slash == std::string::npos)
+        {
+            slash = path.size();
+        }
+        std::string component = path.substr(start, slash - start);
+        size_t position = find_child(index, component);
+        if (is_child(index, position, component))
+        {
+            index = m_nodes[index].children[position];
+        }
+        else if (create)
+        {
+            uint32_t child = new_node(component);
+            m_nodes[child].is_directory = true;
+            m_nodes[child].has_children = true;
+            m_nodes[index].children.insert(m_nodes[index].children.begin() + position, child);
+            index = child;
+        }
+        else
+        {
+            return no_node;
+        }
+        if (create)
+        {
+            m_nodes[index].is_directory = true;
+        }
+        start = slash + 1;
+    }
+    return index;
+}
+
+bool namespace_tree::is_listed(uint32_t index, time_t now)
+{
+    return m_nodes[index].listed && (m_nodes[index].expiry > now);
+}
+
+unsigned long long namespace_tree::begin_listing()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_generation;
+}
+
+void namespace_tree::add_listing(const std::string& dir, const listing_children& children, unsigned long long listing)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!enabled() || (listing != m_generation))
+    {
+        return;
+    }
+    time_t now = time(NULL);
+    uint32_t index = find_node(dir, true);
+
+    // Merge the listing into the children already in the tree, both sorted by name, so that subdirectories keep their own listings.
+    std::vector<uint32_t> old_children;
+    old_children.swap(m_nodes[index].children);
+    std::vector<uint32_t> new_children;
+    new_children.reserve(children.size());
+    size_t old_index = 0;
+    auto iter = children.begin();
+    while ((old_index < old_children.size()) || (iter != children.end()))
+    {
+        int compare = (old_index == old_children.size()) ? 1 : (iter == children.end()) ? -1 : m_names[m_nodes[old_children[old_index]].name]->compare(iter->first);
+        if (compare < 0)
+        {
+            remove_subtree(old_children[old_index++]);
+            continue;
+        }
+
+        uint32_t child;
+        if (compare == 0)
+        {
+            child = old_children[old_index++];
+            if (!iter->second.is_directory)
+            {
+                std::vector<uint32_t> grandchildren;
+                grandchildren.swap(m_nodes[child].children);
+                for (size_t i = 0; i < grandchildren.size(); i++)
+                {
+                    remove_subtree(grandchildren[i]);
+                }
+                m_nodes[child].listed = false;
+            }
+        }
+        else
+        {
+            child = new_node(iter->first);
+        }
+        node& n = m_nodes[child];
+        n.is_directory = iter->second.is_directory;
+        n.has_children = iter->second.has_children;
+        n.size = iter->second.size;
+        n.last_modified = iter->second.last_modified;
+        new_children.push_back(child);
+        ++iter;
+    }
+    node& n = m_nodes[index];
+    n.children.swap(new_children);
+    n.listed = true;
+    n.expiry = now + m_timeout;
+
+    if (node_count() >= m_sweep_size)
+    {
+        prune(0, now);
+        m_sweep_size = std::max(m_sweep_size, node_count() * 2);
+    }
+}
+
+// Drops the nodes that no fully listed directory holds, and clears the flag of the listings that timed out.  Returns whether anything under the node is
+// still needed.
+bool namespace_tree::prune(uint32_t index, time_t now)
+{
+    bool listed = is_listed(index, now);
+    m_nodes[index].listed = listed;
+    bool needed = listed;
+    size_t kept = 0;
+    for (size_t i = 0; i < m_nodes[index].children.size(); i++)
+    {
+        uint32_t child = m_nodes[index].children[i];
+        bool child_needed = prune(child, now);
+        if (listed || child_needed)
+        {
+            m_nodes[index].children[kept++] = child;
+        }
+        else
+        {
+            remove_subtree(child);
+        }
+        needed = needed || child_needed;
+    }
+    m_nodes[index].children.resize(kept);
+    return needed;
+}
+
+int namespace_tree::lookup(const std::string& path, listing_entry& entry)
+{
+    if (!enabled())
+    {
+        return NS_UNKNOWN;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    time_t now = time(NULL);
+    uint32_t index = 0;
+    size_t start = 1;
+    if (start >= path.size())
+    {
+        return NS_UNKNOWN;
+    }
+    while (start < path.size())
+    {
+        size_t slash = path.find('/', start);
+        if (slash == std::string::npos)
+        {
+            slash = path.size();
+        }
+        std::string component = path.substr(start, slash - start);
+        size_t position = find_child(index, component);
+        if (!is_child(index, position, component))
+        {
+            // Nothing exists under a name that a fully listed directory does not hold.
+            return is_listed(index, now) ? NS_MISSING : NS_UNKNOWN;
+        }
+        if ((slash == path.size()) && !is_listed(index, now))
+        {
+            return NS_UNKNOWN;
+        }
+        index = m_nodes[index].children[position];
+        start = slash + 1;
+    }
+
+    const node& n = m_nodes[index];
+    entry.is_directory = n.is_directory;
+    entry.has_children = n.has_children;
+    entry.size = n.size;
+    entry.last_modified = n.last_modified;
+    int state;
+    if (n.is_directory && get_directory_state_locked(index, true, now, state))
+    {
+        entry.has_children = (state == D_NOTEMPTY);
+    }
+    return NS_FOUND;
+}
+
+bool namespace_tree::list(const std::string& dir, listing_children& children)
+{
+    if (!enabled())
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t index = find_node(dir, false);
+    if ((index == no_node) || !is_listed(index, time(NULL)))
+    {
+        return false;
+    }
+    const std::vector<uint32_t>& nodes = m_nodes[index].children;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        const node& n = m_nodes[nodes[i]];
+        listing_entry entry;
+        entry.is_directory = n.is_directory;
+        entry.has_children = n.has_children;
+        entry.size = n.size;
+        entry.last_modified = n.last_modified;
+        children.insert(children.end(), std::make_pair(*m_names[n.name], entry));
+    }
+    return true;
+}
+
+bool namespace_tree::get_directory_state(const std::string& dir, bool dir_blob_exists, int& state)
+{
+    if (!enabled())
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t index = find_node(dir, false);
+    return (index != no_node) && get_directory_state_locked(index, dir_blob_exists, time(NULL), state);
+}
+
+bool namespace_tree::get_directory_state_locked(uint32_t index, bool dir_blob_exists, time_t now, int& state)
+{
+    if (!is_listed(index, now))
+    {
+        return false;
+    }
+    const std::vector<uint32_t>& children = m_nodes[index].children;
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        if (*m_names[m_nodes[children[i]].name] != former_directory_signifier)
+        {
+            state = D_NOTEMPTY;
+            return true;
+        }
+    }
+    state = (dir_blob_exists || !children.empty()) ? D_EMPTY : D_NOTEXIST;
+    return true;
+}
+
+// A change to a path can add or remove it from its parent, and make any of its ancestors appear or disappear, or become empty or not, in their own
+// parents.  Everything under the path changes with it if it is a directory that is renamed or deleted.
+void namespace_tree::invalidate(const std::string& path)
+{
+    if (!enabled())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_generation++;
+    uint32_t index = 0;
+    m_nodes[0].listed = false;
+    size_t start = 1;
+    while (start < path.size())
+    {
+        size_t slash = path.find('/', start);
+        if (slash == std::string::npos)
+        {
+            slash = path.size();
+        }
+        std::string component = path.substr(start, slash - start);
+        size_t position = find_child(index, component);
+        if (!is_child(index, position, component))
+        {
+            return;
+        }
+        uint32_t child = m_nodes[index].children[position];
+        if (slash == path.size())
+        {
+            m_nodes[index].children.erase(m_nodes[index].children.begin() + position);
+            remove_subtree(child);
+            return;
+        }
+        index = child;
+        m_nodes[index].listed = false;
+        start = slash + 1;
+    }
+}
+
+size_t namespace_tree::node_count()
+{
+    return m_nodes.size() - m_free_nodes.size();
+}
+
+size_t namespace_tree::size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return node_count();
+}
+
+void add_listing_items(const std::vector<list_blobs_hierarchical_item>& items, size_t start, const std::string& prefix, listing_children& children)
+{
+    for (size_t i = start; i < items.size(); i++)
+    {
+        const list_blobs_hierarchical_item& item = items[i];
+
+        // We need to parse out just the trailing part of the path name.
+        std::string name = item.name.substr(prefix.size());
+        if (!name.empty() && (name.back() == '/'))
+        {
+            name.pop_back();
+        }
+        if (name.empty())
+        {
+            continue;
+        }
+
+        if (!item.is_directory && !is_directory_blob(item.content_length, item.metadata))
+        {
+            listing_entry& entry = children[name];
+            entry.is_directory = false;
+            entry.has_children = false;
+            entry.size = item.content_length;
+            entry.last_modified = curl_getdate(item.last_modified.c_str(), NULL);
+        }
+        else
+        {
+            // A directory is listed twice if it has both a marker blob and blobs under its prefix.  A file of the same name takes precedence, as it
+            // does for getattr().
+            auto iter = children.find(name);
+            if (iter == children.end())
+            {
+                listing_entry entry;
+                entry.is_directory = true;
+                entry.has_children = item.is_directory;
+                entry.size = 4096;
+                entry.last_modified = 0;
+                children.insert(std::make_pair(name, entry));
+            }
+            else if (iter->second.is_directory && item.is_directory)
+            {
+                iter->second.has_children = true;
+            }
+        }
+    }
+}
+
+listing_children build_listing(const std::vector<std::pair<std::vector<list_blobs_hierarchical_item>, bool>>& list_results, const std::string& prefix)
+{
+    listing_children children;
+    for (size_t result_lists_index = 0; result_lists_index < list_results.size(); result_lists_index++)
+    {
+        // Check to see if the first list_blobs__hierarchical_item can be skipped to avoid duplication
+        add_listing_items(list_results[result_lists_index].first, list_results[result_lists_index].second ? 1 : 0, prefix, children);
+    }
+    return children;
+}
@@ -0,0 +1,161 @@
+#include "blobfuse.h"
+#include <curl/curl.h>
+#include <atomic>
+#include <future>
+
+// Adds one blob found by a flat listing to the listings of the directories above it.  A file takes precedence over a directory of the same name, as it
+// does in build_listing().
+static void add_flat_item(const list_blobs_hierarchical_item& item, std::map<std::string, listing_children>& listings)
+{
+    std::string full = item.name;
+    while (!full.empty() && (full.back() == '/'))
+    {
+        full.pop_back();
+    }
+    std::string dir = "/";
+    size_t start = 0;
+    while (start < full.size())
+    {
+        size_t slash = full.find('/', start);
+        bool last = (slash == std::string::npos);
+        if (last)
+        {
+            slash = full.size();
+        }
+        std::string name = full.substr(start, slash - start);
+        if (name.empty())
+        {
+            return;
+        }
+        listing_children& children = listings[dir];
+        std::string path = (dir.size() > 1) ? dir + "/" + name : dir + name;
+        if (last && !is_directory_blob(item.content_length, item.metadata))
+        {
+            listing_entry& entry = children[name];
+            entry.is_directory = false;
+            entry.has_children = false;
+            entry.size = item.content_length;
+            entry.last_modified = curl_getdate(item.last_modified.c_str(), NULL);
+            return;
+        }
+
+        // Either a directory marker blob, or a directory holding this blob.
+        auto iter = children.find(name);
+        if (iter == children.end())
+        {
+            listing_entry entry;
+            entry.is_directory = true;
+            entry.has_children = !last;
+            entry.size = 4096;
+            entry.last_modified = 0;
+            children.insert(std::make_pair(name, entry));
+        }
+        else if (iter->second.is_directory && !last)
+        {
+            iter->second.has_children = true;
+        }
+        // Every directory was listed in full, even if nothing is stored under it.
+        listings[path];
+        if (last)
+        {
+            return;
+        }
+        dir = path;
+        start = slash + 1;
+    }
+}
+
+// Lists everything under the prefix with a flat listing, one page at a time, and builds the listings of all directories under it.  Returns 0 or the
+// errno of the last failed call.
+static int preload_prefix(const std::string& prefix, std::map<std::string, listing_children>& listings, size_t& blob_count)
+{
+    static const int maxFailCount = 20;
+    std::string continuation;
+    bool success = false;
+    int failcount = 0;
+    do
+    {
+        errno = 0;
+        list_blobs_hierarchical_response response = azure_blob_client_wrapper->list_blobs_hierarchical(str_options.containerName, std::string(), continuation, prefix);
+        if (errno == 0)
+        {
+            success = true;
+            failcount = 0;
+            continuation = response.next_marker;
+            for (size_t i = 0; i < response.blobs.size(); i++)
+            {
+                add_flat_item(response.blobs[i], listings);
+            }
+            blob_count += response.blobs.size();
+        }
+        else
+        {
+            failcount++;
+            success = false;
+            syslog(LOG_WARNING, "Flat listing of prefix %s failed for the %d time with errno = %d.\n", prefix.c_str(), failcount, errno);
+        }
+    } while (((continuation.size() > 0) || !success) && (failcount < maxFailCount));
+    return success ? 0 : errno;
+}
+
+void preload_metadata()
+{
+    time_t start_time = time(NULL);
+    unsigned long long listing = namespace_tree::get_instance()->begin_listing();
+
+    errno = 0;
+    std::vector<std::pair<std::vector<list_blobs_hierarchical_item>, bool>> listResults = list_all_blobs_hierarchical(str_options.containerName, "/", std::string());
+    if (errno != 0)
+    {
+        syslog(LOG_ERR, "Failed to list the root of container %s to preload metadata.  errno = %d.\n", str_options.containerName.c_str(), errno);
+        return;
+    }
+    listing_children root = build_listing(listResults, std::string());
+    namespace_tree::get_instance()->add_listing("/", root, listing);
+
+    // Each top-level directory is listed flat, in parallel with the others.
+    std::vector<std::string> partitions;
+    for (auto iter = root.begin(); iter != root.end(); ++iter)
+    {
+        if (iter->second.is_directory)
+        {
+            partitions.push_back(iter->first);
+        }
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> failed(0);
+    std::vector<std::future<size_t>> task_list;
+    for (size_t i = 0; i < std::min((size_t)PRELOAD_THREAD_COUNT, partitions.size()); i++)
+    {
+        task_list.push_back(std::async(std::launch::async, [&]() {
+            size_t blob_count = 0;
+            for (size_t idx = next++; idx < partitions.size(); idx = next++)
+            {
+                std::map<std::string, listing_children> listings;
+                listings["/" + partitions[idx]];
+                int result = preload_prefix(partitions[idx] + "/", listings, blob_count);
+                if (result != 0)
+                {
+                    syslog(LOG_ERR, "Failed to preload metadata under directory %s.  errno = %d.\n", partitions[idx].c_str(), result);
+                    failed++;
+                    continue;
+                }
+                // The root was listed above, and these listings only hold the partition's own entry in it.
+                listings.erase("/");
+                for (auto iter = listings.begin(); iter != listings.end(); ++iter)
+                {
+                    namespace_tree::get_instance()->add_listing(iter->first, iter->second, listing);
+                }
+            }
+            return blob_count;
+        }));
+    }
+    size_t blob_count = root.size();
+    for (size_t i = 0; i < task_list.size(); i++)
+    {
+        blob_count += task_list[i].get();
+    }
+    syslog(LOG_INFO, "Preloaded metadata of %s entries under %s directories in %s seconds; %s directories failed.\n", to_str(blob_count).c_str(),
+        to_str(partitions.size()).c_str(), to_str(time(NULL) - start_time).c_str(), to_str(failed.load()).c_str());
+}
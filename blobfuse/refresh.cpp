@@ -0,0 +1,173 @@
+#include "blobfuse.h"
+#include <fcntl.h>
+#include <atomic>
+#include <future>
+
+// Downloads one range of the blob and writes it into the file at the same offset.  Fails with EAGAIN if the blob is no longer the version with the given
+// etag.  Returns 0 or a negative errno.
+static int download_range(int fd, const std::string& blob, const std::string& etag, const refresh_range& range)
+{
+    std::ostringstream os;
+    errno = 0;
+    chunk_property props = azure_blob_client_wrapper->download_chunk_to_stream(str_options.containerName, blob, range.offset, range.size, os);
+    if (errno != 0)
+    {
+        int storage_errno = errno;
+        syslog(LOG_ERR, "Failed to download range at offset %llu of blob %s.  storage errno = %d.\n", range.offset, blob.c_str(), storage_errno);
+        return (storage_errno == 416) ? -EAGAIN : 0 - map_errno(storage_errno);
+    }
+    if (props.etag != etag)
+    {
+        AZS_DEBUGLOGV("Blob %s changed again while its changed blocks were being downloaded.\n", blob.c_str());
+        return -EAGAIN;
+    }
+
+    const std::string data = os.str();
+    if (data.size() != range.size)
+    {
+        syslog(LOG_ERR, "Downloaded %s bytes at offset %llu of blob %s, expected %llu.\n", to_str(data.size()).c_str(), range.offset, blob.c_str(), range.size);
+        return -EIO;
+    }
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t res = pwrite(fd, data.data() + written, data.size() - written, range.offset + written);
+        if (res == -1)
+        {
+            return -errno;
+        }
+        written += res;
+    }
+    return 0;
+}
+
+std::vector<refresh_range> plan_refresh(const std::vector<get_block_list_item>& old_blocks, const std::vector<get_block_list_item>& new_blocks,
+    unsigned long long& reused)
+{
+    std::map<unsigned long long, const get_block_list_item*> old_by_offset;
+    unsigned long long offset = 0;
+    for (size_t i = 0; i < old_blocks.size(); i++)
+    {
+        old_by_offset[offset] = &old_blocks[i];
+        offset += old_blocks[i].size;
+    }
+    std::vector<refresh_range> ranges;
+    reused = 0;
+    offset = 0;
+    for (size_t i = 0; i < new_blocks.size(); i++)
+    {
+        auto iter = old_by_offset.find(offset);
+        if ((iter != old_by_offset.end()) && (iter->second->name == new_blocks[i].name) && (iter->second->size == new_blocks[i].size))
+        {
+            reused += new_blocks[i].size;
+        }
+        else
+        {
+            // Download in pieces of at most INCREMENTAL_UPLOAD_BLOCK_SIZE, since each piece is held in memory.
+            for (unsigned long long start = offset; start < offset + new_blocks[i].size; start += INCREMENTAL_UPLOAD_BLOCK_SIZE)
+            {
+                refresh_range range;
+                range.offset = start;
+                range.size = std::min(INCREMENTAL_UPLOAD_BLOCK_SIZE, offset + new_blocks[i].size - start);
+                ranges.push_back(range);
+            }
+        }
+        offset += new_blocks[i].size;
+    }
+    return ranges;
+}
+
+bool refresh_changed_blocks(const std::string& path, const std::string& mntPath, time_t& last_modified, std::string& etag)
+{
+    // The block list saved for the file is only a description of its contents if nothing has been written to it since.
+    std::string blob = path.substr(1);
+    std::shared_ptr<file_write_state> writes = file_write_map::get_instance()->get_state(path);
+    std::vector<get_block_list_item> old_blocks;
+    if (!writes || !writes->is_clean() || !writes->get_base(blob, old_blocks))
+    {
+        return false;
+    }
+    struct stat buf;
+    unsigned long long old_size = 0;
+    for (size_t i = 0; i < old_blocks.size(); i++)
+    {
+        old_size += old_blocks[i].size;
+    }
+    if ((stat(mntPath.c_str(), &buf) != 0) || ((unsigned long long)buf.st_size != old_size))
+    {
+        return false;
+    }
+
+    // Take the new version's etag before its block list.  Every range we download is checked against it, so if the blob changes again in between, the
+    // refresh fails rather than mixing the two versions.
+    errno = 0;
+    blob_property props = azure_blob_client_wrapper->get_blob_property(str_options.containerName, blob, true);
+    if ((errno != 0) || !props.valid() || (props.size <= INCREMENTAL_UPLOAD_MIN_SIZE))
+    {
+        return false;
+    }
+    std::vector<get_block_list_item> new_blocks;
+    if (!fetch_committed_blocks(blob, props.size, new_blocks))
+    {
+        return false;
+    }
+
+    unsigned long long reused = 0;
+    std::vector<refresh_range> ranges = plan_refresh(old_blocks, new_blocks, reused);
+    if (reused == 0)
+    {
+        AZS_DEBUGLOGV("No blocks of blob %s are unchanged; downloading it in full.\n", blob.c_str());
+        return false;
+    }
+    AZS_DEBUGLOGV("Refreshing blob %s in the file cache: downloading %s changed ranges, keeping %s unchanged bytes.\n", blob.c_str(), to_str(ranges.size()).c_str(), to_str(reused).c_str());
+
+    int fd = open(mntPath.c_str(), O_WRONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+    if (ftruncate(fd, props.size) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // Download in parallel, the same way download_blob_to_file does for a whole blob.
+    static const size_t max_downloaders = 8;
+    std::atomic<size_t> next(0);
+    std::vector<std::future<int>> task_list;
+    for (size_t i = 0; i < std::min(max_downloaders, ranges.size()); i++)
+    {
+        task_list.push_back(std::async(std::launch::async, [&]() {
+            int result = 0;
+            for (size_t idx = next++; (idx < ranges.size()) && (result == 0); idx = next++)
+            {
+                result = download_range(fd, blob, props.etag, ranges[idx]);
+            }
+            return result;
+        }));
+    }
+    int result = 0;
+    for (size_t i = 0; i < task_list.size(); i++)
+    {
+        int task_result = task_list[i].get();
+        if (result == 0)
+        {
+            result = task_result;
+        }
+    }
+    close(fd);
+    if (result != 0)
+    {
+        syslog(LOG_WARNING, "Failed to refresh the changed blocks of blob %s in the file cache; downloading it in full.  errno = %d.\n", blob.c_str(), -result);
+        return false;
+    }
+
+    // The file now holds the new version, so its block list is the base for the next refresh or incremental upload.
+    file_write_map::get_instance()->remove_state(path);
+    file_write_map::get_instance()->get_or_create_state(path)->set_base(blob, new_blocks);
+    last_modified = props.last_modified;
+    etag = props.etag;
+    syslog(LOG_INFO, "Refreshed %s changed ranges of blob %s in the file cache.\n", to_str(ranges.size()).c_str(), blob.c_str());
+    return true;
+}
@@ -0,0 +1,480 @@
+#include "blobfuse.h"
+#include <fcntl.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+
+// A directory rename in progress.  names are the paths of the files to move, relative to src and dst.  The journal holds src, dst and names in
+// <id>.rename, and the names that have been moved in <id>.done.
+struct directory_rename
+{
+    std::string id;
+    std::string src;
+    std::string dst;
+    std::vector<std::string> names;
+};
+
+static std::atomic<unsigned long long> s_next_rename_id(0);
+
+// Set while the renames left by an earlier mount are being finished.  New directory renames wait for them, so that renames of the same directories
+// happen in the order they were started.
+static std::mutex s_resume_mutex;
+static std::condition_variable s_resume_cv;
+static bool s_resuming = false;
+
+static std::string rename_journal_dir()
+{
+    return str_options.tmpPath + "/renames";
+}
+
+static std::string rename_journal_file(const std::string& id, const char *extension)
+{
+    return rename_journal_dir() + "/" + id + extension;
+}
+
+static long long steady_now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Writes the record of a rename.  As with write-behind jobs, the record is written to a temporary file and renamed into place, so after a crash there
+// is either a complete record or none.
+static int write_rename_record(const directory_rename& rename_job)
+{
+    std::string tmp_file = rename_journal_file(rename_job.id, ".tmp");
+    int fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+        return errno;
+    }
+    std::string record = rename_job.src + "\n" + rename_job.dst + "\n";
+    for (size_t i = 0; i < rename_job.names.size(); i++)
+    {
+        record.append(rename_job.names[i]).append("\n");
+    }
+    int result = write_all(fd, record.data(), record.size());
+    if ((result == 0) && (fsync(fd) != 0))
+    {
+        result = errno;
+    }
+    close(fd);
+    if ((result == 0) && (rename(tmp_file.c_str(), rename_journal_file(rename_job.id, ".rename").c_str()) != 0))
+    {
+        result = errno;
+    }
+    if (result != 0)
+    {
+        unlink(tmp_file.c_str());
+    }
+    return result;
+}
+
+static void remove_rename_record(const std::string& id)
+{
+    unlink(rename_journal_file(id, ".rename").c_str());
+    unlink(rename_journal_file(id, ".done").c_str());
+}
+
+// Adds the files in the local cache under dir (a path ending in '/') to names, relative to base.
+static void list_local_files(const std::string& dir, const std::string& base, std::vector<std::string>& names, name_set& seen)
+{
+    if (str_options.use_flat_cache)
+    {
+        std::vector<std::pair<std::string, bool>> children = file_cache_map::get_instance()->list_children(dir);
+        for (size_t i = 0; i < children.size(); i++)
+        {
+            std::string path = dir + children[i].first;
+            if (children[i].second)
+            {
+                list_local_files(path + "/", base, names, seen);
+            }
+            else if (seen.insert(path.substr(base.size())))
+            {
+                names.push_back(path.substr(base.size()));
+            }
+        }
+        return;
+    }
+
+    std::string mntPathString = prepend_mnt_path_string(dir);
+    DIR *dir_stream = opendir(mntPathString.c_str());
+    if (dir_stream == NULL)
+    {
+        return;
+    }
+    struct dirent* dir_ent;
+    while ((dir_ent = readdir(dir_stream)) != NULL)
+    {
+        if (dir_ent->d_name[0] == '.')
+        {
+            continue;
+        }
+        std::string path = dir + dir_ent->d_name;
+        if (dir_ent->d_type == DT_DIR)
+        {
+            list_local_files(path + "/", base, names, seen);
+        }
+        else if (seen.insert(path.substr(base.size())))
+        {
+            names.push_back(path.substr(base.size()));
+        }
+    }
+    closedir(dir_stream);
+}
+
+// Adds the blobs under the prefix to names, relative to the prefix, with a flat listing.  Directory marker blobs are moved like any other blob.
+// Returns 0 or the errno of the last failed call.
+static int list_service_files(const std::string& prefix, std::vector<std::string>& names, name_set& seen)
+{
+    static const int maxFailCount = 20;
+    std::string continuation;
+    bool success = false;
+    int failcount = 0;
+    do
+    {
+        errno = 0;
+        list_blobs_hierarchical_response response = azure_blob_client_wrapper->list_blobs_hierarchical(str_options.containerName, std::string(), continuation, prefix);
+        if (errno == 0)
+        {
+            success = true;
+            failcount = 0;
+            continuation = response.next_marker;
+            for (size_t i = 0; i < response.blobs.size(); i++)
+            {
+                std::string name = response.blobs[i].name.substr(prefix.size());
+                if (!name.empty() && seen.insert(name))
+                {
+                    names.push_back(name);
+                }
+            }
+        }
+        else
+        {
+            failcount++;
+            success = false;
+            syslog(LOG_WARNING, "Flat listing of prefix %s failed for the %d time with errno = %d.\n", prefix.c_str(), failcount, errno);
+        }
+    } while (((continuation.size() > 0) || !success) && (failcount < maxFailCount));
+    return success ? 0 : errno;
+}
+
+// Moves a file that is not in the local cache.  It was found by the listing, so it is copied without looking it up on the service first.
+static int move_service_file(const std::string& src, const std::string& dst, int& storage_errno)
+{
+    storage_errno = 0;
+    if (g_write_behind)
+    {
+        g_write_behind->cancel(dst);
+    }
+    auto fsrcmutex = file_lock_map::get_instance()->get_mutex(src);
+    std::lock_guard<std::mutex> locksrc(*fsrcmutex);
+    auto fdstmutex = file_lock_map::get_instance()->get_mutex(dst);
+    std::lock_guard<std::mutex> lockdst(*fdstmutex);
+    file_etag_map::get_instance()->remove_etag(dst);
+    return move_blob(src, dst, storage_errno);
+}
+
+// Moves one file, retrying while the service is busy.  A busy response from any worker makes all of them wait before their next call, and the wait
+// doubles with each retry of the same file.  Files in the local cache are moved with rename_single_file(), and the rest (including the directory
+// marker blob) with move_blob().
+static int move_file(const std::string& src, const std::string& dst, std::atomic<long long>& pause_until)
+{
+    for (int attempt = 1; ; attempt++)
+    {
+        long long wait = pause_until.load() - steady_now_ms();
+        if (wait > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+        }
+
+        int storage_errno = 0;
+        struct stat buf;
+        bool cached = (stat(prepend_mnt_path_string(src).c_str(), &buf) == 0) && S_ISREG(buf.st_mode);
+        int result = cached ? rename_single_file(src.c_str(), dst.c_str(), storage_errno) : move_service_file(src, dst, storage_errno);
+        // The file may have been moved before an earlier rename was interrupted, or deleted since it was listed.
+        if ((result == 0) || (result == -ENOENT))
+        {
+            return 0;
+        }
+        bool busy = (storage_errno == 503) || (storage_errno == 500);
+        if (!busy || (attempt >= RENAME_MAX_ATTEMPTS))
+        {
+            return result;
+        }
+
+        long long backoff = std::min((long long)RENAME_BACKOFF_MS << (attempt - 1), (long long)RENAME_MAX_BACKOFF_MS);
+        long long until = steady_now_ms() + backoff;
+        long long current = pause_until.load();
+        while ((current < until) && !pause_until.compare_exchange_weak(current, until))
+        {
+        }
+        syslog(LOG_WARNING, "Service busy (errno = %d) moving %s to %s; retrying in %lld ms.\n", storage_errno, src.c_str(), dst.c_str(), backoff);
+    }
+}
+
+// Removes the directories left empty under dir in the local cache, and dir itself.
+static void remove_empty_cache_directories(const std::string& mntPath)
+{
+    DIR *dir_stream = opendir(mntPath.c_str());
+    if (dir_stream == NULL)
+    {
+        return;
+    }
+    struct dirent* dir_ent;
+    while ((dir_ent = readdir(dir_stream)) != NULL)
+    {
+        std::string name(dir_ent->d_name);
+        if ((dir_ent->d_type == DT_DIR) && (name != ".") && (name != ".."))
+        {
+            remove_empty_cache_directories(mntPath + "/" + name);
+        }
+    }
+    closedir(dir_stream);
+    rmdir(mntPath.c_str());
+}
+
+// Moves the directory marker blob and the files of a rename, skipping those in done, then removes the source directory.  Returns 0 or the first error.
+// The journal is removed either way: a rename that reported an error is not finished later.  Only a rename interrupted by a crash or unmount is left in
+// the journal for the next mount.
+static int run_directory_rename(const directory_rename& rename_job, const name_set& done)
+{
+    std::atomic<long long> pause_until(0);
+    std::atomic<int> first_error(0);
+    std::atomic<size_t> failed(0);
+
+    // Rename the directory blob, if it exists.
+    errno = 0;
+    blob_property props = azure_blob_client_wrapper->get_blob_property(str_options.containerName, rename_job.src.substr(1));
+    if ((errno == 0) && props.valid() && is_directory_blob(props.size, props.metadata))
+    {
+        int result = move_file(rename_job.src, rename_job.dst, pause_until);
+        if (result != 0)
+        {
+            syslog(LOG_ERR, "Failed to move the directory blob of %s to %s.  errno = %d.\n", rename_job.src.c_str(), rename_job.dst.c_str(), -result);
+            first_error = result;
+            failed++;
+        }
+    }
+    else if ((errno != 0) && (errno != 404) && (errno != ENOENT))
+    {
+        int storage_errno = errno;
+        syslog(LOG_ERR, "Failed to get properties of directory %s to rename it.  errno = %d.\n", rename_job.src.c_str(), storage_errno);
+        remove_rename_record(rename_job.id);
+        return 0 - map_errno(storage_errno);
+    }
+
+    std::string done_file = rename_journal_file(rename_job.id, ".done");
+    int done_fd = open(done_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    std::mutex done_mutex;
+
+    std::atomic<size_t> next(0);
+    size_t concurrency = std::max((size_t)1, std::min(str_options.rename_concurrency, rename_job.names.size()));
+    std::vector<std::future<void>> task_list;
+    for (size_t i = 0; i < concurrency; i++)
+    {
+        task_list.push_back(std::async(std::launch::async, [&]() {
+            for (size_t idx = next++; idx < rename_job.names.size(); idx = next++)
+            {
+                const std::string& name = rename_job.names[idx];
+                if (done.contains(name))
+                {
+                    continue;
+                }
+                int result = move_file(rename_job.src + "/" + name, rename_job.dst + "/" + name, pause_until);
+                if (result != 0)
+                {
+                    syslog(LOG_ERR, "Failed to move %s from directory %s to %s.  errno = %d.\n", name.c_str(), rename_job.src.c_str(), rename_job.dst.c_str(), -result);
+                    int expected = 0;
+                    first_error.compare_exchange_strong(expected, result);
+                    failed++;
+                    continue;
+                }
+                // Progress isn't synced: a file whose record is lost is moved again on resume, and is found to be gone already.
+                if (done_fd != -1)
+                {
+                    std::string record = name + "\n";
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    write_all(done_fd, record.data(), record.size());
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < task_list.size(); i++)
+    {
+        task_list[i].get();
+    }
+    if (done_fd != -1)
+    {
+        close(done_fd);
+    }
+
+    namespace_tree::get_instance()->invalidate(rename_job.src);
+    if (failed > 0)
+    {
+        syslog(LOG_ERR, "Rename of directory %s to %s failed for %s blobs (of %s files); the blobs that were moved stay in %s.\n",
+            rename_job.src.c_str(), rename_job.dst.c_str(), to_str(failed.load()).c_str(), to_str(rename_job.names.size()).c_str(), rename_job.dst.c_str());
+        remove_rename_record(rename_job.id);
+        return first_error.load();
+    }
+
+    if (!str_options.use_flat_cache)
+    {
+        remove_empty_cache_directories(prepend_mnt_path_string(rename_job.src));
+    }
+    azs_rmdir(rename_job.src.c_str());
+    remove_rename_record(rename_job.id);
+    return 0;
+}
+
+int azs_rename_directory(const char *src, const char *dst)
+{
+    AZS_DEBUGLOGV("azs_rename_directory called with src = %s, dst = %s.\n", src, dst);
+    time_t start_time = time(NULL);
+
+    // Files that are still waiting to be uploaded wouldn't be found on the service below.
+    if (g_write_behind)
+    {
+        int upload_result = g_write_behind->wait(src);
+        if (upload_result != 0)
+        {
+            return upload_result;
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(s_resume_mutex);
+        s_resume_cv.wait(lock, []() { return !s_resuming; });
+    }
+
+    // IDs are zero-padded so that sorting them as strings puts the renames in the order they were started.
+    char id[48];
+    snprintf(id, sizeof(id), "%020llu-%020llu", (unsigned long long)time(NULL), s_next_rename_id++);
+    directory_rename rename_job;
+    rename_job.id = id;
+    rename_job.src = src;
+    rename_job.dst = dst;
+    while ((rename_job.src.size() > 1) && (rename_job.src.back() == '/'))
+    {
+        rename_job.src.pop_back();
+    }
+    while ((rename_job.dst.size() > 1) && (rename_job.dst.back() == '/'))
+    {
+        rename_job.dst.pop_back();
+    }
+
+    // List everything under the directory once: the files in the local cache, and then the blobs that aren't among them.
+    name_set seen;
+    list_local_files(rename_job.src + "/", rename_job.src + "/", rename_job.names, seen);
+    int result = list_service_files(rename_job.src.substr(1) + "/", rename_job.names, seen);
+    if (result != 0)
+    {
+        syslog(LOG_ERR, "list blobs operation failed during attempt to rename directory %s to %s.  errno = %d.\n", src, dst, result);
+        return 0 - map_errno(result);
+    }
+    if (!str_options.use_flat_cache)
+    {
+        ensure_files_directory_exists_in_cache(prepend_mnt_path_string(rename_job.dst + "/placeholder"));
+    }
+
+    result = write_rename_record(rename_job);
+    if (result != 0)
+    {
+        syslog(LOG_WARNING, "Failed to journal rename of directory %s to %s; it can't be resumed if interrupted.  errno = %d.\n", src, dst, result);
+    }
+    result = run_directory_rename(rename_job, name_set());
+    syslog(LOG_INFO, "Renamed directory %s to %s (%s files) in %s seconds.\n", src, dst, to_str(rename_job.names.size()).c_str(),
+        to_str(time(NULL) - start_time).c_str());
+    return result;
+}
+
+void resume_directory_renames()
+{
+    std::string journal_dir = rename_journal_dir();
+    if ((mkdir(journal_dir.c_str(), S_IRWXU) != 0) && (errno != EEXIST))
+    {
+        syslog(LOG_ERR, "Failed to create directory rename journal %s.  errno = %d.\n", journal_dir.c_str(), errno);
+        return;
+    }
+    DIR *dir = opendir(journal_dir.c_str());
+    if (dir == NULL)
+    {
+        syslog(LOG_ERR, "Failed to open directory rename journal %s.  errno = %d.\n", journal_dir.c_str(), errno);
+        return;
+    }
+
+    std::vector<std::string> ids;
+    std::vector<std::string> leftovers;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        std::string name(entry->d_name);
+        size_t dot = name.find('.');
+        if ((dot == std::string::npos) || (dot == 0))
+        {
+            continue;
+        }
+        std::string extension = name.substr(dot);
+        if (extension == ".rename")
+        {
+            ids.push_back(name.substr(0, dot));
+        }
+        else if (extension == ".tmp")
+        {
+            // Records that were never completed; the rename never started.
+            leftovers.push_back(journal_dir + "/" + name);
+        }
+    }
+    closedir(dir);
+    for (size_t i = 0; i < leftovers.size(); i++)
+    {
+        unlink(leftovers[i].c_str());
+    }
+
+    // Renames are resumed in the order they were started.
+    std::sort(ids.begin(), ids.end());
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        directory_rename rename_job;
+        rename_job.id = ids[i];
+        std::ifstream record(rename_journal_file(ids[i], ".rename"));
+        std::string name;
+        if (!std::getline(record, rename_job.src) || !std::getline(record, rename_job.dst) || rename_job.src.empty() || rename_job.dst.empty())
+        {
+            syslog(LOG_ERR, "Discarding unreadable directory rename journal %s.\n", ids[i].c_str());
+            remove_rename_record(ids[i]);
+            continue;
+        }
+        while (std::getline(record, name))
+        {
+            rename_job.names.push_back(name);
+        }
+
+        name_set done;
+        std::ifstream done_record(rename_journal_file(ids[i], ".done"));
+        while (std::getline(done_record, name))
+        {
+            done.insert(name);
+        }
+
+        syslog(LOG_INFO, "Resuming rename of directory %s to %s; %s of %s files were moved.\n", rename_job.src.c_str(), rename_job.dst.c_str(),
+            to_str(done.size()).c_str(), to_str(rename_job.names.size()).c_str());
+        run_directory_rename(rename_job, done);
+        missing_path_map::get_instance()->remove_path(rename_job.dst);
+        namespace_tree::get_instance()->invalidate(rename_job.dst);
+    }
+}
+
+void start_resuming_directory_renames()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_resume_mutex);
+        s_resuming = true;
+    }
+    std::thread([]() {
+        resume_directory_renames();
+        std::lock_guard<std::mutex> lock(s_resume_mutex);
+        s_resuming = false;
+        s_resume_cv.notify_all();
+    }).detach();
+}
@@ -0,0 +1,696 @@
+#include "blobfuse.h"
+#include <fcntl.h>
+#include <climits>
+#include <iterator>
+#include <atomic>
+#include <future>
+#include <uuid/uuid.h>
+#include "base64.h"
+
+std::shared_ptr<worker_pool> g_streaming_upload_pool;
+
+file_write_map* file_write_map::get_instance()
+{
+    if(nullptr == s_instance.get())
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if(nullptr == s_instance.get())
+        {
+            s_instance.reset(new file_write_map());
+        }
+    }
+    return s_instance.get();
+}
+
+std::shared_ptr<file_write_state> file_write_map::get_state(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_write_map.find(path);
+    if(iter == m_write_map.end())
+    {
+        return nullptr;
+    }
+    return iter->second;
+}
+
+std::shared_ptr<file_write_state> file_write_map::get_or_create_state(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_write_map.find(path);
+    if(iter == m_write_map.end())
+    {
+        auto state = std::make_shared<file_write_state>();
+        m_write_map[path] = state;
+        return state;
+    }
+    return iter->second;
+}
+
+void file_write_map::remove_state(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_write_map.erase(path);
+}
+
+void file_write_map::rename_state(const std::string& src, const std::string& dst)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_write_map.erase(dst);
+    auto iter = m_write_map.find(src);
+    if(iter != m_write_map.end())
+    {
+        m_write_map[dst] = iter->second;
+        m_write_map.erase(iter);
+    }
+}
+
+std::shared_ptr<file_write_map> file_write_map::s_instance;
+std::mutex file_write_map::s_mutex;
+
+void file_write_state::add_dirty(unsigned long long offset, unsigned long long size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    add_dirty_locked(offset, offset + size);
+    drop_staged_locked(offset, offset + size);
+    m_generation++;
+}
+
+void file_write_state::truncate(unsigned long long size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    add_dirty_locked(size, ULLONG_MAX);
+    drop_staged_locked(size, ULLONG_MAX);
+    m_stream_end = std::min(m_stream_end, size);
+    m_generation++;
+}
+
+void file_write_state::mark_modified()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_generation++;
+}
+
+bool file_write_state::is_clean()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_generation == std::max(m_uploaded_generation, m_queued_generation);
+}
+
+// Inserts [start, end), merging it with any ranges it overlaps or touches.
+void file_write_state::add_dirty_locked(unsigned long long start, unsigned long long end)
+{
+    auto iter = m_dirty.upper_bound(start);
+    if ((iter != m_dirty.begin()) && (std::prev(iter)->second >= start))
+    {
+        --iter;
+        start = iter->first;
+    }
+    while ((iter != m_dirty.end()) && (iter->first <= end))
+    {
+        end = std::max(end, iter->second);
+        iter = m_dirty.erase(iter);
+    }
+    m_dirty[start] = end;
+}
+
+// Forgets the staged blocks that overlap [start, end), because they no longer match the file.
+void file_write_state::drop_staged_locked(unsigned long long start, unsigned long long end)
+{
+    // Staged blocks are all INCREMENTAL_UPLOAD_BLOCK_SIZE long, so only blocks starting less than that before start can overlap.
+    unsigned long long first = (start >= INCREMENTAL_UPLOAD_BLOCK_SIZE) ? start - INCREMENTAL_UPLOAD_BLOCK_SIZE + 1 : 0;
+    for (auto iter = m_staged.lower_bound(first); (iter != m_staged.end()) && (iter->first < end);)
+    {
+        if (iter->first + iter->second.size > start)
+        {
+            iter = m_staged.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+    for (auto iter = m_staging.lower_bound(first); (iter != m_staging.end()) && (iter->first < end); ++iter)
+    {
+        if (iter->first + iter->second.block.size > start)
+        {
+            iter->second.valid = false;
+        }
+    }
+}
+
+// Forgets all staged blocks.  Committing a blob makes the service discard any uncommitted blocks that weren't part of the commit.
+void file_write_state::discard_staged_locked()
+{
+    m_stage_epoch++;
+    m_staged.clear();
+    for (auto iter = m_staging.begin(); iter != m_staging.end(); ++iter)
+    {
+        iter->second.valid = false;
+    }
+}
+
+write_snapshot file_write_state::take_snapshot()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Blocks that are being staged right now are likely to be part of this upload, so let them finish rather than upload them again.
+    std::vector<unsigned long long> in_flight;
+    for (auto iter = m_staging.begin(); iter != m_staging.end(); ++iter)
+    {
+        in_flight.push_back(iter->first);
+    }
+    m_staging_cv.wait(lock, [this, &in_flight]() {
+        for (size_t i = 0; i < in_flight.size(); i++)
+        {
+            if (m_staging.find(in_flight[i]) != m_staging.end())
+            {
+                return false;
+            }
+        }
+        return true;
+    });
+
+    write_snapshot snapshot;
+    snapshot.dirty.swap(m_dirty);
+    snapshot.staged.swap(m_staged);
+    snapshot.staged_blob = m_staged_blob;
+    snapshot.generation = m_generation;
+    return snapshot;
+}
+
+void file_write_state::restore(const write_snapshot& snapshot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto iter = snapshot.dirty.begin(); iter != snapshot.dirty.end(); ++iter)
+    {
+        add_dirty_locked(iter->first, iter->second);
+    }
+    // We don't know whether the failed upload committed anything, so the blocks staged since can't be trusted either.
+    discard_staged_locked();
+}
+
+void file_write_state::mark_uploaded(const write_snapshot& snapshot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_uploaded_generation = std::max(m_uploaded_generation, snapshot.generation);
+    discard_staged_locked();
+}
+
+void file_write_state::mark_queued(unsigned long long generation)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queued_generation = std::max(m_queued_generation, generation);
+}
+
+void file_write_state::clear_queued()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queued_generation = m_uploaded_generation;
+}
+
+bool file_write_state::has_base(const std::string& blob)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_base_blob.empty() && (m_base_blob == blob);
+}
+
+bool file_write_state::get_base(const std::string& blob, std::vector<get_block_list_item>& blocks)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_base_blob.empty() || (m_base_blob != blob))
+    {
+        return false;
+    }
+    blocks = m_base_blocks;
+    return true;
+}
+
+void file_write_state::set_base(const std::string& blob, const std::vector<get_block_list_item>& blocks)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_base_blob = blob;
+    m_base_blocks = blocks;
+
+    // Everything up to the end of the committed blocks is already on the service; appends are streamed from there.
+    unsigned long long total = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        total += blocks[i].size;
+    }
+    m_stream_end = std::max(m_stream_end, total);
+}
+
+void file_write_state::clear_base()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_base_blob.clear();
+    m_base_blocks.clear();
+}
+
+static std::string new_block_id(size_t id_length);
+
+bool file_write_state::next_block_to_stage(const std::string& blob, unsigned long long& offset, unsigned long long& size, std::string& id, unsigned long long& epoch)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_staging.size() >= MAX_STAGING_BLOCKS)
+    {
+        return false;
+    }
+    if (m_staged_blob != blob)
+    {
+        // The file has been renamed; blocks staged for the old blob are no use.
+        discard_staged_locked();
+        m_staged_blob = blob;
+    }
+
+    // The next block is ready once a single written range covers it, and the stream is long enough to be worth it.
+    auto iter = m_dirty.upper_bound(m_stream_end);
+    if (iter == m_dirty.begin())
+    {
+        return false;
+    }
+    --iter;
+    unsigned long long end = m_stream_end + INCREMENTAL_UPLOAD_BLOCK_SIZE;
+    if ((iter->second < end) || (iter->second <= INCREMENTAL_UPLOAD_MIN_SIZE))
+    {
+        return false;
+    }
+
+    offset = m_stream_end;
+    size = INCREMENTAL_UPLOAD_BLOCK_SIZE;
+    id = new_block_id(((m_base_blob == blob) && !m_base_blocks.empty()) ? m_base_blocks[0].name.size() : 48);
+    epoch = m_stage_epoch;
+    staging_block staging;
+    staging.block.size = size;
+    staging.block.id = id;
+    staging.epoch = epoch;
+    staging.valid = true;
+    m_staging[offset] = staging;
+    m_stream_end = end;
+    return true;
+}
+
+void file_write_state::complete_staging(unsigned long long offset, unsigned long long epoch, bool success)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_staging.find(offset);
+    if (iter == m_staging.end())
+    {
+        return;
+    }
+    if (success && iter->second.valid && (iter->second.epoch == m_stage_epoch) && (epoch == m_stage_epoch))
+    {
+        m_staged[offset] = iter->second.block;
+    }
+    m_staging.erase(iter);
+    m_staging_cv.notify_all();
+}
+
+bool fetch_committed_blocks(const std::string& blob, unsigned long long size, std::vector<get_block_list_item>& blocks)
+{
+    errno = 0;
+    get_block_list_response response = azure_blob_client_wrapper->get_block_list(str_options.containerName, blob);
+    if (errno != 0)
+    {
+        syslog(LOG_WARNING, "Failed to get the block list of blob %s; the next upload will upload the whole file.  errno = %d.\n", blob.c_str(), errno);
+        return false;
+    }
+
+    // Block IDs within a blob must all have the same length, and the IDs we generate for new blocks are derived from that length.
+    unsigned long long total = 0;
+    for (size_t i = 0; i < response.committed.size(); i++)
+    {
+        const std::string& id = response.committed[i].name;
+        if ((id.size() < 24) || (id.size() % 4 != 0) || (id.size() != response.committed[0].name.size()))
+        {
+            AZS_DEBUGLOGV("Not using the block list of blob %s for incremental uploads, because of its block IDs.\n", blob.c_str());
+            return false;
+        }
+        total += response.committed[i].size;
+    }
+    if (response.committed.empty() || (total != size))
+    {
+        AZS_DEBUGLOGV("Not using the block list of blob %s for incremental uploads; committed blocks add up to %s bytes, file is %s bytes.\n", blob.c_str(), to_str(total).c_str(), to_str(size).c_str());
+        return false;
+    }
+    blocks.swap(response.committed);
+    return true;
+}
+
+void load_committed_blocks(const std::string& path, int fd, bool fresh)
+{
+    struct stat buf;
+    if ((fstat(fd, &buf) != 0) || ((unsigned long long)buf.st_size <= INCREMENTAL_UPLOAD_MIN_SIZE))
+    {
+        return;
+    }
+
+    std::string blob = path.substr(1);
+    std::shared_ptr<file_write_state> writes = file_write_map::get_instance()->get_or_create_state(path);
+    if (writes->has_base(blob))
+    {
+        return;
+    }
+
+    // The block list is only useful if the file in the cache holds exactly the blob's current contents.  That is the case if we just downloaded it.
+    // Otherwise, compare against the blob's properties: azs_open() sets the mtime of a downloaded file to the blob's last modified time, so a file that
+    // hasn't been written to since still has it.
+    if (!fresh)
+    {
+        errno = 0;
+        blob_property props = azure_blob_client_wrapper->get_blob_property(str_options.containerName, blob);
+        if ((errno != 0) || !props.valid() || (props.size != (unsigned long long)buf.st_size) || (props.last_modified != buf.st_mtime))
+        {
+            AZS_DEBUGLOGV("File %s in the cache may not match blob %s; not using the block list for incremental uploads.\n", path.c_str(), blob.c_str());
+            return;
+        }
+    }
+
+    std::vector<get_block_list_item> blocks;
+    if (fetch_committed_blocks(blob, buf.st_size, blocks))
+    {
+        AZS_DEBUGLOGV("Loaded %s committed blocks of blob %s.\n", to_str(blocks.size()).c_str(), blob.c_str());
+        writes->set_base(blob, blocks);
+    }
+}
+
+// Generates a new block ID with the same length as the blob's existing block IDs, which the service requires.
+static std::string new_block_id(size_t id_length)
+{
+    uuid_t uuid;
+    char uuid_cstr[37]; // 36 byte uuid plus null.
+    uuid_generate(uuid);
+    uuid_unparse(uuid, uuid_cstr);
+
+    // id_length is a multiple of 4, so encoding 3/4 of that many bytes gives an ID of exactly id_length characters.
+    std::string raw(uuid_cstr, 36);
+    raw.resize(id_length / 4 * 3, '-');
+    return to_base64(std::vector<unsigned char>(raw.begin(), raw.end()));
+}
+
+std::vector<upload_segment> plan_upload(const std::vector<get_block_list_item>& base, const std::map<unsigned long long, staged_block>& staged,
+    const std::map<unsigned long long, unsigned long long>& dirty, unsigned long long size, size_t id_length)
+{
+    // The blocks that can be reused, by offset.  Staged blocks are newer than the committed blocks they overlap.
+    std::map<unsigned long long, upload_segment> reusable;
+    unsigned long long offset = 0;
+    for (size_t i = 0; (i < base.size()) && (offset < size); i++)
+    {
+        unsigned long long end = offset + base[i].size;
+        bool clean = (end <= size);
+        if (clean)
+        {
+            // Find the first dirty range that ends after this block starts, and check whether it starts before the block ends.
+            auto iter = dirty.upper_bound(offset);
+            if ((iter != dirty.begin()) && (std::prev(iter)->second > offset))
+            {
+                --iter;
+            }
+            clean = (iter == dirty.end()) || (iter->first >= end);
+        }
+        if (clean)
+        {
+            upload_segment segment;
+            segment.id = base[i].name;
+            segment.committed = true;
+            segment.uploaded = true;
+            segment.offset = offset;
+            segment.size = base[i].size;
+            reusable[offset] = segment;
+        }
+        offset = end;
+    }
+    for (auto iter = staged.begin(); iter != staged.end(); ++iter)
+    {
+        if ((iter->first + iter->second.size <= size) && (iter->second.id.size() == id_length))
+        {
+            upload_segment segment;
+            segment.id = iter->second.id;
+            segment.committed = false;
+            segment.uploaded = true;
+            segment.offset = iter->first;
+            segment.size = iter->second.size;
+            reusable[iter->first] = segment;
+        }
+    }
+
+    std::vector<upload_segment> segments;
+    unsigned long long pending_start = 0; // Start of the range not yet covered by a segment.
+    while (pending_start < size)
+    {
+        auto iter = reusable.find(pending_start);
+        if (iter != reusable.end())
+        {
+            segments.push_back(iter->second);
+            pending_start += iter->second.size;
+            continue;
+        }
+
+        // Fill the gap up to the next reusable block.  Reusable blocks that start inside a segment already planned are skipped.
+        iter = reusable.upper_bound(pending_start);
+        unsigned long long end = (iter == reusable.end()) ? size : iter->first;
+        while (pending_start < end)
+        {
+            upload_segment segment;
+            segment.id = new_block_id(id_length);
+            segment.committed = false;
+            segment.uploaded = false;
+            segment.offset = pending_start;
+            segment.size = std::min(end - pending_start, INCREMENTAL_UPLOAD_BLOCK_SIZE);
+            segments.push_back(segment);
+            pending_start += segment.size;
+        }
+    }
+    if (segments.size() > MAX_BLOCK_COUNT)
+    {
+        segments.clear();
+    }
+    return segments;
+}
+
+// Reads [offset, offset + size) from the file and uploads it as a block.  Returns 0 or a storage errno.
+static int upload_block_from_file(int fd, const std::string& blob, const upload_segment& segment)
+{
+    std::string buffer(segment.size, '\0');
+    size_t read_bytes = 0;
+    while (read_bytes < segment.size)
+    {
+        ssize_t res = pread(fd, &buffer[read_bytes], segment.size - read_bytes, segment.offset + read_bytes);
+        if (res <= 0)
+        {
+            syslog(LOG_ERR, "Failed to read from cache file to upload a block of blob %s.  errno = %d.\n", blob.c_str(), errno);
+            return res == 0 ? EIO : errno;
+        }
+        read_bytes += res;
+    }
+
+    std::istringstream is(buffer);
+    errno = 0;
+    azure_blob_client_wrapper->upload_block_from_stream(str_options.containerName, blob, segment.id, is);
+    return errno;
+}
+
+// Uploads the modified parts of the file as new blocks, and commits them along with the unmodified committed blocks.
+// Returns 0 or a storage errno; on success, new_base holds the blob's new committed block list.
+static int upload_modified_blocks(const std::string& mntPath, const std::string& blob, const std::vector<upload_segment>& segments, std::vector<get_block_list_item>& new_base)
+{
+    int fd = open(mntPath.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        return errno;
+    }
+
+    // Upload in parallel, with the same parallelism upload_file_to_blob is given.
+    static const size_t max_uploaders = 8;
+    std::vector<size_t> to_upload;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        if (!segments[i].uploaded)
+        {
+            to_upload.push_back(i);
+        }
+    }
+    AZS_DEBUGLOGV("Uploading %s modified blocks of blob %s, reusing %s committed or staged blocks.\n", to_str(to_upload.size()).c_str(), blob.c_str(), to_str(segments.size() - to_upload.size()).c_str());
+
+    std::atomic<size_t> next(0);
+    std::vector<std::future<int>> task_list;
+    for (size_t i = 0; i < std::min(max_uploaders, to_upload.size()); i++)
+    {
+        task_list.push_back(std::async(std::launch::async, [&]() {
+            int result = 0;
+            for (size_t idx = next++; (idx < to_upload.size()) && (result == 0); idx = next++)
+            {
+                result = upload_block_from_file(fd, blob, segments[to_upload[idx]]);
+            }
+            return result;
+        }));
+    }
+    int result = 0;
+    for (size_t i = 0; i < task_list.size(); i++)
+    {
+        int task_result = task_list[i].get();
+        if (result == 0)
+        {
+            result = task_result;
+        }
+    }
+    close(fd);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    std::vector<put_block_list_request_base::block_item> block_list;
+    unsigned long long size = 0;
+    new_base.clear();
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        size += segments[i].size;
+        put_block_list_request_base::block_item item;
+        item.id = segments[i].id;
+        item.type = segments[i].committed ? put_block_list_request_base::block_type::committed : put_block_list_request_base::block_type::uncommitted;
+        block_list.push_back(item);
+
+        get_block_list_item base_item;
+        base_item.name = segments[i].id;
+        base_item.size = segments[i].size;
+        new_base.push_back(base_item);
+    }
+
+    std::vector<std::pair<std::string, std::string>> metadata;
+    blob_property props(false);
+    errno = 0;
+    azure_blob_client_wrapper->put_block_list(str_options.containerName, blob, block_list, metadata, size, props);
+    return errno;
+}
+
+int upload_cache_file(const std::string& path, const std::string& mntPath)
+{
+    std::shared_ptr<file_write_state> writes = file_write_map::get_instance()->get_or_create_state(path);
+
+    // Take the dirty ranges before looking at the file: anything written from here on is recorded again, and uploaded by the next flush.
+    write_snapshot snapshot = writes->take_snapshot();
+    struct stat buf;
+    if (stat(mntPath.c_str(), &buf) != 0)
+    {
+        int stat_errno = errno;
+        writes->restore(snapshot);
+        return -stat_errno;
+    }
+    return upload_file_contents(writes, path, mntPath, buf.st_size, snapshot);
+}
+
+int upload_file_contents(std::shared_ptr<file_write_state> writes, const std::string& path, const std::string& source_path, unsigned long long size,
+    const write_snapshot& snapshot)
+{
+    std::string blob = path.substr(1);
+    std::vector<get_block_list_item> base;
+    std::vector<upload_segment> segments;
+    bool have_base = (size > INCREMENTAL_UPLOAD_MIN_SIZE) && writes->get_base(blob, base);
+    bool have_staged = (snapshot.staged_blob == blob) && !snapshot.staged.empty();
+    if (have_base || have_staged)
+    {
+        size_t id_length = have_base ? base[0].name.size() : snapshot.staged.begin()->second.id.size();
+        if (!have_base)
+        {
+            base.clear();
+        }
+        segments = plan_upload(base, have_staged ? snapshot.staged : std::map<unsigned long long, staged_block>(), snapshot.dirty, size, id_length);
+        if (segments.empty() && (size > 0))
+        {
+            AZS_DEBUGLOGV("Incremental upload of blob %s would need more than %d blocks; uploading the whole file instead.\n", blob.c_str(), MAX_BLOCK_COUNT);
+        }
+    }
+
+    if (!segments.empty())
+    {
+        std::vector<get_block_list_item> new_base;
+        int storage_errno = upload_modified_blocks(source_path, blob, segments, new_base);
+        namespace_tree::get_instance()->invalidate(path);
+        if (storage_errno == 0)
+        {
+            writes->set_base(blob, new_base);
+            writes->mark_uploaded(snapshot);
+            return 0;
+        }
+
+        // Uncommitted blocks that were uploaded are garbage collected by the service.  Whether or not the block list was committed, our view of it can't be
+        // trusted any more; commonly the blob was rewritten elsewhere and the committed IDs are gone.  Upload the whole file instead.
+        syslog(LOG_WARNING, "Incremental upload of blob %s failed; uploading the whole file.  errno = %d.\n", blob.c_str(), storage_errno);
+        writes->clear_base();
+    }
+
+    std::vector<std::pair<std::string, std::string>> metadata;
+    errno = 0;
+    blob_property props(false);
+    azure_blob_client_wrapper->upload_file_to_blob(source_path, str_options.containerName, blob, metadata, 8, props);
+    int storage_errno = errno;
+    namespace_tree::get_instance()->invalidate(path);
+    if (storage_errno != 0)
+    {
+        writes->clear_base();
+        writes->restore(snapshot);
+        return 0 - map_errno(storage_errno);
+    }
+
+    writes->mark_uploaded(snapshot);
+
+    // The storage library chooses its own block IDs, so fetch them for the next flush.
+    writes->clear_base();
+    std::vector<get_block_list_item> new_base;
+    if ((size > INCREMENTAL_UPLOAD_MIN_SIZE) && fetch_committed_blocks(blob, size, new_base))
+    {
+        writes->set_base(blob, new_base);
+    }
+    return 0;
+}
+
+void stage_written_blocks(struct fhwrapper *fhwrap, const std::string& path)
+{
+    std::shared_ptr<file_write_state> writes = fhwrap->writes;
+    if (!writes)
+    {
+        return;
+    }
+
+    std::string blob = path.substr(1);
+    std::shared_ptr<int> fd;
+    unsigned long long offset, size, epoch;
+    std::string id;
+    while (writes->next_block_to_stage(blob, offset, size, id, epoch))
+    {
+        if (!fd)
+        {
+            // The handle may be write-only, so read the blocks through a descriptor of our own, shared by the uploads and closed after the last one.
+            std::string fd_path = "/proc/self/fd/" + std::to_string(fhwrap->fh);
+            int read_fd = open(fd_path.c_str(), O_RDONLY);
+            if (read_fd == -1)
+            {
+                syslog(LOG_WARNING, "Failed to open %s to stage blocks of blob %s.  errno = %d.\n", fd_path.c_str(), blob.c_str(), errno);
+                writes->complete_staging(offset, epoch, false);
+                return;
+            }
+            fd = std::shared_ptr<int>(new int(read_fd), [](int *p) { close(*p); delete p; });
+        }
+
+        AZS_DEBUGLOGV("Staging block at offset %s of blob %s.\n", to_str(offset).c_str(), blob.c_str());
+        upload_segment segment;
+        segment.id = id;
+        segment.committed = false;
+        segment.uploaded = false;
+        segment.offset = offset;
+        segment.size = size;
+        g_streaming_upload_pool->submit([writes, fd, blob, segment, epoch]() {
+            int result = upload_block_from_file(*fd, blob, segment);
+            if (result != 0)
+            {
+                syslog(LOG_WARNING, "Failed to stage block at offset %llu of blob %s.  errno = %d.  It will be uploaded on flush.\n", segment.offset, blob.c_str(), result);
+            }
+            writes->complete_staging(segment.offset, epoch, result == 0);
+        });
+    }
+}
@@ -2,6 +2,7 @@
 #include <sys/file.h>
 
 gc_cache g_gc_cache;
+std::shared_ptr<worker_pool> g_read_ahead_pool;
 
 int map_errno(int error)
 {
@@ -19,6 +20,10 @@ int map_errno(int error)
 
 std::string prepend_mnt_path_string(const std::string& path)
 {
+    if (str_options.use_flat_cache)
+    {
+        return file_cache_map::get_instance()->get_cache_path(path);
+    }
     std::string result;
     result.reserve(str_options.tmpPath.length() + 5 + path.length());
     return result.append(str_options.tmpPath).append("/root").append(path);
@@ -35,16 +40,26 @@ bool gc_cache::check_disk_space()
         return false;
     }
 
-    //calculating the percentage of the amount of used space on the cached disk
     //<used space in bytes> = <total size of disk in bytes> - <size of available disk space in bytes>
-    //<used percent of cached disk >= <used space> / <total size>
     //f_frsize - the fundamental file system block size (in bytes) (used to convert file system blocks to bytes)
     //f_blocks - total number of blocks on the filesystem/disk in the units of f_frsize
     //f_bfree - total number of free blocks in units of f_frsize
-    double total = buf.f_blocks * buf.f_frsize;
-    double available = buf.f_bfree * buf.f_frsize;
-    double used = total - available;
-    double used_percent = (double)(used / total) * (double)100;
+    m_disk_total_bytes = (unsigned long long)buf.f_blocks * buf.f_frsize;
+    m_disk_used_bytes = m_disk_total_bytes - (unsigned long long)buf.f_bfree * buf.f_frsize;
+    return disk_over_threshold();
+}
+
+// Compares the last known disk usage against the thresholds.  Between calls to check_disk_space(), the usage is kept up to date by subtracting the
+// size of each file the GC deletes.
+bool gc_cache::disk_over_threshold()
+{
+    if (m_disk_total_bytes == 0)
+    {
+        return false;
+    }
+
+    //<used percent of cached disk >= <used space> / <total size>
+    double used_percent = (double)m_disk_used_bytes / (double)m_disk_total_bytes * (double)100;
 
     if(used_percent >= high_threshold && !disk_threshold_reached)
     {
@@ -59,13 +74,132 @@ bool gc_cache::check_disk_space()
 
 void gc_cache::add_file(std::string path)
 {
+    touch_file(path);
+
     file_to_delete file;
     file.path = path;
     file.closed_time = time(NULL); 
     
-    // lock before updating deque
+    // lock before updating the heap
+    std::lock_guard<std::mutex> lock(m_deque_lock);
+    m_cleanup.push(file);
+    // Files are closed in order, so the GC thread only needs waking if it is sleeping without a file to wait for.
+    if (m_cleanup.size() == 1)
+    {
+        m_wakeup = true;
+        m_cv.notify_one();
+    }
+}
+
+// Wakes the GC thread up to look at the cache again.
+void gc_cache::wake()
+{
     std::lock_guard<std::mutex> lock(m_deque_lock);
-    m_cleanup.push_back(file);
+    m_wakeup = true;
+    m_cv.notify_one();
+}
+
+// Records an access to the file in the cache: moves it to the front of the LRU list, and updates its size.
+void gc_cache::touch_file(const std::string& path)
+{
+    update_file(path, time(NULL));
+}
+
+// Adds a file that was left in the cache by an earlier mount.  Files must be added in the order they were last used.
+void gc_cache::add_cached_file(const std::string& path, time_t last_access)
+{
+    update_file(path, last_access);
+
+    file_to_delete file;
+    file.path = path;
+    file.closed_time = last_access;
+    std::lock_guard<std::mutex> lock(m_deque_lock);
+    m_cleanup.push(file);
+    m_wakeup = true;
+    m_cv.notify_one();
+}
+
+// Returns the files in the cache, most recently used first.
+std::vector<cached_file> gc_cache::get_cached_files()
+{
+    std::lock_guard<std::mutex> lock(m_lru_lock);
+    std::vector<cached_file> files;
+    files.reserve(m_lru.size());
+    for (auto iter = m_lru.begin(); iter != m_lru.end(); ++iter)
+    {
+        cached_file file;
+        file.path = *iter;
+        file.last_access = m_lru_map[*iter].last_access;
+        files.push_back(file);
+    }
+    return files;
+}
+
+void gc_cache::update_file(const std::string& path, time_t last_access)
+{
+    // Count the space the file takes up on disk; files of the block cache are sparse.
+    struct stat buf;
+    if (stat(prepend_mnt_path_string(path).c_str(), &buf) != 0)
+    {
+        return;
+    }
+    unsigned long long size = (unsigned long long)buf.st_blocks * 512;
+
+    bool over_budget;
+    {
+        std::lock_guard<std::mutex> lock(m_lru_lock);
+        auto iter = m_lru_map.find(path);
+        if (iter == m_lru_map.end())
+        {
+            m_lru.push_front(path);
+            lru_entry entry;
+            entry.position = m_lru.begin();
+            entry.size = size;
+            entry.last_access = last_access;
+            m_lru_map[path] = entry;
+        }
+        else
+        {
+            m_lru.splice(m_lru.begin(), m_lru, iter->second.position);
+            m_cached_bytes -= iter->second.size;
+            iter->second.size = size;
+            iter->second.last_access = last_access;
+        }
+        m_cached_bytes += size;
+        over_budget = (str_options.max_cache_bytes != 0) && (m_cached_bytes > str_options.max_cache_bytes);
+    }
+    if (over_budget)
+    {
+        wake();
+    }
+}
+
+// Forgets a file that has been deleted from the cache.
+void gc_cache::remove_file(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_lru_lock);
+    auto iter = m_lru_map.find(path);
+    if (iter != m_lru_map.end())
+    {
+        m_cached_bytes -= iter->second.size;
+        m_lru.erase(iter->second.position);
+        m_lru_map.erase(iter);
+    }
+}
+
+// Moves the entry of a file that has been renamed in the cache.  A file that was at dst has been replaced.
+void gc_cache::rename_file(const std::string& src, const std::string& dst)
+{
+    remove_file(dst);
+    std::lock_guard<std::mutex> lock(m_lru_lock);
+    auto iter = m_lru_map.find(src);
+    if (iter != m_lru_map.end())
+    {
+        lru_entry entry = iter->second;
+        *entry.position = dst;
+        m_lru_map.erase(iter);
+        m_lru_map[dst] = entry;
+    }
 }
 
 void gc_cache::run()
@@ -74,109 +208,252 @@ void gc_cache::run()
     t1.detach();
 }
 
-// cleanup function to clean cached files that are too old
-void gc_cache::run_gc_cache()
+// Deletes a file from the cache, unless there is still an open handle to it.  Must be called with the file_lock_map mutex for the path held.
+// Returns true if the file was deleted.
+bool gc_cache::delete_cached_file(const std::string& path)
 {
+    std::string mntPathString = prepend_mnt_path_string(path);
+    const char *mntPath = mntPathString.c_str();
 
-    while(true){
+    int fd = open(mntPath, O_WRONLY);
+    if (fd <= 0)
+    {
+        //TODO:if we can't open the file consistently, should we just try to move onto the next file?
+        //or somehow timeout on a file we can't open?
+        AZS_DEBUGLOGV("Failed to open file %s from file cache in GC, skipping cleanup. errno from open = %d.", mntPath, errno);
+        if (errno == ENOENT)
+        {
+            remove_file(path);
+        }
+        return false;
+    }
 
-        // lock the deque
-        file_to_delete file;
-        bool is_empty;
+    bool deleted = false;
+    int flockres = flock(fd, LOCK_EX|LOCK_NB);
+    if (flockres != 0)
+    {
+        if (errno == EWOULDBLOCK)
         {
-            std::lock_guard<std::mutex> lock(m_deque_lock);
-            is_empty = m_cleanup.empty();
-            if(!is_empty)
+            // Someone else holds the lock.  In this case, we will postpone updating the cache until the next time open() is called.
+            // TODO: examine the possibility that we can never acquire the lock and refresh the cache.
+            AZS_DEBUGLOGV("Did not clean up file %s from file cache because there's still an open file handle to it.", mntPath);
+        }
+        else
+        {
+            // Failed to acquire the lock for some other reason.  We close the open fd, and continue.
+            syslog(LOG_ERR, "Did not clean up file %s from file cache because we failed to acquire the flock for an unknown reason, errno = %d.\n", mntPath, errno);
+        }
+    }
+    else
+    {
+        struct stat buf;
+        unsigned long long freed = (fstat(fd, &buf) == 0) ? (unsigned long long)buf.st_blocks * 512 : 0;
+        unlink(mntPath);
+        file_cache_map::get_instance()->remove_path(path);
+        file_block_map::get_instance()->remove_state(path);
+        file_write_map::get_instance()->remove_state(path);
+        file_etag_map::get_instance()->remove_etag(path);
+        remove_file(path);
+        flock(fd, LOCK_UN);
+        deleted = true;
+
+        //update disk space, without asking the file system again
+        m_disk_used_bytes -= std::min(m_disk_used_bytes, freed);
+        disk_threshold_reached = disk_over_threshold();
+    }
+
+    close(fd);
+    return deleted;
+}
+
+// Deletes the least recently used files until the files in the cache fit in --cache-size-mb again.  Files that are open can't be deleted; they are
+// moved to the front of the list, since they are in use.
+void gc_cache::evict_over_budget()
+{
+    if (str_options.max_cache_bytes == 0)
+    {
+        return;
+    }
+
+    size_t candidates;
+    {
+        std::lock_guard<std::mutex> lock(m_lru_lock);
+        candidates = m_lru.size();
+    }
+    // Look at each file at most once per call, in case none of them can be deleted.
+    for (size_t i = 0; i < candidates; i++)
+    {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(m_lru_lock);
+            if (m_lru.empty() || (m_cached_bytes <= str_options.max_cache_bytes))
             {
-                file = m_cleanup.front();
+                return;
             }
+            path = m_lru.back();
         }
 
-        //if deque is empty, skip
-        if(is_empty)
+        auto fmutex = file_lock_map::get_instance()->get_mutex(path.c_str());
+        std::lock_guard<std::mutex> lock(*fmutex);
+        bool deleted = false;
+        if (g_write_behind && g_write_behind->has_pending(path))
         {
-            //run it every 1 second
-            usleep(1000);
-            continue;
+            AZS_DEBUGLOGV("Did not evict file %s from file cache because it has a pending upload.", path.c_str());
+        }
+        else
+        {
+            AZS_DEBUGLOGV("Evicting file %s from file cache to stay within the cache size limit.\n", path.c_str());
+            deleted = delete_cached_file(path);
         }
 
-        time_t now = time(NULL);
-        //check if the closed time is old enough to delete
-        if(((now - file.closed_time) > file_cache_timeout_in_seconds) || disk_threshold_reached)
+        if (!deleted)
         {
-            AZS_DEBUGLOGV("File %s being considered for deletion by file cache GC.\n", file.path.c_str());
+            std::lock_guard<std::mutex> lru_lock(m_lru_lock);
+            auto iter = m_lru_map.find(path);
+            if (iter != m_lru_map.end())
+            {
+                m_lru.splice(m_lru.begin(), m_lru, iter->second.position);
+            }
+        }
+    }
+}
+
+// cleanup function to clean cached files that are too old
+void gc_cache::run_gc_cache()
+{
 
-            // path in the temp location
-            const char * mntPath;
-            std::string mntPathString = prepend_mnt_path_string(file.path);
-            mntPath = mntPathString.c_str();
+    while(true){
 
-            //check if the file on disk is still too old
-            //mutex lock
-            auto fmutex = file_lock_map::get_instance()->get_mutex(file.path.c_str());
-            std::lock_guard<std::mutex> lock(*fmutex);
+        evict_over_budget();
 
-            struct stat buf;
-            stat(mntPath, &buf);
-            if ((((now - buf.st_mtime) > file_cache_timeout_in_seconds) && ((now - buf.st_ctime) > file_cache_timeout_in_seconds))
-                || disk_threshold_reached)
+        time_t now = time(NULL);
+        if (now >= m_next_disk_check)
+        {
+            //check disk space
+            bool was_reached = disk_threshold_reached;
+            disk_threshold_reached = check_disk_space();
+            if (disk_threshold_reached && !was_reached)
             {
-                //clean up the file from cache
-                int fd = open(mntPath, O_WRONLY);
-                if (fd > 0)
-                {
-                    int flockres = flock(fd, LOCK_EX|LOCK_NB);
-                    if (flockres != 0)
-                    {
-                        if (errno == EWOULDBLOCK)
-                        {
-                            // Someone else holds the lock.  In this case, we will postpone updating the cache until the next time open() is called.
-                            // TODO: examine the possibility that we can never acquire the lock and refresh the cache.
-                            AZS_DEBUGLOGV("Did not clean up file %s from file cache because there's still an open file handle to it.", mntPath);
-                        }
-                        else
-                        {
-                            // Failed to acquire the lock for some other reason.  We close the open fd, and continue.
-                            syslog(LOG_ERR, "Did not clean up file %s from file cache because we failed to acquire the flock for an unknown reason, errno = %d.\n", mntPath, errno);
-                        }
-                    }
-                    else
-                    {
-                        unlink(mntPath);
-                        flock(fd, LOCK_UN);
-
-                        //update disk space
-                        disk_threshold_reached = check_disk_space();
-                    }
-
-                    close(fd);
-                }
-                else
-                {
-                    //TODO:if we can't open the file consistently, should we just try to move onto the next file?
-                    //or somehow timeout on a file we can't open?
-                    AZS_DEBUGLOGV("Failed to open file %s from file cache in GC, skipping cleanup. errno from open = %d.", mntPath, errno);
-                }
+                syslog(LOG_WARNING, "Disk holding the file cache is over %d%% full; deleting cached files that are not in use.\n", HIGH_THRESHOLD_VALUE);
             }
+            // Under pressure, everything closed up to now may be deleted.  Files added back to the heap from here on wait for the next check, so that
+            // files that can't be deleted yet aren't retried in a tight loop.
+            m_pressure_start = now;
+            m_next_disk_check = now + GC_DISK_CHECK_INTERVAL;
+        }
+
+        if (str_options.use_persistent_cache && (now >= m_next_index_save))
+        {
+            save_cache_index();
+            m_next_index_save = now + CACHE_INDEX_SAVE_INTERVAL;
+        }
 
-            // lock to remove from front
+        // Take the file that was closed first, or sleep until there is something to do.
+        file_to_delete file;
+        {
+            std::unique_lock<std::mutex> lock(m_deque_lock);
+            bool due = false;
+            time_t deadline = m_next_disk_check;
+            if (!m_cleanup.empty())
             {
-                std::lock_guard<std::mutex> lock(m_deque_lock);
-                m_cleanup.pop_front();
+                const file_to_delete& first = m_cleanup.top();
+                due = ((now - first.closed_time) > file_cache_timeout_in_seconds) || (disk_threshold_reached && (first.closed_time < m_pressure_start));
+                deadline = std::min(deadline, (time_t)(first.closed_time + file_cache_timeout_in_seconds + 1));
             }
+            if (!due)
+            {
+                m_cv.wait_until(lock, std::chrono::system_clock::from_time_t(deadline), [this]() { return m_wakeup; });
+                m_wakeup = false;
+                continue;
+            }
+            file = m_cleanup.top();
+            m_cleanup.pop();
+        }
 
+        AZS_DEBUGLOGV("File %s being considered for deletion by file cache GC.\n", file.path.c_str());
+
+        // path in the temp location
+        const char * mntPath;
+        std::string mntPathString = prepend_mnt_path_string(file.path);
+        mntPath = mntPathString.c_str();
+
+        //check if the file on disk is still too old
+        //mutex lock
+        auto fmutex = file_lock_map::get_instance()->get_mutex(file.path.c_str());
+        std::lock_guard<std::mutex> lock(*fmutex);
+
+        struct stat buf;
+        if (stat(mntPath, &buf) != 0)
+        {
+            // Already gone.
+            continue;
         }
-        else
+        if (g_write_behind && g_write_behind->has_pending(file.path))
         {
-            // no file was timed out - let's wait a second
-            usleep(1000);
-            //check disk space
-            disk_threshold_reached = check_disk_space();
+            // Keep the file in the cache until its queued upload is done, so that it doesn't appear to revert to the old contents of the blob.
+            AZS_DEBUGLOGV("Did not clean up file %s from file cache because it has a pending upload.", mntPath);
+            add_file(file.path);
+        }
+        else if ((((now - buf.st_mtime) > file_cache_timeout_in_seconds) && ((now - buf.st_ctime) > file_cache_timeout_in_seconds))
+            || disk_threshold_reached)
+        {
+            //clean up the file from cache
+            delete_cached_file(file.path);
         }
     }
 
 }
 
+worker_pool::worker_pool(size_t thread_count) : m_stop(false)
+{
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        m_threads.push_back(std::thread(std::bind(&worker_pool::run, this)));
+    }
+}
+
+worker_pool::~worker_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_tasks.clear();
+    }
+    m_cv.notify_all();
+    for (size_t i = 0; i < m_threads.size(); i++)
+    {
+        m_threads[i].join();
+    }
+}
+
+void worker_pool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_cv.notify_one();
+}
+
+void worker_pool::run()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_stop)
+            {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
 // Acquire shared lock utility function
 int shared_lock_file(int flags, int fd)
 {
@@ -263,6 +540,17 @@ int ensure_files_directory_exists_in_cache(const std::string& file_path)
     return status;
 }
 
+int ensure_cache_path(const std::string& path, std::string& mntPathString)
+{
+    if (str_options.use_flat_cache)
+    {
+        // The fan-out directories all exist already.
+        mntPathString = file_cache_map::get_instance()->add_path(path);
+        return 0;
+    }
+    return ensure_files_directory_exists_in_cache(mntPathString);
+}
+
 std::vector<std::pair<std::vector<list_blobs_hierarchical_item>, bool>> list_all_blobs_hierarchical(const std::string& container, const std::string& delimiter, const std::string& prefix)
 {
     static const int maxFailCount = 20;
@@ -386,6 +674,93 @@ int is_directory_empty(const std::string& container, const std::string& dir_name
 }
 
 
+missing_path_map* missing_path_map::get_instance()
+{
+    if(nullptr == s_instance.get())
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if(nullptr == s_instance.get())
+        {
+            s_instance.reset(new missing_path_map());
+        }
+    }
+    return s_instance.get();
+}
+
+std::shared_ptr<missing_path_map> missing_path_map::s_instance;
+std::mutex missing_path_map::s_mutex;
+
+void missing_path_map::set_timeout(int timeout_in_seconds)
+{
+    m_timeout = timeout_in_seconds;
+}
+
+unsigned long long missing_path_map::begin_lookup()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_generation;
+}
+
+void missing_path_map::add_missing(const std::string& path, unsigned long long lookup)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!enabled() || (lookup != m_generation))
+    {
+        return;
+    }
+    time_t now = time(NULL);
+    m_expiry[path] = now + m_timeout;
+    if (m_expiry.size() >= m_sweep_size)
+    {
+        for (auto iter = m_expiry.begin(); iter != m_expiry.end();)
+        {
+            iter = (iter->second <= now) ? m_expiry.erase(iter) : std::next(iter);
+        }
+        m_sweep_size = std::max(m_sweep_size, m_expiry.size() * 2);
+    }
+}
+
+bool missing_path_map::is_missing(const std::string& path)
+{
+    if (!enabled())
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_expiry.find(path);
+    if (iter == m_expiry.end())
+    {
+        return false;
+    }
+    if (iter->second <= time(NULL))
+    {
+        m_expiry.erase(iter);
+        return false;
+    }
+    return true;
+}
+
+void missing_path_map::remove_path(const std::string& path)
+{
+    if (!enabled())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_generation++;
+    m_expiry.erase(path);
+    for (size_t slash = path.rfind('/'); (slash != std::string::npos) && (slash > 0); slash = path.rfind('/', slash - 1))
+    {
+        m_expiry.erase(path.substr(0, slash));
+    }
+    std::string prefix = path + "/";
+    auto iter = m_expiry.lower_bound(prefix);
+    while ((iter != m_expiry.end()) && (iter->first.compare(0, prefix.size(), prefix) == 0))
+    {
+        iter = m_expiry.erase(iter);
+    }
+}
+
 int azs_getattr(const char *path, struct stat *stbuf)
 {
     AZS_DEBUGLOGV("azs_getattr called with path = %s\n", path);
@@ -428,12 +803,59 @@ int azs_getattr(const char *path, struct stat *stbuf)
             return 0;
         }
     }
+    else if (str_options.use_flat_cache && file_cache_map::get_instance()->has_children(pathString))
+    {
+        // With the flat cache layout there are no directories in the cache, but a directory holding files in the cache exists all the same.
+        AZS_DEBUGLOGV("Directory %s holds files in the local cache during get_attr.\n", path);
+        stbuf->st_mode = S_IFDIR | default_permission;
+        stbuf->st_uid = fuse_get_context()->uid;
+        stbuf->st_gid = fuse_get_context()->gid;
+        stbuf->st_nlink = 2;
+        stbuf->st_size = 4096;
+        stbuf->st_mtime = time(NULL);
+        return 0;
+    }
     else
     {
         AZS_DEBUGLOGV("Object %s is not in the local cache during get_attr.\n", mntPathString.c_str());
     }
 
+    if (missing_path_map::get_instance()->is_missing(pathString))
+    {
+        AZS_DEBUGLOGV("Entity %s was recently found not to exist.  Returning ENOENT (%d) from get_attr.\n", path, ENOENT);
+        return -(ENOENT);
+    }
+
+    // The namespace tree answers for the children of directories it holds a listing of, without a call to the service.
+    listing_entry entry;
+    int found = namespace_tree::get_instance()->lookup(pathString, entry);
+    if (found == NS_MISSING)
+    {
+        AZS_DEBUGLOGV("Entity %s is not in the cached listing of its directory.  Returning ENOENT (%d) from get_attr.\n", path, ENOENT);
+        return -(ENOENT);
+    }
+    if (found == NS_FOUND)
+    {
+        stbuf->st_uid = fuse_get_context()->uid;
+        stbuf->st_gid = fuse_get_context()->gid;
+        if (entry.is_directory)
+        {
+            AZS_DEBUGLOGV("Directory %s found in the cached listing of its directory during get_attr.\n", path);
+            stbuf->st_mode = S_IFDIR | default_permission;
+            stbuf->st_nlink = entry.has_children ? 3 : 2;
+            stbuf->st_size = 4096;
+            return 0;
+        }
+        AZS_DEBUGLOGV("Blob %s, representing a file, found in the cached listing of its directory during get_attr.\n", path);
+        stbuf->st_mode = S_IFREG | default_permission;
+        stbuf->st_mtime = entry.last_modified;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = entry.size;
+        return 0;
+    }
+
     // It's not in the local cache.  Check to see if it's a blob on the service:
+    unsigned long long lookup = missing_path_map::get_instance()->begin_lookup();
     std::string blobNameStr(&(path[1]));
     errno = 0;
     auto blob_property = azure_blob_client_wrapper->get_blob_property(str_options.containerName, blobNameStr);
@@ -448,7 +870,14 @@ int azs_getattr(const char *path, struct stat *stbuf)
             // Directory size will affect behaviour for mv, rmdir, cp etc.
             stbuf->st_uid = fuse_get_context()->uid;
             stbuf->st_gid = fuse_get_context()->gid;
-            stbuf->st_nlink = is_directory_empty(str_options.containerName, blobNameStr) == D_EMPTY ? 2 : 3;
+            int dirState;
+            if (!namespace_tree::get_instance()->get_directory_state(pathString, true, dirState))
+            {
+                // rmdir() checks for itself whether the directory is empty, so with --lazy-dir-emptiness the listing is skipped, and the directory is
+                // reported as not empty so that tools which count subdirectories by nlink still descend into it.
+                dirState = str_options.lazy_dir_emptiness ? D_NOTEMPTY : is_directory_empty(str_options.containerName, blobNameStr);
+            }
+            stbuf->st_nlink = dirState == D_EMPTY ? 2 : 3;
             stbuf->st_size = 4096;
             return 0;
         }
@@ -467,7 +896,11 @@ int azs_getattr(const char *path, struct stat *stbuf)
         // Check to see if it's a directory, instead of a file
 
         errno = 0;
-        int dirSize = is_directory_empty(str_options.containerName, blobNameStr);
+        int dirSize;
+        if (!namespace_tree::get_instance()->get_directory_state(pathString, false, dirSize))
+        {
+            dirSize = is_directory_empty(str_options.containerName, blobNameStr);
+        }
         if (errno != 0)
         {
             int storage_errno = errno;
@@ -489,6 +922,7 @@ int azs_getattr(const char *path, struct stat *stbuf)
         else
         {
             AZS_DEBUGLOGV("Entity %s does not exist.  Returning ENOENT (%d) from get_attr.\n", path, ENOENT);
+            missing_path_map::get_instance()->add_missing(pathString, lookup);
             return -(ENOENT);
         }
     }
@@ -517,11 +951,21 @@ int rm(const char *fpath, const struct stat * /*sb*/, int tflag, struct FTW * /*
     }
 }
 
-// Delete the entire contents of tmpPath.
+// Delete the entire contents of tmpPath, unless the cache is kept for the next mount.
 void azs_destroy(void * /*private_data*/)
 {
     AZS_DEBUGLOG("azs_destroy called.\n");
-    std::string rootPath(str_options.tmpPath + "/root");
+    if (g_write_behind)
+    {
+        // Finish the queued uploads before unmounting.
+        g_write_behind->wait_all();
+    }
+    if (str_options.use_persistent_cache)
+    {
+        save_cache_index();
+        return;
+    }
+    std::string rootPath(str_options.tmpPath + (str_options.use_flat_cache ? "/objects" : "/root"));
 
     errno = 0;
     // FTW_DEPTH instructs FTW to do a post-order traversal (children of a directory before the actual directory.)
@@ -540,9 +984,23 @@ int azs_readlink(const char * /*path*/, char * /*buf*/, size_t /*size*/)
     return -EINVAL; // not a symlink
 }
 
-int azs_fsync(const char * /*path*/, int /*isdatasync*/, struct fuse_file_info * /*fi*/)
+int azs_fsync(const char *path, int /*isdatasync*/, struct fuse_file_info *fi)
 {
-    return 0; // Skip for now
+    if (!g_write_behind || (path == NULL))
+    {
+        return 0; // Without write-behind, data is uploaded in flush(); skip for now.
+    }
+
+    // Queue anything written since the last flush, then wait for the file's uploads to finish.
+    if ((fi != NULL) && ((struct fhwrapper *)fi->fh)->upload)
+    {
+        int flush_result = azs_flush(path, fi);
+        if (flush_result != 0)
+        {
+            return flush_result;
+        }
+    }
+    return g_write_behind->wait(path);
 }
 
 int azs_chown(const char * /*path*/, uid_t /*uid*/, gid_t /*gid*/)
@@ -569,149 +1027,6 @@ int azs_utimens(const char * /*path*/, const struct timespec [2] /*ts[2]*/)
 }
 //  #endif
 
-int azs_rename_directory(const char *src, const char *dst)
-{
-    AZS_DEBUGLOGV("azs_rename_directory called with src = %s, dst = %s.\n", src, dst);
-    std::string srcPathStr(src);
-    std::string dstPathStr(dst);
-
-    // Rename the directory blob, if it exists.
-    errno = 0;
-    blob_property props = azure_blob_client_wrapper->get_blob_property(str_options.containerName, srcPathStr.substr(1));
-    if ((errno == 0) && (props.valid()))
-    {
-        if (is_directory_blob(props.size, props.metadata))
-        {
-            azs_rename_single_file(src, dst);
-        }
-    }
-    if (errno != 0)
-    {
-        if ((errno != 404) && (errno != ENOENT))
-        {
-            return 0 - map_errno(errno); // Failure in fetching properties - errno set by blob_exists
-        }
-    }
-
-    if (srcPathStr.size() > 1)
-    {
-        srcPathStr.push_back('/');
-    }
-    if (dstPathStr.size() > 1)
-    {
-        dstPathStr.push_back('/');
-    }
-    std::vector<std::string> local_list_results;
-
-    // Rename all files and directories that exist in the local cache.
-    ensure_files_directory_exists_in_cache(prepend_mnt_path_string(dstPathStr + "placeholder"));
-    std::string mntPathString = prepend_mnt_path_string(srcPathStr);
-    DIR *dir_stream = opendir(mntPathString.c_str());
-    if (dir_stream != NULL)
-    {
-        struct dirent* dir_ent = readdir(dir_stream);
-        while (dir_ent != NULL)
-        {
-            if (dir_ent->d_name[0] != '.')
-            {
-                int nameLen = strlen(dir_ent->d_name);
-                char *newSrc = (char *)malloc(sizeof(char) * (srcPathStr.size() + nameLen + 1));
-                memcpy(newSrc, srcPathStr.c_str(), srcPathStr.size());
-                memcpy(&(newSrc[srcPathStr.size()]), dir_ent->d_name, nameLen);
-                newSrc[srcPathStr.size() + nameLen] = '\0';
-
-                char *newDst = (char *)malloc(sizeof(char) * (dstPathStr.size() + nameLen + 1));
-                memcpy(newDst, dstPathStr.c_str(), dstPathStr.size());
-                memcpy(&(newDst[dstPathStr.size()]), dir_ent->d_name, nameLen);
-                newDst[dstPathStr.size() + nameLen] = '\0';
-
-                AZS_DEBUGLOGV("Local object found - about to rename %s to %s.\n", newSrc, newDst);
-                if (dir_ent->d_type == DT_DIR)
-                {
-                    azs_rename_directory(newSrc, newDst);
-                }
-                else
-                {
-                    azs_rename_single_file(newSrc, newDst);
-                }
-
-                free(newSrc);
-                free(newDst);
-
-                std::string dir_str(dir_ent->d_name);
-                local_list_results.push_back(dir_str);
-            }
-
-            dir_ent = readdir(dir_stream);
-        }
-
-        closedir(dir_stream);
-    }
-
-    // Rename all files & directories that don't exist in the local cache.
-    errno = 0;
-    std::vector<std::pair<std::vector<list_blobs_hierarchical_item>, bool>> listResults = list_all_blobs_hierarchical(str_options.containerName, "/", srcPathStr.substr(1));
-    if (errno != 0)
-    {
-        int storage_errno = errno;
-        syslog(LOG_ERR, "list blobs operation failed during attempt to rename directory %s to %s.  errno = %d.\n", src, dst, storage_errno);
-        return 0 - map_errno(storage_errno);
-    }
-
-    AZS_DEBUGLOGV("Total of %s result lists found from list_blobs call during rename operation\n.", to_str(listResults.size()).c_str());
-    for (size_t result_lists_index = 0; result_lists_index < listResults.size(); result_lists_index++)
-    {
-        int start = listResults[result_lists_index].second ? 1 : 0;
-        for (size_t i = start; i < listResults[result_lists_index].first.size(); i++)
-        {
-            // We need to parse out just the trailing part of the path name.
-            int len = listResults[result_lists_index].first[i].name.size();
-            if (len > 0)
-            {
-                std::string prev_token_str;
-                if (listResults[result_lists_index].first[i].name.back() == '/')
-                {
-                    prev_token_str = listResults[result_lists_index].first[i].name.substr(srcPathStr.size() - 1, listResults[result_lists_index].first[i].name.size() - srcPathStr.size());
-                }
-                else
-                {
-                    prev_token_str = listResults[result_lists_index].first[i].name.substr(srcPathStr.size() - 1);
-                }
-
-                // TODO: order or hash the list to improve perf
-                if ((prev_token_str.size() > 0) && (std::find(local_list_results.begin(), local_list_results.end(), prev_token_str) == local_list_results.end()))
-                {
-                    int nameLen = prev_token_str.size();
-                    char *newSrc = (char *)malloc(sizeof(char) * (srcPathStr.size() + nameLen + 1));
-                    memcpy(newSrc, srcPathStr.c_str(), srcPathStr.size());
-                    memcpy(&(newSrc[srcPathStr.size()]), prev_token_str.c_str(), nameLen);
-                    newSrc[srcPathStr.size() + nameLen] = '\0';
-
-                    char *newDst = (char *)malloc(sizeof(char) * (dstPathStr.size() + nameLen + 1));
-                    memcpy(newDst, dstPathStr.c_str(), dstPathStr.size());
-                    memcpy(&(newDst[dstPathStr.size()]), prev_token_str.c_str(), nameLen);
-                    newDst[dstPathStr.size() + nameLen] = '\0';
-
-                    AZS_DEBUGLOGV("Object found on the service - about to rename %s to %s.\n", newSrc, newDst);
-                    if (listResults[result_lists_index].first[i].is_directory)
-                    {
-                        azs_rename_directory(newSrc, newDst);
-                    }
-                    else
-                    {
-                        azs_rename_single_file(newSrc, newDst);
-                    }
-
-                    free(newSrc);
-                    free(newDst);
-                }
-            }
-        }
-    }
-    azs_rmdir(src);
-    return 0;
-}
-
 // TODO: Fix bug where the files and directories in the source in the file cache are not deleted.
 // TODO: Fix bugs where the a file has been created but not yet uploaded.
 // TODO: Fix the bug where this fails for multi-level dirrectories.
@@ -727,16 +1042,20 @@ int azs_rename(const char *src, const char *dst)
     {
         return getattrret;
     }
+    int result = 0;
     if ((statbuf.st_mode & S_IFDIR) == S_IFDIR)
     {
-        azs_rename_directory(src, dst);
+        result = azs_rename_directory(src, dst);
     }
     else
     {
-        azs_rename_single_file(src, dst);
+        result = azs_rename_single_file(src, dst);
     }
+    missing_path_map::get_instance()->remove_path(dst);
+    namespace_tree::get_instance()->invalidate(src);
+    namespace_tree::get_instance()->invalidate(dst);
 
-    return 0;
+    return result;
 }
 
 
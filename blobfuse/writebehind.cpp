@@ -0,0 +1,476 @@
+#include "blobfuse.h"
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+std::shared_ptr<write_behind_queue> g_write_behind;
+
+write_behind_queue::write_behind_queue(const std::string& journal_dir, size_t thread_count, unsigned long long max_pending_bytes,
+    unsigned long long retry_ms)
+    : m_journal_dir(journal_dir), m_max_pending_bytes(max_pending_bytes), m_retry_ms(retry_ms), m_pending_bytes(0), m_next_id(0), m_stop(false),
+    m_retry_thread(std::bind(&write_behind_queue::run_retries, this)), m_pool(thread_count)
+{
+}
+
+write_behind_queue::~write_behind_queue()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_retry_cv.notify_all();
+    m_retry_thread.join();
+}
+
+std::string write_behind_queue::journal_file(unsigned long long id, const char *extension)
+{
+    // Zero-padded, so that the entries sort in the order they were queued.
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu%s", id, extension);
+    return m_journal_dir + "/" + name;
+}
+
+void write_behind_queue::remove_job_files(unsigned long long id)
+{
+    unlink(journal_file(id, ".job").c_str());
+    unlink(journal_file(id, ".data").c_str());
+}
+
+int write_all(int fd, const char *data, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t res = write(fd, data + written, size - written);
+        if (res == -1)
+        {
+            return errno;
+        }
+        written += res;
+    }
+    return 0;
+}
+
+// Copies the file at src to dst, and makes the copy durable.  Uses a reflink if the file system supports it, so the copy costs no I/O; the file in the
+// cache can then keep being written to without affecting the snapshot.  Returns 0 with size set to the size of the copy, or an errno.
+static int snapshot_file(const std::string& src, const std::string& dst, unsigned long long& size)
+{
+    int in = open(src.c_str(), O_RDONLY);
+    if (in == -1)
+    {
+        return errno;
+    }
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (out == -1)
+    {
+        int open_errno = errno;
+        close(in);
+        return open_errno;
+    }
+
+    int result = -1;
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0)
+    {
+        result = 0;
+    }
+#endif
+    if (result != 0)
+    {
+        result = 0;
+        std::vector<char> buffer(1024 * 1024);
+        while (result == 0)
+        {
+            ssize_t res = read(in, buffer.data(), buffer.size());
+            if (res == 0)
+            {
+                break;
+            }
+            result = (res == -1) ? errno : write_all(out, buffer.data(), res);
+        }
+    }
+    if ((result == 0) && (fsync(out) != 0))
+    {
+        result = errno;
+    }
+    struct stat buf;
+    if ((result == 0) && (fstat(out, &buf) != 0))
+    {
+        result = errno;
+    }
+    if (result == 0)
+    {
+        size = buf.st_size;
+    }
+    close(in);
+    close(out);
+    return result;
+}
+
+// Writes the blob path for a snapshot next to it.  The record is written to a temporary file and renamed into place, so after a crash there is either a
+// complete record or none.
+static int write_job_record(const std::string& tmp_file, const std::string& job_file, const std::string& path)
+{
+    int fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+        return errno;
+    }
+    std::string record = path + "\n";
+    int result = write_all(fd, record.data(), record.size());
+    if ((result == 0) && (fsync(fd) != 0))
+    {
+        result = errno;
+    }
+    close(fd);
+    if ((result == 0) && (rename(tmp_file.c_str(), job_file.c_str()) != 0))
+    {
+        result = errno;
+    }
+    if (result != 0)
+    {
+        unlink(tmp_file.c_str());
+    }
+    return result;
+}
+
+void write_behind_queue::resume()
+{
+    DIR *dir = opendir(m_journal_dir.c_str());
+    if (dir == NULL)
+    {
+        syslog(LOG_ERR, "Failed to open write-behind journal directory %s.  errno = %d.\n", m_journal_dir.c_str(), errno);
+        return;
+    }
+
+    std::map<unsigned long long, std::string> jobs;
+    std::vector<std::string> leftovers;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        std::string name(entry->d_name);
+        if ((name == ".") || (name == ".."))
+        {
+            continue;
+        }
+        unsigned long long id = strtoull(name.c_str(), NULL, 10);
+        m_next_id = std::max(m_next_id, id + 1);
+        size_t dot = name.find('.');
+        std::string extension = (dot == std::string::npos) ? std::string() : name.substr(dot);
+        if (extension == ".job")
+        {
+            std::ifstream record(m_journal_dir + "/" + name);
+            std::string path;
+            if (std::getline(record, path) && !path.empty())
+            {
+                jobs[id] = path;
+                continue;
+            }
+        }
+        // Snapshots whose record is missing were never queued, and temporary records were never completed.
+        if (extension != ".data")
+        {
+            leftovers.push_back(m_journal_dir + "/" + name);
+        }
+    }
+    closedir(dir);
+
+    for (size_t i = 0; i < leftovers.size(); i++)
+    {
+        unlink(leftovers[i].c_str());
+    }
+
+    // Only the newest snapshot of each file needs to be uploaded.
+    std::map<std::string, unsigned long long> newest;
+    for (auto iter = jobs.begin(); iter != jobs.end(); ++iter)
+    {
+        auto previous = newest.find(iter->second);
+        if (previous != newest.end())
+        {
+            remove_job_files(previous->second);
+        }
+        newest[iter->second] = iter->first;
+    }
+
+    for (auto iter = newest.begin(); iter != newest.end(); ++iter)
+    {
+        struct stat buf;
+        if (stat(journal_file(iter->second, ".data").c_str(), &buf) != 0)
+        {
+            syslog(LOG_ERR, "Snapshot for pending upload of %s is missing from the write-behind journal; dropping it.\n", iter->first.c_str());
+            remove_job_files(iter->second);
+            continue;
+        }
+        syslog(LOG_INFO, "Resuming pending upload of %s from the write-behind journal.\n", iter->first.c_str());
+        upload_job job;
+        job.id = iter->second;
+        job.size = buf.st_size;
+        job.writes = file_write_map::get_instance()->get_or_create_state(iter->first);
+        job.snapshot.generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending_bytes += job.size;
+        }
+        add_job(iter->first, job);
+    }
+}
+
+int write_behind_queue::enqueue(const std::string& path, const std::string& mntPath)
+{
+    // The size here is only used for back-pressure.  The file may still grow before it is snapshotted, so the job's size is taken from the snapshot.
+    struct stat buf;
+    if (stat(mntPath.c_str(), &buf) != 0)
+    {
+        return -errno;
+    }
+    unsigned long long charged = buf.st_size;
+
+    unsigned long long id;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // Apply back-pressure: wait until the snapshot fits under the cap.  A file larger than the cap is still allowed once nothing else is pending.
+        m_cv.wait(lock, [this, charged]() { return (m_pending_bytes == 0) || (m_pending_bytes + charged <= m_max_pending_bytes); });
+        m_pending_bytes += charged;
+        id = m_next_id++;
+    }
+
+    // Take the dirty ranges before copying the file, as upload_cache_file() does: anything written from here on is recorded again, and uploaded by the
+    // next flush.
+    std::shared_ptr<file_write_state> writes = file_write_map::get_instance()->get_or_create_state(path);
+    upload_job job;
+    job.id = id;
+    job.writes = writes;
+    job.snapshot = writes->take_snapshot();
+
+    job.size = 0;
+    int result = snapshot_file(mntPath, journal_file(id, ".data"), job.size);
+    if (result == 0)
+    {
+        result = write_job_record(journal_file(id, ".tmp"), journal_file(id, ".job"), path);
+    }
+    if (result != 0)
+    {
+        syslog(LOG_ERR, "Failed to snapshot %s for write-behind upload.  errno = %d.\n", path.c_str(), result);
+        writes->restore(job.snapshot);
+        remove_job_files(id);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending_bytes -= charged;
+        m_cv.notify_all();
+        return -result;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending_bytes = m_pending_bytes - charged + job.size;
+        m_cv.notify_all();
+    }
+
+    writes->mark_queued(job.snapshot.generation);
+    AZS_DEBUGLOGV("Queued snapshot %s of %s for upload.\n", to_str(id).c_str(), path.c_str());
+    add_job(path, job);
+    return 0;
+}
+
+void write_behind_queue::add_job(const std::string& path, upload_job job)
+{
+    bool start = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        path_uploads& uploads = m_uploads[path];
+        if (!uploads.queued.empty())
+        {
+            // The waiting snapshot is superseded by this one.  Everything it had to upload, this one has to upload as well.  The blocks staged for it
+            // may have been overwritten since, so they are uploaded again as part of its dirty ranges.
+            upload_job& previous = uploads.queued.back();
+            for (auto iter = previous.snapshot.dirty.begin(); iter != previous.snapshot.dirty.end(); ++iter)
+            {
+                job.snapshot.dirty[iter->first] = std::max(job.snapshot.dirty[iter->first], iter->second);
+            }
+            for (auto iter = previous.snapshot.staged.begin(); iter != previous.snapshot.staged.end(); ++iter)
+            {
+                job.snapshot.dirty[iter->first] = std::max(job.snapshot.dirty[iter->first], iter->first + iter->second.size);
+            }
+            remove_job_files(previous.id);
+            m_pending_bytes -= previous.size;
+            uploads.queued.pop_back();
+            m_cv.notify_all();
+        }
+        uploads.queued.push_back(job);
+        start = !uploads.running && (uploads.queued.size() == 1);
+        if (start)
+        {
+            uploads.running = true;
+        }
+    }
+    if (start)
+    {
+        m_pool.submit(std::bind(&write_behind_queue::run_uploads, this, path));
+    }
+}
+
+// Runs the queued uploads for one path, one at a time, until there are none left.
+void write_behind_queue::run_uploads(const std::string& path)
+{
+    while (true)
+    {
+        upload_job job;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            path_uploads& uploads = m_uploads[path];
+            if (uploads.queued.empty())
+            {
+                m_uploads.erase(path);
+                m_cv.notify_all();
+                return;
+            }
+            job = uploads.queued.front();
+            uploads.queued.pop_front();
+        }
+
+        std::string data_file = journal_file(job.id, ".data");
+        int result = upload_file_contents(job.writes, path, data_file, job.size, job.snapshot);
+        if ((result != 0) && (job.attempt < WRITE_BEHIND_MAX_ATTEMPTS))
+        {
+            // The failed attempt gave the dirty ranges back and dropped the block list, so the retry uploads the whole snapshot.  The job goes back to
+            // the front of the queue, and run_retries() hands the file back to the pool once the retry is due.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            path_uploads& uploads = m_uploads[path];
+            if (job.id >= uploads.cancelled_below)
+            {
+                syslog(LOG_WARNING, "Background upload of %s failed with errno = %d; retrying.\n", path.c_str(), -result);
+                write_snapshot retry;
+                retry.generation = job.snapshot.generation;
+                job.snapshot = retry;
+                m_retries.insert(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(m_retry_ms << job.attempt), path));
+                job.attempt++;
+                uploads.queued.push_front(job);
+                uploads.retry_pending = true;
+                m_retry_cv.notify_one();
+                return;
+            }
+        }
+        if (result == 0)
+        {
+            syslog(LOG_INFO, "Successfully uploaded %s in the background.\n", path.c_str());
+        }
+        else
+        {
+            // The data is still in the file cache; the next flush() of the file queues it again.
+            syslog(LOG_ERR, "Background upload of %s failed.  errno = %d.\n", path.c_str(), -result);
+            job.writes->clear_queued();
+        }
+        remove_job_files(job.id);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if ((result != 0) && (job.id >= m_uploads[path].cancelled_below))
+        {
+            m_errors[path] = result;
+        }
+        m_pending_bytes -= job.size;
+        m_cv.notify_all();
+    }
+}
+
+void write_behind_queue::run_retries()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop)
+    {
+        if (m_retries.empty())
+        {
+            m_retry_cv.wait(lock);
+            continue;
+        }
+        auto first = m_retries.begin();
+        if (first->first > std::chrono::steady_clock::now())
+        {
+            m_retry_cv.wait_until(lock, first->first);
+            continue;
+        }
+        std::string path = first->second;
+        m_retries.erase(first);
+        auto iter = m_uploads.find(path);
+        if ((iter != m_uploads.end()) && iter->second.retry_pending)
+        {
+            iter->second.retry_pending = false;
+            m_pool.submit(std::bind(&write_behind_queue::run_uploads, this, path));
+        }
+    }
+}
+
+bool write_behind_queue::is_pending_locked(const std::string& path)
+{
+    // The uploads of everything under path sort directly after it, so only a short range of the map needs to be checked.
+    for (auto iter = m_uploads.lower_bound(path); iter != m_uploads.end(); ++iter)
+    {
+        if (iter->first == path)
+        {
+            return true;
+        }
+        if (iter->first.compare(0, path.size(), path) != 0)
+        {
+            break;
+        }
+        if ((iter->first[path.size()] == '/') || (path[path.size() - 1] == '/'))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool write_behind_queue::has_pending(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_uploads.find(path) != m_uploads.end();
+}
+
+int write_behind_queue::wait(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this, &path]() { return !is_pending_locked(path); });
+    auto iter = m_errors.find(path);
+    if (iter == m_errors.end())
+    {
+        return 0;
+    }
+    int result = iter->second;
+    m_errors.erase(iter);
+    return result;
+}
+
+void write_behind_queue::cancel(const std::string& path)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto iter = m_uploads.find(path);
+    if (iter != m_uploads.end())
+    {
+        std::deque<upload_job>& queued = iter->second.queued;
+        for (size_t i = 0; i < queued.size(); i++)
+        {
+            AZS_DEBUGLOGV("Cancelled pending upload of %s.\n", path.c_str());
+            remove_job_files(queued[i].id);
+            m_pending_bytes -= queued[i].size;
+        }
+        queued.clear();
+        // The upload that is running is not retried, and one waiting for its retry has no worker to finish it.
+        iter->second.cancelled_below = m_next_id;
+        if (iter->second.retry_pending)
+        {
+            for (auto retry = m_retries.begin(); retry != m_retries.end();)
+            {
+                retry = (retry->second == path) ? m_retries.erase(retry) : std::next(retry);
+            }
+            m_uploads.erase(iter);
+        }
+        m_cv.notify_all();
+    }
+    m_errors.erase(path);
+    m_cv.wait(lock, [this, &path]() { return m_uploads.find(path) == m_uploads.end(); });
+}
+
+void write_behind_queue::wait_all()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_uploads.empty(); });
+}
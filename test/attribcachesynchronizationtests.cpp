@@ -11,14 +11,26 @@ public:
     MOCK_CONST_METHOD0(is_valid, bool());
     MOCK_METHOD5(list_blobs_hierarchical, list_blobs_hierarchical_response(const std::string &container, const std::string &delimiter, const std::string &continuation_token, const std::string &prefix, int maxresults));
     MOCK_METHOD4(put_blob, void(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata));
+    MOCK_METHOD5(put_blob, void(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props));
     MOCK_METHOD4(upload_block_blob_from_stream, void(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata));
+    MOCK_METHOD5(upload_block_blob_from_stream, void(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props));
     MOCK_METHOD5(upload_file_to_blob, void(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel));
+    MOCK_METHOD6(upload_file_to_blob, void(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel, blob_property &returned_props));
     MOCK_METHOD5(download_blob_to_stream, void(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os));
+    MOCK_METHOD5(download_chunk_to_stream, chunk_property(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os));
+    MOCK_METHOD2(get_block_list, get_block_list_response(const std::string &container, const std::string &blob));
+    MOCK_METHOD4(upload_block_from_stream, void(const std::string &container, const std::string blob, const std::string &blockid, std::istream &is));
+    MOCK_METHOD4(put_block_list, void(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata));
+    MOCK_METHOD6(put_block_list, void(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, unsigned long long size, blob_property &returned_props));
     MOCK_METHOD5(download_blob_to_file, void(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, size_t parallel));
+    MOCK_METHOD6(download_blob_to_file, void(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, std::string &returned_etag, size_t parallel));
+    MOCK_METHOD5(download_blob_to_file, void(const std::string &container, const std::string &blob, const std::string &destPath, blob_property &returned_props, size_t parallel));
     MOCK_METHOD2(get_blob_property, blob_property(const std::string &container, const std::string &blob));
+    MOCK_METHOD3(get_blob_property, blob_property(const std::string &container, const std::string &blob, bool assume_cache_invalid));
     MOCK_METHOD2(blob_exists, bool(const std::string &container, const std::string &blob));
     MOCK_METHOD2(delete_blob, void(const std::string &container, const std::string &blob));
     MOCK_METHOD4(start_copy, void(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob));
+    MOCK_METHOD5(start_copy, void(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props));
 };
 
 // These tests validate that calls into the cache layer from multiple threads are synchronized & serialized properly.
@@ -107,7 +119,7 @@ void AttribCacheSynchronizationTest::prep_mock(std::shared_ptr<std::mutex> m, st
     {
         prep(m, cv, calls, sleep_finished);
     }));
-    ON_CALL(*mockClient, download_blob_to_file(_, _, _, _, _))
+    ON_CALL(*mockClient, download_blob_to_file(_, _, _, ::testing::An<time_t&>(), _))
     .WillByDefault(::testing::InvokeWithoutArgs([=] ()
     {
         prep(m, cv, calls, sleep_finished);
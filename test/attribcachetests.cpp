@@ -5,6 +5,8 @@
 
 using::testing::_;
 using ::testing::Return;
+using ::testing::SetArgReferee;
+using ::testing::DoAll;
 
 // Used for GoogleMock
 class MockBlobClient : public sync_blob_client {
@@ -12,14 +14,26 @@ public:
     MOCK_CONST_METHOD0(is_valid, bool());
     MOCK_METHOD5(list_blobs_hierarchical, list_blobs_hierarchical_response(const std::string &container, const std::string &delimiter, const std::string &continuation_token, const std::string &prefix, int maxresults));
     MOCK_METHOD4(put_blob, void(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata));
+    MOCK_METHOD5(put_blob, void(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props));
     MOCK_METHOD4(upload_block_blob_from_stream, void(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata));
+    MOCK_METHOD5(upload_block_blob_from_stream, void(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props));
     MOCK_METHOD5(upload_file_to_blob, void(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel));
+    MOCK_METHOD6(upload_file_to_blob, void(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel, blob_property &returned_props));
     MOCK_METHOD5(download_blob_to_stream, void(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os));
+    MOCK_METHOD5(download_chunk_to_stream, chunk_property(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os));
+    MOCK_METHOD2(get_block_list, get_block_list_response(const std::string &container, const std::string &blob));
+    MOCK_METHOD4(upload_block_from_stream, void(const std::string &container, const std::string blob, const std::string &blockid, std::istream &is));
+    MOCK_METHOD4(put_block_list, void(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata));
+    MOCK_METHOD6(put_block_list, void(const std::string &container, const std::string blob, const std::vector<put_block_list_request_base::block_item> &block_list, const std::vector<std::pair<std::string, std::string>> &metadata, unsigned long long size, blob_property &returned_props));
     MOCK_METHOD5(download_blob_to_file, void(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, size_t parallel));
+    MOCK_METHOD6(download_blob_to_file, void(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, std::string &returned_etag, size_t parallel));
+    MOCK_METHOD5(download_blob_to_file, void(const std::string &container, const std::string &blob, const std::string &destPath, blob_property &returned_props, size_t parallel));
     MOCK_METHOD2(get_blob_property, blob_property(const std::string &container, const std::string &blob));
+    MOCK_METHOD3(get_blob_property, blob_property(const std::string &container, const std::string &blob, bool assume_cache_invalid));
     MOCK_METHOD2(blob_exists, bool(const std::string &container, const std::string &blob));
     MOCK_METHOD2(delete_blob, void(const std::string &container, const std::string &blob));
     MOCK_METHOD4(start_copy, void(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob));
+    MOCK_METHOD5(start_copy, void(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob, blob_property &returned_props));
 };
 
 // These tests primarily test correctness of the attr cache - both that the data is correct, and that data is being correctly cached.
@@ -234,6 +248,123 @@ TEST_F(AttribCacheTest, GetBlobPropertiesMultiple)
     assert_blob_property_objects_equal(prop3, prop3copy1);
 }
 
+// Check that cached properties are fetched again once the cache timeout has passed.
+TEST_F(AttribCacheTest, GetBlobPropertiesTimeout)
+{
+    std::string blob = "blob";
+    blob_property prop = create_blob_property("etag", 4);
+    attrib_cache_wrapper->set_cache_limits(0, 0, 0);
+
+    EXPECT_CALL(*mockClient, get_blob_property(container_name, blob))
+    .Times(2)
+    .WillRepeatedly(Return(prop));
+    blob_property newprop = attrib_cache_wrapper->get_blob_property(container_name, blob);
+    blob_property newprop2 = attrib_cache_wrapper->get_blob_property(container_name, blob);
+
+    assert_blob_property_objects_equal(prop, newprop);
+    assert_blob_property_objects_equal(prop, newprop2);
+}
+
+// Check that the least recently used blob is evicted when the cache is over its entry limit.
+TEST_F(AttribCacheTest, GetBlobPropertiesEvictLeastRecentlyUsed)
+{
+    std::string blob1 = "blob1";
+    std::string blob2 = "blob2";
+    std::string blob3 = "blob3";
+    attrib_cache_wrapper->set_cache_limits(-1, 2, 0);
+
+    EXPECT_CALL(*mockClient, get_blob_property(container_name, blob1))
+    .Times(1)
+    .WillOnce(Return(create_blob_property("etag1", 4)));
+    EXPECT_CALL(*mockClient, get_blob_property(container_name, blob2))
+    .Times(2)
+    .WillRepeatedly(Return(create_blob_property("etag2", 15)));
+    EXPECT_CALL(*mockClient, get_blob_property(container_name, blob3))
+    .Times(1)
+    .WillOnce(Return(create_blob_property("etag3", 16)));
+
+    attrib_cache_wrapper->get_blob_property(container_name, blob1);
+    attrib_cache_wrapper->get_blob_property(container_name, blob2);
+    attrib_cache_wrapper->get_blob_property(container_name, blob1);
+    attrib_cache_wrapper->get_blob_property(container_name, blob3); // Evicts blob2
+    blob_property prop1 = attrib_cache_wrapper->get_blob_property(container_name, blob1);
+    blob_property prop2 = attrib_cache_wrapper->get_blob_property(container_name, blob2);
+
+    EXPECT_EQ("etag1", prop1.etag);
+    EXPECT_EQ("etag2", prop2.etag);
+}
+
+// Check that blobs are evicted when the cache is over its memory limit.
+TEST_F(AttribCacheTest, GetBlobPropertiesMemoryLimit)
+{
+    std::string blob1 = "blob1";
+    std::string blob2 = "blob2";
+    attrib_cache_wrapper->set_cache_limits(-1, 0, 1);
+
+    EXPECT_CALL(*mockClient, get_blob_property(container_name, blob1))
+    .Times(2)
+    .WillRepeatedly(Return(create_blob_property("etag1", 4)));
+    EXPECT_CALL(*mockClient, get_blob_property(container_name, blob2))
+    .Times(1)
+    .WillOnce(Return(create_blob_property("etag2", 15)));
+
+    attrib_cache_wrapper->get_blob_property(container_name, blob1);
+    attrib_cache_wrapper->get_blob_property(container_name, blob2); // Evicts blob1
+    blob_property prop1 = attrib_cache_wrapper->get_blob_property(container_name, blob1);
+
+    EXPECT_EQ("etag1", prop1.etag);
+}
+
+// The properties returned by an upload are stored in the cache, so reading them back makes no call to the service.
+TEST_F(AttribCacheTest, UploadStoresProperties)
+{
+    std::string blob = "blob";
+    blob_property prop = create_blob_property("etag", 4);
+    std::vector<std::pair<std::string, std::string>> metadata;
+
+    EXPECT_CALL(*mockClient, upload_file_to_blob("source_path", container_name, blob, _, 10, _))
+    .Times(1)
+    .WillOnce(DoAll(SetArgReferee<5>(prop), ::testing::Assign(&errno, 0)));
+    blob_property returned_prop(false);
+    attrib_cache_wrapper->upload_file_to_blob("source_path", container_name, blob, metadata, 10, returned_prop);
+    blob_property newprop = attrib_cache_wrapper->get_blob_property(container_name, blob);
+
+    assert_blob_property_objects_equal(prop, returned_prop);
+    assert_blob_property_objects_equal(prop, newprop);
+}
+
+// The properties read by a download are not stored if the blob was changed through the cache while it ran.
+TEST_F(AttribCacheTest, DownloadStoresProperties)
+{
+    std::string blob = "blob";
+    blob_property prop_v1 = create_blob_property("etag1", 4);
+    blob_property prop_v2 = create_blob_property("etag2", 8);
+
+    EXPECT_CALL(*mockClient, download_blob_to_file(container_name, blob, "dest_path", ::testing::An<blob_property&>(), 10))
+    .Times(2)
+    .WillOnce(DoAll(SetArgReferee<3>(prop_v1), ::testing::Assign(&errno, 0)))
+    .WillOnce(::testing::Invoke([&](const std::string &, const std::string &, const std::string &, blob_property &returned_props, size_t)
+        {
+            attrib_cache_wrapper->delete_blob(container_name, blob);
+            returned_props = prop_v2;
+            errno = 0;
+        }));
+    EXPECT_CALL(*mockClient, delete_blob(container_name, blob))
+    .Times(1);
+    EXPECT_CALL(*mockClient, get_blob_property(container_name, blob))
+    .Times(1)
+    .WillOnce(Return(prop_v2));
+
+    blob_property returned_prop(false);
+    attrib_cache_wrapper->download_blob_to_file(container_name, blob, "dest_path", returned_prop, 10);
+    blob_property propcache_1 = attrib_cache_wrapper->get_blob_property(container_name, blob);
+    attrib_cache_wrapper->download_blob_to_file(container_name, blob, "dest_path", returned_prop, 10);
+    blob_property propcache_2 = attrib_cache_wrapper->get_blob_property(container_name, blob);
+
+    assert_blob_property_objects_equal(prop_v1, propcache_1);
+    assert_blob_property_objects_equal(prop_v2, propcache_2);
+}
+
 // Check that listing operations cache the returned blob properties
 TEST_F(AttribCacheTest, GetBlobPropertiesListSimple)
 {
@@ -424,6 +555,26 @@ std::map<std::string, std::function<void(std::shared_ptr<blob_client_attr_cache_
         {
             attrib_cache_wrapper->start_copy(container_name, "src", container_name, blob);
         }}, 
+    {"CopyWithStatus", [](std::shared_ptr<blob_client_attr_cache_wrapper> attrib_cache_wrapper, std::string container_name, std::string blob)
+        {
+            blob_property props(false);
+            attrib_cache_wrapper->start_copy(container_name, "src", container_name, blob, props);
+        }},
+    {"GetBlockList", [](std::shared_ptr<blob_client_attr_cache_wrapper> attrib_cache_wrapper, std::string container_name, std::string blob)
+        {
+            attrib_cache_wrapper->get_block_list(container_name, blob);
+        }},
+    {"PutBlock", [](std::shared_ptr<blob_client_attr_cache_wrapper> attrib_cache_wrapper, std::string container_name, std::string blob)
+        {
+            std::stringstream is;
+            attrib_cache_wrapper->upload_block_from_stream(container_name, blob, "blockid", is);
+        }},
+    {"PutBlockList", [](std::shared_ptr<blob_client_attr_cache_wrapper> attrib_cache_wrapper, std::string container_name, std::string blob)
+        {
+            std::vector<put_block_list_request_base::block_item> block_list;
+            std::vector<std::pair<std::string, std::string>> metadata;
+            attrib_cache_wrapper->put_block_list(container_name, blob, block_list, metadata);
+        }},
 };
 
 // Maps the name of an operation to the code needed to set up the expectation for that operation on the mock.
@@ -456,7 +607,7 @@ std::map<std::string, std::function<void(std::shared_ptr<::testing::StrictMock<M
     }},
     {"DownloadToFile", [](std::shared_ptr<::testing::StrictMock<MockBlobClient>> mockClient, std::string container_name, std::string blob_name, ::testing::Sequence seq)
     {
-        EXPECT_CALL(*mockClient, download_blob_to_file(container_name, blob_name, _, _, _))
+        EXPECT_CALL(*mockClient, download_blob_to_file(container_name, blob_name, _, ::testing::An<time_t&>(), _))
         .Times(1)
         .InSequence(seq);
     }},
@@ -476,6 +627,30 @@ std::map<std::string, std::function<void(std::shared_ptr<::testing::StrictMock<M
         .Times(1)
         .InSequence(seq);
     }},
+    {"CopyWithStatus", [](std::shared_ptr<::testing::StrictMock<MockBlobClient>> mockClient, std::string container_name, std::string blob_name, ::testing::Sequence seq)
+    {
+        EXPECT_CALL(*mockClient, start_copy(container_name, _, container_name, blob_name, _))
+        .Times(1)
+        .InSequence(seq);
+    }},
+    {"GetBlockList", [](std::shared_ptr<::testing::StrictMock<MockBlobClient>> mockClient, std::string container_name, std::string blob_name, ::testing::Sequence seq)
+    {
+        EXPECT_CALL(*mockClient, get_block_list(container_name, blob_name))
+        .Times(1)
+        .InSequence(seq);
+    }},
+    {"PutBlock", [](std::shared_ptr<::testing::StrictMock<MockBlobClient>> mockClient, std::string container_name, std::string blob_name, ::testing::Sequence seq)
+    {
+        EXPECT_CALL(*mockClient, upload_block_from_stream(container_name, blob_name, "blockid", _))
+        .Times(1)
+        .InSequence(seq);
+    }},
+    {"PutBlockList", [](std::shared_ptr<::testing::StrictMock<MockBlobClient>> mockClient, std::string container_name, std::string blob_name, ::testing::Sequence seq)
+    {
+        EXPECT_CALL(*mockClient, put_block_list(container_name, blob_name, _, _))
+        .Times(1)
+        .InSequence(seq);
+    }},
 };
 
 // For each operation, whether or not the test should expect the operation to invalidate the cache.
@@ -489,6 +664,10 @@ std::map<std::string, bool> expectInvalidate =
     {"Exists", false},
     {"Delete", true},
     {"Copy", true},
+    {"CopyWithStatus", true},
+    {"GetBlockList", false},
+    {"PutBlock", false},
+    {"PutBlockList", true},
 };
 
 
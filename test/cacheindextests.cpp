@@ -0,0 +1,168 @@
+#include <ftw.h>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover the persistent cache index: restoring the files left in the cache by an earlier mount, and falling back to the cache directory
+// when the index is damaged or out of date.  The ETags, block states and GC entries are singletons, so each test uses its own paths.
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+class CacheIndexTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/blobfuse_index_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(dir));
+        tmp = dir;
+        saved_options = str_options;
+        str_options.tmpPath = tmp;
+        str_options.use_block_cache = true;
+        str_options.block_size = 4096;
+        ASSERT_EQ(0, mkdir((tmp + "/root").c_str(), S_IRWXU));
+    }
+
+    void TearDown() override
+    {
+        str_options = saved_options;
+        nftw(tmp.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    // Adds a fully downloaded file to the cache.
+    void add_file(const std::string& path, const std::string& contents, const std::string& etag)
+    {
+        std::ofstream out(prepend_mnt_path_string(path));
+        out << contents;
+        out.close();
+        file_etag_map::get_instance()->set_etag(path, etag);
+        g_gc_cache.touch_file(path);
+    }
+
+    // Adds a sparse file, of which only the present blocks were downloaded.
+    void add_partial_file(const std::string& path, const std::vector<bool>& present)
+    {
+        unsigned long long size = present.size() * str_options.block_size;
+        int fd = open(prepend_mnt_path_string(path).c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+        ASSERT_NE(-1, fd);
+        ASSERT_EQ(0, ftruncate(fd, size));
+        close(fd);
+        std::shared_ptr<file_block_state> blocks = std::make_shared<file_block_state>(path.substr(1), size, "etag-partial", str_options.block_size);
+        blocks->set_present(present);
+        file_block_map::get_instance()->add_state(path, blocks);
+        file_etag_map::get_instance()->set_etag(path, "etag-partial");
+        g_gc_cache.touch_file(path);
+    }
+
+    // Forgets what this mount knew about the files, as if blobfuse was restarted.
+    void remount(const std::vector<std::string>& paths)
+    {
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            file_etag_map::get_instance()->remove_etag(paths[i]);
+            file_block_map::get_instance()->remove_state(paths[i]);
+            g_gc_cache.remove_file(paths[i]);
+        }
+        load_cache_index();
+    }
+
+    bool cached(const std::string& path)
+    {
+        return access(prepend_mnt_path_string(path).c_str(), F_OK) == 0;
+    }
+
+    bool last_access(const std::string& path, time_t& value)
+    {
+        std::vector<cached_file> files = g_gc_cache.get_cached_files();
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            if (files[i].path == path)
+            {
+                value = files[i].last_access;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string tmp;
+    struct str_options saved_options;
+};
+
+TEST_F(CacheIndexTest, RestoresFilesFromIndex)
+{
+    add_file("/idx_full", "contents", "etag-full");
+    add_partial_file("/idx_partial", {true, false, true, false});
+    time_t full_access = 0;
+    ASSERT_TRUE(last_access("/idx_full", full_access));
+    save_cache_index();
+
+    remount({"/idx_full", "/idx_partial"});
+    std::string etag;
+    ASSERT_TRUE(file_etag_map::get_instance()->get_etag("/idx_full", etag));
+    ASSERT_EQ("etag-full", etag);
+    // Restored files are checked against the service on first open.
+    ASSERT_TRUE(file_etag_map::get_instance()->is_unverified("/idx_full"));
+    time_t restored_access = 0;
+    ASSERT_TRUE(last_access("/idx_full", restored_access));
+    ASSERT_EQ(full_access, restored_access);
+
+    ASSERT_TRUE(cached("/idx_partial"));
+    std::shared_ptr<file_block_state> blocks = file_block_map::get_instance()->get_state("/idx_partial");
+    ASSERT_NE(nullptr, blocks);
+    std::vector<bool> expected = {true, false, true, false};
+    ASSERT_EQ(expected, blocks->get_present());
+}
+
+TEST_F(CacheIndexTest, TornIndexIsIgnored)
+{
+    add_file("/idx_torn_full", "contents", "etag-full");
+    add_partial_file("/idx_torn_partial", {true, false, false, false});
+    save_cache_index();
+
+    // Cut the index short, as a crash in the middle of writing it would.
+    std::string index = tmp + "/cache.index";
+    struct stat buf;
+    ASSERT_EQ(0, stat(index.c_str(), &buf));
+    ASSERT_EQ(0, truncate(index.c_str(), buf.st_size - 5));
+
+    remount({"/idx_torn_full", "/idx_torn_partial"});
+    // The complete file is kept, but its ETag is not known.
+    ASSERT_TRUE(cached("/idx_torn_full"));
+    std::string etag;
+    ASSERT_FALSE(file_etag_map::get_instance()->get_etag("/idx_torn_full", etag));
+    ASSERT_TRUE(file_etag_map::get_instance()->is_unverified("/idx_torn_full"));
+    time_t access = 0;
+    ASSERT_TRUE(last_access("/idx_torn_full", access));
+    // There is no telling which parts of the sparse file were downloaded.
+    ASSERT_FALSE(cached("/idx_torn_partial"));
+    ASSERT_EQ(nullptr, file_block_map::get_instance()->get_state("/idx_torn_partial"));
+}
+
+TEST_F(CacheIndexTest, ChangedFileLosesItsEtag)
+{
+    add_file("/idx_changed", "contents", "etag-changed");
+    save_cache_index();
+
+    std::ofstream out(prepend_mnt_path_string("/idx_changed"), std::ios::app);
+    out << " and more";
+    out.close();
+
+    remount({"/idx_changed"});
+    ASSERT_TRUE(cached("/idx_changed"));
+    std::string etag;
+    ASSERT_FALSE(file_etag_map::get_instance()->get_etag("/idx_changed", etag));
+}
+
+TEST_F(CacheIndexTest, PartialDownloadNeedsTheSameBlockSize)
+{
+    add_partial_file("/idx_block_size", {true, true, false, false});
+    save_cache_index();
+
+    str_options.block_size = 8192;
+    remount({"/idx_block_size"});
+    ASSERT_FALSE(cached("/idx_block_size"));
+    ASSERT_EQ(nullptr, file_block_map::get_instance()->get_state("/idx_block_size"));
+}
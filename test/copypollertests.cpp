@@ -0,0 +1,95 @@
+#include <chrono>
+#include <future>
+#include <thread>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+#include "fakeblobclient.h"
+
+// These tests cover copy_poller, which waits for server-side copies that are still pending after start_copy().
+
+class CopyPollerTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        saved_options = str_options;
+        saved_client = azure_blob_client_wrapper;
+        str_options.containerName = "container";
+        client = std::make_shared<FakeBlobClient>();
+        client->pending_copies = true;
+        azure_blob_client_wrapper = client;
+    }
+
+    void TearDown() override
+    {
+        azure_blob_client_wrapper = saved_client;
+        str_options = saved_options;
+    }
+
+    std::future<int> start_wait(const std::string& blob, std::string& status, std::string& etag)
+    {
+        return std::async(std::launch::async, [&status, &etag, blob]() { return copy_poller::get_instance()->wait(blob, status, etag); });
+    }
+
+    struct str_options saved_options;
+    std::shared_ptr<sync_blob_client> saved_client;
+    std::shared_ptr<FakeBlobClient> client;
+};
+
+TEST_F(CopyPollerTest, WaitsForPendingCopy)
+{
+    client->add_blob("src", "contents");
+    blob_property props(false);
+    client->start_copy("container", "src", "container", "dst", props);
+    ASSERT_EQ("pending", props.copy_status);
+
+    std::string status, etag;
+    std::future<int> result = start_wait("dst", status, etag);
+    ASSERT_EQ(std::future_status::timeout, result.wait_for(std::chrono::milliseconds(200)));
+    client->complete_copies();
+    ASSERT_EQ(0, result.get());
+    ASSERT_EQ("success", status);
+    ASSERT_EQ(props.etag, etag);
+
+    // A later copy to the same blob reports its own ETag.
+    client->add_blob("src", "changed");
+    blob_property second(false);
+    client->start_copy("container", "src", "container", "dst", second);
+    result = start_wait("dst", status, etag);
+    client->complete_copies();
+    ASSERT_EQ(0, result.get());
+    ASSERT_EQ(second.etag, etag);
+}
+
+TEST_F(CopyPollerTest, ManyCopiesIntoOneDirectory)
+{
+    // Enough copies into one directory to be polled with a listing of it.
+    client->add_blob("src", "contents");
+    const size_t count = COPY_POLL_LIST_THRESHOLD * 2;
+    std::vector<std::string> statuses(count), etags(count);
+    std::vector<std::future<int>> results;
+    for (size_t i = 0; i < count; i++)
+    {
+        blob_property props(false);
+        client->start_copy("container", "src", "container", "dir/" + std::to_string(i), props);
+        results.push_back(start_wait("dir/" + std::to_string(i), statuses[i], etags[i]));
+    }
+    client->complete_copies();
+    for (size_t i = 0; i < count; i++)
+    {
+        ASSERT_EQ(0, results[i].get());
+        ASSERT_EQ("success", statuses[i]);
+    }
+}
+
+TEST_F(CopyPollerTest, DestinationIsGone)
+{
+    client->add_blob("src", "contents");
+    blob_property props(false);
+    client->start_copy("container", "src", "container", "aborted", props);
+
+    std::string status, etag;
+    std::future<int> result = start_wait("aborted", status, etag);
+    client->delete_blob("container", "aborted");
+    ASSERT_EQ(404, result.get());
+}
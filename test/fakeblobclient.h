@@ -0,0 +1,382 @@
+#ifndef FAKE_BLOB_CLIENT_H
+#define FAKE_BLOB_CLIENT_H
+
+#include <fstream>
+#include <sstream>
+#include "blobfuse.h"
+
+// An in-memory container, for tests that run blobfuse code against the service.  Errors are reported through errno as the blob_client_wrapper does:
+// 404 for a missing blob, or whatever fail_next() was told to return.  Copies finish immediately, unless pending_copies is set, in which case they stay
+// pending until complete_copies() is called.  upload_hook, if set, is called with the blob name before each upload, and may block it.
+class FakeBlobClient : public sync_blob_client
+{
+public:
+    struct blob
+    {
+        std::string contents;
+        std::vector<std::pair<std::string, std::string>> metadata;
+        std::string etag;
+        std::string copy_status;
+    };
+
+    FakeBlobClient() : pending_copies(false), m_next_etag(0)
+    {
+    }
+
+    bool is_valid() const override
+    {
+        return true;
+    }
+
+    void add_blob(const std::string& name, const std::string& contents)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_blobs[name].contents = contents;
+        m_blobs[name].metadata.clear();
+        m_blobs[name].etag = next_etag();
+    }
+
+    void add_directory_blob(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_blobs[name].contents.clear();
+        m_blobs[name].metadata = {std::make_pair(std::string("hdi_isfolder"), std::string("true"))};
+        m_blobs[name].etag = next_etag();
+    }
+
+    bool has_blob(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_blobs.count(name) > 0;
+    }
+
+    std::string contents(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_blobs.find(name);
+        return (iter == m_blobs.end()) ? std::string() : iter->second.contents;
+    }
+
+    std::vector<std::string> names()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::string> result;
+        for (auto iter = m_blobs.begin(); iter != m_blobs.end(); ++iter)
+        {
+            result.push_back(iter->first);
+        }
+        return result;
+    }
+
+    // The next count calls of the named kind ("start_copy", "upload", ...) on the blob fail with the given errno.
+    void fail_next(const std::string& call, const std::string& name, int error, size_t count = 1)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failures[call + ":" + name] = std::make_pair(error, count);
+    }
+
+    void complete_copies()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto iter = m_blobs.begin(); iter != m_blobs.end(); ++iter)
+        {
+            if (iter->second.copy_status == "pending")
+            {
+                iter->second.copy_status = "success";
+            }
+        }
+    }
+
+    size_t call_count(const std::string& call)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_calls[call];
+    }
+
+    list_blobs_hierarchical_response list_blobs_hierarchical(const std::string &, const std::string &delimiter, const std::string &, const std::string &prefix, int maxresults) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls["list"]++;
+        errno = 0;
+        list_blobs_hierarchical_response response;
+        std::string last_directory;
+        for (auto iter = m_blobs.lower_bound(prefix); (iter != m_blobs.end()) && (iter->first.compare(0, prefix.size(), prefix) == 0); ++iter)
+        {
+            if ((maxresults > 0) && (response.blobs.size() >= (size_t)maxresults))
+            {
+                break;
+            }
+            list_blobs_hierarchical_item item;
+            size_t slash = delimiter.empty() ? std::string::npos : iter->first.find(delimiter, prefix.size());
+            if (slash != std::string::npos)
+            {
+                std::string directory = iter->first.substr(0, slash + 1);
+                if (directory == last_directory)
+                {
+                    continue;
+                }
+                last_directory = directory;
+                item.name = directory;
+                item.is_directory = true;
+                item.content_length = 0;
+            }
+            else
+            {
+                item.name = iter->first;
+                item.is_directory = false;
+                item.content_length = iter->second.contents.size();
+                item.etag = iter->second.etag;
+                item.copy_status = iter->second.copy_status;
+                item.metadata = iter->second.metadata;
+            }
+            response.blobs.push_back(item);
+        }
+        return response;
+    }
+
+    void put_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata) override
+    {
+        blob_property props(false);
+        put_blob(sourcePath, container, blob, metadata, props);
+    }
+
+    void put_blob(const std::string &sourcePath, const std::string &, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props) override
+    {
+        store_file(sourcePath, blob, metadata, returned_props);
+    }
+
+    void upload_block_blob_from_stream(const std::string &container, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata) override
+    {
+        blob_property props(false);
+        upload_block_blob_from_stream(container, blob, is, metadata, props);
+    }
+
+    void upload_block_blob_from_stream(const std::string &, const std::string blob, std::istream &is, const std::vector<std::pair<std::string, std::string>> &metadata, blob_property &returned_props) override
+    {
+        std::stringstream buffer;
+        buffer << is.rdbuf();
+        store(blob, buffer.str(), metadata, returned_props);
+    }
+
+    void upload_file_to_blob(const std::string &sourcePath, const std::string &container, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t parallel) override
+    {
+        blob_property props(false);
+        upload_file_to_blob(sourcePath, container, blob, metadata, parallel, props);
+    }
+
+    void upload_file_to_blob(const std::string &sourcePath, const std::string &, const std::string blob, const std::vector<std::pair<std::string, std::string>> &metadata, size_t, blob_property &returned_props) override
+    {
+        store_file(sourcePath, blob, metadata, returned_props);
+    }
+
+    void download_blob_to_stream(const std::string &, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls["download"]++;
+        auto iter = find_locked("download", blob);
+        if (iter != m_blobs.end())
+        {
+            os << iter->second.contents.substr(offset, size);
+        }
+    }
+
+    chunk_property download_chunk_to_stream(const std::string &container, const std::string &blob, unsigned long long offset, unsigned long long size, std::ostream &os) override
+    {
+        download_blob_to_stream(container, blob, offset, size, os);
+        chunk_property chunk;
+        chunk.size = contents(blob).size();
+        chunk.totalSize = chunk.size;
+        chunk.last_modified = time(NULL);
+        return chunk;
+    }
+
+    void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, size_t parallel) override
+    {
+        std::string etag;
+        download_blob_to_file(container, blob, destPath, returned_last_modified, etag, parallel);
+    }
+
+    void download_blob_to_file(const std::string &, const std::string &blob, const std::string &destPath, time_t &returned_last_modified, std::string &returned_etag, size_t) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls["download"]++;
+        auto iter = find_locked("download", blob);
+        if (iter != m_blobs.end())
+        {
+            std::ofstream out(destPath, std::ios::binary | std::ios::trunc);
+            out << iter->second.contents;
+            returned_last_modified = time(NULL);
+            returned_etag = iter->second.etag;
+        }
+    }
+
+    void download_blob_to_file(const std::string &container, const std::string &blob, const std::string &destPath, blob_property &returned_props, size_t parallel) override
+    {
+        download_blob_to_file(container, blob, destPath, returned_props.last_modified, returned_props.etag, parallel);
+        if (errno == 0)
+        {
+            returned_props = get_blob_property(container, blob);
+        }
+    }
+
+    blob_property get_blob_property(const std::string &, const std::string &blob) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls["get_blob_property"]++;
+        blob_property props(false);
+        auto iter = find_locked("get_blob_property", blob);
+        if (iter != m_blobs.end())
+        {
+            fill_properties(iter->second, props);
+        }
+        return props;
+    }
+
+    blob_property get_blob_property(const std::string &container, const std::string &blob, bool) override
+    {
+        return get_blob_property(container, blob);
+    }
+
+    bool blob_exists(const std::string &container, const std::string &blob) override
+    {
+        return get_blob_property(container, blob).valid();
+    }
+
+    void delete_blob(const std::string &, const std::string &blob) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls["delete_blob"]++;
+        auto iter = find_locked("delete_blob", blob);
+        if (iter != m_blobs.end())
+        {
+            m_blobs.erase(iter);
+        }
+    }
+
+    void start_copy(const std::string &sourceContainer, const std::string &sourceBlob, const std::string &destContainer, const std::string &destBlob) override
+    {
+        blob_property props(false);
+        start_copy(sourceContainer, sourceBlob, destContainer, destBlob, props);
+    }
+
+    void start_copy(const std::string &, const std::string &sourceBlob, const std::string &, const std::string &destBlob, blob_property &returned_props) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls["start_copy"]++;
+        auto iter = find_locked("start_copy", sourceBlob);
+        if (iter == m_blobs.end())
+        {
+            return;
+        }
+        blob copy = iter->second;
+        copy.etag = next_etag();
+        copy.copy_status = pending_copies ? "pending" : "success";
+        m_blobs[destBlob] = copy;
+        fill_properties(copy, returned_props);
+    }
+
+    get_block_list_response get_block_list(const std::string &, const std::string &) override
+    {
+        errno = 0;
+        return get_block_list_response();
+    }
+
+    void upload_block_from_stream(const std::string &, const std::string, const std::string &, std::istream &) override
+    {
+        errno = 0;
+    }
+
+    void put_block_list(const std::string &, const std::string, const std::vector<put_block_list_request_base::block_item> &, const std::vector<std::pair<std::string, std::string>> &) override
+    {
+        errno = 0;
+    }
+
+    void put_block_list(const std::string &, const std::string, const std::vector<put_block_list_request_base::block_item> &, const std::vector<std::pair<std::string, std::string>> &, unsigned long long, blob_property &) override
+    {
+        errno = 0;
+    }
+
+    std::atomic<bool> pending_copies;
+    std::function<void(const std::string&)> upload_hook;
+
+private:
+    std::string next_etag()
+    {
+        return "etag" + std::to_string(m_next_etag++);
+    }
+
+    static void fill_properties(const blob& b, blob_property& props)
+    {
+        props.set_valid(true);
+        props.size = b.contents.size();
+        props.metadata = b.metadata;
+        props.etag = b.etag;
+        props.copy_status = b.copy_status;
+        props.last_modified = time(NULL);
+    }
+
+    // Sets errno for a call on the blob, and returns the blob if the call succeeds.
+    std::map<std::string, blob>::iterator find_locked(const std::string& call, const std::string& name)
+    {
+        if (take_failure_locked(call + ":" + name))
+        {
+            return m_blobs.end();
+        }
+        auto iter = m_blobs.find(name);
+        errno = (iter == m_blobs.end()) ? 404 : 0;
+        return iter;
+    }
+
+    // Sets errno and returns true if the call was told to fail.
+    bool take_failure_locked(const std::string& key)
+    {
+        auto failure = m_failures.find(key);
+        if (failure == m_failures.end())
+        {
+            return false;
+        }
+        errno = failure->second.first;
+        if (--failure->second.second == 0)
+        {
+            m_failures.erase(failure);
+        }
+        return true;
+    }
+
+    void store(const std::string& name, const std::string& contents, const std::vector<std::pair<std::string, std::string>>& metadata, blob_property& returned_props)
+    {
+        if (upload_hook)
+        {
+            upload_hook(name);
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls["upload"]++;
+        if (take_failure_locked("upload:" + name))
+        {
+            return;
+        }
+        errno = 0;
+        blob& b = m_blobs[name];
+        b.contents = contents;
+        b.metadata = metadata;
+        b.etag = next_etag();
+        b.copy_status.clear();
+        fill_properties(b, returned_props);
+    }
+
+    void store_file(const std::string& path, const std::string& name, const std::vector<std::pair<std::string, std::string>>& metadata, blob_property& returned_props)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        store(name, buffer.str(), metadata, returned_props);
+    }
+
+    std::mutex m_mutex;
+    std::map<std::string, blob> m_blobs;
+    std::map<std::string, std::pair<int, size_t>> m_failures; // The errno, and how many more calls fail with it.
+    std::map<std::string, size_t> m_calls;
+    unsigned long long m_next_etag;
+};
+
+#endif
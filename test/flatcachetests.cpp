@@ -0,0 +1,134 @@
+#include <ftw.h>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover file_cache_map, which places each file of the flat cache layout and lists the directories that only exist as prefixes of the
+// paths in it.  The map is a singleton, so each test uses its own paths.
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+class FlatCacheTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/blobfuse_flat_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(dir));
+        tmp = dir;
+        objects = tmp + "/objects";
+        ASSERT_EQ(0, file_cache_map::get_instance()->init(objects));
+    }
+
+    void TearDown() override
+    {
+        for (size_t i = 0; i < used.size(); i++)
+        {
+            file_cache_map::get_instance()->remove_path(used[i]);
+        }
+        nftw(tmp.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    std::string tmp;
+    std::string objects;
+    std::vector<std::string> used; // Paths to take out of the map after the test.
+};
+
+TEST_F(FlatCacheTest, CreatesFanOutDirectories)
+{
+    struct stat buf;
+    ASSERT_EQ(0, stat((objects + "/00").c_str(), &buf));
+    ASSERT_TRUE(S_ISDIR(buf.st_mode));
+    ASSERT_EQ(0, stat((objects + "/ff").c_str(), &buf));
+    ASSERT_TRUE(S_ISDIR(buf.st_mode));
+}
+
+TEST_F(FlatCacheTest, FileIsNamedByHashOfPath)
+{
+    file_cache_map *map = file_cache_map::get_instance();
+    used = {"/flat_hash/file"};
+    std::string expected = map->get_cache_path("/flat_hash/file");
+    std::string file = map->add_path("/flat_hash/file");
+    ASSERT_EQ(expected, file);
+    ASSERT_EQ(file, map->add_path("/flat_hash/file"));
+
+    // objects/<first two characters of the name>/<SHA-1 of the path in hex>
+    std::string object = map->get_object("/flat_hash/file");
+    ASSERT_EQ(40u, object.size());
+    ASSERT_EQ(objects + "/" + object.substr(0, 2) + "/" + object, file);
+    ASSERT_EQ("/flat_hash/file", map->get_path(file));
+
+    map->remove_path("/flat_hash/file");
+    ASSERT_EQ("", map->get_path(file));
+    ASSERT_EQ("", map->get_object("/flat_hash/file"));
+}
+
+TEST_F(FlatCacheTest, RenameMovesTheFileToTheNewPath)
+{
+    file_cache_map *map = file_cache_map::get_instance();
+    used = {"/flat_rename/src", "/flat_rename/dst", "/flat_rename/other"};
+    std::string src_file = map->add_path("/flat_rename/src");
+    std::string dst_file = map->add_path("/flat_rename/dst");
+
+    ASSERT_EQ(dst_file, map->rename_path("/flat_rename/src", "/flat_rename/dst"));
+    ASSERT_EQ(src_file, map->get_cache_path("/flat_rename/dst"));
+    ASSERT_EQ("/flat_rename/dst", map->get_path(src_file));
+    ASSERT_EQ("", map->get_path(dst_file));
+    ASSERT_EQ("", map->get_object("/flat_rename/src"));
+
+    // Nothing is replaced when the destination had no file, or the source has none.
+    ASSERT_EQ("", map->rename_path("/flat_rename/dst", "/flat_rename/other"));
+    ASSERT_EQ("", map->rename_path("/flat_rename/missing", "/flat_rename/other"));
+    ASSERT_EQ(src_file, map->get_cache_path("/flat_rename/other"));
+}
+
+TEST_F(FlatCacheTest, TakenNameGetsASuffix)
+{
+    file_cache_map *map = file_cache_map::get_instance();
+    used = {"/flat_probe/a", "/flat_probe/b"};
+    std::string file = map->add_path("/flat_probe/a");
+    map->rename_path("/flat_probe/a", "/flat_probe/b");
+
+    // The file of /flat_probe/b still has the name for /flat_probe/a.
+    ASSERT_EQ(file + "-1", map->add_path("/flat_probe/a"));
+    ASSERT_EQ("/flat_probe/a", map->get_path(file + "-1"));
+    ASSERT_EQ("/flat_probe/b", map->get_path(file));
+}
+
+TEST_F(FlatCacheTest, ListChildren)
+{
+    file_cache_map *map = file_cache_map::get_instance();
+    used = {"/flat_list/d/a", "/flat_list/d/b", "/flat_list/d/sub.txt", "/flat_list/d/sub/c", "/flat_list/d/sub/deeper/e",
+        "/flat_list/d/sub0", "/flat_list/d/z", "/flat_list/d-x", "/flat_list/d0"};
+    for (size_t i = 0; i < used.size(); i++)
+    {
+        map->add_path(used[i]);
+    }
+
+    // '.' sorts before '/' and '0' after it, so the files next to the subdirectory must not be mistaken for its contents.
+    std::vector<std::pair<std::string, bool>> expected = {{"a", false}, {"b", false}, {"sub.txt", false}, {"sub", true}, {"sub0", false}, {"z", false}};
+    ASSERT_EQ(expected, map->list_children("/flat_list/d"));
+    ASSERT_EQ(expected, map->list_children("/flat_list/d/"));
+    ASSERT_TRUE(map->has_children("/flat_list/d/sub"));
+    ASSERT_FALSE(map->has_children("/flat_list/d/a"));
+    ASSERT_TRUE(map->list_children("/flat_list/missing").empty());
+
+    map->remove_path("/flat_list/d/sub/c");
+    map->remove_path("/flat_list/d/sub/deeper/e");
+    ASSERT_FALSE(map->has_children("/flat_list/d/sub"));
+}
+
+TEST_F(FlatCacheTest, RestorePath)
+{
+    file_cache_map *map = file_cache_map::get_instance();
+    used = {"/flat_restore/a", "/flat_restore/b"};
+    ASSERT_TRUE(map->restore_path("/flat_restore/a", "00restored"));
+    ASSERT_EQ("00restored", map->get_object("/flat_restore/a"));
+    ASSERT_EQ(objects + "/00/00restored", map->get_cache_path("/flat_restore/a"));
+
+    // Neither the path nor the file can be restored twice.
+    ASSERT_FALSE(map->restore_path("/flat_restore/a", "00other"));
+    ASSERT_FALSE(map->restore_path("/flat_restore/b", "00restored"));
+}
@@ -0,0 +1,160 @@
+#include <ftw.h>
+#include <sys/file.h>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover the file cache GC: which files are evicted to keep the cache within --cache-size-mb, and the order closed files expire in.  Each
+// test uses its own gc_cache, without starting the GC thread.
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+class GcCacheTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/blobfuse_gc_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(dir));
+        tmp = dir;
+        saved_options = str_options;
+        str_options.tmpPath = tmp;
+        ASSERT_EQ(0, mkdir((tmp + "/root").c_str(), S_IRWXU));
+    }
+
+    void TearDown() override
+    {
+        str_options = saved_options;
+        nftw(tmp.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    // Creates a file in the cache, and returns the space it takes up on disk.
+    unsigned long long add_cache_file(const std::string& path)
+    {
+        std::ofstream out(prepend_mnt_path_string(path));
+        out << std::string(64 * 1024, 'x');
+        out.close();
+        struct stat buf;
+        EXPECT_EQ(0, stat(prepend_mnt_path_string(path).c_str(), &buf));
+        return (unsigned long long)buf.st_blocks * 512;
+    }
+
+    bool cached(const std::string& path)
+    {
+        return access(prepend_mnt_path_string(path).c_str(), F_OK) == 0;
+    }
+
+    std::string tmp;
+    struct str_options saved_options;
+};
+
+TEST_F(GcCacheTest, EvictsLeastRecentlyUsed)
+{
+    gc_cache gc;
+    unsigned long long size = add_cache_file("/a");
+    add_cache_file("/b");
+    add_cache_file("/c");
+    gc.touch_file("/a");
+    gc.touch_file("/b");
+    gc.touch_file("/c");
+    gc.touch_file("/a");
+
+    str_options.max_cache_bytes = 2 * size;
+    gc.evict_over_budget();
+    ASSERT_TRUE(cached("/a"));
+    ASSERT_FALSE(cached("/b"));
+    ASSERT_TRUE(cached("/c"));
+
+    str_options.max_cache_bytes = size;
+    gc.evict_over_budget();
+    ASSERT_TRUE(cached("/a"));
+    ASSERT_FALSE(cached("/c"));
+}
+
+TEST_F(GcCacheTest, OpenFileIsNotEvicted)
+{
+    gc_cache gc;
+    unsigned long long size = add_cache_file("/open");
+    add_cache_file("/closed");
+    gc.touch_file("/open");
+    gc.touch_file("/closed");
+
+    int fd = open(prepend_mnt_path_string("/open").c_str(), O_RDONLY);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(0, flock(fd, LOCK_SH));
+    str_options.max_cache_bytes = size;
+    gc.evict_over_budget();
+    ASSERT_TRUE(cached("/open"));
+    ASSERT_FALSE(cached("/closed"));
+    close(fd);
+
+    // The file that was open was moved to the front, and is the next to go once it is closed.
+    str_options.max_cache_bytes = 1;
+    gc.evict_over_budget();
+    ASSERT_FALSE(cached("/open"));
+}
+
+TEST_F(GcCacheTest, RenamedFileKeepsItsPlace)
+{
+    gc_cache gc;
+    unsigned long long size = add_cache_file("/old");
+    add_cache_file("/other");
+    gc.touch_file("/old");
+    gc.touch_file("/other");
+
+    ASSERT_EQ(0, rename(prepend_mnt_path_string("/old").c_str(), prepend_mnt_path_string("/new").c_str()));
+    gc.rename_file("/old", "/new");
+    str_options.max_cache_bytes = size;
+    gc.evict_over_budget();
+    ASSERT_FALSE(cached("/new"));
+    ASSERT_TRUE(cached("/other"));
+}
+
+TEST_F(GcCacheTest, RemovedFileIsNotCounted)
+{
+    gc_cache gc;
+    unsigned long long size = add_cache_file("/kept");
+    add_cache_file("/removed");
+    gc.touch_file("/kept");
+    gc.touch_file("/removed");
+    ASSERT_EQ(0, unlink(prepend_mnt_path_string("/removed").c_str()));
+    gc.remove_file("/removed");
+
+    str_options.max_cache_bytes = size;
+    gc.evict_over_budget();
+    ASSERT_TRUE(cached("/kept"));
+}
+
+TEST_F(GcCacheTest, NoLimit)
+{
+    gc_cache gc;
+    add_cache_file("/unlimited");
+    gc.touch_file("/unlimited");
+    str_options.max_cache_bytes = 0;
+    gc.evict_over_budget();
+    ASSERT_TRUE(cached("/unlimited"));
+}
+
+TEST(GcHeapTest, ClosedFirstIsOnTop)
+{
+    std::priority_queue<file_to_delete, std::vector<file_to_delete>, closed_later> heap;
+    std::vector<time_t> closed = {300, 100, 500, 200, 400, 100};
+    for (size_t i = 0; i < closed.size(); i++)
+    {
+        file_to_delete file;
+        file.path = "/file" + std::to_string(i);
+        file.closed_time = closed[i];
+        heap.push(file);
+    }
+
+    std::vector<time_t> order;
+    while (!heap.empty())
+    {
+        order.push_back(heap.top().closed_time);
+        heap.pop();
+    }
+    std::vector<time_t> expected = {100, 100, 200, 300, 400, 500};
+    ASSERT_EQ(expected, order);
+}
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <thread>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover missing_path_map, the paths cached as missing for --negative-cache-timeout.  The map is a singleton, so each test works under its
+// own top-level directory.
+
+class MissingPathTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        paths = missing_path_map::get_instance();
+        paths->set_timeout(60);
+    }
+
+    void add_missing(const std::string& path)
+    {
+        paths->add_missing(path, paths->begin_lookup());
+    }
+
+    missing_path_map* paths;
+};
+
+TEST_F(MissingPathTest, AddAndExpire)
+{
+    ASSERT_FALSE(paths->is_missing("/expire/file"));
+    add_missing("/expire/file");
+    ASSERT_TRUE(paths->is_missing("/expire/file"));
+    ASSERT_FALSE(paths->is_missing("/expire"));
+    ASSERT_FALSE(paths->is_missing("/expire/file2"));
+
+    paths->set_timeout(1);
+    add_missing("/expire/short");
+    ASSERT_TRUE(paths->is_missing("/expire/short"));
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    ASSERT_FALSE(paths->is_missing("/expire/short"));
+    ASSERT_TRUE(paths->is_missing("/expire/file"));
+}
+
+TEST_F(MissingPathTest, StaleLookupIsRejected)
+{
+    unsigned long long lookup = paths->begin_lookup();
+    paths->remove_path("/stale/other");
+    paths->add_missing("/stale/file", lookup);
+    ASSERT_FALSE(paths->is_missing("/stale/file"));
+
+    add_missing("/stale/file");
+    ASSERT_TRUE(paths->is_missing("/stale/file"));
+}
+
+TEST_F(MissingPathTest, RemovePathAncestorsAndDescendants)
+{
+    add_missing("/remove");
+    add_missing("/remove/dir");
+    add_missing("/remove/dir/file");
+    add_missing("/remove/dir/sub/file");
+    add_missing("/remove/dir2");
+    add_missing("/remove/dir2/file");
+    add_missing("/remove/di");
+
+    paths->remove_path("/remove/dir");
+
+    ASSERT_FALSE(paths->is_missing("/remove"));
+    ASSERT_FALSE(paths->is_missing("/remove/dir"));
+    ASSERT_FALSE(paths->is_missing("/remove/dir/file"));
+    ASSERT_FALSE(paths->is_missing("/remove/dir/sub/file"));
+    // Paths that only share a prefix of the name are kept.
+    ASSERT_TRUE(paths->is_missing("/remove/dir2"));
+    ASSERT_TRUE(paths->is_missing("/remove/dir2/file"));
+    ASSERT_TRUE(paths->is_missing("/remove/di"));
+}
+
+TEST_F(MissingPathTest, Disabled)
+{
+    paths->set_timeout(0);
+    add_missing("/disabled/file");
+    ASSERT_FALSE(paths->is_missing("/disabled/file"));
+    paths->set_timeout(60);
+    ASSERT_FALSE(paths->is_missing("/disabled/file"));
+}
@@ -0,0 +1,100 @@
+#include <chrono>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover name_set, used to de-duplicate the local cache and service listings of a directory in readdir and directory rename.
+
+TEST(NameSetTest, InsertAndContains)
+{
+    name_set names;
+    ASSERT_EQ(0u, names.size());
+    ASSERT_FALSE(names.contains("file"));
+
+    ASSERT_TRUE(names.insert("file"));
+    ASSERT_TRUE(names.insert("dir"));
+    ASSERT_TRUE(names.insert(""));
+    ASSERT_FALSE(names.insert("file"));
+    ASSERT_EQ(3u, names.size());
+
+    ASSERT_TRUE(names.contains("file"));
+    ASSERT_TRUE(names.contains("dir"));
+    ASSERT_TRUE(names.contains(""));
+    ASSERT_FALSE(names.contains("fil"));
+    ASSERT_FALSE(names.contains("file2"));
+    ASSERT_FALSE(names.contains("dir/"));
+}
+
+TEST(NameSetTest, Clear)
+{
+    name_set names;
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_TRUE(names.insert("name" + std::to_string(i)));
+    }
+    names.clear();
+    ASSERT_EQ(0u, names.size());
+    ASSERT_FALSE(names.contains("name0"));
+    ASSERT_TRUE(names.insert("name0"));
+    ASSERT_TRUE(names.contains("name0"));
+}
+
+TEST(NameSetTest, Grow)
+{
+    // Names sharing long prefixes, as blob names in one directory often do, must survive the table growing many times.
+    name_set names;
+    const int count = 100000;
+    for (int i = 0; i < count; i++)
+    {
+        ASSERT_TRUE(names.insert("train/shard-0000/sample-" + std::to_string(i) + ".jpg"));
+    }
+    ASSERT_EQ((size_t)count, names.size());
+    for (int i = 0; i < count; i++)
+    {
+        ASSERT_TRUE(names.contains("train/shard-0000/sample-" + std::to_string(i) + ".jpg"));
+        ASSERT_FALSE(names.contains("train/shard-0000/sample-" + std::to_string(i) + ".png"));
+    }
+}
+
+// Merges a listing of a directory against entries from the local cache, half of which are also on the service, the way readdir does.
+static size_t merge_listing(int service_count, int local_count)
+{
+    std::vector<std::string> service_names;
+    service_names.reserve(service_count);
+    for (int i = 0; i < service_count; i++)
+    {
+        service_names.push_back("sample-" + std::to_string(i) + ".jpg");
+    }
+
+    name_set seen;
+    for (int i = 0; i < local_count; i++)
+    {
+        // Every other local file is also on the service.
+        seen.insert("sample-" + std::to_string((i % 2 == 0) ? i * 2 : service_count + i) + ".jpg");
+    }
+    size_t listed = 0;
+    for (size_t i = 0; i < service_names.size(); i++)
+    {
+        if (!seen.contains(service_names[i]))
+        {
+            listed++;
+        }
+    }
+    return listed;
+}
+
+TEST(NameSetTest, MergeListing)
+{
+    ASSERT_EQ((size_t)(10000 - 1000 / 2), merge_listing(10000, 1000));
+}
+
+// Benchmark for a 1M-entry directory with 100K local entries; searching the local entries linearly, as readdir used to, takes minutes.  Run it with
+// --gtest_also_run_disabled_tests; the time taken is recorded as the elapsed_ms property in the test report.
+TEST(NameSetTest, DISABLED_MergeMillionEntryDirectory)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t listed = merge_listing(1000000, 100000);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    ASSERT_EQ((size_t)(1000000 - 100000 / 2), listed);
+    ::testing::Test::RecordProperty("elapsed_ms", (int)elapsed.count());
+}
@@ -0,0 +1,251 @@
+#include <chrono>
+#include <thread>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover namespace_tree, the listings cached for --listing-cache-timeout.  The tree is a singleton, so each test works under its own
+// top-level directory.
+
+static listing_entry file_entry(unsigned long long size)
+{
+    listing_entry entry;
+    entry.is_directory = false;
+    entry.has_children = false;
+    entry.size = size;
+    entry.last_modified = 0;
+    return entry;
+}
+
+static listing_entry directory_entry()
+{
+    listing_entry entry;
+    entry.is_directory = true;
+    entry.has_children = true;
+    entry.size = 0;
+    entry.last_modified = 0;
+    return entry;
+}
+
+class NamespaceTreeTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        tree = namespace_tree::get_instance();
+        tree->set_timeout(60);
+    }
+
+    void add_listing(const std::string& dir, const listing_children& children)
+    {
+        tree->add_listing(dir, children, tree->begin_listing());
+    }
+
+    namespace_tree* tree;
+};
+
+TEST_F(NamespaceTreeTest, LookupInListedDirectory)
+{
+    listing_children children;
+    children["file"] = file_entry(10);
+    children["dir"] = directory_entry();
+    add_listing("/lookup", children);
+
+    listing_entry entry;
+    ASSERT_EQ(NS_FOUND, tree->lookup("/lookup/file", entry));
+    ASSERT_FALSE(entry.is_directory);
+    ASSERT_EQ(10u, entry.size);
+    ASSERT_EQ(NS_FOUND, tree->lookup("/lookup/dir", entry));
+    ASSERT_TRUE(entry.is_directory);
+    ASSERT_EQ(NS_MISSING, tree->lookup("/lookup/other", entry));
+    ASSERT_EQ(NS_MISSING, tree->lookup("/lookup/other/file", entry));
+    // The directory holding the listed one was never listed.
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/lookup", entry));
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/lookup/dir/file", entry));
+
+    listing_children listed;
+    ASSERT_TRUE(tree->list("/lookup", listed));
+    ASSERT_EQ(2u, listed.size());
+    ASSERT_EQ(1u, listed.count("file"));
+    ASSERT_EQ(1u, listed.count("dir"));
+    ASSERT_FALSE(tree->list("/lookup/dir", listed));
+}
+
+TEST_F(NamespaceTreeTest, MergeKeepsSubdirectoryListings)
+{
+    listing_children children;
+    children["a"] = file_entry(1);
+    children["sub"] = directory_entry();
+    add_listing("/merge", children);
+
+    listing_children sub_children;
+    sub_children["x"] = file_entry(2);
+    add_listing("/merge/sub", sub_children);
+
+    // Listing the parent again drops the file that is gone, adds the new one, and keeps the listing of the directory that is still there.
+    children.erase("a");
+    children["b"] = file_entry(3);
+    add_listing("/merge", children);
+
+    listing_entry entry;
+    ASSERT_EQ(NS_MISSING, tree->lookup("/merge/a", entry));
+    ASSERT_EQ(NS_FOUND, tree->lookup("/merge/b", entry));
+    ASSERT_EQ(3u, entry.size);
+    ASSERT_EQ(NS_FOUND, tree->lookup("/merge/sub/x", entry));
+    ASSERT_EQ(2u, entry.size);
+    ASSERT_EQ(NS_MISSING, tree->lookup("/merge/sub/y", entry));
+
+    listing_children listed;
+    ASSERT_TRUE(tree->list("/merge/sub", listed));
+    ASSERT_EQ(1u, listed.size());
+}
+
+TEST_F(NamespaceTreeTest, FileReplacesDirectory)
+{
+    listing_children children;
+    children["d"] = directory_entry();
+    add_listing("/replace", children);
+
+    listing_children d_children;
+    d_children["x"] = file_entry(1);
+    add_listing("/replace/d", d_children);
+
+    children["d"] = file_entry(5);
+    add_listing("/replace", children);
+
+    listing_entry entry;
+    ASSERT_EQ(NS_FOUND, tree->lookup("/replace/d", entry));
+    ASSERT_FALSE(entry.is_directory);
+    ASSERT_EQ(5u, entry.size);
+    // What was listed under the directory is gone with it.
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/replace/d/x", entry));
+    listing_children listed;
+    ASSERT_FALSE(tree->list("/replace/d", listed));
+}
+
+TEST_F(NamespaceTreeTest, InvalidatePathAndAncestors)
+{
+    listing_children children;
+    children["d"] = directory_entry();
+    add_listing("/invalidate", children);
+
+    listing_children d_children;
+    d_children["f"] = file_entry(1);
+    d_children["g"] = file_entry(2);
+    add_listing("/invalidate/d", d_children);
+
+    listing_children other_children;
+    other_children["h"] = file_entry(3);
+    add_listing("/invalidate_other", other_children);
+
+    tree->invalidate("/invalidate/d/f");
+
+    listing_entry entry;
+    listing_children listed;
+    ASSERT_FALSE(tree->list("/invalidate/d", listed));
+    ASSERT_FALSE(tree->list("/invalidate", listed));
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/invalidate/d/f", entry));
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/invalidate/d/g", entry));
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/invalidate/d", entry));
+
+    // Directories that do not hold the path keep their listings.
+    ASSERT_TRUE(tree->list("/invalidate_other", listed));
+    ASSERT_EQ(NS_FOUND, tree->lookup("/invalidate_other/h", entry));
+
+    // Invalidating a directory removes what was listed under it.
+    add_listing("/invalidate/d", d_children);
+    tree->invalidate("/invalidate/d");
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/invalidate/d/g", entry));
+    ASSERT_FALSE(tree->list("/invalidate/d", listed));
+}
+
+TEST_F(NamespaceTreeTest, StaleListingIsRejected)
+{
+    listing_children children;
+    children["file"] = file_entry(1);
+
+    unsigned long long listing = tree->begin_listing();
+    tree->invalidate("/stale/file");
+    tree->add_listing("/stale", children, listing);
+
+    listing_entry entry;
+    listing_children listed;
+    ASSERT_FALSE(tree->list("/stale", listed));
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/stale/file", entry));
+
+    add_listing("/stale", children);
+    ASSERT_TRUE(tree->list("/stale", listed));
+    ASSERT_EQ(NS_FOUND, tree->lookup("/stale/file", entry));
+}
+
+TEST_F(NamespaceTreeTest, DirectoryState)
+{
+    listing_children children;
+    children["empty"] = directory_entry();
+    children["full"] = directory_entry();
+    add_listing("/state", children);
+
+    listing_children empty_children;
+    empty_children[former_directory_signifier] = file_entry(0);
+    add_listing("/state/empty", empty_children);
+
+    // A listing with nothing in it is a directory only if its marker blob exists.
+    add_listing("/state/none", listing_children());
+    int none_state;
+    ASSERT_TRUE(tree->get_directory_state("/state/none", false, none_state));
+    ASSERT_EQ(D_NOTEXIST, none_state);
+    ASSERT_TRUE(tree->get_directory_state("/state/none", true, none_state));
+    ASSERT_EQ(D_EMPTY, none_state);
+
+    listing_children full_children;
+    full_children["file"] = file_entry(1);
+    add_listing("/state/full", full_children);
+
+    int state;
+    ASSERT_TRUE(tree->get_directory_state("/state/empty", true, state));
+    ASSERT_EQ(D_EMPTY, state);
+    ASSERT_TRUE(tree->get_directory_state("/state/full", true, state));
+    ASSERT_EQ(D_NOTEMPTY, state);
+    ASSERT_TRUE(tree->get_directory_state("/state", true, state));
+    ASSERT_EQ(D_NOTEMPTY, state);
+    ASSERT_FALSE(tree->get_directory_state("/state/unlisted", true, state));
+
+    listing_entry entry;
+    ASSERT_EQ(NS_FOUND, tree->lookup("/state/empty", entry));
+    ASSERT_FALSE(entry.has_children);
+    ASSERT_EQ(NS_FOUND, tree->lookup("/state/full", entry));
+    ASSERT_TRUE(entry.has_children);
+}
+
+TEST_F(NamespaceTreeTest, PruneAfterExpiry)
+{
+    tree->set_timeout(1);
+    listing_children children;
+    for (int i = 0; i < 2000; i++)
+    {
+        children["f" + std::to_string(i)] = file_entry(i);
+    }
+    add_listing("/prune", children);
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    listing_entry entry;
+    listing_children listed;
+    ASSERT_FALSE(tree->list("/prune", listed));
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/prune/f0", entry));
+
+    // A listing large enough to reach the next sweep drops the nodes of the listing that timed out, and keeps its own.
+    tree->set_timeout(60);
+    size_t before = tree->size();
+    size_t count = before * 2 + 1024;
+    listing_children kept_children;
+    for (size_t i = 0; i < count; i++)
+    {
+        kept_children["g" + std::to_string(i)] = file_entry(i);
+    }
+    add_listing("/prune_kept", kept_children);
+
+    ASSERT_LE(tree->size(), before + count - 2000);
+    ASSERT_TRUE(tree->list("/prune_kept", listed));
+    ASSERT_EQ(count, listed.size());
+    ASSERT_EQ(NS_FOUND, tree->lookup("/prune_kept/g0", entry));
+    ASSERT_EQ(NS_UNKNOWN, tree->lookup("/prune/f0", entry));
+}
@@ -0,0 +1,111 @@
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover read_ahead(), which decides how far ahead of a sequential reader to prefetch.  The read-ahead pool has no threads, so the blocks
+// queued for prefetch are never downloaded.
+
+static const unsigned long long block_size = 4096;
+
+class ReadAheadTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        saved_options = str_options;
+        saved_pool = g_read_ahead_pool;
+        str_options.max_read_ahead_blocks = 4;
+        g_read_ahead_pool = std::make_shared<worker_pool>(0);
+
+        char file[] = "/tmp/blobfuse_readahead_XXXXXX";
+        fd = mkstemp(file);
+        ASSERT_NE(-1, fd);
+        unlink(file);
+        fhwrap = std::make_shared<fhwrapper>(fd, false);
+        fhwrap->blocks = std::make_shared<file_block_state>("blob", 32 * block_size, "etag", block_size);
+    }
+
+    void TearDown() override
+    {
+        fhwrap.reset();
+        g_read_ahead_pool = saved_pool;
+        str_options = saved_options;
+        close(fd);
+    }
+
+    void read(unsigned long long block, size_t size = block_size)
+    {
+        read_ahead(fhwrap.get(), block * block_size, size);
+    }
+
+    struct str_options saved_options;
+    std::shared_ptr<worker_pool> saved_pool;
+    int fd;
+    std::shared_ptr<fhwrapper> fhwrap;
+};
+
+TEST_F(ReadAheadTest, WindowDoublesForSequentialReads)
+{
+    read(0);
+    ASSERT_EQ(1u, fhwrap->read_ahead.window);
+    ASSERT_EQ(2u, fhwrap->read_ahead.prefetch_end);
+    read(1);
+    ASSERT_EQ(2u, fhwrap->read_ahead.window);
+    ASSERT_EQ(4u, fhwrap->read_ahead.prefetch_end);
+    read(2);
+    ASSERT_EQ(4u, fhwrap->read_ahead.window);
+    ASSERT_EQ(7u, fhwrap->read_ahead.prefetch_end);
+    // The window stops growing at --max-read-ahead-in-mb.
+    read(3);
+    ASSERT_EQ(4u, fhwrap->read_ahead.window);
+    ASSERT_EQ(8u, fhwrap->read_ahead.prefetch_end);
+}
+
+TEST_F(ReadAheadTest, ReadsWithinABlockDoNotGrowTheWindow)
+{
+    read_ahead(fhwrap.get(), 0, 100);
+    ASSERT_EQ(1u, fhwrap->read_ahead.window);
+    read_ahead(fhwrap.get(), 100, 100);
+    read_ahead(fhwrap.get(), 1000, 100);
+    ASSERT_EQ(1u, fhwrap->read_ahead.window);
+    ASSERT_EQ(2u, fhwrap->read_ahead.prefetch_end);
+
+    // A read that arrives out of order, but within the block of the last one, is still sequential.
+    read_ahead(fhwrap.get(), 500, 100);
+    ASSERT_EQ(1u, fhwrap->read_ahead.window);
+    read(1);
+    ASSERT_EQ(2u, fhwrap->read_ahead.window);
+}
+
+TEST_F(ReadAheadTest, RandomReadHalvesTheWindow)
+{
+    for (unsigned long long block = 0; block < 4; block++)
+    {
+        read(block);
+    }
+    ASSERT_EQ(4u, fhwrap->read_ahead.window);
+
+    // Skipping ahead starts a new prefetch from the new position, with half the window.
+    read(20);
+    ASSERT_EQ(2u, fhwrap->read_ahead.window);
+    ASSERT_EQ(23u, fhwrap->read_ahead.prefetch_end);
+    // Going back is not sequential either.
+    read(10);
+    ASSERT_EQ(1u, fhwrap->read_ahead.window);
+    ASSERT_EQ(12u, fhwrap->read_ahead.prefetch_end);
+    read(15);
+    ASSERT_EQ(0u, fhwrap->read_ahead.window);
+
+    // A sequential reader starts growing the window again.
+    read(16);
+    ASSERT_EQ(1u, fhwrap->read_ahead.window);
+    ASSERT_EQ(18u, fhwrap->read_ahead.prefetch_end);
+}
+
+TEST_F(ReadAheadTest, Disabled)
+{
+    str_options.max_read_ahead_blocks = 0;
+    read(0);
+    read(1);
+    ASSERT_EQ(0u, fhwrap->read_ahead.window);
+    ASSERT_EQ(0u, fhwrap->read_ahead.prefetch_end);
+}
@@ -0,0 +1,162 @@
+#include <ftw.h>
+#include <algorithm>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover azs_readdir handing a directory to the kernel a page at a time, and picking up from the offset the kernel gives back.  The
+// listing comes from the namespace tree, so no client is needed.
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+// Stands in for the kernel's buffer, which takes a limited number of entries per call.
+struct readdir_buffer
+{
+    size_t room;
+    std::vector<std::string> names;
+    std::vector<off_t> offsets;
+};
+
+static int fill(void *buf, const char *name, const struct stat *, off_t off)
+{
+    readdir_buffer *buffer = (readdir_buffer *)buf;
+    if (buffer->room == 0)
+    {
+        return 1;
+    }
+    buffer->room--;
+    buffer->names.push_back(name);
+    buffer->offsets.push_back(off);
+    return 0;
+}
+
+class ReaddirTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/blobfuse_readdir_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(dir));
+        tmp = dir;
+        saved_options = str_options;
+        str_options.tmpPath = tmp;
+        ASSERT_EQ(0, mkdir((tmp + "/root").c_str(), S_IRWXU));
+        namespace_tree::get_instance()->set_timeout(60);
+        fi.fh = (long unsigned int)new dirhandle();
+    }
+
+    void TearDown() override
+    {
+        azs_releasedir("/", &fi);
+        namespace_tree::get_instance()->set_timeout(0);
+        str_options = saved_options;
+        nftw(tmp.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    // Creates dir in the cache with the given files, and gives the namespace tree a listing of it on the service.
+    void add_directory(const std::string& dir, const std::vector<std::string>& local, const listing_children& service)
+    {
+        ASSERT_EQ(0, mkdir(prepend_mnt_path_string(dir).c_str(), S_IRWXU));
+        for (size_t i = 0; i < local.size(); i++)
+        {
+            std::ofstream out(prepend_mnt_path_string(dir + "/" + local[i]));
+            out << "local";
+        }
+        namespace_tree::get_instance()->add_listing(dir, service, namespace_tree::get_instance()->begin_listing());
+    }
+
+    // Reads the directory from offset, room entries at a time, the way the kernel would.
+    readdir_buffer read_all(const std::string& dir, off_t offset, size_t room)
+    {
+        readdir_buffer all;
+        while (true)
+        {
+            readdir_buffer page;
+            page.room = room;
+            EXPECT_EQ(0, azs_readdir(dir.c_str(), &page, fill, offset, &fi));
+            if (page.names.empty())
+            {
+                return all;
+            }
+            all.names.insert(all.names.end(), page.names.begin(), page.names.end());
+            all.offsets.insert(all.offsets.end(), page.offsets.begin(), page.offsets.end());
+            offset = page.offsets.back();
+        }
+    }
+
+    static listing_entry file_entry(unsigned long long size)
+    {
+        listing_entry entry = {};
+        entry.size = size;
+        return entry;
+    }
+
+    static listing_entry directory_entry()
+    {
+        listing_entry entry = {};
+        entry.is_directory = true;
+        entry.has_children = true;
+        return entry;
+    }
+
+    std::string tmp;
+    struct str_options saved_options;
+    struct fuse_file_info fi = {};
+};
+
+TEST_F(ReaddirTest, ResumesFromTheKernelsOffset)
+{
+    listing_children service = {{"a", file_entry(1)}, {"b", directory_entry()}, {"c", file_entry(3)}, {"shared", file_entry(5)}};
+    add_directory("/rd_resume", {"local1", "local2", "shared"}, service);
+
+    readdir_buffer all = read_all("/rd_resume", 0, 3);
+    // Each entry is handed over once, in order, even though every call stopped with the buffer full.
+    std::vector<std::string> names = all.names;
+    std::sort(names.begin(), names.end());
+    std::vector<std::string> expected = {".", "..", "a", "b", "c", "local1", "local2", "shared"};
+    ASSERT_EQ(expected, names);
+    for (size_t i = 0; i < all.offsets.size(); i++)
+    {
+        ASSERT_EQ((off_t)i + 1, all.offsets[i]);
+    }
+    ASSERT_EQ(".", all.names[0]);
+    ASSERT_EQ("..", all.names[1]);
+}
+
+TEST_F(ReaddirTest, SameStreamWhateverTheBufferSize)
+{
+    listing_children service;
+    for (int i = 0; i < 20; i++)
+    {
+        service["blob" + to_str(i)] = file_entry(i);
+    }
+    add_directory("/rd_sizes", {"local"}, service);
+
+    readdir_buffer whole = read_all("/rd_sizes", 0, 1000);
+    ASSERT_EQ(23u, whole.names.size());
+    for (size_t room = 1; room < 8; room++)
+    {
+        SCOPED_TRACE(room);
+        readdir_buffer paged = read_all("/rd_sizes", 0, room);
+        ASSERT_EQ(whole.names, paged.names);
+        ASSERT_EQ(whole.offsets, paged.offsets);
+    }
+}
+
+TEST_F(ReaddirTest, RewindStartsOver)
+{
+    listing_children service = {{"a", file_entry(1)}, {"b", file_entry(2)}};
+    add_directory("/rd_rewind", {}, service);
+
+    readdir_buffer first = read_all("/rd_rewind", 0, 2);
+    ASSERT_EQ(4u, first.names.size());
+    readdir_buffer again = read_all("/rd_rewind", 0, 2);
+    ASSERT_EQ(first.names, again.names);
+
+    // Going back to an earlier offset picks up just after it.
+    readdir_buffer tail = read_all("/rd_rewind", 2, 10);
+    std::vector<std::string> expected(first.names.begin() + 2, first.names.end());
+    ASSERT_EQ(expected, tail.names);
+}
@@ -0,0 +1,59 @@
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover plan_refresh, which works out the ranges to download when a blob in the file cache has changed on the service.
+
+#define MB (1024ULL * 1024)
+
+struct refresh_plan_case
+{
+    const char *name;
+    std::vector<std::pair<std::string, unsigned long long>> old_blocks; // ID and size of each block.
+    std::vector<std::pair<std::string, unsigned long long>> new_blocks;
+    std::vector<std::pair<unsigned long long, unsigned long long>> expected; // Offset and size of each range.
+    unsigned long long reused;
+};
+
+static std::vector<get_block_list_item> make_blocks(const std::vector<std::pair<std::string, unsigned long long>>& blocks)
+{
+    std::vector<get_block_list_item> items;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        get_block_list_item item;
+        item.name = blocks[i].first;
+        item.size = blocks[i].second;
+        items.push_back(item);
+    }
+    return items;
+}
+
+TEST(RefreshPlanTest, PlanRefresh)
+{
+    std::vector<std::pair<std::string, unsigned long long>> old_blocks = {{"a", 8 * MB}, {"b", 8 * MB}, {"c", 8 * MB}};
+    std::vector<refresh_plan_case> cases = {
+        {"unchanged", old_blocks, old_blocks, {}, 24 * MB},
+        {"one block replaced", old_blocks, {{"a", 8 * MB}, {"x", 8 * MB}, {"c", 8 * MB}}, {{8 * MB, 8 * MB}}, 16 * MB},
+        {"appended", old_blocks, {{"a", 8 * MB}, {"b", 8 * MB}, {"c", 8 * MB}, {"d", 4 * MB}}, {{24 * MB, 4 * MB}}, 24 * MB},
+        {"truncated", old_blocks, {{"a", 8 * MB}, {"b", 8 * MB}}, {}, 16 * MB},
+        {"same ID with a different size", old_blocks, {{"a", 8 * MB}, {"b", 6 * MB}, {"c", 8 * MB}}, {{8 * MB, 6 * MB}, {14 * MB, 8 * MB}}, 8 * MB},
+        {"block inserted, shifting the rest", old_blocks, {{"x", 1 * MB}, {"a", 8 * MB}, {"b", 8 * MB}, {"c", 8 * MB}},
+            {{0, 1 * MB}, {1 * MB, 8 * MB}, {9 * MB, 8 * MB}, {17 * MB, 8 * MB}}, 0},
+        {"changed block larger than a range", old_blocks, {{"a", 8 * MB}, {"y", 40 * MB}},
+            {{8 * MB, 16 * MB}, {24 * MB, 16 * MB}, {40 * MB, 8 * MB}}, 8 * MB},
+        {"no old blocks", {}, {{"a", 8 * MB}}, {{0, 8 * MB}}, 0},
+    };
+    for (size_t i = 0; i < cases.size(); i++)
+    {
+        SCOPED_TRACE(cases[i].name);
+        unsigned long long reused = 1;
+        std::vector<refresh_range> ranges = plan_refresh(make_blocks(cases[i].old_blocks), make_blocks(cases[i].new_blocks), reused);
+        ASSERT_EQ(cases[i].reused, reused);
+        ASSERT_EQ(cases[i].expected.size(), ranges.size());
+        for (size_t j = 0; j < ranges.size(); j++)
+        {
+            SCOPED_TRACE(j);
+            ASSERT_EQ(cases[i].expected[j].first, ranges[j].offset);
+            ASSERT_EQ(cases[i].expected[j].second, ranges[j].size);
+        }
+    }
+}
@@ -0,0 +1,228 @@
+#include <ftw.h>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+#include "fakeblobclient.h"
+
+// These tests cover renaming files and directories against an in-memory container: blobs that are only on the service, files in the local cache, and
+// the journal that lets an interrupted directory rename finish at the next mount.
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+class RenameTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/blobfuse_rename_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(dir));
+        tmp = dir;
+        saved_options = str_options;
+        saved_client = azure_blob_client_wrapper;
+        str_options.tmpPath = tmp;
+        str_options.containerName = "container";
+        str_options.rename_concurrency = 4;
+        str_options.use_flat_cache = false;
+        namespace_tree::get_instance()->set_timeout(0);
+        missing_path_map::get_instance()->set_timeout(0);
+        ASSERT_EQ(0, mkdir((tmp + "/root").c_str(), S_IRWXU));
+        client = std::make_shared<FakeBlobClient>();
+        azure_blob_client_wrapper = client;
+        // Creates the journal directory.
+        resume_directory_renames();
+    }
+
+    void TearDown() override
+    {
+        azure_blob_client_wrapper = saved_client;
+        str_options = saved_options;
+        nftw(tmp.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    void write_local_file(const std::string& path, const std::string& contents)
+    {
+        std::string mntPath = prepend_mnt_path_string(path);
+        ensure_files_directory_exists_in_cache(mntPath);
+        std::ofstream out(mntPath);
+        out << contents;
+    }
+
+    void write_journal_file(const std::string& name, const std::string& contents)
+    {
+        std::ofstream out(tmp + "/renames/" + name);
+        out << contents;
+    }
+
+    bool journal_empty()
+    {
+        DIR *dir = opendir((tmp + "/renames").c_str());
+        bool empty = true;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            empty = empty && (entry->d_name[0] == '.');
+        }
+        closedir(dir);
+        return empty;
+    }
+
+    std::string tmp;
+    struct str_options saved_options;
+    std::shared_ptr<sync_blob_client> saved_client;
+    std::shared_ptr<FakeBlobClient> client;
+};
+
+TEST_F(RenameTest, SingleFileNotInCache)
+{
+    client->add_blob("file", "contents");
+    ASSERT_EQ(0, azs_rename_single_file("/file", "/renamed"));
+    ASSERT_FALSE(client->has_blob("file"));
+    ASSERT_EQ("contents", client->contents("renamed"));
+
+    ASSERT_EQ(-ENOENT, azs_rename_single_file("/file", "/renamed2"));
+    ASSERT_FALSE(client->has_blob("renamed2"));
+}
+
+TEST_F(RenameTest, SingleFileInCache)
+{
+    client->add_blob("cached", "contents");
+    write_local_file("/cached", "contents");
+    ASSERT_EQ(0, azs_rename_single_file("/cached", "/moved"));
+    ASSERT_FALSE(client->has_blob("cached"));
+    ASSERT_EQ("contents", client->contents("moved"));
+    ASSERT_NE(0, access(prepend_mnt_path_string("/cached").c_str(), F_OK));
+    ASSERT_EQ(0, access(prepend_mnt_path_string("/moved").c_str(), F_OK));
+}
+
+TEST_F(RenameTest, SingleFileOnlyInCache)
+{
+    // A file that has not been uploaded yet.
+    write_local_file("/new", "contents");
+    ASSERT_EQ(0, azs_rename_single_file("/new", "/newer"));
+    ASSERT_EQ(0, access(prepend_mnt_path_string("/newer").c_str(), F_OK));
+    ASSERT_FALSE(client->has_blob("newer"));
+}
+
+TEST_F(RenameTest, DirectoryNotInCache)
+{
+    client->add_directory_blob("src");
+    client->add_blob("src/a", "a");
+    client->add_directory_blob("src/sub");
+    client->add_blob("src/sub/b", "b");
+    client->add_blob("srcfile", "not in the directory");
+
+    ASSERT_EQ(0, azs_rename_directory("/src", "/dst"));
+
+    std::vector<std::string> expected = {"dst", "dst/a", "dst/sub", "dst/sub/b", "srcfile"};
+    ASSERT_EQ(expected, client->names());
+    ASSERT_EQ("a", client->contents("dst/a"));
+    ASSERT_EQ("b", client->contents("dst/sub/b"));
+    ASSERT_TRUE(journal_empty());
+}
+
+TEST_F(RenameTest, DirectoryPartlyInCache)
+{
+    client->add_directory_blob("mixed");
+    client->add_blob("mixed/cached", "cached");
+    client->add_blob("mixed/remote", "remote");
+    write_local_file("/mixed/cached", "cached");
+    // A file that was created locally and not uploaded yet.
+    write_local_file("/mixed/local", "local");
+
+    ASSERT_EQ(0, azs_rename_directory("/mixed", "/moved"));
+
+    std::vector<std::string> expected = {"moved", "moved/cached", "moved/remote"};
+    ASSERT_EQ(expected, client->names());
+    ASSERT_EQ(0, access(prepend_mnt_path_string("/moved/cached").c_str(), F_OK));
+    ASSERT_EQ(0, access(prepend_mnt_path_string("/moved/local").c_str(), F_OK));
+    ASSERT_NE(0, access(prepend_mnt_path_string("/mixed").c_str(), F_OK));
+    ASSERT_TRUE(journal_empty());
+}
+
+TEST_F(RenameTest, DirectoryRetriesWhenBusy)
+{
+    client->add_blob("busy/a", "a");
+    client->fail_next("start_copy", "busy/a", 503);
+
+    ASSERT_EQ(0, azs_rename_directory("/busy", "/notbusy"));
+    ASSERT_EQ("a", client->contents("notbusy/a"));
+    ASSERT_FALSE(client->has_blob("busy/a"));
+}
+
+TEST_F(RenameTest, FailedDirectoryRenameIsNotResumed)
+{
+    client->add_directory_blob("failing");
+    client->add_blob("failing/a", "a");
+    client->add_blob("failing/b", "b");
+    client->fail_next("start_copy", "failing/b", 403);
+
+    ASSERT_EQ(-EACCES, azs_rename_directory("/failing", "/failed"));
+    ASSERT_EQ("a", client->contents("failed/a"));
+    ASSERT_EQ("b", client->contents("failing/b"));
+    ASSERT_TRUE(client->has_blob("failed"));
+    ASSERT_TRUE(journal_empty());
+
+    resume_directory_renames();
+    ASSERT_EQ("b", client->contents("failing/b"));
+    ASSERT_FALSE(client->has_blob("failed/b"));
+}
+
+TEST_F(RenameTest, FailedDirectoryBlobMoveFailsTheRename)
+{
+    client->add_directory_blob("marked");
+    client->add_blob("marked/a", "a");
+    client->fail_next("start_copy", "marked", 403);
+
+    ASSERT_EQ(-EACCES, azs_rename_directory("/marked", "/unmarked"));
+    // The marker of the source directory is not deleted.
+    ASSERT_TRUE(client->has_blob("marked"));
+    ASSERT_EQ("a", client->contents("unmarked/a"));
+    ASSERT_TRUE(journal_empty());
+}
+
+TEST_F(RenameTest, ResumeFinishesInterruptedRename)
+{
+    // The rename was interrupted after moving "a".
+    client->add_directory_blob("interrupted");
+    client->add_blob("finished/a", "a");
+    client->add_blob("interrupted/b", "b");
+    client->add_blob("interrupted/sub/c", "c");
+    write_journal_file("00000000000000000100-00000000000000000000.rename", "/interrupted\n/finished\na\nb\nsub/c\n");
+    write_journal_file("00000000000000000100-00000000000000000000.done", "a\n");
+    // A record that was never completed is discarded.
+    write_journal_file("00000000000000000100-00000000000000000001.tmp", "/finished\n");
+
+    resume_directory_renames();
+
+    std::vector<std::string> expected = {"finished", "finished/a", "finished/b", "finished/sub/c"};
+    ASSERT_EQ(expected, client->names());
+    ASSERT_TRUE(journal_empty());
+}
+
+TEST_F(RenameTest, ResumeInStartOrder)
+{
+    // Two chained renames, started in the same second: chain1 to chain2, then chain2 to chain3.  They only end up in chain3 if they are resumed in
+    // the order they were started.
+    client->add_blob("chain1/x", "x");
+    write_journal_file("00000000000000000100-00000000000000000009.rename", "/chain1\n/chain2\nx\n");
+    write_journal_file("00000000000000000100-00000000000000000010.rename", "/chain2\n/chain3\nx\n");
+
+    resume_directory_renames();
+
+    std::vector<std::string> expected = {"chain3/x"};
+    ASSERT_EQ(expected, client->names());
+    ASSERT_TRUE(journal_empty());
+}
+
+TEST_F(RenameTest, UnreadableJournalIsDiscarded)
+{
+    client->add_blob("kept/x", "x");
+    write_journal_file("00000000000000000100-00000000000000000000.rename", "/kept\n");
+
+    resume_directory_renames();
+
+    ASSERT_TRUE(client->has_blob("kept/x"));
+    ASSERT_TRUE(journal_empty());
+}
@@ -0,0 +1,138 @@
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover plan_upload, which works out the block list to commit when a file that was changed through this mount is uploaded.
+
+#define MB (1024ULL * 1024)
+
+// What a segment of the plan should be: 'C' for a committed block, 'S' for a staged block, or 'N' for a new block to upload.
+struct expected_segment
+{
+    char kind;
+    std::string id;
+    unsigned long long offset;
+    unsigned long long size;
+};
+
+struct upload_plan_case
+{
+    const char *name;
+    std::vector<unsigned long long> base; // Sizes of the committed blocks, with IDs base0000, base0001, ...
+    std::map<unsigned long long, staged_block> staged;
+    std::map<unsigned long long, unsigned long long> dirty;
+    unsigned long long size;
+    std::vector<expected_segment> expected;
+};
+
+static const size_t id_length = 8;
+
+static std::string base_id(size_t index)
+{
+    char id[16];
+    snprintf(id, sizeof(id), "base%04zu", index);
+    return id;
+}
+
+static staged_block make_staged(unsigned long long size, const std::string& id)
+{
+    staged_block block;
+    block.size = size;
+    block.id = id;
+    return block;
+}
+
+static void check_plan(const upload_plan_case& test_case)
+{
+    SCOPED_TRACE(test_case.name);
+    std::vector<get_block_list_item> base;
+    for (size_t i = 0; i < test_case.base.size(); i++)
+    {
+        get_block_list_item item;
+        item.name = base_id(i);
+        item.size = test_case.base[i];
+        base.push_back(item);
+    }
+
+    std::vector<upload_segment> segments = plan_upload(base, test_case.staged, test_case.dirty, test_case.size, id_length);
+    ASSERT_EQ(test_case.expected.size(), segments.size());
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        const expected_segment& expected = test_case.expected[i];
+        SCOPED_TRACE(i);
+        ASSERT_EQ(expected.offset, segments[i].offset);
+        ASSERT_EQ(expected.size, segments[i].size);
+        ASSERT_EQ(expected.kind == 'C', segments[i].committed);
+        ASSERT_EQ(expected.kind != 'N', segments[i].uploaded);
+        if (expected.kind == 'N')
+        {
+            ASSERT_EQ(id_length, segments[i].id.size());
+        }
+        else
+        {
+            ASSERT_EQ(expected.id, segments[i].id);
+        }
+    }
+}
+
+TEST(UploadPlanTest, PlanUpload)
+{
+    std::vector<unsigned long long> base = {8 * MB, 8 * MB, 8 * MB};
+    std::vector<upload_plan_case> cases = {
+        {"unchanged", base, {}, {}, 24 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'C', base_id(1), 8 * MB, 8 * MB}, {'C', base_id(2), 16 * MB, 8 * MB}}},
+        {"dirty range inside one block", base, {}, {{9 * MB, 10 * MB}}, 24 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'N', "", 8 * MB, 8 * MB}, {'C', base_id(2), 16 * MB, 8 * MB}}},
+        {"dirty range ending at a block boundary", base, {}, {{12 * MB, 16 * MB}}, 24 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'N', "", 8 * MB, 8 * MB}, {'C', base_id(2), 16 * MB, 8 * MB}}},
+        {"dirty range across a block boundary", base, {}, {{7 * MB, 9 * MB}}, 24 * MB,
+            {{'N', "", 0, 16 * MB}, {'C', base_id(2), 16 * MB, 8 * MB}}},
+        {"dirty ranges in two blocks", base, {}, {{1 * MB, 2 * MB}, {17 * MB, 18 * MB}}, 24 * MB,
+            {{'N', "", 0, 8 * MB}, {'C', base_id(1), 8 * MB, 8 * MB}, {'N', "", 16 * MB, 8 * MB}}},
+        {"truncated inside a block", base, {}, {}, 20 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'C', base_id(1), 8 * MB, 8 * MB}, {'N', "", 16 * MB, 4 * MB}}},
+        {"truncated at a block boundary", base, {}, {}, 8 * MB,
+            {{'C', base_id(0), 0, 8 * MB}}},
+        {"extended past the base", base, {}, {{24 * MB, 60 * MB}}, 60 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'C', base_id(1), 8 * MB, 8 * MB}, {'C', base_id(2), 16 * MB, 8 * MB},
+             {'N', "", 24 * MB, 16 * MB}, {'N', "", 40 * MB, 16 * MB}, {'N', "", 56 * MB, 4 * MB}}},
+        {"truncated and extended again", base, {}, {{10 * MB, 30 * MB}}, 30 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'N', "", 8 * MB, 16 * MB}, {'N', "", 24 * MB, 6 * MB}}},
+        {"staged block replaces a committed one", base, {{8 * MB, make_staged(8 * MB, "staged01")}}, {{8 * MB, 16 * MB}}, 24 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'S', "staged01", 8 * MB, 8 * MB}, {'C', base_id(2), 16 * MB, 8 * MB}}},
+        {"staged blocks past the base", base, {{24 * MB, make_staged(16 * MB, "staged01")}, {40 * MB, make_staged(16 * MB, "staged02")}},
+            {{24 * MB, 60 * MB}}, 60 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'C', base_id(1), 8 * MB, 8 * MB}, {'C', base_id(2), 16 * MB, 8 * MB},
+             {'S', "staged01", 24 * MB, 16 * MB}, {'S', "staged02", 40 * MB, 16 * MB}, {'N', "", 56 * MB, 4 * MB}}},
+        {"staged block cut off by truncation", base, {{8 * MB, make_staged(8 * MB, "staged01")}}, {{8 * MB, 16 * MB}}, 12 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'N', "", 8 * MB, 4 * MB}}},
+        {"staged block with a different ID length", base, {{8 * MB, make_staged(8 * MB, "staged")}}, {{8 * MB, 16 * MB}}, 24 * MB,
+            {{'C', base_id(0), 0, 8 * MB}, {'N', "", 8 * MB, 8 * MB}, {'C', base_id(2), 16 * MB, 8 * MB}}},
+        {"staged blocks without a base", {}, {{0, make_staged(16 * MB, "staged01")}}, {{0, 20 * MB}}, 20 * MB,
+            {{'S', "staged01", 0, 16 * MB}, {'N', "", 16 * MB, 4 * MB}}},
+        {"empty file", base, {}, {}, 0, {}},
+    };
+    for (size_t i = 0; i < cases.size(); i++)
+    {
+        check_plan(cases[i]);
+    }
+}
+
+TEST(UploadPlanTest, TooManyBlocks)
+{
+    // A blob can't have more than MAX_BLOCK_COUNT blocks, so a plan that would need more is dropped and the whole file is uploaded instead.
+    std::vector<get_block_list_item> base;
+    for (size_t i = 0; i <= MAX_BLOCK_COUNT; i++)
+    {
+        get_block_list_item item;
+        item.name = base_id(i % 10000);
+        item.size = 1;
+        base.push_back(item);
+    }
+    std::map<unsigned long long, staged_block> staged;
+    std::map<unsigned long long, unsigned long long> dirty;
+    ASSERT_TRUE(plan_upload(base, staged, dirty, MAX_BLOCK_COUNT + 1, id_length).empty());
+    ASSERT_EQ((size_t)MAX_BLOCK_COUNT, plan_upload(base, staged, dirty, MAX_BLOCK_COUNT, id_length).size());
+
+    dirty[0] = 1;
+    ASSERT_TRUE(plan_upload(base, staged, dirty, MAX_BLOCK_COUNT + 1, id_length).empty());
+}
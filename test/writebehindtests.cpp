@@ -0,0 +1,259 @@
+#include <ftw.h>
+#include <chrono>
+#include <future>
+#include <thread>
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+#include "fakeblobclient.h"
+
+// These tests cover write_behind_queue, the background uploads for --write-behind: superseding a waiting snapshot, cancel, retries and the errors
+// handed to wait(), and the journal that lets pending uploads finish at the next mount.  The dirty ranges of a file are kept in a singleton, so each
+// test uploads its own blobs.
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+class WriteBehindTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/blobfuse_writebehind_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(dir));
+        tmp = dir;
+        journal = tmp + "/uploads";
+        ASSERT_EQ(0, mkdir(journal.c_str(), S_IRWXU));
+        saved_options = str_options;
+        saved_client = azure_blob_client_wrapper;
+        str_options.containerName = "container";
+        namespace_tree::get_instance()->set_timeout(0);
+        client = std::make_shared<FakeBlobClient>();
+        azure_blob_client_wrapper = client;
+    }
+
+    void TearDown() override
+    {
+        azure_blob_client_wrapper = saved_client;
+        str_options = saved_options;
+        nftw(tmp.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    // Writes the file that the mount has open for path, and returns where it is.
+    std::string write_file(const std::string& path, const std::string& contents)
+    {
+        std::string file = tmp + path;
+        std::ofstream out(file, std::ios::trunc);
+        out << contents;
+        return file;
+    }
+
+    void write_journal_file(const std::string& name, const std::string& contents)
+    {
+        std::ofstream out(journal + "/" + name);
+        out << contents;
+    }
+
+    bool journal_empty()
+    {
+        DIR *dir = opendir(journal.c_str());
+        bool empty = true;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            empty = empty && (entry->d_name[0] == '.');
+        }
+        closedir(dir);
+        return empty;
+    }
+
+    // Waits until the fake has seen count uploads, and returns false if that takes too long.
+    bool wait_for_uploads(size_t count)
+    {
+        for (int i = 0; (i < 1000) && (client->call_count("upload") < count); i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return client->call_count("upload") >= count;
+    }
+
+    std::string tmp;
+    std::string journal;
+    struct str_options saved_options;
+    std::shared_ptr<sync_blob_client> saved_client;
+    std::shared_ptr<FakeBlobClient> client;
+};
+
+// Holds uploads in the fake until release() is called.
+class upload_gate
+{
+public:
+    upload_gate() : m_started(0), m_released(false)
+    {
+    }
+
+    void enter()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_started++;
+        m_cv.notify_all();
+        m_cv.wait(lock, [this]() { return m_released; });
+    }
+
+    void wait_started(size_t count)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this, count]() { return m_started >= count; });
+    }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_released = true;
+        m_cv.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    size_t m_started;
+    bool m_released;
+};
+
+TEST_F(WriteBehindTest, UploadsInBackground)
+{
+    write_behind_queue queue(journal, 2, 1024 * 1024, 1);
+    ASSERT_EQ(0, queue.enqueue("/wb_basic", write_file("/wb_basic", "contents")));
+    ASSERT_EQ(0, queue.wait("/wb_basic"));
+    ASSERT_EQ("contents", client->contents("wb_basic"));
+    ASSERT_FALSE(queue.has_pending("/wb_basic"));
+    ASSERT_TRUE(journal_empty());
+}
+
+TEST_F(WriteBehindTest, NewerSnapshotSupersedesWaitingOne)
+{
+    upload_gate gate;
+    client->upload_hook = [&gate](const std::string&) { gate.enter(); };
+    write_behind_queue queue(journal, 2, 1024 * 1024, 1);
+
+    ASSERT_EQ(0, queue.enqueue("/wb_supersede", write_file("/wb_supersede", "v1")));
+    gate.wait_started(1);
+    // v1 is being uploaded, so v2 waits behind it and is then replaced by v3.
+    ASSERT_EQ(0, queue.enqueue("/wb_supersede", write_file("/wb_supersede", "v2")));
+    ASSERT_EQ(0, queue.enqueue("/wb_supersede", write_file("/wb_supersede", "v3")));
+    gate.release();
+
+    ASSERT_EQ(0, queue.wait("/wb_supersede"));
+    ASSERT_EQ("v3", client->contents("wb_supersede"));
+    ASSERT_EQ(2u, client->call_count("upload"));
+    ASSERT_TRUE(journal_empty());
+}
+
+TEST_F(WriteBehindTest, ErrorIsReportedToWait)
+{
+    client->fail_next("upload", "wb_error", 403, WRITE_BEHIND_MAX_ATTEMPTS);
+    write_behind_queue queue(journal, 2, 1024 * 1024, 1);
+
+    ASSERT_EQ(0, queue.enqueue("/wb_error", write_file("/wb_error", "contents")));
+    ASSERT_EQ(-EACCES, queue.wait("/wb_error"));
+    ASSERT_EQ((size_t)WRITE_BEHIND_MAX_ATTEMPTS, client->call_count("upload"));
+    ASSERT_FALSE(client->has_blob("wb_error"));
+    ASSERT_TRUE(journal_empty());
+    // The error is reported once.
+    ASSERT_EQ(0, queue.wait("/wb_error"));
+
+    ASSERT_EQ(0, queue.enqueue("/wb_error", write_file("/wb_error", "contents")));
+    ASSERT_EQ(0, queue.wait("/wb_error"));
+    ASSERT_EQ("contents", client->contents("wb_error"));
+}
+
+TEST_F(WriteBehindTest, RetrySucceeds)
+{
+    client->fail_next("upload", "wb_retry", 503);
+    write_behind_queue queue(journal, 2, 1024 * 1024, 1);
+
+    ASSERT_EQ(0, queue.enqueue("/wb_retry", write_file("/wb_retry", "contents")));
+    ASSERT_EQ(0, queue.wait("/wb_retry"));
+    ASSERT_EQ("contents", client->contents("wb_retry"));
+    ASSERT_EQ(2u, client->call_count("upload"));
+}
+
+TEST_F(WriteBehindTest, RetryDoesNotHoldWorker)
+{
+    // With one worker and a retry that is not due for a minute, the other file is only uploaded if the worker was let go.
+    client->fail_next("upload", "wb_waiting", 503);
+    write_behind_queue queue(journal, 1, 1024 * 1024, 60 * 1000);
+
+    ASSERT_EQ(0, queue.enqueue("/wb_waiting", write_file("/wb_waiting", "waiting")));
+    ASSERT_TRUE(wait_for_uploads(1));
+    ASSERT_EQ(0, queue.enqueue("/wb_other", write_file("/wb_other", "other")));
+    ASSERT_EQ(0, queue.wait("/wb_other"));
+    ASSERT_EQ("other", client->contents("wb_other"));
+    ASSERT_TRUE(queue.has_pending("/wb_waiting"));
+
+    queue.cancel("/wb_waiting");
+}
+
+TEST_F(WriteBehindTest, CancelDropsPendingUploads)
+{
+    client->fail_next("upload", "wb_cancel", 503);
+    write_behind_queue queue(journal, 2, 1024 * 1024, 60 * 1000);
+
+    ASSERT_EQ(0, queue.enqueue("/wb_cancel", write_file("/wb_cancel", "contents")));
+    ASSERT_TRUE(wait_for_uploads(1));
+    // The retry is not due for a minute; cancel does not wait for it.
+    queue.cancel("/wb_cancel");
+
+    ASSERT_FALSE(queue.has_pending("/wb_cancel"));
+    ASSERT_EQ(0, queue.wait("/wb_cancel"));
+    ASSERT_FALSE(client->has_blob("wb_cancel"));
+    ASSERT_EQ(1u, client->call_count("upload"));
+    ASSERT_TRUE(journal_empty());
+}
+
+TEST_F(WriteBehindTest, ResumeUploadsNewestSnapshot)
+{
+    write_journal_file("00000000000000000001.job", "/wb_resume\n");
+    write_journal_file("00000000000000000001.data", "old");
+    write_journal_file("00000000000000000002.job", "/wb_resume\n");
+    write_journal_file("00000000000000000002.data", "new");
+    // A record that was never completed, and a record without its snapshot.
+    write_journal_file("00000000000000000003.tmp", "/wb_resume\n");
+    write_journal_file("00000000000000000004.job", "/wb_resume_lost\n");
+
+    write_behind_queue queue(journal, 2, 1024 * 1024, 1);
+    queue.resume();
+    queue.wait_all();
+
+    ASSERT_EQ("new", client->contents("wb_resume"));
+    ASSERT_EQ(1u, client->call_count("upload"));
+    ASSERT_FALSE(client->has_blob("wb_resume_lost"));
+    ASSERT_TRUE(journal_empty());
+
+    // New snapshots are numbered after the ones in the journal.
+    ASSERT_EQ(0, queue.enqueue("/wb_resume", write_file("/wb_resume", "newer")));
+    ASSERT_EQ(0, queue.wait("/wb_resume"));
+    ASSERT_EQ("newer", client->contents("wb_resume"));
+}
+
+TEST_F(WriteBehindTest, EnqueueAfterResume)
+{
+    write_journal_file("00000000000000000001.job", "/wb_resumed\n");
+    write_journal_file("00000000000000000001.data", "resumed");
+
+    // Room for one small snapshot at a time: if the resumed one were not counted while it was pending, enqueue would wait forever afterwards.
+    auto queue = std::make_shared<write_behind_queue>(journal, 2, 16, 1);
+    queue->resume();
+    queue->wait_all();
+    ASSERT_EQ("resumed", client->contents("wb_resumed"));
+
+    std::string file = write_file("/wb_after_resume", "data");
+    auto result = std::make_shared<std::promise<int>>();
+    std::future<int> enqueued = result->get_future();
+    std::thread([queue, file, result]() { result->set_value(queue->enqueue("/wb_after_resume", file)); }).detach();
+    ASSERT_EQ(std::future_status::ready, enqueued.wait_for(std::chrono::seconds(10)));
+    ASSERT_EQ(0, enqueued.get());
+    ASSERT_EQ(0, queue->wait("/wb_after_resume"));
+    ASSERT_EQ("data", client->contents("wb_after_resume"));
+}
@@ -0,0 +1,185 @@
+#include "gtest/gtest.h"
+#include "blobfuse.h"
+
+// These tests cover the staging of blocks in file_write_state: which blocks of a file being written are uploaded before flush(), and which staged
+// blocks are forgotten because the file or the blob changed under them.
+
+#define BLOCK INCREMENTAL_UPLOAD_BLOCK_SIZE
+
+struct staging
+{
+    unsigned long long offset;
+    unsigned long long size;
+    std::string id;
+    unsigned long long epoch;
+};
+
+static bool next_block(file_write_state& state, staging& block, const std::string& blob = "blob")
+{
+    return state.next_block_to_stage(blob, block.offset, block.size, block.id, block.epoch);
+}
+
+// Stages the next block, and records that its upload succeeded.  Returns its offset.
+static unsigned long long stage_next(file_write_state& state, const std::string& blob = "blob")
+{
+    staging block;
+    EXPECT_TRUE(next_block(state, block, blob));
+    state.complete_staging(block.offset, block.epoch, true);
+    return block.offset;
+}
+
+static std::vector<unsigned long long> staged_offsets(const write_snapshot& snapshot)
+{
+    std::vector<unsigned long long> offsets;
+    for (auto iter = snapshot.staged.begin(); iter != snapshot.staged.end(); ++iter)
+    {
+        offsets.push_back(iter->first);
+    }
+    return offsets;
+}
+
+TEST(WriteStateTest, StagesCompletedBlocksOnceTheStreamIsLongEnough)
+{
+    file_write_state state;
+    staging block;
+    state.add_dirty(0, INCREMENTAL_UPLOAD_MIN_SIZE);
+    ASSERT_FALSE(next_block(state, block));
+
+    state.add_dirty(INCREMENTAL_UPLOAD_MIN_SIZE, 1);
+    std::vector<unsigned long long> expected;
+    for (unsigned long long offset = 0; offset + BLOCK <= INCREMENTAL_UPLOAD_MIN_SIZE + 1; offset += BLOCK)
+    {
+        ASSERT_TRUE(next_block(state, block));
+        ASSERT_EQ(offset, block.offset);
+        ASSERT_EQ(BLOCK, block.size);
+        ASSERT_FALSE(block.id.empty());
+        state.complete_staging(block.offset, block.epoch, true);
+        expected.push_back(offset);
+    }
+    // The last block is not complete yet.
+    ASSERT_FALSE(next_block(state, block));
+
+    write_snapshot snapshot = state.take_snapshot();
+    ASSERT_EQ("blob", snapshot.staged_blob);
+    ASSERT_EQ(expected, staged_offsets(snapshot));
+    ASSERT_EQ(1u, snapshot.dirty.size());
+    ASSERT_EQ(INCREMENTAL_UPLOAD_MIN_SIZE + 1, snapshot.dirty[0]);
+}
+
+TEST(WriteStateTest, RewriteDropsStagedBlock)
+{
+    file_write_state state;
+    state.add_dirty(0, INCREMENTAL_UPLOAD_MIN_SIZE + BLOCK);
+    stage_next(state);
+    stage_next(state);
+    stage_next(state);
+
+    state.add_dirty(BLOCK + 10, 5);
+    std::vector<unsigned long long> expected = {0, 2 * BLOCK};
+    ASSERT_EQ(expected, staged_offsets(state.take_snapshot()));
+}
+
+TEST(WriteStateTest, WriteDuringStagingDropsTheBlock)
+{
+    file_write_state state;
+    state.add_dirty(0, INCREMENTAL_UPLOAD_MIN_SIZE + BLOCK);
+    staging block;
+    ASSERT_TRUE(next_block(state, block));
+    state.add_dirty(5, 5);
+    state.complete_staging(block.offset, block.epoch, true);
+    ASSERT_TRUE(state.take_snapshot().staged.empty());
+}
+
+TEST(WriteStateTest, FailedStagingIsNotKept)
+{
+    file_write_state state;
+    state.add_dirty(0, INCREMENTAL_UPLOAD_MIN_SIZE + BLOCK);
+    staging block;
+    ASSERT_TRUE(next_block(state, block));
+    state.complete_staging(block.offset, block.epoch, false);
+    ASSERT_TRUE(state.take_snapshot().staged.empty());
+}
+
+TEST(WriteStateTest, CommitDiscardsStagedBlocks)
+{
+    file_write_state state;
+    state.add_dirty(0, INCREMENTAL_UPLOAD_MIN_SIZE + BLOCK);
+    stage_next(state);
+    write_snapshot snapshot = state.take_snapshot();
+    ASSERT_EQ(1u, snapshot.staged.size());
+
+    // A block staged before the commit and finished after it was discarded by the service.
+    state.add_dirty(BLOCK, INCREMENTAL_UPLOAD_MIN_SIZE);
+    staging block;
+    ASSERT_TRUE(next_block(state, block));
+    state.mark_uploaded(snapshot);
+    state.complete_staging(block.offset, block.epoch, true);
+    ASSERT_TRUE(state.take_snapshot().staged.empty());
+}
+
+TEST(WriteStateTest, FailedUploadGivesBackDirtyRanges)
+{
+    file_write_state state;
+    state.add_dirty(0, INCREMENTAL_UPLOAD_MIN_SIZE + BLOCK);
+    stage_next(state);
+    write_snapshot snapshot = state.take_snapshot();
+    ASSERT_TRUE(state.take_snapshot().dirty.empty());
+
+    // The upload may have committed the staged blocks, so they can't be used again.
+    state.restore(snapshot);
+    write_snapshot retry = state.take_snapshot();
+    ASSERT_EQ(snapshot.dirty, retry.dirty);
+    ASSERT_TRUE(retry.staged.empty());
+}
+
+TEST(WriteStateTest, RenameDiscardsStagedBlocks)
+{
+    file_write_state state;
+    state.add_dirty(0, INCREMENTAL_UPLOAD_MIN_SIZE + BLOCK);
+    stage_next(state, "blob");
+    // Staging carries on from the same point of the file, for the new blob.
+    ASSERT_EQ(BLOCK, stage_next(state, "renamed"));
+
+    write_snapshot snapshot = state.take_snapshot();
+    ASSERT_EQ("renamed", snapshot.staged_blob);
+    std::vector<unsigned long long> expected = {BLOCK};
+    ASSERT_EQ(expected, staged_offsets(snapshot));
+}
+
+TEST(WriteStateTest, LimitsBlocksInFlight)
+{
+    file_write_state state;
+    state.add_dirty(0, INCREMENTAL_UPLOAD_MIN_SIZE + (MAX_STAGING_BLOCKS + 2) * BLOCK);
+    std::vector<staging> blocks(MAX_STAGING_BLOCKS);
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        ASSERT_TRUE(next_block(state, blocks[i]));
+    }
+    staging block;
+    ASSERT_FALSE(next_block(state, block));
+
+    state.complete_staging(blocks[0].offset, blocks[0].epoch, true);
+    ASSERT_TRUE(next_block(state, block));
+    ASSERT_EQ(MAX_STAGING_BLOCKS * BLOCK, block.offset);
+}
+
+TEST(WriteStateTest, AppendsStreamFromTheEndOfTheBase)
+{
+    std::vector<get_block_list_item> base;
+    for (size_t i = 0; i < 5; i++)
+    {
+        get_block_list_item item;
+        item.name = std::string(32, 'a' + i);
+        item.size = BLOCK;
+        base.push_back(item);
+    }
+    file_write_state state;
+    state.set_base("blob", base);
+    state.add_dirty(5 * BLOCK, BLOCK);
+
+    staging block;
+    ASSERT_TRUE(next_block(state, block));
+    ASSERT_EQ(5 * BLOCK, block.offset);
+    // New block IDs must have the same length as the committed ones.
+    ASSERT_EQ(32u, block.id.size());
+}